@@ -9,7 +9,7 @@
 
 #define Q3_INFINITE			16777216
 
-#define	GAME_API_VERSION	1
+#define	GAME_API_VERSION	2
 
 // entity->svFlags
 // the server does not know how to interpret most of the values
@@ -235,6 +235,19 @@ typedef struct sharedEntity_s {
 	int				next_roff_time; //rww - npc's need to know when they're getting roff'd
 } sharedEntity_t;
 
+// one trace of a TraceBatch, with the arguments Trace takes
+typedef struct traceRequest_s {
+	vec3_t		start;
+	vec3_t		end;
+	vec3_t		mins;
+	vec3_t		maxs;
+	int			passEntityNum;
+	int			contentmask;
+	int			capsule;
+	int			traceFlags;
+	int			useLod;
+} traceRequest_t;
+
 #if !defined(_GAME) && defined(__cplusplus)
 class CSequencer;
 class CTaskManager;
@@ -692,7 +705,8 @@ typedef enum gameImportLegacy_e {
 	G_CM_REGISTER_TERRAIN,
 	G_RMG_INIT,
 	G_BOT_UPDATEWAYPOINTS,
-	G_BOT_CALCULATEPATHS
+	G_BOT_CALCULATEPATHS,
+	G_TRACEBATCH
 } gameImportLegacy_t;
 
 typedef enum gameExportLegacy_e {
@@ -1074,6 +1088,8 @@ typedef struct gameImport_s {
 	void		(*G2API_CleanEntAttachments)			( void );
 	qboolean	(*G2API_OverrideServer)					( void *serverInstance );
 	void		(*G2API_GetSurfaceName)					( void *ghoul2, int surfNumber, int modelIndex, char *fillBuf );
+
+	void		(*TraceBatch)							( trace_t *results, const traceRequest_t *requests, int numRequests );
 } gameImport_t;
 
 typedef struct gameExport_s {
@@ -0,0 +1,1047 @@
+// lg_client.cpp -- one simulated client: connection, parsing and usercmds
+
+#include "lg_local.h"
+
+/*
+==============================================================================
+
+NETCHAN
+
+Same keyed xor as cl_net_chan.cpp; the server undoes it with the client's
+challenge and the last reliable command each side has seen.
+
+==============================================================================
+*/
+
+/*
+==============
+LG_Netchan_Encode
+==============
+*/
+static void LG_Netchan_Encode( lgClient_t *lc, msg_t *msg ) {
+	int		serverId, messageAcknowledge, reliableAcknowledge;
+	int		i, index, srdc, sbit;
+	qboolean soob;
+	byte	key, *string;
+
+	if ( msg->cursize <= CL_ENCODE_START ) {
+		return;
+	}
+
+	srdc = msg->readcount;
+	sbit = msg->bit;
+	soob = msg->oob;
+
+	msg->bit = 0;
+	msg->readcount = 0;
+	msg->oob = qfalse;
+
+	serverId = MSG_ReadLong( msg );
+	messageAcknowledge = MSG_ReadLong( msg );
+	reliableAcknowledge = MSG_ReadLong( msg );
+
+	msg->oob = soob;
+	msg->bit = sbit;
+	msg->readcount = srdc;
+
+	string = (byte *)lc->serverCommands[ reliableAcknowledge & (MAX_RELIABLE_COMMANDS-1) ];
+	index = 0;
+	key = lc->challenge ^ serverId ^ messageAcknowledge;
+	for ( i = CL_ENCODE_START; i < msg->cursize; i++ ) {
+		if ( !string[index] )
+			index = 0;
+		if ( string[index] == '%' ) {
+			key ^= '.' << (i & 1);
+		} else {
+			key ^= string[index] << (i & 1);
+		}
+		index++;
+		msg->data[i] ^= key;
+	}
+}
+
+/*
+==============
+LG_Netchan_Decode
+==============
+*/
+static void LG_Netchan_Decode( lgClient_t *lc, msg_t *msg ) {
+	int		reliableAcknowledge, i, index, srdc, sbit;
+	qboolean soob;
+	byte	key, *string;
+
+	srdc = msg->readcount;
+	sbit = msg->bit;
+	soob = msg->oob;
+
+	msg->oob = qfalse;
+
+	reliableAcknowledge = MSG_ReadLong( msg );
+
+	msg->oob = soob;
+	msg->bit = sbit;
+	msg->readcount = srdc;
+
+	string = (byte *)lc->reliableCommands[ reliableAcknowledge & (MAX_RELIABLE_COMMANDS-1) ];
+	index = 0;
+	key = lc->challenge ^ LittleLong( *(unsigned *)msg->data );
+	for ( i = msg->readcount + CL_DECODE_START; i < msg->cursize; i++ ) {
+		if ( !string[index] )
+			index = 0;
+		if ( string[index] == '%' ) {
+			key ^= '.' << (i & 1);
+		} else {
+			key ^= string[index] << (i & 1);
+		}
+		index++;
+		msg->data[i] ^= key;
+	}
+}
+
+/*
+==============
+LG_Netchan_Transmit
+==============
+*/
+static void LG_Netchan_Transmit( lgClient_t *lc, msg_t *msg ) {
+	MSG_WriteByte( msg, clc_EOF );
+	LG_Netchan_Encode( lc, msg );
+
+	LG_SetSendSocket( lc->sock );
+	Netchan_Transmit( &lc->netchan, msg->cursize, msg->data );
+	while ( lc->netchan.unsentFragments ) {
+		Netchan_TransmitNextFragment( &lc->netchan );
+	}
+}
+
+/*
+==============================================================================
+
+CONNECTION
+
+==============================================================================
+*/
+
+/*
+==================
+LG_Tokenize
+
+Splits text in place into whitespace separated, optionally quoted tokens,
+the part of Cmd_TokenizeString the server's commands need
+==================
+*/
+static int LG_Tokenize( char *text, char **argv, int maxArgs ) {
+	int		argc = 0;
+
+	while ( argc < maxArgs ) {
+		while ( *text && *text <= ' ' ) {
+			text++;
+		}
+		if ( !*text ) {
+			break;
+		}
+		if ( *text == '"' ) {
+			argv[argc++] = ++text;
+			while ( *text && *text != '"' ) {
+				text++;
+			}
+		} else {
+			argv[argc++] = text;
+			while ( *text > ' ' ) {
+				text++;
+			}
+		}
+		if ( !*text ) {
+			break;
+		}
+		*text++ = 0;
+	}
+
+	return argc;
+}
+
+/*
+==================
+LG_ClearConnection
+
+Forgets everything learned from the server, as CL_Disconnect does with clc
+==================
+*/
+static void LG_ClearConnection( lgClient_t *lc ) {
+	lc->reliableSequence = 0;
+	lc->reliableAcknowledge = 0;
+	lc->serverMessageSequence = 0;
+	lc->serverCommandSequence = 0;
+	memset( lc->reliableCommands, 0, sizeof( lc->reliableCommands ) );
+	memset( lc->serverCommands, 0, sizeof( lc->serverCommands ) );
+	lc->bigConfigString[0] = 0;
+
+	lc->serverId = 0;
+	lc->checksumFeed = 0;
+	lc->clientNum = -1;
+
+	memset( &lc->snap, 0, sizeof( lc->snap ) );
+	memset( lc->snapshots, 0, sizeof( lc->snapshots ) );
+	lc->parseEntitiesNum = 0;
+	lc->lastSnapTime = 0;
+
+	memset( lc->cmds, 0, sizeof( lc->cmds ) );
+	memset( lc->outPackets, 0, sizeof( lc->outPackets ) );
+	lc->cmdNumber = 0;
+	lc->serverTime = 0;
+}
+
+/*
+==================
+LG_ClientInit
+==================
+*/
+void LG_ClientInit( lgClient_t *lc, int index, lgServer_t *server ) {
+	memset( lc, 0, sizeof( *lc ) );
+
+	lc->index = index;
+	lc->server = server;
+	lc->sock = LG_OpenSocket();
+	lc->state = LG_FREE;
+
+	// qports only have to be unique per address, but keep them unique overall
+	lc->scriptSeed = lg_config.seed * 7919 + index;
+	lc->qport = ( ( Q_rand( &lc->scriptSeed ) & 0xff00 ) + index ) & 0xffff;
+	lc->scriptYaw = Q_random( &lc->scriptSeed ) * 360.0f;
+
+	lc->entityBaselines = (entityState_t *)calloc( MAX_GENTITIES, sizeof( entityState_t ) );
+	lc->parseEntities = (entityState_t *)calloc( LG_PARSE_ENTITIES, sizeof( entityState_t ) );
+	if ( !lc->entityBaselines || !lc->parseEntities ) {
+		Com_Error( ERR_FATAL, "LG_ClientInit: out of memory for client %i", index );
+	}
+
+	LG_ClearConnection( lc );
+}
+
+/*
+==================
+LG_ClientFree
+==================
+*/
+void LG_ClientFree( lgClient_t *lc ) {
+	LG_CloseSocket( lc->sock );
+	free( lc->entityBaselines );
+	free( lc->parseEntities );
+	lc->entityBaselines = NULL;
+	lc->parseEntities = NULL;
+}
+
+/*
+==================
+LG_ClientDrop
+
+Lost the connection, try again in a few seconds like a player would.
+The delay stays above the server's default sv_reconnectlimit.
+==================
+*/
+static void LG_ClientDrop( lgClient_t *lc, int realtime, const char *reason ) {
+	if ( lg_config.verbose ) {
+		Com_Printf( "client %i: %s\n", lc->index, reason );
+	}
+
+	if ( lc->state == LG_ACTIVE ) {
+		lc->server->numActive--;
+	}
+	lc->state = LG_FREE;
+	lc->stateTime = realtime + 5000;
+	LG_ClearConnection( lc );
+}
+
+/*
+==================
+LG_CheckForResend
+
+Mirrors CL_CheckForResend
+==================
+*/
+static void LG_CheckForResend( lgClient_t *lc, int realtime ) {
+	char	info[MAX_INFO_STRING];
+	char	data[MAX_INFO_STRING];
+
+	if ( realtime - lc->stateTime < LG_RETRANSMIT_TIMEOUT ) {
+		return;
+	}
+	lc->stateTime = realtime;
+
+	LG_SetSendSocket( lc->sock );
+
+	if ( lc->state == LG_CONNECTING ) {
+		NET_OutOfBandPrint( NS_CLIENT, lc->serverAddress, "getchallenge %i", lc->challenge );
+		return;
+	}
+
+	Com_sprintf( info, sizeof( info ), "\\name\\%s%03i\\rate\\%i\\snaps\\%i\\model\\kyle/default\\handicap\\100",
+		lg_config.namePrefix, lc->index, lg_config.rate, lg_config.snaps );
+	Info_SetValueForKey( info, "protocol", va( "%i", PROTOCOL_VERSION ) );
+	Info_SetValueForKey( info, "qport", va( "%i", lc->qport ) );
+	Info_SetValueForKey( info, "challenge", va( "%i", lc->challenge ) );
+
+	Com_sprintf( data, sizeof( data ), "connect \"%s\"", info );
+	NET_OutOfBandData( NS_CLIENT, lc->serverAddress, (byte *)data, strlen( data ) );
+}
+
+/*
+==================
+LG_ConnectionlessPacket
+==================
+*/
+static void LG_ConnectionlessPacket( lgClient_t *lc, netadr_t from, msg_t *msg, int realtime ) {
+	char	line[MAX_STRING_CHARS];
+	char	*argv[3];
+	int		argc;
+
+	MSG_BeginReadingOOB( msg );
+	MSG_ReadLong( msg );	// skip the -1
+	Q_strncpyz( line, MSG_ReadStringLine( msg ), sizeof( line ) );
+
+	argc = LG_Tokenize( line, argv, 3 );
+	if ( !argc ) {
+		return;
+	}
+
+	if ( !Q_stricmp( argv[0], "challengeResponse" ) ) {
+		if ( lc->state != LG_CONNECTING ) {
+			return;
+		}
+		if ( argc > 2 && atoi( argv[2] ) != lc->challenge ) {
+			return;
+		}
+
+		lc->challenge = argc > 1 ? atoi( argv[1] ) : 0;
+		lc->state = LG_CHALLENGING;
+		lc->stateTime = -99999;
+		lc->serverAddress = from;
+		return;
+	}
+
+	if ( !Q_stricmp( argv[0], "connectResponse" ) ) {
+		if ( lc->state != LG_CHALLENGING || !NET_CompareAdr( from, lc->serverAddress ) ) {
+			return;
+		}
+
+		Netchan_Setup( NS_CLIENT, &lc->netchan, from, lc->qport );
+		lc->state = LG_CONNECTED;
+		lc->lastPacketTime = realtime;
+		lc->lastPacketSentTime = -9999;		// send first packet immediately
+		LG_StatsEvent( LG_EV_CONNECT );
+		return;
+	}
+
+	if ( !Q_stricmp( argv[0], "disconnect" ) ) {
+		if ( lc->state >= LG_CONNECTED && NET_CompareAdr( from, lc->netchan.remoteAddress ) ) {
+			LG_StatsEvent( LG_EV_KICKED );
+			LG_ClientDrop( lc, realtime, "server disconnected" );
+		}
+		return;
+	}
+
+	if ( !Q_stricmp( argv[0], "print" ) ) {
+		// rejections come back as prints, resending will retry them
+		if ( lg_config.verbose ) {
+			Com_Printf( "client %i: %s", lc->index, MSG_ReadString( msg ) );
+		}
+		return;
+	}
+}
+
+/*
+==============================================================================
+
+PARSING
+
+Per client copies of the cl_parse.cpp routines
+
+==============================================================================
+*/
+
+/*
+==================
+LG_SystemInfoChanged
+==================
+*/
+static void LG_SystemInfoChanged( lgClient_t *lc, const char *systemInfo ) {
+	lc->serverId = atoi( Info_ValueForKey( systemInfo, "sv_serverid" ) );
+}
+
+/*
+==================
+LG_ServerCommand
+
+Handles the commands the engine side of a client looks at itself in
+CL_GetServerCommand; everything else would go to the cgame and is ignored
+==================
+*/
+static void LG_ServerCommand( lgClient_t *lc, const char *s, int realtime ) {
+	char	text[BIG_INFO_STRING];
+	char	*argv[3];
+	int		argc;
+
+	Q_strncpyz( text, s, sizeof( text ) );
+
+rescan:
+	argc = LG_Tokenize( text, argv, 3 );
+	if ( !argc ) {
+		return;
+	}
+
+	if ( !strcmp( argv[0], "disconnect" ) ) {
+		LG_StatsEvent( LG_EV_KICKED );
+		LG_ClientDrop( lc, realtime, va( "server disconnected: %s", argc > 1 ? argv[1] : "" ) );
+		return;
+	}
+
+	if ( argc < 3 ) {
+		return;
+	}
+
+	if ( !strcmp( argv[0], "bcs0" ) ) {
+		Com_sprintf( lc->bigConfigString, sizeof( lc->bigConfigString ), "cs %s \"%s", argv[1], argv[2] );
+		return;
+	}
+
+	if ( !strcmp( argv[0], "bcs1" ) || !strcmp( argv[0], "bcs2" ) ) {
+		if ( strlen( lc->bigConfigString ) + strlen( argv[2] ) + 1 >= sizeof( lc->bigConfigString ) ) {
+			Com_Error( ERR_DROP, "bcs exceeded BIG_INFO_STRING" );
+		}
+		Q_strcat( lc->bigConfigString, sizeof( lc->bigConfigString ), argv[2] );
+		if ( argv[0][3] == '2' ) {
+			Q_strcat( lc->bigConfigString, sizeof( lc->bigConfigString ), "\"" );
+			Q_strncpyz( text, lc->bigConfigString, sizeof( text ) );
+			goto rescan;
+		}
+		return;
+	}
+
+	if ( !strcmp( argv[0], "cs" ) && atoi( argv[1] ) == CS_SYSTEMINFO ) {
+		LG_SystemInfoChanged( lc, argv[2] );
+	}
+}
+
+/*
+=====================
+LG_ParseCommandString
+=====================
+*/
+static void LG_ParseCommandString( lgClient_t *lc, msg_t *msg, int realtime ) {
+	char	*s;
+	int		seq;
+	int		index;
+
+	seq = MSG_ReadLong( msg );
+	s = MSG_ReadString( msg );
+
+	// see if we have already stored it off
+	if ( lc->serverCommandSequence >= seq ) {
+		return;
+	}
+	lc->serverCommandSequence = seq;
+
+	index = seq & (MAX_RELIABLE_COMMANDS-1);
+	Q_strncpyz( lc->serverCommands[ index ], s, sizeof( lc->serverCommands[ index ] ) );
+
+	LG_ServerCommand( lc, lc->serverCommands[ index ], realtime );
+}
+
+/*
+==================
+LG_ParseGamestate
+==================
+*/
+static void LG_ParseGamestate( lgClient_t *lc, msg_t *msg ) {
+	int				i;
+	int				cmd;
+	int				newnum;
+	entityState_t	nullstate;
+	char			*s;
+
+	memset( &lc->snap, 0, sizeof( lc->snap ) );
+	memset( lc->snapshots, 0, sizeof( lc->snapshots ) );
+	memset( lc->entityBaselines, 0, MAX_GENTITIES * sizeof( entityState_t ) );
+	lc->parseEntitiesNum = 0;
+	lc->lastSnapTime = 0;
+
+	// a gamestate always marks a server command sequence
+	lc->serverCommandSequence = MSG_ReadLong( msg );
+
+	while ( 1 ) {
+		cmd = MSG_ReadByte( msg );
+
+		if ( cmd == svc_EOF ) {
+			break;
+		}
+
+		if ( cmd == svc_configstring ) {
+			i = MSG_ReadShort( msg );
+			if ( i < 0 || i >= MAX_CONFIGSTRINGS ) {
+				Com_Error( ERR_DROP, "configstring > MAX_CONFIGSTRINGS" );
+			}
+			s = MSG_ReadBigString( msg );
+			if ( i == CS_SYSTEMINFO ) {
+				LG_SystemInfoChanged( lc, s );
+			}
+		} else if ( cmd == svc_baseline ) {
+			newnum = MSG_ReadBits( msg, GENTITYNUM_BITS );
+			if ( newnum < 0 || newnum >= MAX_GENTITIES ) {
+				Com_Error( ERR_DROP, "Baseline number out of range: %i", newnum );
+			}
+			memset( &nullstate, 0, sizeof( nullstate ) );
+			MSG_ReadDeltaEntity( msg, &nullstate, &lc->entityBaselines[ newnum ], newnum );
+		} else {
+			Com_Error( ERR_DROP, "LG_ParseGamestate: bad command byte" );
+		}
+	}
+
+	lc->clientNum = MSG_ReadLong( msg );
+	lc->checksumFeed = MSG_ReadLong( msg );
+
+	// Throw away the info for the old RMG system.
+	MSG_ReadShort( msg );
+
+	if ( lc->state == LG_ACTIVE ) {
+		lc->server->numActive--;
+	}
+	lc->state = LG_PRIMED;
+	LG_StatsEvent( LG_EV_GAMESTATE );
+}
+
+/*
+==================
+LG_DeltaEntity
+==================
+*/
+static void LG_DeltaEntity( lgClient_t *lc, msg_t *msg, lgSnapshot_t *frame, int newnum, entityState_t *old, qboolean unchanged ) {
+	entityState_t	*state;
+
+	state = &lc->parseEntities[ lc->parseEntitiesNum & (LG_PARSE_ENTITIES-1) ];
+
+	if ( unchanged ) {
+		*state = *old;
+	} else {
+		MSG_ReadDeltaEntity( msg, old, state, newnum );
+	}
+
+	if ( state->number == (MAX_GENTITIES-1) ) {
+		return;		// entity was delta removed
+	}
+	lc->parseEntitiesNum++;
+	frame->numEntities++;
+}
+
+/*
+==================
+LG_NextOldEntity
+==================
+*/
+static int LG_NextOldEntity( lgClient_t *lc, lgSnapshot_t *oldframe, int oldindex, entityState_t **oldstate ) {
+	if ( !oldframe || oldindex >= oldframe->numEntities ) {
+		*oldstate = NULL;
+		return 99999;
+	}
+
+	*oldstate = &lc->parseEntities[ (oldframe->parseEntitiesNum + oldindex) & (LG_PARSE_ENTITIES-1) ];
+	return (*oldstate)->number;
+}
+
+/*
+==================
+LG_ParsePacketEntities
+==================
+*/
+static void LG_ParsePacketEntities( lgClient_t *lc, msg_t *msg, lgSnapshot_t *oldframe, lgSnapshot_t *newframe ) {
+	int				newnum;
+	entityState_t	*oldstate;
+	int				oldindex, oldnum;
+
+	newframe->parseEntitiesNum = lc->parseEntitiesNum;
+	newframe->numEntities = 0;
+
+	// delta from the entities present in oldframe
+	oldindex = 0;
+	oldnum = LG_NextOldEntity( lc, oldframe, oldindex, &oldstate );
+
+	while ( 1 ) {
+		newnum = MSG_ReadBits( msg, GENTITYNUM_BITS );
+
+		if ( newnum == (MAX_GENTITIES-1) ) {
+			break;
+		}
+
+		if ( msg->readcount > msg->cursize ) {
+			Com_Error( ERR_DROP, "LG_ParsePacketEntities: end of message" );
+		}
+
+		while ( oldnum < newnum ) {
+			// one or more entities from the old packet are unchanged
+			LG_DeltaEntity( lc, msg, newframe, oldnum, oldstate, qtrue );
+			oldnum = LG_NextOldEntity( lc, oldframe, ++oldindex, &oldstate );
+		}
+
+		if ( oldnum == newnum ) {
+			// delta from previous state
+			LG_DeltaEntity( lc, msg, newframe, newnum, oldstate, qfalse );
+			oldnum = LG_NextOldEntity( lc, oldframe, ++oldindex, &oldstate );
+			continue;
+		}
+
+		// delta from baseline
+		LG_DeltaEntity( lc, msg, newframe, newnum, &lc->entityBaselines[ newnum ], qfalse );
+	}
+
+	// any remaining entities in the old frame are copied over
+	while ( oldnum != 99999 ) {
+		LG_DeltaEntity( lc, msg, newframe, oldnum, oldstate, qtrue );
+		oldnum = LG_NextOldEntity( lc, oldframe, ++oldindex, &oldstate );
+	}
+}
+
+/*
+================
+LG_ParseSnapshot
+================
+*/
+static void LG_ParseSnapshot( lgClient_t *lc, msg_t *msg, int realtime ) {
+	int				len;
+	lgSnapshot_t	*old;
+	lgSnapshot_t	newSnap;
+	int				deltaNum;
+	int				oldMessageNum;
+	int				i, packetNum;
+	byte			areamask[MAX_MAP_AREA_BYTES];
+	int				serverStep, arrival;
+
+	memset( &newSnap, 0, sizeof( newSnap ) );
+
+	newSnap.serverTime = MSG_ReadLong( msg );
+	newSnap.messageNum = lc->serverMessageSequence;
+
+	deltaNum = MSG_ReadByte( msg );
+	if ( !deltaNum ) {
+		newSnap.deltaNum = -1;
+	} else {
+		newSnap.deltaNum = newSnap.messageNum - deltaNum;
+	}
+	newSnap.snapFlags = MSG_ReadByte( msg );
+
+	// If the frame is delta compressed from data that we
+	// no longer have available, we must suck up the rest of
+	// the frame, but not use it, then ask for a non-compressed
+	// message
+	if ( newSnap.deltaNum <= 0 ) {
+		newSnap.valid = qtrue;		// uncompressed frame
+		old = NULL;
+	} else {
+		old = &lc->snapshots[ newSnap.deltaNum & PACKET_MASK ];
+		if ( !old->valid ) {
+			// should never happen
+		} else if ( old->messageNum != newSnap.deltaNum ) {
+			// the frame that the server did the delta from is too old
+		} else if ( lc->parseEntitiesNum - old->parseEntitiesNum > LG_PARSE_ENTITIES-128 ) {
+			// our entity ring is smaller than a real client's
+		} else {
+			newSnap.valid = qtrue;	// valid delta parse
+		}
+	}
+
+	// read areamask
+	len = MSG_ReadByte( msg );
+	if ( (unsigned)len > sizeof( areamask ) ) {
+		Com_Error( ERR_DROP, "LG_ParseSnapshot: Invalid size %d for areamask", len );
+	}
+	MSG_ReadData( msg, areamask, len );
+
+	// read playerinfo
+	MSG_ReadDeltaPlayerstate( msg, old ? &old->ps : NULL, &newSnap.ps );
+	if ( newSnap.ps.m_iVehicleNum ) {
+		// this means we must have written our vehicle's ps too
+		MSG_ReadDeltaPlayerstate( msg, old ? &old->vps : NULL, &newSnap.vps, qtrue );
+	}
+
+	// read packet entities
+	LG_ParsePacketEntities( lc, msg, old, &newSnap );
+
+	serverStep = lc->snap.serverTime ? newSnap.serverTime - lc->snap.serverTime : 0;
+	arrival = lc->lastSnapTime ? realtime - lc->lastSnapTime : 0;
+	LG_StatsSnapshot( msg->cursize, serverStep, arrival, (qboolean)(old != NULL), newSnap.valid, newSnap.snapFlags );
+
+	// if not valid, dump the entire thing now that it has
+	// been properly read
+	if ( !newSnap.valid ) {
+		return;
+	}
+
+	// clear the valid flags of any snapshots between the last
+	// received and this one
+	oldMessageNum = lc->snap.messageNum + 1;
+	if ( newSnap.messageNum - oldMessageNum >= PACKET_BACKUP ) {
+		oldMessageNum = newSnap.messageNum - ( PACKET_BACKUP - 1 );
+	}
+	for ( ; oldMessageNum < newSnap.messageNum; oldMessageNum++ ) {
+		lc->snapshots[ oldMessageNum & PACKET_MASK ].valid = qfalse;
+	}
+
+	lc->snap = newSnap;
+	lc->snapshots[ lc->snap.messageNum & PACKET_MASK ] = lc->snap;
+	lc->lastSnapTime = realtime;
+
+	// calculate ping time
+	for ( i = 0; i < PACKET_BACKUP; i++ ) {
+		packetNum = ( lc->netchan.outgoingSequence - 1 - i ) & PACKET_MASK;
+		if ( lc->snap.ps.commandTime >= lc->outPackets[ packetNum ].p_serverTime && lc->outPackets[ packetNum ].p_serverTime ) {
+			LG_StatsPing( realtime - lc->outPackets[ packetNum ].p_realtime );
+			break;
+		}
+	}
+
+	if ( lc->state == LG_PRIMED && !( lc->snap.snapFlags & SNAPFLAG_NOT_ACTIVE ) ) {
+		lc->state = LG_ACTIVE;
+		lc->server->numActive++;
+	}
+}
+
+/*
+=====================
+LG_ParseServerMessage
+=====================
+*/
+static void LG_ParseServerMessage( lgClient_t *lc, msg_t *msg, int realtime ) {
+	int		cmd;
+
+	MSG_Bitstream( msg );
+
+	// get the reliable sequence acknowledge number
+	lc->reliableAcknowledge = MSG_ReadLong( msg );
+	if ( lc->reliableAcknowledge < lc->reliableSequence - MAX_RELIABLE_COMMANDS ) {
+		lc->reliableAcknowledge = lc->reliableSequence;
+	}
+
+	while ( lc->state >= LG_CONNECTED ) {
+		if ( msg->readcount > msg->cursize ) {
+			Com_Error( ERR_DROP, "LG_ParseServerMessage: read past end of server message" );
+		}
+
+		cmd = MSG_ReadByte( msg );
+		if ( cmd == svc_EOF ) {
+			break;
+		}
+
+		switch ( cmd ) {
+		default:
+			Com_Error( ERR_DROP, "LG_ParseServerMessage: Illegible server message" );
+			break;
+		case svc_nop:
+			break;
+		case svc_serverCommand:
+			LG_ParseCommandString( lc, msg, realtime );
+			break;
+		case svc_gamestate:
+			LG_ParseGamestate( lc, msg );
+			break;
+		case svc_snapshot:
+			LG_ParseSnapshot( lc, msg, realtime );
+			break;
+		case svc_setgame:
+			// fs_game name, we never load anything from it
+			while ( MSG_ReadByte( msg ) > 0 ) {
+			}
+			break;
+		case svc_download:
+			Com_Error( ERR_DROP, "LG_ParseServerMessage: server started a download (set sv_allowDownload 0 or provide the paks)" );
+			break;
+		case svc_mapchange:
+			break;
+		}
+	}
+}
+
+/*
+==================
+LG_ClientPacket
+==================
+*/
+void LG_ClientPacket( lgClient_t *lc, netadr_t from, msg_t *msg, int realtime ) {
+	LG_StatsPacketIn( msg->cursize );
+
+	try {
+		if ( msg->cursize >= 4 && *(int *)msg->data == -1 ) {
+			LG_ConnectionlessPacket( lc, from, msg, realtime );
+			return;
+		}
+
+		if ( lc->state < LG_CONNECTED || msg->cursize < 4 ) {
+			return;
+		}
+		if ( !NET_CompareAdr( from, lc->netchan.remoteAddress ) ) {
+			return;
+		}
+
+		if ( !Netchan_Process( &lc->netchan, msg ) ) {
+			return;		// out of order, duplicated, fragment etc
+		}
+		LG_Netchan_Decode( lc, msg );
+
+		if ( lc->netchan.dropped > 0 ) {
+			LG_StatsDropped( lc->netchan.dropped );
+		}
+
+		lc->serverMessageSequence = LittleLong( *(int *)msg->data );
+		lc->lastPacketTime = realtime;
+
+		LG_ParseServerMessage( lc, msg, realtime );
+	}
+	catch ( int code ) {
+		(void)code;
+		LG_StatsEvent( LG_EV_ERROR );
+		LG_ClientDrop( lc, realtime, "parse error" );
+	}
+}
+
+/*
+==============================================================================
+
+USERCMDS
+
+==============================================================================
+*/
+
+/*
+==================
+LG_ScriptCommand
+
+Fills in the movement part of a usercmd from the client's script
+==================
+*/
+static void LG_ScriptCommand( lgClient_t *lc, usercmd_t *cmd, int realtime, int msec ) {
+	switch ( lg_config.script ) {
+	case LG_SCRIPT_IDLE:
+		break;
+
+	case LG_SCRIPT_RUN:
+		cmd->forwardmove = 127;
+		lc->scriptYaw += 0.03f * msec;
+		if ( realtime >= lc->scriptTime ) {
+			cmd->upmove = 127;
+			lc->scriptTime = realtime + 1500 + ( Q_rand( &lc->scriptSeed ) % 2000 );
+		}
+		break;
+
+	case LG_SCRIPT_STRAFE:
+		if ( realtime >= lc->scriptTime ) {
+			lc->scriptMove[1] = lc->scriptMove[1] > 0 ? -127 : 127;
+			lc->scriptTime = realtime + 500;
+		}
+		cmd->rightmove = lc->scriptMove[1];
+		lc->scriptYaw += ( lc->scriptMove[1] > 0 ? 0.1f : -0.1f ) * msec;
+		break;
+
+	case LG_SCRIPT_RANDOM:
+		if ( realtime >= lc->scriptTime ) {
+			lc->scriptMove[0] = ( Q_rand( &lc->scriptSeed ) % 3 - 1 ) * 127;
+			lc->scriptMove[1] = ( Q_rand( &lc->scriptSeed ) % 3 - 1 ) * 127;
+			lc->scriptMove[2] = ( Q_rand( &lc->scriptSeed ) % 8 ) ? 0 : 127;
+			lc->scriptPitch = Q_crandom( &lc->scriptSeed ) * 30.0f;
+			lc->scriptTime = realtime + 250 + ( Q_rand( &lc->scriptSeed ) % 750 );
+			if ( ( Q_rand( &lc->scriptSeed ) % 4 ) == 0 ) {
+				lc->scriptYaw += Q_crandom( &lc->scriptSeed ) * 90.0f;
+			}
+		}
+		cmd->forwardmove = lc->scriptMove[0];
+		cmd->rightmove = lc->scriptMove[1];
+		cmd->upmove = lc->scriptMove[2];
+		if ( ( Q_rand( &lc->scriptSeed ) % 16 ) == 0 ) {
+			cmd->buttons |= BUTTON_ATTACK;
+		}
+		break;
+	}
+
+	lc->scriptYaw = AngleNormalize360( lc->scriptYaw );
+	cmd->angles[PITCH] = ANGLE2SHORT( lc->scriptPitch );
+	cmd->angles[YAW] = ANGLE2SHORT( lc->scriptYaw );
+}
+
+/*
+==================
+LG_CreateNewCommands
+
+Builds usercmds at the configured fps, stamped with the server time
+extrapolated from the last snapshot like cl.serverTime
+==================
+*/
+static void LG_CreateNewCommands( lgClient_t *lc, int realtime ) {
+	int			msec = 1000 / lg_config.fps;
+	usercmd_t	*cmd;
+	int			serverTime;
+
+	if ( lc->state < LG_PRIMED ) {
+		lc->nextCmdTime = realtime;
+		return;
+	}
+
+	// don't try to catch up after a stall
+	if ( realtime - lc->nextCmdTime > 250 ) {
+		lc->nextCmdTime = realtime;
+	}
+
+	while ( realtime >= lc->nextCmdTime ) {
+		lc->nextCmdTime += msec;
+
+		serverTime = lc->snap.serverTime;
+		if ( lc->lastSnapTime ) {
+			serverTime += realtime - lc->lastSnapTime;
+		}
+		if ( serverTime <= lc->serverTime ) {
+			serverTime = lc->serverTime + 1;
+		}
+		lc->serverTime = serverTime;
+
+		cmd = &lc->cmds[ ++lc->cmdNumber & LG_CMD_MASK ];
+		memset( cmd, 0, sizeof( *cmd ) );
+		cmd->serverTime = serverTime;
+		cmd->weapon = lc->snap.ps.weapon;
+		LG_ScriptCommand( lc, cmd, realtime, msec );
+	}
+}
+
+/*
+==================
+LG_WritePacket
+
+Mirrors CL_WritePacket with cl_packetdup 1
+==================
+*/
+static void LG_WritePacket( lgClient_t *lc, int realtime ) {
+	msg_t		buf;
+	byte		data[MAX_MSGLEN];
+	int			i, j;
+	usercmd_t	*cmd, *oldcmd;
+	usercmd_t	nullcmd;
+	int			packetNum, oldPacketNum;
+	int			count, key;
+
+	memset( &nullcmd, 0, sizeof( nullcmd ) );
+	oldcmd = &nullcmd;
+
+	MSG_Init( &buf, data, sizeof( data ) );
+	MSG_Bitstream( &buf );
+
+	MSG_WriteLong( &buf, lc->serverId );
+	MSG_WriteLong( &buf, lc->serverMessageSequence );
+	MSG_WriteLong( &buf, lc->serverCommandSequence );
+
+	// write any unacknowledged clientCommands
+	for ( i = lc->reliableAcknowledge + 1; i <= lc->reliableSequence; i++ ) {
+		MSG_WriteByte( &buf, clc_clientCommand );
+		MSG_WriteLong( &buf, i );
+		MSG_WriteString( &buf, lc->reliableCommands[ i & (MAX_RELIABLE_COMMANDS-1) ] );
+	}
+
+	oldPacketNum = ( lc->netchan.outgoingSequence - 2 ) & PACKET_MASK;
+	count = lc->cmdNumber - lc->outPackets[ oldPacketNum ].p_cmdNumber;
+	if ( count > MAX_PACKET_USERCMDS ) {
+		count = MAX_PACKET_USERCMDS;
+	}
+	if ( lc->state >= LG_PRIMED && count >= 1 ) {
+		if ( !lc->snap.valid || lc->serverMessageSequence != lc->snap.messageNum ) {
+			MSG_WriteByte( &buf, clc_moveNoDelta );
+		} else {
+			MSG_WriteByte( &buf, clc_move );
+		}
+
+		MSG_WriteByte( &buf, count );
+
+		key = lc->checksumFeed;
+		key ^= lc->serverMessageSequence;
+		key ^= Com_HashKey( lc->serverCommands[ lc->serverCommandSequence & (MAX_RELIABLE_COMMANDS-1) ], 32 );
+
+		for ( i = 0; i < count; i++ ) {
+			j = ( lc->cmdNumber - count + i + 1 ) & LG_CMD_MASK;
+			cmd = &lc->cmds[j];
+			MSG_WriteDeltaUsercmdKey( &buf, key, oldcmd, cmd );
+			oldcmd = cmd;
+		}
+	}
+
+	packetNum = lc->netchan.outgoingSequence & PACKET_MASK;
+	lc->outPackets[ packetNum ].p_realtime = realtime;
+	lc->outPackets[ packetNum ].p_serverTime = oldcmd->serverTime;
+	lc->outPackets[ packetNum ].p_cmdNumber = lc->cmdNumber;
+	lc->lastPacketSentTime = realtime;
+
+	LG_Netchan_Transmit( lc, &buf );
+}
+
+/*
+==================
+LG_ClientDisconnect
+
+Sends the reliable disconnect a few times, as CL_Disconnect does
+==================
+*/
+void LG_ClientDisconnect( lgClient_t *lc ) {
+	int		realtime = LG_Milliseconds();
+
+	if ( lc->state >= LG_CONNECTED ) {
+		Q_strncpyz( lc->reliableCommands[ ++lc->reliableSequence & (MAX_RELIABLE_COMMANDS-1) ],
+			"disconnect", sizeof( lc->reliableCommands[0] ) );
+		LG_WritePacket( lc, realtime );
+		LG_WritePacket( lc, realtime );
+		LG_WritePacket( lc, realtime );
+	}
+
+	if ( lc->state == LG_ACTIVE ) {
+		lc->server->numActive--;
+	}
+	lc->state = LG_FREE;
+	lc->stateTime = 0x7fffffff;
+	LG_ClearConnection( lc );
+}
+
+/*
+==================
+LG_ClientFrame
+==================
+*/
+void LG_ClientFrame( lgClient_t *lc, int realtime ) {
+	switch ( lc->state ) {
+	case LG_FREE:
+		if ( realtime >= lc->stateTime ) {
+			lc->challenge = ( ( Q_rand( &lc->scriptSeed ) << 16 ) ^ Q_rand( &lc->scriptSeed ) ^ realtime ) & 0x7fffffff;
+			lc->serverAddress = lc->server->adr;
+			lc->state = LG_CONNECTING;
+			lc->stateTime = -99999;
+			LG_CheckForResend( lc, realtime );
+		}
+		return;
+
+	case LG_CONNECTING:
+	case LG_CHALLENGING:
+		LG_CheckForResend( lc, realtime );
+		return;
+
+	default:
+		break;
+	}
+
+	if ( realtime - lc->lastPacketTime > LG_TIMEOUT ) {
+		LG_StatsEvent( LG_EV_TIMEOUT );
+		LG_ClientDrop( lc, realtime, "timed out" );
+		return;
+	}
+
+	LG_CreateNewCommands( lc, realtime );
+
+	// the client only sends once a second until it has a gamestate
+	if ( lc->state == LG_CONNECTED ) {
+		if ( realtime - lc->lastPacketSentTime < 1000 ) {
+			return;
+		}
+	} else if ( realtime - lc->lastPacketSentTime < 1000 / lg_config.maxPackets ) {
+		return;
+	}
+
+	LG_WritePacket( lc, realtime );
+}
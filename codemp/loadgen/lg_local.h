@@ -0,0 +1,187 @@
+// lg_local.h -- headless multi-client load generator for dedicated servers
+
+#pragma once
+
+#include "qcommon/qcommon.h"
+
+/*
+==============================================================================
+
+The load generator speaks the real protocol 26 client side of the netchan:
+getchallenge/connect, Huffman coded and xor keyed sequenced messages,
+gamestate and delta snapshot parsing and clc_move usercmds. It has no
+renderer, sound, cgame or filesystem, so one process can drive every slot
+of several local servers at once.
+
+Each simulated client keeps just enough state to reconstruct snapshots the
+way cl_parse.cpp does, so the server sees the same acknowledgements, delta
+bases and usercmd stream a real client would produce.
+
+==============================================================================
+*/
+
+#define	LG_PARSE_ENTITIES		2048	// smaller than MAX_PARSE_ENTITIES, we run hundreds of these
+#define	LG_CMD_BACKUP			64
+#define	LG_CMD_MASK				(LG_CMD_BACKUP-1)
+#define	LG_MAX_SERVERS			16
+#define	LG_RETRANSMIT_TIMEOUT	3000	// same as the client's RETRANSMIT_TIMEOUT
+#define	LG_TIMEOUT				30000	// drop and reconnect after this long without a packet
+
+typedef enum {
+	LG_FREE,			// not started yet, or waiting to reconnect
+	LG_CONNECTING,		// sending getchallenge
+	LG_CHALLENGING,		// sending connect
+	LG_CONNECTED,		// netchan up, waiting for a gamestate
+	LG_PRIMED,			// have a gamestate, sending usercmds
+	LG_ACTIVE			// receiving snapshots
+} lgState_t;
+
+typedef enum {
+	LG_SCRIPT_IDLE,		// stand still, only keep the connection alive
+	LG_SCRIPT_RUN,		// run forward while slowly turning, jump now and then
+	LG_SCRIPT_STRAFE,	// strafe left and right, swinging the view
+	LG_SCRIPT_RANDOM	// random moves, turns, jumps and attacks
+} lgScript_t;
+
+typedef enum {
+	LG_EV_CONNECT,		// connectResponse received
+	LG_EV_GAMESTATE,
+	LG_EV_KICKED,		// server sent a disconnect
+	LG_EV_TIMEOUT,
+	LG_EV_ERROR,		// unparsable server message
+	LG_NUM_EVENTS
+} lgEvent_t;
+
+typedef struct lgSnapshot_s {
+	qboolean		valid;
+	int				snapFlags;
+	int				serverTime;
+	int				messageNum;
+	int				deltaNum;
+	int				parseEntitiesNum;
+	int				numEntities;
+	playerState_t	ps;
+	playerState_t	vps;
+} lgSnapshot_t;
+
+typedef struct lgOutPacket_s {
+	int				p_cmdNumber;
+	int				p_serverTime;
+	int				p_realtime;
+} lgOutPacket_t;
+
+typedef struct lgServer_s {
+	netadr_t		adr;
+	char			name[MAX_QPATH];
+	int				pid;				// openjkded process for cpu sampling, 0 if unknown
+	int				numActive;
+} lgServer_t;
+
+typedef struct lgClient_s {
+	int				index;
+	lgServer_t		*server;
+	int				sock;				// index into the socket table of lg_net.cpp
+	lgState_t		state;
+	int				stateTime;			// last connection packet or reconnect time
+	int				lastPacketTime;		// last packet from the server
+	int				lastPacketSentTime;
+	int				nextCmdTime;
+
+	// connection
+	netadr_t		serverAddress;		// may be handed off by challengeResponse
+	int				challenge;			// ours until challengeResponse, then the server's
+	int				qport;
+	netchan_t		netchan;
+
+	// reliable commands in both directions, as in clientConnection_t
+	int				reliableSequence;
+	int				reliableAcknowledge;
+	char			reliableCommands[MAX_RELIABLE_COMMANDS][MAX_STRING_CHARS];
+	int				serverMessageSequence;
+	int				serverCommandSequence;
+	char			serverCommands[MAX_RELIABLE_COMMANDS][MAX_STRING_CHARS];
+	char			bigConfigString[BIG_INFO_STRING];
+
+	// gamestate
+	int				serverId;
+	int				checksumFeed;
+	int				clientNum;
+	entityState_t	*entityBaselines;	// [MAX_GENTITIES]
+
+	// snapshots
+	lgSnapshot_t	snap;
+	lgSnapshot_t	snapshots[PACKET_BACKUP];
+	int				parseEntitiesNum;
+	entityState_t	*parseEntities;		// [LG_PARSE_ENTITIES]
+	int				lastSnapTime;		// realtime the last snapshot arrived
+
+	// usercmds
+	usercmd_t		cmds[LG_CMD_BACKUP];
+	int				cmdNumber;
+	int				serverTime;			// extrapolated from the last snapshot
+	lgOutPacket_t	outPackets[PACKET_BACKUP];
+	int				scriptTime;
+	int				scriptSeed;
+	int				scriptMove[3];
+	float			scriptYaw;
+	float			scriptPitch;
+} lgClient_t;
+
+typedef struct lgConfig_s {
+	int				numClients;
+	int				duration;			// seconds to measure
+	int				warmup;				// seconds to wait once every client is in
+	int				ramp;				// new connections per second
+	int				fps;				// usercmds per second
+	int				maxPackets;			// packets per second
+	int				rate;
+	int				snaps;
+	lgScript_t		script;
+	int				seed;
+	char			namePrefix[32];
+	int				verbose;
+} lgConfig_t;
+
+extern lgConfig_t	lg_config;
+extern lgServer_t	lg_servers[LG_MAX_SERVERS];
+extern int			lg_numServers;
+
+//
+// lg_main.cpp
+//
+int			LG_Milliseconds( void );
+int64_t		LG_Microseconds( void );
+
+//
+// lg_client.cpp
+//
+void		LG_ClientInit( lgClient_t *lc, int index, lgServer_t *server );
+void		LG_ClientFree( lgClient_t *lc );
+void		LG_ClientFrame( lgClient_t *lc, int realtime );
+void		LG_ClientPacket( lgClient_t *lc, netadr_t from, msg_t *msg, int realtime );
+void		LG_ClientDisconnect( lgClient_t *lc );
+
+//
+// lg_net.cpp
+//
+qboolean	LG_NetInit( void );
+void		LG_NetShutdown( void );
+int			LG_OpenSocket( void );
+void		LG_CloseSocket( int sock );
+void		LG_SetSendSocket( int sock );
+qboolean	LG_GetPacket( int sock, netadr_t *from, msg_t *msg );
+void		LG_WaitPackets( const int *socks, int numSocks, int usec );
+
+//
+// lg_stats.cpp
+//
+void		LG_StatsReset( int realtime );
+void		LG_StatsPacketIn( int bytes );
+void		LG_StatsPacketOut( int bytes );
+void		LG_StatsDropped( int count );
+void		LG_StatsSnapshot( int bytes, int serverStep, int arrival, qboolean delta, qboolean valid, int snapFlags );
+void		LG_StatsPing( int ping );
+void		LG_StatsEvent( lgEvent_t ev );
+void		LG_StatsProgress( int realtime, int numActive, int numClients );
+void		LG_StatsCpuBegin( void );
+void		LG_StatsReport( int realtime );
@@ -0,0 +1,429 @@
+// lg_main.cpp -- command line, main loop and the engine services msg.cpp and net_chan.cpp expect
+
+#include "lg_local.h"
+#include "server/server.h"
+
+#include <signal.h>
+#include <stdarg.h>
+
+#ifdef _WIN32
+	#include <windows.h>
+#else
+	#include <sys/time.h>
+#endif
+
+lgConfig_t		lg_config;
+lgServer_t		lg_servers[LG_MAX_SERVERS];
+int				lg_numServers;
+
+static lgClient_t	*lg_clients;
+static volatile int	lg_quit;
+
+/*
+==============================================================================
+
+ENGINE STUBS
+
+msg.cpp and net_chan.cpp are linked in unchanged; these are the few engine
+services they call. There is no cvar system, no filesystem and no server.
+
+==============================================================================
+*/
+
+server_t		sv;					// msg.cpp only reads sv.state for cl_shownet output
+static cvar_t	lg_zeroCvars[8];
+static int		lg_numZeroCvars;
+cvar_t			*cl_shownet = &lg_zeroCvars[0];
+cvar_t			*sv_blockJumpSelect = &lg_zeroCvars[0];
+
+/*
+==================
+Cvar_Get
+
+Hands out zeroed cvars for showpackets, showdrop and friends
+==================
+*/
+cvar_t *Cvar_Get( const char *var_name, const char *var_value, uint32_t flags ) {
+	if ( lg_numZeroCvars + 1 < (int)ARRAY_LEN( lg_zeroCvars ) ) {
+		lg_numZeroCvars++;
+	}
+	return &lg_zeroCvars[lg_numZeroCvars];
+}
+
+void QDECL Com_Printf( const char *fmt, ... ) {
+	va_list		argptr;
+
+	va_start( argptr, fmt );
+	vprintf( fmt, argptr );
+	va_end( argptr );
+	fflush( stdout );
+}
+
+/*
+==================
+Com_Error
+
+ERR_DROP unwinds to LG_ClientPacket like it does to Com_Frame in the engine
+==================
+*/
+void QDECL Com_Error( int code, const char *fmt, ... ) {
+	va_list		argptr;
+	char		text[MAX_STRING_CHARS];
+
+	va_start( argptr, fmt );
+	Q_vsnprintf( text, sizeof( text ), fmt, argptr );
+	va_end( argptr );
+
+	if ( code == ERR_DROP || code == ERR_DISCONNECT || code == ERR_SERVERDISCONNECT ) {
+		if ( lg_config.verbose ) {
+			Com_Printf( "%s\n", text );
+		}
+		throw code;
+	}
+
+	Com_Printf( "ERROR: %s\n", text );
+	exit( 1 );
+}
+
+int Com_HashKey( char *string, int maxlen ) {
+	int		hash, i;
+
+	hash = 0;
+	for ( i = 0; i < maxlen && string[i] != '\0'; i++ ) {
+		hash += string[i] * (119 + i);
+	}
+	hash = (hash ^ (hash >> 10) ^ (hash >> 20));
+	return hash;
+}
+
+long FS_FOpenFileRead( const char *filename, fileHandle_t *file, qboolean uniqueFILE ) {
+	// no ext_data overrides, the load generator has no filesystem
+	*file = 0;
+	return -1;
+}
+
+int FS_Read( void *buffer, int len, fileHandle_t f ) {
+	return 0;
+}
+
+void FS_FCloseFile( fileHandle_t f ) {
+}
+
+sharedEntity_t *SV_GentityNum( int num ) {
+	static sharedEntity_t	ent;
+	return &ent;
+}
+
+qboolean SV_ReplayOutput( int length, const void *data ) {
+	return qfalse;
+}
+
+qboolean SV_Replaying( void ) {
+	return qfalse;
+}
+
+void *Z_Malloc( int iSize, memtag_t eTag, qboolean bZeroit, int iAlign ) {
+	void	*buf = calloc( 1, iSize );
+
+	if ( !buf ) {
+		Com_Error( ERR_FATAL, "Z_Malloc: failed on allocation of %i bytes", iSize );
+	}
+	return buf;
+}
+
+/*
+==============================================================================
+
+TIME
+
+==============================================================================
+*/
+
+/*
+================
+LG_Microseconds
+================
+*/
+int64_t LG_Microseconds( void ) {
+	static int64_t	base;
+	int64_t			now;
+#ifdef _WIN32
+	static LARGE_INTEGER	frequency;
+	LARGE_INTEGER			counter;
+
+	if ( !frequency.QuadPart ) {
+		QueryPerformanceFrequency( &frequency );
+	}
+	QueryPerformanceCounter( &counter );
+	now = counter.QuadPart * 1000000 / frequency.QuadPart;
+#else
+	struct timeval	tp;
+
+	gettimeofday( &tp, NULL );
+	now = (int64_t)tp.tv_sec * 1000000 + tp.tv_usec;
+#endif
+
+	if ( !base ) {
+		base = now;
+	}
+	return now - base;
+}
+
+int LG_Milliseconds( void ) {
+	return (int)( LG_Microseconds() / 1000 );
+}
+
+/*
+==============================================================================
+
+MAIN
+
+==============================================================================
+*/
+
+static void LG_Usage( void ) {
+	Com_Printf(
+		"usage: openjkloadgen [options]\n"
+		"  -server <address[:port]>  server to load, repeat for several (127.0.0.1:%i)\n"
+		"  -pid <pid>                process of the matching -server, for cpu per client\n"
+		"  -clients <n>              simulated clients, spread over the servers (16)\n"
+		"  -ramp <n>                 new connections per second (4)\n"
+		"  -warmup <seconds>         wait after everyone is in before measuring (5)\n"
+		"  -duration <seconds>       measured time (60)\n"
+		"  -fps <n>                  usercmds per second (60)\n"
+		"  -maxpackets <n>           packets per second, like cl_maxpackets (30)\n"
+		"  -rate <n>                 userinfo rate (25000)\n"
+		"  -snaps <n>                userinfo snaps (40)\n"
+		"  -script <idle|run|strafe|random>  what the clients do (random)\n"
+		"  -name <prefix>            player name prefix (lg)\n"
+		"  -seed <n>                 script seed (1)\n"
+		"  -verbose                  print connection problems\n"
+		"Servers need sv_pure 0, and sv_maxclients limits each to %i clients.\n",
+		PORT_SERVER, MAX_CLIENTS );
+	exit( 1 );
+}
+
+/*
+==================
+LG_AddServer
+==================
+*/
+static void LG_AddServer( const char *address ) {
+	lgServer_t	*server;
+
+	if ( lg_numServers == LG_MAX_SERVERS ) {
+		Com_Error( ERR_FATAL, "too many servers, max %i", LG_MAX_SERVERS );
+	}
+
+	server = &lg_servers[lg_numServers];
+	Q_strncpyz( server->name, address, sizeof( server->name ) );
+
+	// "localhost" means the loopback netchan to NET_StringToAdr
+	if ( !Q_stricmpn( address, "localhost", 9 ) ) {
+		Com_sprintf( server->name, sizeof( server->name ), "127.0.0.1%s", address + 9 );
+	}
+
+	if ( !NET_StringToAdr( server->name, &server->adr ) || server->adr.type != NA_IP ) {
+		Com_Error( ERR_FATAL, "bad server address %s", address );
+	}
+	lg_numServers++;
+}
+
+/*
+==================
+LG_ParseArgs
+==================
+*/
+static void LG_ParseArgs( int argc, char **argv ) {
+	int		i, numPids = 0;
+
+	lg_config.numClients = 16;
+	lg_config.duration = 60;
+	lg_config.warmup = 5;
+	lg_config.ramp = 4;
+	lg_config.fps = 60;
+	lg_config.maxPackets = 30;
+	lg_config.rate = 25000;
+	lg_config.snaps = 40;
+	lg_config.script = LG_SCRIPT_RANDOM;
+	lg_config.seed = 1;
+	Q_strncpyz( lg_config.namePrefix, "lg", sizeof( lg_config.namePrefix ) );
+
+	for ( i = 1; i < argc; i++ ) {
+		const char *arg = argv[i];
+		const char *value = i + 1 < argc ? argv[i + 1] : NULL;
+
+		if ( !Q_stricmp( arg, "-verbose" ) ) {
+			lg_config.verbose = 1;
+			continue;
+		}
+		if ( !value ) {
+			LG_Usage();
+		}
+		i++;
+
+		if ( !Q_stricmp( arg, "-server" ) ) {
+			LG_AddServer( value );
+		} else if ( !Q_stricmp( arg, "-pid" ) ) {
+			if ( numPids < LG_MAX_SERVERS ) {
+				lg_servers[numPids++].pid = atoi( value );
+			}
+		} else if ( !Q_stricmp( arg, "-clients" ) ) {
+			lg_config.numClients = atoi( value );
+		} else if ( !Q_stricmp( arg, "-ramp" ) ) {
+			lg_config.ramp = atoi( value );
+		} else if ( !Q_stricmp( arg, "-warmup" ) ) {
+			lg_config.warmup = atoi( value );
+		} else if ( !Q_stricmp( arg, "-duration" ) ) {
+			lg_config.duration = atoi( value );
+		} else if ( !Q_stricmp( arg, "-fps" ) ) {
+			lg_config.fps = atoi( value );
+		} else if ( !Q_stricmp( arg, "-maxpackets" ) ) {
+			lg_config.maxPackets = atoi( value );
+		} else if ( !Q_stricmp( arg, "-rate" ) ) {
+			lg_config.rate = atoi( value );
+		} else if ( !Q_stricmp( arg, "-snaps" ) ) {
+			lg_config.snaps = atoi( value );
+		} else if ( !Q_stricmp( arg, "-name" ) ) {
+			Q_strncpyz( lg_config.namePrefix, value, sizeof( lg_config.namePrefix ) );
+		} else if ( !Q_stricmp( arg, "-seed" ) ) {
+			lg_config.seed = atoi( value );
+		} else if ( !Q_stricmp( arg, "-script" ) ) {
+			if ( !Q_stricmp( value, "idle" ) ) {
+				lg_config.script = LG_SCRIPT_IDLE;
+			} else if ( !Q_stricmp( value, "run" ) ) {
+				lg_config.script = LG_SCRIPT_RUN;
+			} else if ( !Q_stricmp( value, "strafe" ) ) {
+				lg_config.script = LG_SCRIPT_STRAFE;
+			} else if ( !Q_stricmp( value, "random" ) ) {
+				lg_config.script = LG_SCRIPT_RANDOM;
+			} else {
+				LG_Usage();
+			}
+		} else {
+			LG_Usage();
+		}
+	}
+
+	if ( !lg_numServers ) {
+		LG_AddServer( va( "127.0.0.1:%i", PORT_SERVER ) );
+	}
+
+	lg_config.numClients = Com_Clampi( 1, lg_numServers * MAX_CLIENTS, lg_config.numClients );
+	lg_config.ramp = Com_Clampi( 1, 1000, lg_config.ramp );
+	lg_config.fps = Com_Clampi( 1, 1000, lg_config.fps );
+	lg_config.maxPackets = Com_Clampi( 1, lg_config.fps, lg_config.maxPackets );
+	lg_config.warmup = Com_Clampi( 0, 3600, lg_config.warmup );
+	lg_config.duration = Com_Clampi( 1, 86400, lg_config.duration );
+}
+
+static void LG_Signal( int sig ) {
+	lg_quit = 1;
+}
+
+/*
+==================
+main
+==================
+*/
+int main( int argc, char **argv ) {
+	int			i, realtime, numActive;
+	int			rampEnd, measureStart, measureEnd;
+	int			*socks;
+	lgClient_t	*lc;
+	netadr_t	from;
+	msg_t		msg;
+	static byte	msgData[MAX_MSGLEN];
+
+	LG_ParseArgs( argc, argv );
+
+	if ( !LG_NetInit() ) {
+		return 1;
+	}
+	Netchan_Init( 0 );
+
+	signal( SIGINT, LG_Signal );
+	signal( SIGTERM, LG_Signal );
+
+	lg_clients = (lgClient_t *)calloc( lg_config.numClients, sizeof( lgClient_t ) );
+	socks = (int *)calloc( lg_config.numClients, sizeof( int ) );
+	if ( !lg_clients || !socks ) {
+		Com_Error( ERR_FATAL, "out of memory for %i clients", lg_config.numClients );
+	}
+
+	// spread the clients over the servers and the connects over the ramp
+	realtime = LG_Milliseconds();
+	for ( i = 0; i < lg_config.numClients; i++ ) {
+		lc = &lg_clients[i];
+		LG_ClientInit( lc, i, &lg_servers[i % lg_numServers] );
+		lc->stateTime = realtime + i * 1000 / lg_config.ramp;
+		socks[i] = lc->sock;
+	}
+	rampEnd = realtime + lg_config.numClients * 1000 / lg_config.ramp;
+
+	Com_Printf( "%i clients against %i server(s), %s\n", lg_config.numClients, lg_numServers,
+		lg_config.script == LG_SCRIPT_IDLE ? "idle" : lg_config.script == LG_SCRIPT_RUN ? "run" :
+		lg_config.script == LG_SCRIPT_STRAFE ? "strafe" : "random" );
+
+	LG_StatsReset( realtime );
+	measureStart = measureEnd = 0;
+
+	while ( !lg_quit ) {
+		LG_WaitPackets( socks, lg_config.numClients, 1000 );
+		realtime = LG_Milliseconds();
+
+		for ( i = 0; i < lg_config.numClients; i++ ) {
+			lc = &lg_clients[i];
+			MSG_Init( &msg, msgData, sizeof( msgData ) );
+			while ( LG_GetPacket( lc->sock, &from, &msg ) ) {
+				LG_ClientPacket( lc, from, &msg, realtime );
+				MSG_Init( &msg, msgData, sizeof( msgData ) );
+			}
+		}
+
+		for ( i = 0; i < lg_config.numClients; i++ ) {
+			LG_ClientFrame( &lg_clients[i], realtime );
+		}
+
+		numActive = 0;
+		for ( i = 0; i < lg_numServers; i++ ) {
+			numActive += lg_servers[i].numActive;
+		}
+		LG_StatsProgress( realtime, numActive, lg_config.numClients );
+
+		// measure once everyone is in, or a while after the ramp if some never make it
+		if ( !measureStart ) {
+			if ( numActive == lg_config.numClients || realtime - rampEnd > 15000 ) {
+				if ( numActive != lg_config.numClients ) {
+					Com_Printf( "only %i of %i clients got in, measuring anyway\n", numActive, lg_config.numClients );
+				}
+				measureStart = realtime + lg_config.warmup * 1000;
+			}
+		} else if ( !measureEnd ) {
+			if ( realtime >= measureStart ) {
+				Com_Printf( "measuring for %i seconds\n", lg_config.duration );
+				LG_StatsReset( realtime );
+				LG_StatsCpuBegin();
+				measureEnd = realtime + lg_config.duration * 1000;
+			}
+		} else if ( realtime >= measureEnd ) {
+			break;
+		}
+	}
+
+	if ( measureEnd ) {
+		LG_StatsReport( LG_Milliseconds() );
+	} else {
+		Com_Printf( "stopped before the measurement started\n" );
+	}
+
+	for ( i = 0; i < lg_config.numClients; i++ ) {
+		LG_ClientDisconnect( &lg_clients[i] );
+		LG_ClientFree( &lg_clients[i] );
+	}
+	free( lg_clients );
+	free( socks );
+
+	LG_NetShutdown();
+	return 0;
+}
@@ -0,0 +1,276 @@
+// lg_net.cpp -- one UDP socket per simulated client
+
+#include "lg_local.h"
+
+#ifdef _WIN32
+	#define FD_SETSIZE 1024		// before winsock, select() is all we have there
+	#include <winsock.h>
+
+	typedef int socklen_t;
+
+	static WSADATA	winsockdata;
+#else
+	#include <arpa/inet.h>
+	#include <errno.h>
+	#include <netdb.h>
+	#include <netinet/in.h>
+	#include <poll.h>
+	#include <sys/ioctl.h>
+	#include <sys/socket.h>
+	#include <sys/types.h>
+	#include <unistd.h>
+
+	typedef int SOCKET;
+	#define INVALID_SOCKET		-1
+	#define closesocket			close
+	#define ioctlsocket			ioctl
+#endif
+
+#define	LG_MAX_SOCKETS		1024
+
+static SOCKET	lg_sockets[LG_MAX_SOCKETS];
+static int		lg_numSockets;
+static int		lg_sendSocket = -1;
+
+/*
+====================
+LG_NetInit
+====================
+*/
+qboolean LG_NetInit( void ) {
+#ifdef _WIN32
+	if ( WSAStartup( MAKEWORD( 1, 1 ), &winsockdata ) ) {
+		Com_Printf( "WARNING: Winsock initialization failed\n" );
+		return qfalse;
+	}
+#endif
+	return qtrue;
+}
+
+/*
+====================
+LG_NetShutdown
+====================
+*/
+void LG_NetShutdown( void ) {
+	int		i;
+
+	for ( i = 0; i < lg_numSockets; i++ ) {
+		LG_CloseSocket( i );
+	}
+	lg_numSockets = 0;
+
+#ifdef _WIN32
+	WSACleanup();
+#endif
+}
+
+/*
+====================
+LG_OpenSocket
+
+Non-blocking socket on an ephemeral port, so every client has an address
+of its own as far as the server's challenge table is concerned
+====================
+*/
+int LG_OpenSocket( void ) {
+	SOCKET				s;
+	struct sockaddr_in	address;
+#ifdef _WIN32
+	u_long				_true = 1;
+#else
+	int					_true = 1;
+#endif
+
+	if ( lg_numSockets == LG_MAX_SOCKETS ) {
+		Com_Error( ERR_FATAL, "LG_OpenSocket: more than %i clients", LG_MAX_SOCKETS );
+	}
+
+	s = socket( AF_INET, SOCK_DGRAM, IPPROTO_UDP );
+	if ( s == INVALID_SOCKET ) {
+		Com_Error( ERR_FATAL, "LG_OpenSocket: socket failed" );
+	}
+
+	if ( ioctlsocket( s, FIONBIO, &_true ) == -1 ) {
+		Com_Error( ERR_FATAL, "LG_OpenSocket: ioctl FIONBIO failed" );
+	}
+
+	memset( &address, 0, sizeof( address ) );
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = INADDR_ANY;
+	address.sin_port = 0;
+
+	if ( bind( s, (struct sockaddr *)&address, sizeof( address ) ) == -1 ) {
+		Com_Error( ERR_FATAL, "LG_OpenSocket: bind failed" );
+	}
+
+	lg_sockets[lg_numSockets] = s;
+	return lg_numSockets++;
+}
+
+/*
+====================
+LG_CloseSocket
+====================
+*/
+void LG_CloseSocket( int sock ) {
+	if ( sock < 0 || sock >= lg_numSockets || lg_sockets[sock] == INVALID_SOCKET ) {
+		return;
+	}
+
+	closesocket( lg_sockets[sock] );
+	lg_sockets[sock] = INVALID_SOCKET;
+}
+
+/*
+====================
+LG_SetSendSocket
+
+The shared netchan code sends through Sys_SendPacket, which has no idea
+which client is talking; this picks the socket for the next sends
+====================
+*/
+void LG_SetSendSocket( int sock ) {
+	lg_sendSocket = sock;
+}
+
+/*
+====================
+Sys_SendPacket
+====================
+*/
+void Sys_SendPacket( int length, const void *data, netadr_t to ) {
+	struct sockaddr_in	addr;
+
+	if ( lg_sendSocket < 0 || lg_sockets[lg_sendSocket] == INVALID_SOCKET || to.type != NA_IP ) {
+		return;
+	}
+
+	memset( &addr, 0, sizeof( addr ) );
+	addr.sin_family = AF_INET;
+	memcpy( &addr.sin_addr, to.ip, 4 );
+	addr.sin_port = to.port;
+
+	if ( sendto( lg_sockets[lg_sendSocket], (const char *)data, length, 0, (struct sockaddr *)&addr, sizeof( addr ) ) == length ) {
+		LG_StatsPacketOut( length );
+	}
+}
+
+/*
+====================
+Sys_SendPacketv
+====================
+*/
+void Sys_SendPacketv( const netIovec_t *iov, int numIov, netadr_t to ) {
+	static byte	buf[MAX_MSGLEN];
+	int			i, length;
+
+	length = 0;
+	for ( i = 0; i < numIov; i++ ) {
+		if ( length + iov[i].length > (int)sizeof( buf ) ) {
+			return;
+		}
+		memcpy( buf + length, iov[i].data, iov[i].length );
+		length += iov[i].length;
+	}
+
+	Sys_SendPacket( length, buf, to );
+}
+
+/*
+====================
+Sys_StringToAdr
+====================
+*/
+qboolean Sys_StringToAdr( const char *s, netadr_t *a ) {
+	struct hostent	*h;
+	unsigned int	ip;
+
+	memset( a, 0, sizeof( *a ) );
+
+	if ( s[0] >= '0' && s[0] <= '9' ) {
+		ip = inet_addr( s );
+	} else {
+		if ( ( h = gethostbyname( s ) ) == 0 ) {
+			return qfalse;
+		}
+		memcpy( &ip, h->h_addr_list[0], 4 );
+	}
+
+	a->type = NA_IP;
+	memcpy( a->ip, &ip, 4 );
+	return qtrue;
+}
+
+/*
+====================
+LG_GetPacket
+====================
+*/
+qboolean LG_GetPacket( int sock, netadr_t *from, msg_t *msg ) {
+	struct sockaddr_in	addr;
+	socklen_t			addrLen = sizeof( addr );
+	int					ret;
+
+	if ( lg_sockets[sock] == INVALID_SOCKET ) {
+		return qfalse;
+	}
+
+	ret = recvfrom( lg_sockets[sock], (char *)msg->data, msg->maxsize, 0, (struct sockaddr *)&addr, &addrLen );
+	if ( ret <= 0 ) {
+		// would block, or an ICMP error from a server that isn't up yet
+		return qfalse;
+	}
+
+	memset( from, 0, sizeof( *from ) );
+	from->type = NA_IP;
+	memcpy( from->ip, &addr.sin_addr, 4 );
+	from->port = addr.sin_port;
+
+	msg->readcount = 0;
+	msg->bit = 0;
+	msg->cursize = ret;
+	if ( ret == msg->maxsize ) {
+		Com_Printf( "Oversize packet from %s\n", NET_AdrToString( *from ) );
+		return qfalse;
+	}
+
+	return qtrue;
+}
+
+/*
+====================
+LG_WaitPackets
+
+Sleeps until one of the sockets is readable or usec have passed
+====================
+*/
+void LG_WaitPackets( const int *socks, int numSocks, int usec ) {
+#ifdef _WIN32
+	fd_set			fdset;
+	struct timeval	timeout;
+	int				i;
+
+	FD_ZERO( &fdset );
+	for ( i = 0; i < numSocks && i < FD_SETSIZE; i++ ) {
+		if ( lg_sockets[socks[i]] != INVALID_SOCKET ) {
+			FD_SET( lg_sockets[socks[i]], &fdset );
+		}
+	}
+
+	timeout.tv_sec = usec / 1000000;
+	timeout.tv_usec = usec % 1000000;
+	select( 0, &fdset, NULL, NULL, &timeout );
+#else
+	static struct pollfd	fds[LG_MAX_SOCKETS];
+	int						i;
+
+	for ( i = 0; i < numSocks; i++ ) {
+		fds[i].fd = lg_sockets[socks[i]];
+		fds[i].events = POLLIN;
+		fds[i].revents = 0;
+	}
+
+	poll( fds, numSocks, usec / 1000 );
+#endif
+}
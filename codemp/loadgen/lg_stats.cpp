@@ -0,0 +1,433 @@
+// lg_stats.cpp -- what the simulated clients saw, and what it cost the servers
+
+#include "lg_local.h"
+
+#ifdef _WIN32
+	#include <windows.h>
+#else
+	#include <unistd.h>
+#endif
+
+#define	LG_SIZE_BUCKET		64						// bytes per snapshot size bucket
+#define	LG_SIZE_BUCKETS		(MAX_MSGLEN / LG_SIZE_BUCKET + 1)
+#define	LG_TIME_BUCKETS		1001					// one per msec, the last one collects the rest
+
+typedef struct lgHistogram_s {
+	int			*buckets;
+	int			numBuckets;
+	int			bucketSize;
+	int			count;
+	double		sum;
+	double		sumSquares;
+	int			max;
+} lgHistogram_t;
+
+static int			sizeBuckets[LG_SIZE_BUCKETS];
+static int			stepBuckets[LG_TIME_BUCKETS];
+static int			arrivalBuckets[LG_TIME_BUCKETS];
+static int			jitterBuckets[LG_TIME_BUCKETS];
+static int			pingBuckets[LG_TIME_BUCKETS];
+
+static struct {
+	int				startTime;
+
+	int64_t			packetsIn;
+	int64_t			bytesIn;
+	int64_t			packetsOut;
+	int64_t			bytesOut;
+	int64_t			dropped;
+
+	int64_t			snapshots;
+	int64_t			deltaSnapshots;
+	int64_t			invalidSnapshots;
+	int64_t			rateDelayed;
+
+	lgHistogram_t	size;			// bytes of the message carrying each snapshot
+	lgHistogram_t	step;			// serverTime advance between a client's snapshots
+	lgHistogram_t	arrival;		// wall clock time between a client's snapshots
+	lgHistogram_t	jitter;			// |arrival - step|
+	lgHistogram_t	ping;
+
+	int				events[LG_NUM_EVENTS];
+
+	// progress line
+	int				lastProgressTime;
+	int64_t			lastProgressSnapshots;
+	int64_t			lastProgressBytesIn;
+	int64_t			lastProgressBytesOut;
+
+	// server cpu, in seconds of cpu time
+	double			cpuStart[LG_MAX_SERVERS];
+	qboolean		cpuValid[LG_MAX_SERVERS];
+	int				cpuStartTime;
+} lg_stats;
+
+static const char *lg_eventNames[LG_NUM_EVENTS] = {
+	"connects",
+	"gamestates",
+	"kicked",
+	"timeouts",
+	"parse errors"
+};
+
+/*
+==================
+LG_HistInit
+==================
+*/
+static void LG_HistInit( lgHistogram_t *hist, int *buckets, int numBuckets, int bucketSize ) {
+	memset( buckets, 0, numBuckets * sizeof( int ) );
+	memset( hist, 0, sizeof( *hist ) );
+	hist->buckets = buckets;
+	hist->numBuckets = numBuckets;
+	hist->bucketSize = bucketSize;
+}
+
+/*
+==================
+LG_HistAdd
+==================
+*/
+static void LG_HistAdd( lgHistogram_t *hist, int value ) {
+	int		bucket;
+
+	if ( value < 0 ) {
+		value = 0;
+	}
+
+	bucket = value / hist->bucketSize;
+	if ( bucket >= hist->numBuckets ) {
+		bucket = hist->numBuckets - 1;
+	}
+	hist->buckets[bucket]++;
+
+	hist->count++;
+	hist->sum += value;
+	hist->sumSquares += (double)value * value;
+	if ( value > hist->max ) {
+		hist->max = value;
+	}
+}
+
+/*
+==================
+LG_HistMean
+==================
+*/
+static double LG_HistMean( const lgHistogram_t *hist ) {
+	return hist->count ? hist->sum / hist->count : 0.0;
+}
+
+/*
+==================
+LG_HistStdDev
+==================
+*/
+static double LG_HistStdDev( const lgHistogram_t *hist ) {
+	double	mean, variance;
+
+	if ( hist->count < 2 ) {
+		return 0.0;
+	}
+
+	mean = LG_HistMean( hist );
+	variance = hist->sumSquares / hist->count - mean * mean;
+	return variance > 0.0 ? sqrt( variance ) : 0.0;
+}
+
+/*
+==================
+LG_HistPercentile
+
+Upper edge of the bucket holding the given fraction of samples
+==================
+*/
+static int LG_HistPercentile( const lgHistogram_t *hist, float fraction ) {
+	int		i, target, seen;
+
+	if ( !hist->count ) {
+		return 0;
+	}
+
+	target = (int)( hist->count * fraction );
+	seen = 0;
+	for ( i = 0; i < hist->numBuckets; i++ ) {
+		seen += hist->buckets[i];
+		if ( seen > target ) {
+			break;
+		}
+	}
+
+	if ( i >= hist->numBuckets - 1 ) {
+		return hist->max;
+	}
+	return ( i + 1 ) * hist->bucketSize - 1;
+}
+
+/*
+==================
+LG_HistMode
+==================
+*/
+static int LG_HistMode( const lgHistogram_t *hist, int *modeCount ) {
+	int		i, best = 0;
+
+	for ( i = 1; i < hist->numBuckets; i++ ) {
+		if ( hist->buckets[i] > hist->buckets[best] ) {
+			best = i;
+		}
+	}
+
+	*modeCount = hist->buckets[best];
+	return best * hist->bucketSize;
+}
+
+/*
+==================
+LG_ProcessCpuSeconds
+
+User plus system time the process has used so far, -1 if we can't tell
+==================
+*/
+static double LG_ProcessCpuSeconds( int pid ) {
+#if defined(_WIN32)
+	HANDLE		process;
+	FILETIME	creation, exitTime, kernel, user;
+	double		seconds = -1.0;
+
+	process = OpenProcess( PROCESS_QUERY_INFORMATION, FALSE, pid );
+	if ( !process ) {
+		return -1.0;
+	}
+	if ( GetProcessTimes( process, &creation, &exitTime, &kernel, &user ) ) {
+		seconds = ( ( (double)kernel.dwHighDateTime + user.dwHighDateTime ) * 4294967296.0
+			+ (double)kernel.dwLowDateTime + user.dwLowDateTime ) / 10000000.0;
+	}
+	CloseHandle( process );
+	return seconds;
+#elif defined(__linux__)
+	char		path[64];
+	char		buf[1024];
+	char		*p;
+	FILE		*f;
+	size_t		len;
+	unsigned long utime, stime;
+
+	Com_sprintf( path, sizeof( path ), "/proc/%i/stat", pid );
+	f = fopen( path, "r" );
+	if ( !f ) {
+		return -1.0;
+	}
+	len = fread( buf, 1, sizeof( buf ) - 1, f );
+	fclose( f );
+	buf[len] = 0;
+
+	// the command name can hold spaces and parentheses, skip past the last ')'
+	p = strrchr( buf, ')' );
+	if ( !p || sscanf( p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &utime, &stime ) != 2 ) {
+		return -1.0;
+	}
+	return (double)( utime + stime ) / sysconf( _SC_CLK_TCK );
+#else
+	return -1.0;
+#endif
+}
+
+/*
+==================
+LG_StatsReset
+
+Starts the measured window, everything before it was ramp up and warmup
+==================
+*/
+void LG_StatsReset( int realtime ) {
+	memset( &lg_stats, 0, sizeof( lg_stats ) );
+	LG_HistInit( &lg_stats.size, sizeBuckets, LG_SIZE_BUCKETS, LG_SIZE_BUCKET );
+	LG_HistInit( &lg_stats.step, stepBuckets, LG_TIME_BUCKETS, 1 );
+	LG_HistInit( &lg_stats.arrival, arrivalBuckets, LG_TIME_BUCKETS, 1 );
+	LG_HistInit( &lg_stats.jitter, jitterBuckets, LG_TIME_BUCKETS, 1 );
+	LG_HistInit( &lg_stats.ping, pingBuckets, LG_TIME_BUCKETS, 1 );
+
+	lg_stats.startTime = realtime;
+	lg_stats.lastProgressTime = realtime;
+}
+
+void LG_StatsPacketIn( int bytes ) {
+	lg_stats.packetsIn++;
+	lg_stats.bytesIn += bytes;
+}
+
+void LG_StatsPacketOut( int bytes ) {
+	lg_stats.packetsOut++;
+	lg_stats.bytesOut += bytes;
+}
+
+void LG_StatsDropped( int count ) {
+	lg_stats.dropped += count;
+}
+
+void LG_StatsPing( int ping ) {
+	LG_HistAdd( &lg_stats.ping, ping );
+}
+
+void LG_StatsEvent( lgEvent_t ev ) {
+	lg_stats.events[ev]++;
+}
+
+/*
+==================
+LG_StatsSnapshot
+
+serverStep and arrival are 0 for a client's first snapshot
+==================
+*/
+void LG_StatsSnapshot( int bytes, int serverStep, int arrival, qboolean delta, qboolean valid, int snapFlags ) {
+	lg_stats.snapshots++;
+	if ( delta ) {
+		lg_stats.deltaSnapshots++;
+	}
+	if ( !valid ) {
+		lg_stats.invalidSnapshots++;
+	}
+	if ( snapFlags & SNAPFLAG_RATE_DELAYED ) {
+		lg_stats.rateDelayed++;
+	}
+
+	LG_HistAdd( &lg_stats.size, bytes );
+
+	if ( serverStep > 0 && arrival > 0 ) {
+		LG_HistAdd( &lg_stats.step, serverStep );
+		LG_HistAdd( &lg_stats.arrival, arrival );
+		LG_HistAdd( &lg_stats.jitter, abs( arrival - serverStep ) );
+	}
+}
+
+/*
+==================
+LG_StatsProgress
+
+One line every five seconds so a long run shows it is alive
+==================
+*/
+void LG_StatsProgress( int realtime, int numActive, int numClients ) {
+	float	seconds;
+
+	if ( realtime - lg_stats.lastProgressTime < 5000 ) {
+		return;
+	}
+
+	seconds = ( realtime - lg_stats.lastProgressTime ) * 0.001f;
+	Com_Printf( "[%5is] %i/%i active, %.0f snaps/s, %.1f kB/s in, %.1f kB/s out\n",
+		( realtime - lg_stats.startTime ) / 1000, numActive, numClients,
+		( lg_stats.snapshots - lg_stats.lastProgressSnapshots ) / seconds,
+		( lg_stats.bytesIn - lg_stats.lastProgressBytesIn ) / seconds / 1024.0f,
+		( lg_stats.bytesOut - lg_stats.lastProgressBytesOut ) / seconds / 1024.0f );
+
+	lg_stats.lastProgressTime = realtime;
+	lg_stats.lastProgressSnapshots = lg_stats.snapshots;
+	lg_stats.lastProgressBytesIn = lg_stats.bytesIn;
+	lg_stats.lastProgressBytesOut = lg_stats.bytesOut;
+}
+
+/*
+==================
+LG_StatsCpuBegin
+==================
+*/
+void LG_StatsCpuBegin( void ) {
+	int		i;
+
+	for ( i = 0; i < lg_numServers; i++ ) {
+		lg_stats.cpuStart[i] = lg_servers[i].pid ? LG_ProcessCpuSeconds( lg_servers[i].pid ) : -1.0;
+		lg_stats.cpuValid[i] = (qboolean)( lg_stats.cpuStart[i] >= 0.0 );
+	}
+	lg_stats.cpuStartTime = LG_Milliseconds();
+}
+
+/*
+==================
+LG_StatsReport
+==================
+*/
+void LG_StatsReport( int realtime ) {
+	static const int	sizeEdges[] = { 64, 128, 256, 512, 1024, 2048, 4096, 8192, 16384, MAX_MSGLEN + 1 };
+	lgHistogram_t		*size = &lg_stats.size;
+	float				seconds;
+	double				cpu, wall;
+	int					i, j, lower, count, mode, modeCount;
+	char				bar[41];
+
+	seconds = ( realtime - lg_stats.startTime ) * 0.001f;
+	if ( seconds <= 0.0f ) {
+		seconds = 1.0f;
+	}
+
+	Com_Printf( "\n==== load generator report ====\n" );
+	Com_Printf( "measured        %.1f s\n", seconds );
+	Com_Printf( "traffic in      %.0f pkt/s, %.1f kB/s, %lli dropped\n",
+		lg_stats.packetsIn / seconds, lg_stats.bytesIn / seconds / 1024.0f, (long long)lg_stats.dropped );
+	Com_Printf( "traffic out     %.0f pkt/s, %.1f kB/s\n",
+		lg_stats.packetsOut / seconds, lg_stats.bytesOut / seconds / 1024.0f );
+
+	Com_Printf( "snapshots       %lli (%.0f/s), %.1f%% delta, %lli invalid, %lli rate delayed\n",
+		(long long)lg_stats.snapshots, lg_stats.snapshots / seconds,
+		lg_stats.snapshots ? 100.0 * lg_stats.deltaSnapshots / lg_stats.snapshots : 0.0,
+		(long long)lg_stats.invalidSnapshots, (long long)lg_stats.rateDelayed );
+
+	// snapshot size distribution
+	Com_Printf( "snapshot bytes  avg %.0f, p50 %i, p95 %i, p99 %i, max %i\n",
+		LG_HistMean( size ), LG_HistPercentile( size, 0.50f ), LG_HistPercentile( size, 0.95f ),
+		LG_HistPercentile( size, 0.99f ), size->max );
+	lower = 0;
+	for ( i = 0; i < (int)ARRAY_LEN( sizeEdges ) && size->count; i++ ) {
+		count = 0;
+		for ( j = lower / LG_SIZE_BUCKET; j < size->numBuckets && j * LG_SIZE_BUCKET < sizeEdges[i]; j++ ) {
+			count += size->buckets[j];
+		}
+		if ( count ) {
+			memset( bar, 0, sizeof( bar ) );
+			memset( bar, '#', (int)( 40.0 * count / size->count ) );
+			Com_Printf( "  %5i-%-5i  %6.2f%%  %s\n", lower, sizeEdges[i] - 1, 100.0 * count / size->count, bar );
+		}
+		lower = j * LG_SIZE_BUCKET;
+	}
+
+	// tick stability: the server should advance serverTime by whole frames
+	// and the snapshots should arrive on that same cadence
+	mode = LG_HistMode( &lg_stats.step, &modeCount );
+	Com_Printf( "server step     avg %.2f ms, stdev %.2f, most common %i ms (%.1f%%), max %i\n",
+		LG_HistMean( &lg_stats.step ), LG_HistStdDev( &lg_stats.step ), mode,
+		lg_stats.step.count ? 100.0 * modeCount / lg_stats.step.count : 0.0, lg_stats.step.max );
+	Com_Printf( "arrival         avg %.2f ms, stdev %.2f, p99 %i, max %i\n",
+		LG_HistMean( &lg_stats.arrival ), LG_HistStdDev( &lg_stats.arrival ),
+		LG_HistPercentile( &lg_stats.arrival, 0.99f ), lg_stats.arrival.max );
+	Com_Printf( "jitter          avg %.2f ms, p99 %i, max %i\n",
+		LG_HistMean( &lg_stats.jitter ), LG_HistPercentile( &lg_stats.jitter, 0.99f ), lg_stats.jitter.max );
+	Com_Printf( "ping            avg %.1f ms, p99 %i, max %i\n",
+		LG_HistMean( &lg_stats.ping ), LG_HistPercentile( &lg_stats.ping, 0.99f ), lg_stats.ping.max );
+
+	// server cpu per client
+	wall = ( LG_Milliseconds() - lg_stats.cpuStartTime ) * 0.001;
+	for ( i = 0; i < lg_numServers; i++ ) {
+		if ( !lg_stats.cpuValid[i] || wall <= 0.0 ) {
+			Com_Printf( "server %-21s cpu n/a (pass -pid), %i clients\n", lg_servers[i].name, lg_servers[i].numActive );
+			continue;
+		}
+
+		cpu = LG_ProcessCpuSeconds( lg_servers[i].pid );
+		if ( cpu < 0.0 ) {
+			Com_Printf( "server %-21s pid %i went away\n", lg_servers[i].name, lg_servers[i].pid );
+			continue;
+		}
+
+		cpu = 100.0 * ( cpu - lg_stats.cpuStart[i] ) / wall;
+		Com_Printf( "server %-21s cpu %.1f%% of a core, %.2f%% per client (%i clients)\n",
+			lg_servers[i].name, cpu, lg_servers[i].numActive ? cpu / lg_servers[i].numActive : 0.0,
+			lg_servers[i].numActive );
+	}
+
+	Com_Printf( "events         " );
+	for ( i = 0; i < LG_NUM_EVENTS; i++ ) {
+		Com_Printf( " %i %s%s", lg_stats.events[i], lg_eventNames[i], i == LG_NUM_EVENTS - 1 ? "\n" : "," );
+	}
+}
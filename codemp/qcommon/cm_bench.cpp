@@ -0,0 +1,556 @@
+// cm_bench.cpp -- recorded trace sets, the brush kernel and leaf query benchmarks
+
+#include "cm_local.h"
+
+/*
+==============================================================================
+
+TRACE SETS
+
+cm_recordtraces collects the arguments of the next CM_Trace calls, from the
+game, the server and the client alike, and writes them out as a trace set.
+Traces claim their slot atomically, so any thread may record; the file is
+only written from CM_TraceRecordFrame, on the main thread.
+cm_tracebench runs a trace set against the loaded map with one of the
+collision switches off and then on, by default cm_simd for the scalar brush
+loops against the SIMD kernels, reports how long each took, and lists
+every trace whose trace_t came out different.
+
+"CMTS" [int TRACESET_VERSION] [char mapname[MAX_QPATH]] [int numBrushes]
+[int numPlanes] [int numTraces] recordedTrace_t...
+
+The traces are written in native byte order, a set only means anything on
+the map it was recorded on anyway.
+
+==============================================================================
+*/
+
+#define	TRACESET_IDENT		( ( 'S' << 24 ) + ( 'T' << 16 ) + ( 'M' << 8 ) + 'C' )
+#define	TRACESET_VERSION	1
+#define	TRACESET_DEFAULT	100000
+
+typedef struct {
+	int			ident;
+	int			version;
+	char		mapname[MAX_QPATH];
+	int			numBrushes;
+	int			numPlanes;
+	int			numTraces;
+} traceSetHeader_t;
+
+typedef struct {
+	vec3_t		start, end;
+	vec3_t		mins, maxs;
+	vec3_t		origin;
+	vec3_t		boxMins, boxMaxs;	// CM_TempBoxModel bounds, for the box and capsule handles
+	int			model;
+	int			brushmask;
+	int			capsule;
+	int			useSphere;
+	sphere_t	sphere;
+} recordedTrace_t;
+
+qboolean	cm_recordingTraces;
+
+static struct {
+	char			name[MAX_QPATH];
+	recordedTrace_t	*traces;
+	int				numTraces;		// slots claimed, runs past maxTraces once full
+	int				numFilled;		// claimed slots that have been filled in
+	int				numKept;		// slots that count, -1 until the recording stops
+	int				maxTraces;
+} record;
+
+/*
+==================
+CM_WriteTraceSet
+==================
+*/
+static void CM_WriteTraceSet( void ) {
+	traceSetHeader_t	header;
+	fileHandle_t		f;
+
+	f = FS_FOpenFileWrite( record.name );
+	if ( !f ) {
+		Com_Printf( "Couldn't write %s.\n", record.name );
+	} else {
+		memset( &header, 0, sizeof( header ) );
+		header.ident = TRACESET_IDENT;
+		header.version = TRACESET_VERSION;
+		Q_strncpyz( header.mapname, cmg.name, sizeof( header.mapname ) );
+		header.numBrushes = cmg.numBrushes;
+		header.numPlanes = cmg.numPlanes;
+		header.numTraces = record.numKept;
+
+		FS_Write( &header, sizeof( header ), f );
+		FS_Write( record.traces, record.numKept * sizeof( recordedTrace_t ), f );
+		FS_FCloseFile( f );
+
+		Com_Printf( "Wrote %i traces to %s.\n", record.numKept, record.name );
+	}
+
+	Z_Free( record.traces );
+	record.traces = NULL;
+}
+
+/*
+==================
+CM_FinishTraceSet
+
+Stops the recording, and writes it out once every trace that got a slot
+has been filled in. Main thread only
+==================
+*/
+static void CM_FinishTraceSet( void ) {
+	cm_recordingTraces = qfalse;
+
+	// push the claims past the end, so no more slots are handed out
+	if ( record.numKept < 0 ) {
+		record.numKept = minimum( CM_STAT_ADD( record.numTraces, record.maxTraces ), record.maxTraces );
+	}
+
+	if ( record.numFilled == record.numKept ) {
+		CM_WriteTraceSet();
+	}
+}
+
+/*
+==================
+CM_TraceRecordFrame
+
+Writes out a recording that filled up or was stopped
+==================
+*/
+void CM_TraceRecordFrame( void ) {
+	if ( record.traces && !cm_recordingTraces ) {
+		CM_FinishTraceSet();
+	}
+}
+
+/*
+==================
+CM_RecordTrace
+
+Called by CM_Trace while a recording runs, from any thread
+==================
+*/
+void CM_RecordTrace( const vec3_t start, const vec3_t end, const vec3_t mins, const vec3_t maxs,
+	clipHandle_t model, const vec3_t origin, int brushmask, int capsule, const sphere_t *sphere ) {
+	recordedTrace_t	*rt;
+	int				slot;
+
+	if ( !record.traces ) {
+		return;
+	}
+
+	slot = CM_STAT_ADD( record.numTraces, 1 );
+	if ( slot >= record.maxTraces ) {
+		return;
+	}
+
+	rt = &record.traces[slot];
+	memset( rt, 0, sizeof( *rt ) );
+	VectorCopy( start, rt->start );
+	VectorCopy( end, rt->end );
+	VectorCopy( mins ? mins : vec3_origin, rt->mins );
+	VectorCopy( maxs ? maxs : vec3_origin, rt->maxs );
+	VectorCopy( origin, rt->origin );
+	if ( model == BOX_MODEL_HANDLE || model == CAPSULE_MODEL_HANDLE ) {
+		CM_ModelBounds( BOX_MODEL_HANDLE, rt->boxMins, rt->boxMaxs );
+	}
+	rt->model = model;
+	rt->brushmask = brushmask;
+	rt->capsule = capsule;
+	if ( sphere ) {
+		rt->useSphere = 1;
+		rt->sphere = *sphere;
+	}
+	CM_STAT_ADD( record.numFilled, 1 );
+
+	// full, CM_TraceRecordFrame writes it out
+	if ( slot == record.maxTraces - 1 ) {
+		cm_recordingTraces = qfalse;
+	}
+}
+
+/*
+==================
+CM_RecordTraces_f
+
+cm_recordtraces <name> [count]
+==================
+*/
+static void CM_RecordTraces_f( void ) {
+	int		count;
+
+	if ( Cmd_Argc() < 2 || Cmd_Argc() > 3 ) {
+		Com_Printf( "cm_recordtraces <name> [count]\n" );
+		return;
+	}
+
+	if ( record.traces ) {
+		Com_Printf( "Already recording to %s.\n", record.name );
+		return;
+	}
+	if ( !cmg.numNodes ) {
+		Com_Printf( "No map loaded.\n" );
+		return;
+	}
+
+	count = ( Cmd_Argc() == 3 ) ? atoi( Cmd_Argv( 2 ) ) : TRACESET_DEFAULT;
+	if ( count <= 0 ) {
+		Com_Printf( "Bad trace count %i.\n", count );
+		return;
+	}
+
+	Com_sprintf( record.name, sizeof( record.name ), "traces/%s.cmts", Cmd_Argv( 1 ) );
+	record.numTraces = record.numFilled = 0;
+	record.numKept = -1;
+	record.maxTraces = count;
+	record.traces = (recordedTrace_t *)Z_Malloc( count * sizeof( recordedTrace_t ), TAG_GENERAL, qfalse );
+	cm_recordingTraces = qtrue;
+
+	Com_Printf( "Recording the next %i traces to %s.\n", count, record.name );
+}
+
+/*
+==================
+CM_StopRecordTraces_f
+==================
+*/
+static void CM_StopRecordTraces_f( void ) {
+	if ( !record.traces ) {
+		Com_Printf( "Not recording traces.\n" );
+		return;
+	}
+
+	CM_FinishTraceSet();
+}
+
+/*
+==================
+CM_RunTraceSet
+==================
+*/
+static int64_t CM_RunTraceSet( const recordedTrace_t *traces, int numTraces, trace_t *results ) {
+	const recordedTrace_t	*rt;
+	sphere_t				sphere;
+	int64_t					start;
+	int						i;
+
+	start = Sys_Microseconds();
+	for ( i = 0, rt = traces ; i < numTraces ; i++, rt++ ) {
+		if ( rt->model == BOX_MODEL_HANDLE || rt->model == CAPSULE_MODEL_HANDLE ) {
+			CM_TempBoxModel( rt->boxMins, rt->boxMaxs, rt->model == CAPSULE_MODEL_HANDLE );
+		}
+		sphere = rt->sphere;
+		CM_Trace( &results[i], rt->start, rt->end, rt->mins, rt->maxs, rt->model, rt->origin,
+			rt->brushmask, rt->capsule, rt->useSphere ? &sphere : NULL );
+	}
+	return Sys_Microseconds() - start;
+}
+
+// the switches cm_tracebench can compare, and what their settings do
+static const char *traceBenchSwitches[][3] = {
+	{ "cm_simd", "scalar", "simd" },
+	{ "cm_flatNodes", "nodes", "flat" },
+	{ "cm_patchBVH", "facets", "bvh" },
+};
+
+/*
+==================
+CM_TraceBench_f
+
+cm_tracebench <name> [passes] [switch]
+
+Takes the best of the passes for each setting
+==================
+*/
+static void CM_TraceBench_f( void ) {
+	char				name[MAX_QPATH];
+	traceSetHeader_t	*header;
+	recordedTrace_t		*traces;
+	trace_t				*results[2];
+	int64_t				best[2], usec;
+	void				*buffer;
+	long				len;
+	int					i, kernel, pass, passes, numKernels, mismatches;
+	int					wasSet;
+	const char			**sw;
+
+	if ( Cmd_Argc() < 2 || Cmd_Argc() > 4 ) {
+		Com_Printf( "cm_tracebench <name> [passes] [cm_simd|cm_flatNodes|cm_patchBVH]\n" );
+		return;
+	}
+
+	sw = traceBenchSwitches[0];
+	if ( Cmd_Argc() == 4 ) {
+		for ( i = 0 ; i < (int)ARRAY_LEN( traceBenchSwitches ) ; i++ ) {
+			if ( !Q_stricmp( Cmd_Argv( 3 ), traceBenchSwitches[i][0] ) ) {
+				break;
+			}
+		}
+		if ( i == (int)ARRAY_LEN( traceBenchSwitches ) ) {
+			Com_Printf( "Can't compare with %s.\n", Cmd_Argv( 3 ) );
+			return;
+		}
+		sw = traceBenchSwitches[i];
+	}
+
+	if ( record.traces ) {
+		Com_Printf( "Can't benchmark while recording traces.\n" );
+		return;
+	}
+	if ( !cmg.numNodes ) {
+		Com_Printf( "No map loaded.\n" );
+		return;
+	}
+
+	passes = ( Cmd_Argc() >= 3 ) ? atoi( Cmd_Argv( 2 ) ) : 5;
+	if ( passes < 1 ) {
+		passes = 1;
+	}
+
+	Com_sprintf( name, sizeof( name ), "traces/%s.cmts", Cmd_Argv( 1 ) );
+	len = FS_ReadFile( name, &buffer );
+	if ( !buffer ) {
+		Com_Printf( "Couldn't read %s.\n", name );
+		return;
+	}
+
+	header = (traceSetHeader_t *)buffer;
+	if ( len < (long)sizeof( *header ) || header->ident != TRACESET_IDENT || header->version != TRACESET_VERSION
+		|| header->numTraces < 0 || len != (long)( sizeof( *header ) + header->numTraces * sizeof( recordedTrace_t ) ) ) {
+		Com_Printf( "%s is not a trace set.\n", name );
+		FS_FreeFile( buffer );
+		return;
+	}
+	if ( Q_stricmp( header->mapname, cmg.name ) || header->numBrushes != cmg.numBrushes || header->numPlanes != cmg.numPlanes ) {
+		Com_Printf( "%s was recorded on %s, not on the map that is loaded.\n", name, header->mapname );
+		FS_FreeFile( buffer );
+		return;
+	}
+	traces = (recordedTrace_t *)( header + 1 );
+
+	numKernels = 2;
+#ifndef CM_SIMD
+	if ( sw == traceBenchSwitches[0] ) {
+		numKernels = 1;
+		Com_Printf( "This build has no SIMD brush kernels, timing the scalar loops only.\n" );
+	}
+#endif
+
+	wasSet = Cvar_VariableIntegerValue( sw[0] );
+	for ( kernel = 0 ; kernel < numKernels ; kernel++ ) {
+		Cvar_Set( sw[0], kernel ? "1" : "0" );
+		results[kernel] = (trace_t *)Z_Malloc( header->numTraces * sizeof( trace_t ), TAG_GENERAL, qfalse );
+
+		best[kernel] = 0;
+		for ( pass = 0 ; pass < passes ; pass++ ) {
+			usec = CM_RunTraceSet( traces, header->numTraces, results[kernel] );
+			if ( !pass || usec < best[kernel] ) {
+				best[kernel] = usec;
+			}
+		}
+	}
+	Cvar_Set( sw[0], va( "%i", wasSet ) );
+
+	Com_Printf( "%i traces on %s, best of %i passes\n", header->numTraces, header->mapname, passes );
+	Com_Printf( "%-7s %8.3f ms %7.1f ns/trace\n", va( "%s:", sw[1] ), best[0] / 1000.0, header->numTraces ? best[0] * 1000.0 / header->numTraces : 0.0 );
+
+	if ( numKernels == 2 ) {
+		Com_Printf( "%-7s %8.3f ms %7.1f ns/trace  %.2fx\n", va( "%s:", sw[2] ), best[1] / 1000.0,
+			header->numTraces ? best[1] * 1000.0 / header->numTraces : 0.0, best[1] ? (double)best[0] / best[1] : 0.0 );
+
+		// CM_Trace clears the whole trace_t first, so padding compares equal too
+		mismatches = 0;
+		for ( i = 0 ; i < header->numTraces ; i++ ) {
+			if ( !memcmp( &results[0][i], &results[1][i], sizeof( trace_t ) ) ) {
+				continue;
+			}
+			if ( mismatches++ < 10 ) {
+				Com_Printf( "trace %i differs: fraction %f / %f, startsolid %i / %i, allsolid %i / %i\n", i,
+					results[0][i].fraction, results[1][i].fraction, results[0][i].startsolid, results[1][i].startsolid,
+					results[0][i].allsolid, results[1][i].allsolid );
+			}
+		}
+
+		if ( mismatches ) {
+			Com_Printf( S_COLOR_RED "%i of %i traces differ.\n", mismatches, header->numTraces );
+		} else {
+			Com_Printf( "All traces identical.\n" );
+		}
+	}
+
+	for ( kernel = 0 ; kernel < numKernels ; kernel++ ) {
+		Z_Free( results[kernel] );
+	}
+	FS_FreeFile( buffer );
+}
+
+/*
+==============================================================================
+
+LEAF QUERIES
+
+cm_leafbench times CM_PointLeafnum and CM_BoxLeafnums over points and boxes
+spread through the loaded world, once walking cm.nodes and once walking the
+flat nodes, and checks both trees found the same leafs. The queries come
+from a fixed seed, so runs on the same map are comparable.
+
+==============================================================================
+*/
+
+#define	LEAFBENCH_DEFAULT	200000
+#define	LEAFBENCH_MAX_LEAFS	128
+
+typedef struct {
+	vec3_t		point;
+	vec3_t		mins, maxs;
+} leafQuery_t;
+
+typedef struct {
+	int			pointLeaf;
+	int			numBoxLeafs;
+	int			lastLeaf;
+	unsigned	boxLeafSum;		// order matters, the walks should visit leafs the same way
+} leafResult_t;
+
+/*
+==================
+CM_RunLeafQueries
+==================
+*/
+static void CM_RunLeafQueries( const leafQuery_t *queries, int numQueries, leafResult_t *results, int64_t *pointUsec, int64_t *boxUsec ) {
+	int		leafs[LEAFBENCH_MAX_LEAFS];
+	int64_t	start;
+	int		i, j;
+
+	start = Sys_Microseconds();
+	for ( i = 0 ; i < numQueries ; i++ ) {
+		results[i].pointLeaf = CM_PointLeafnum( queries[i].point );
+	}
+	*pointUsec = Sys_Microseconds() - start;
+
+	start = Sys_Microseconds();
+	for ( i = 0 ; i < numQueries ; i++ ) {
+		results[i].numBoxLeafs = CM_BoxLeafnums( queries[i].mins, queries[i].maxs, leafs, LEAFBENCH_MAX_LEAFS, &results[i].lastLeaf );
+		results[i].boxLeafSum = 0;
+		for ( j = 0 ; j < results[i].numBoxLeafs ; j++ ) {
+			results[i].boxLeafSum = results[i].boxLeafSum * 31 + leafs[j];
+		}
+	}
+	*boxUsec = Sys_Microseconds() - start;
+}
+
+/*
+==================
+CM_LeafBench_f
+
+cm_leafbench [count] [passes]
+
+Takes the best of the passes for each tree
+==================
+*/
+static void CM_LeafBench_f( void ) {
+	leafQuery_t		*queries;
+	leafResult_t	*results[2];
+	int64_t			bestPoint[2], bestBox[2], pointUsec, boxUsec;
+	int				i, j, tree, pass, passes, count, mismatches;
+	int				wasFlat, seed;
+	float			size;
+	const cmodel_t	*world;
+
+	if ( Cmd_Argc() > 3 ) {
+		Com_Printf( "cm_leafbench [count] [passes]\n" );
+		return;
+	}
+
+	if ( !cmg.numNodes || !cmg.flatNodes ) {
+		Com_Printf( "No map loaded.\n" );
+		return;
+	}
+
+	count = ( Cmd_Argc() >= 2 ) ? atoi( Cmd_Argv( 1 ) ) : LEAFBENCH_DEFAULT;
+	if ( count <= 0 ) {
+		Com_Printf( "Bad query count %i.\n", count );
+		return;
+	}
+	passes = ( Cmd_Argc() == 3 ) ? atoi( Cmd_Argv( 2 ) ) : 5;
+	if ( passes < 1 ) {
+		passes = 1;
+	}
+
+	// points anywhere in the world, boxes from bullet sized to a bit over a player
+	world = &cmg.cmodels[0];
+	seed = 0x1234;
+	queries = (leafQuery_t *)Z_Malloc( count * sizeof( leafQuery_t ), TAG_GENERAL, qfalse );
+	for ( i = 0 ; i < count ; i++ ) {
+		for ( j = 0 ; j < 3 ; j++ ) {
+			queries[i].point[j] = world->mins[j] + Q_random( &seed ) * ( world->maxs[j] - world->mins[j] );
+		}
+		size = 2.0f + Q_random( &seed ) * 62.0f;
+		for ( j = 0 ; j < 3 ; j++ ) {
+			queries[i].mins[j] = queries[i].point[j] - size;
+			queries[i].maxs[j] = queries[i].point[j] + size;
+		}
+	}
+
+	wasFlat = cm_flatNodes->integer;
+	for ( tree = 0 ; tree < 2 ; tree++ ) {
+		Cvar_Set( "cm_flatNodes", tree ? "1" : "0" );
+		results[tree] = (leafResult_t *)Z_Malloc( count * sizeof( leafResult_t ), TAG_GENERAL, qfalse );
+
+		bestPoint[tree] = bestBox[tree] = 0;
+		for ( pass = 0 ; pass < passes ; pass++ ) {
+			CM_RunLeafQueries( queries, count, results[tree], &pointUsec, &boxUsec );
+			if ( !pass || pointUsec < bestPoint[tree] ) {
+				bestPoint[tree] = pointUsec;
+			}
+			if ( !pass || boxUsec < bestBox[tree] ) {
+				bestBox[tree] = boxUsec;
+			}
+		}
+	}
+	Cvar_Set( "cm_flatNodes", va( "%i", wasFlat ) );
+
+	Com_Printf( "%i point and box queries on %s, %i nodes, best of %i passes\n", count, cmg.name, cmg.numNodes, passes );
+	Com_Printf( "point  nodes: %7.1f ns  flat: %7.1f ns  %.2fx\n", bestPoint[0] * 1000.0 / count,
+		bestPoint[1] * 1000.0 / count, bestPoint[1] ? (double)bestPoint[0] / bestPoint[1] : 0.0 );
+	Com_Printf( "box    nodes: %7.1f ns  flat: %7.1f ns  %.2fx\n", bestBox[0] * 1000.0 / count,
+		bestBox[1] * 1000.0 / count, bestBox[1] ? (double)bestBox[0] / bestBox[1] : 0.0 );
+
+	mismatches = 0;
+	for ( i = 0 ; i < count ; i++ ) {
+		if ( !memcmp( &results[0][i], &results[1][i], sizeof( leafResult_t ) ) ) {
+			continue;
+		}
+		if ( mismatches++ < 10 ) {
+			Com_Printf( "query %i differs: point leaf %i / %i, box leafs %i / %i\n", i,
+				results[0][i].pointLeaf, results[1][i].pointLeaf, results[0][i].numBoxLeafs, results[1][i].numBoxLeafs );
+		}
+	}
+
+	if ( mismatches ) {
+		Com_Printf( S_COLOR_RED "%i of %i queries differ.\n", mismatches, count );
+	} else {
+		Com_Printf( "All queries identical.\n" );
+	}
+
+	for ( tree = 0 ; tree < 2 ; tree++ ) {
+		Z_Free( results[tree] );
+	}
+	Z_Free( queries );
+}
+
+/*
+==================
+CM_InitCommands
+==================
+*/
+void CM_InitCommands( void ) {
+	Cmd_AddCommand( "cm_recordtraces", CM_RecordTraces_f );
+	Cmd_AddCommand( "cm_stoprecordtraces", CM_StopRecordTraces_f );
+	Cmd_AddCommand( "cm_tracebench", CM_TraceBench_f );
+	Cmd_AddCommand( "cm_leafbench", CM_LeafBench_f );
+}
@@ -0,0 +1,651 @@
+// cm_cache.cpp -- precompiled collision data, so map changes skip the BSP parse
+
+#include "cm_local.h"
+#include "cm_patch.h"
+
+/*
+==============================================================================
+
+COLLISION CACHE
+
+Once a map has been loaded from its BSP, the built clip map is written to
+cmcache/<mapname>.cmc, keyed by the BSP checksum. The next load of the same
+BSP maps that file instead of converting lumps and regenerating patch
+collision. Arrays that hold pointers are stored as indexes and fixed up into
+the hunk; visibility, the entity string and the patch planes and facets are
+used straight out of the mapping, and so is the facet hierarchy. Writes go
+to a temporary file that is renamed into place, never over a live mapping.
+
+"CMCC" [cmCacheHeader_t] then, each starting on a 16 byte boundary:
+cmCacheShader_t[numShaders] cplane_t[numPlanes]
+cmCacheBrushSide_t[numBrushSides] cmCacheBrush_t[numBrushes]
+cmCacheNode_t[numNodes] cLeaf_t[numLeafs] int[numLeafBrushes]
+int[numLeafSurfaces] cmodel_t[numSubModels] submodel leaf lists
+byte[numVisBytes] char[numEntityChars] and per patch cmCachePatch_t,
+patchPlane_t[numPlanes], facet_t[numFacets], patchBVHNode_t[numBVHNodes]
+
+Everything is in native byte order and layout. The header carries the sizes
+of the structures written raw, so a cache from a different build is just
+ignored and rewritten.
+
+==============================================================================
+*/
+
+#define	CMCACHE_IDENT		( ( 'C' << 24 ) + ( 'C' << 16 ) + ( 'M' << 8 ) + 'C' )
+#define	CMCACHE_VERSION		2
+#define	CMCACHE_ALIGN		16
+
+typedef struct {
+	int			ident;
+	int			version;
+	int			checksum;				// of the BSP this was built from
+	int			structSizes[6];			// cplane_t, cLeaf_t, cmodel_t, patchPlane_t, facet_t, patchBVHNode_t
+
+	int			numShaders;
+	int			numPlanes;
+	int			numBrushSides;
+	int			numBrushes;
+	int			numNodes;
+	int			numLeafs;
+	int			numLeafBrushes;
+	int			numLeafSurfaces;
+	int			numSubModels;
+	int			numClusters;
+	int			clusterBytes;
+	int			vised;
+	int			numVisBytes;
+	int			numEntityChars;
+	int			numAreas;
+	int			numSurfaces;
+	int			numPatches;
+} cmCacheHeader_t;
+
+typedef struct {
+	char		shader[MAX_QPATH];
+	int			surfaceFlags;
+	int			contentFlags;
+} cmCacheShader_t;
+
+typedef struct {
+	int			planeNum;
+	int			shaderNum;
+} cmCacheBrushSide_t;
+
+typedef struct {
+	int			shaderNum;
+	int			contents;
+	vec3_t		bounds[2];
+	int			firstSide;
+	int			numSides;
+} cmCacheBrush_t;
+
+typedef struct {
+	int			planeNum;
+	int			children[2];
+} cmCacheNode_t;
+
+typedef struct {
+	int			surfaceNum;
+	int			surfaceFlags;
+	int			contents;
+	vec3_t		bounds[2];
+	int			numPlanes;
+	int			numFacets;
+	int			numBVHNodes;
+} cmCachePatch_t;
+
+typedef struct {
+	byte		*base;
+	long		len;
+	long		ofs;
+} cmCacheReader_t;
+
+/*
+==================
+CM_CachePath
+==================
+*/
+static void CM_CachePath( const char *name, char *path, int size ) {
+	char	stripped[MAX_QPATH];
+
+	COM_StripExtension( name, stripped, sizeof( stripped ) );
+	Com_sprintf( path, size, "cmcache/%s.cmc", stripped );
+}
+
+/*
+==================
+CM_CacheStructSizes
+==================
+*/
+static void CM_CacheStructSizes( int *sizes ) {
+	sizes[0] = sizeof( cplane_t );
+	sizes[1] = sizeof( cLeaf_t );
+	sizes[2] = sizeof( cmodel_t );
+	sizes[3] = sizeof( patchPlane_t );
+	sizes[4] = sizeof( facet_t );
+	sizes[5] = sizeof( patchBVHNode_t );
+}
+
+/*
+==================
+CM_CacheRead
+
+Returns the next count elements of the cache, starting on a section
+boundary, or NULL if the file is too short to hold them
+==================
+*/
+static void *CM_CacheRead( cmCacheReader_t *r, int count, int size ) {
+	void	*data;
+
+	r->ofs = ( r->ofs + CMCACHE_ALIGN - 1 ) & ~( CMCACHE_ALIGN - 1 );
+	if ( count < 0 || r->ofs > r->len || count > ( r->len - r->ofs ) / size ) {
+		return NULL;
+	}
+
+	data = r->base + r->ofs;
+	r->ofs += count * size;
+	return data;
+}
+
+/*
+==================
+CM_CacheCopy
+
+Hunk copy of the next count elements with room for extra ones after them,
+for the arrays CM_InitBoxHull appends to
+==================
+*/
+static void *CM_CacheCopy( cmCacheReader_t *r, int count, int size, int extra ) {
+	void	*in, *out;
+
+	in = CM_CacheRead( r, count, size );
+	if ( !in ) {
+		return NULL;
+	}
+
+	out = Hunk_Alloc( ( count + extra ) * size, h_high );
+	Com_Memcpy( out, in, count * size );
+	return out;
+}
+
+/*
+==================
+CM_CacheLeafValid
+
+True if everything the leaf indexes lies within the map
+==================
+*/
+static qboolean CM_CacheLeafValid( const clipMap_t &cm, const cLeaf_t *leaf ) {
+	if ( leaf->cluster < -1 || leaf->cluster >= cm.numClusters || leaf->area < -1 || leaf->area >= cm.numAreas ) {
+		return qfalse;
+	}
+	if ( leaf->firstLeafBrush < 0 || leaf->numLeafBrushes < 0
+		|| leaf->numLeafBrushes > cm.numLeafBrushes - leaf->firstLeafBrush ) {
+		return qfalse;
+	}
+	if ( leaf->firstLeafSurface < 0 || leaf->numLeafSurfaces < 0
+		|| leaf->numLeafSurfaces > cm.numLeafSurfaces - leaf->firstLeafSurface ) {
+		return qfalse;
+	}
+	return qtrue;
+}
+
+/*
+==================
+CM_CacheWriteSection
+==================
+*/
+static void CM_CacheWriteSection( fileHandle_t f, int *ofs, const void *data, int len ) {
+	static const byte	pad[CMCACHE_ALIGN] = { 0 };
+	int					padding;
+
+	padding = ( CMCACHE_ALIGN - ( *ofs & ( CMCACHE_ALIGN - 1 ) ) ) & ( CMCACHE_ALIGN - 1 );
+	if ( padding ) {
+		FS_Write( pad, padding, f );
+		*ofs += padding;
+	}
+
+	if ( len ) {
+		FS_Write( data, len, f );
+		*ofs += len;
+	}
+}
+
+/*
+==================
+CM_LoadCache
+
+Fills cm from the cache file for name if there is one built from a BSP
+with this checksum. Returns qfalse, with cm as it was, if there isn't or
+it doesn't hold together; anything already put on the hunk is wasted then,
+which only a damaged cache file can cause.
+==================
+*/
+qboolean CM_LoadCache( const char *name, int checksum, clipMap_t &cm ) {
+	char				path[MAX_QPATH];
+	cmCacheReader_t		r;
+	cmCacheHeader_t		*header;
+	cmCacheShader_t		*shaders;
+	cmCacheBrushSide_t	*sides;
+	cmCacheBrush_t		*brushes;
+	cmCacheNode_t		*nodes;
+	cmCachePatch_t		*patchIn;
+	cPatch_t			*patch;
+	patchCollide_t		*pc;
+	void				*image;
+	qboolean			mapped;
+	long				len;
+	int					sizes[6];
+	int					*indexes;
+	int					i, j, k;
+
+	CM_CachePath( name, path, sizeof( path ) );
+	len = FS_MapFile( path, &image, &mapped );
+	if ( len <= 0 ) {
+		return qfalse;
+	}
+
+	r.base = (byte *)image;
+	r.len = len;
+	r.ofs = 0;
+
+	CM_CacheStructSizes( sizes );
+	header = (cmCacheHeader_t *)CM_CacheRead( &r, 1, sizeof( *header ) );
+	if ( !header || header->ident != CMCACHE_IDENT || header->version != CMCACHE_VERSION
+		|| header->checksum != checksum || memcmp( header->structSizes, sizes, sizeof( sizes ) ) ) {
+		Com_DPrintf( "CM_LoadCache: %s is stale\n", path );
+		FS_UnmapFile( image, len, mapped );
+		return qfalse;
+	}
+
+	if ( header->numShaders < 1 || header->numSubModels < 1 || header->numSubModels > MAX_SUBMODELS
+		|| header->numAreas < 0 || header->numAreas > MAX_MAP_AREAS || header->numSurfaces < 0
+		|| header->numClusters < 0 || header->clusterBytes < 0
+		|| header->numVisBytes != ( header->vised ? header->numClusters * header->clusterBytes : header->clusterBytes ) ) {
+		goto bad;
+	}
+
+	cm.numShaders = header->numShaders;
+	cm.numPlanes = header->numPlanes;
+	cm.numBrushSides = header->numBrushSides;
+	cm.numBrushes = header->numBrushes;
+	cm.numNodes = header->numNodes;
+	cm.numLeafs = header->numLeafs;
+	cm.numLeafBrushes = header->numLeafBrushes;
+	cm.numLeafSurfaces = header->numLeafSurfaces;
+	cm.numSubModels = header->numSubModels;
+	cm.numClusters = header->numClusters;
+	cm.clusterBytes = header->clusterBytes;
+	cm.vised = (qboolean)!!header->vised;
+	cm.numEntityChars = header->numEntityChars;
+	cm.numAreas = header->numAreas;
+	cm.numSurfaces = header->numSurfaces;
+
+	// shaders
+	shaders = (cmCacheShader_t *)CM_CacheRead( &r, cm.numShaders, sizeof( *shaders ) );
+	if ( !shaders ) {
+		goto bad;
+	}
+	cm.shaders = (CCMShader *)Hunk_Alloc( ( 1 + cm.numShaders ) * sizeof( *cm.shaders ), h_high );
+	for ( i = 0 ; i < cm.numShaders ; i++ ) {
+		Q_strncpyz( cm.shaders[i].shader, shaders[i].shader, sizeof( cm.shaders[i].shader ) );
+		cm.shaders[i].surfaceFlags = shaders[i].surfaceFlags;
+		cm.shaders[i].contentFlags = shaders[i].contentFlags;
+	}
+
+	// planes and brushes
+	cm.planes = (cplane_t *)CM_CacheCopy( &r, cm.numPlanes, sizeof( *cm.planes ), BOX_PLANES );
+	sides = (cmCacheBrushSide_t *)CM_CacheRead( &r, cm.numBrushSides, sizeof( *sides ) );
+	brushes = (cmCacheBrush_t *)CM_CacheRead( &r, cm.numBrushes, sizeof( *brushes ) );
+	if ( !cm.planes || !sides || !brushes ) {
+		goto bad;
+	}
+
+	cm.brushsides = (cbrushside_t *)Hunk_Alloc( ( BOX_SIDES + cm.numBrushSides ) * sizeof( *cm.brushsides ), h_high );
+	for ( i = 0 ; i < cm.numBrushSides ; i++ ) {
+		if ( (unsigned)sides[i].planeNum >= (unsigned)cm.numPlanes
+			|| (unsigned)sides[i].shaderNum >= (unsigned)cm.numShaders ) {
+			goto bad;
+		}
+		cm.brushsides[i].plane = &cm.planes[sides[i].planeNum];
+		cm.brushsides[i].shaderNum = sides[i].shaderNum;
+	}
+
+	cm.brushes = (cbrush_t *)Hunk_Alloc( ( BOX_BRUSHES + cm.numBrushes ) * sizeof( *cm.brushes ), h_high );
+	for ( i = 0 ; i < cm.numBrushes ; i++ ) {
+		if ( brushes[i].firstSide < 0 || brushes[i].numSides < 0
+			|| brushes[i].numSides > cm.numBrushSides - brushes[i].firstSide
+			|| (unsigned)brushes[i].shaderNum >= (unsigned)cm.numShaders ) {
+			goto bad;
+		}
+		cm.brushes[i].shaderNum = brushes[i].shaderNum;
+		cm.brushes[i].contents = brushes[i].contents;
+		VectorCopy( brushes[i].bounds[0], cm.brushes[i].bounds[0] );
+		VectorCopy( brushes[i].bounds[1], cm.brushes[i].bounds[1] );
+		cm.brushes[i].sides = cm.brushsides + brushes[i].firstSide;
+		cm.brushes[i].numsides = brushes[i].numSides;
+	}
+	CM_BuildBrushPlaneBlocks( cm );
+
+	// the tree
+	nodes = (cmCacheNode_t *)CM_CacheRead( &r, cm.numNodes, sizeof( *nodes ) );
+	if ( !nodes ) {
+		goto bad;
+	}
+	cm.nodes = (cNode_t *)Hunk_Alloc( cm.numNodes * sizeof( *cm.nodes ), h_high );
+	for ( i = 0 ; i < cm.numNodes ; i++ ) {
+		if ( (unsigned)nodes[i].planeNum >= (unsigned)cm.numPlanes ) {
+			goto bad;
+		}
+		for ( j = 0 ; j < 2 ; j++ ) {
+			if ( nodes[i].children[j] >= cm.numNodes || -1 - nodes[i].children[j] >= cm.numLeafs ) {
+				goto bad;
+			}
+		}
+		cm.nodes[i].plane = &cm.planes[nodes[i].planeNum];
+		cm.nodes[i].children[0] = nodes[i].children[0];
+		cm.nodes[i].children[1] = nodes[i].children[1];
+	}
+
+	cm.leafs = (cLeaf_t *)CM_CacheCopy( &r, cm.numLeafs, sizeof( *cm.leafs ), BOX_LEAFS );
+	cm.leafbrushes = (int *)CM_CacheCopy( &r, cm.numLeafBrushes, sizeof( *cm.leafbrushes ), BOX_BRUSHES );
+	cm.leafsurfaces = (int *)CM_CacheCopy( &r, cm.numLeafSurfaces, sizeof( *cm.leafsurfaces ), 0 );
+	cm.cmodels = (cmodel_t *)CM_CacheCopy( &r, cm.numSubModels, sizeof( *cm.cmodels ), 0 );
+	if ( !cm.leafs || !cm.leafbrushes || !cm.leafsurfaces || !cm.cmodels ) {
+		goto bad;
+	}
+	for ( i = 0 ; i < cm.numLeafs ; i++ ) {
+		if ( !CM_CacheLeafValid( cm, &cm.leafs[i] ) ) {
+			goto bad;
+		}
+	}
+	for ( i = 0 ; i < cm.numLeafBrushes ; i++ ) {
+		if ( (unsigned)cm.leafbrushes[i] >= (unsigned)cm.numBrushes ) {
+			goto bad;
+		}
+	}
+	for ( i = 0 ; i < cm.numLeafSurfaces ; i++ ) {
+		if ( (unsigned)cm.leafsurfaces[i] >= (unsigned)cm.numSurfaces ) {
+			goto bad;
+		}
+	}
+
+	// submodel leaves index lists of their own, relative to the
+	// map's, just the way CMod_LoadSubmodels builds them
+	for ( i = 0 ; i < cm.numSubModels ; i++ ) {
+		cmodel_t *mod = &cm.cmodels[i];
+
+		if ( mod->firstNode != -1 ) {
+			if ( mod->firstNode < 0 || mod->firstNode >= cm.numNodes ) {
+				goto bad;
+			}
+			continue;
+		}
+
+		indexes = (int *)CM_CacheCopy( &r, mod->leaf.numLeafBrushes, sizeof( *indexes ), 0 );
+		if ( !indexes ) {
+			goto bad;
+		}
+		for ( j = 0 ; j < mod->leaf.numLeafBrushes ; j++ ) {
+			if ( (unsigned)indexes[j] >= (unsigned)cm.numBrushes ) {
+				goto bad;
+			}
+		}
+		mod->leaf.firstLeafBrush = indexes - cm.leafbrushes;
+
+		indexes = (int *)CM_CacheCopy( &r, mod->leaf.numLeafSurfaces, sizeof( *indexes ), 0 );
+		if ( !indexes ) {
+			goto bad;
+		}
+		for ( j = 0 ; j < mod->leaf.numLeafSurfaces ; j++ ) {
+			if ( (unsigned)indexes[j] >= (unsigned)cm.numSurfaces ) {
+				goto bad;
+			}
+		}
+		mod->leaf.firstLeafSurface = indexes - cm.leafsurfaces;
+	}
+
+	cm.areas = (cArea_t *)Hunk_Alloc( cm.numAreas * sizeof( *cm.areas ), h_high );
+	cm.areaPortals = (int *)Hunk_Alloc( cm.numAreas * cm.numAreas * sizeof( *cm.areaPortals ), h_high );
+
+	// visibility and entities are only read, so use them where they are;
+	// an entity string without its terminator gets one in a copy
+	if ( mapped ) {
+		cm.visibility = (byte *)CM_CacheRead( &r, header->numVisBytes, 1 );
+		cm.entityString = (char *)CM_CacheRead( &r, cm.numEntityChars, 1 );
+		if ( cm.entityString && cm.numEntityChars && cm.entityString[cm.numEntityChars - 1] ) {
+			r.ofs -= cm.numEntityChars;
+			cm.entityString = (char *)CM_CacheCopy( &r, cm.numEntityChars, 1, 1 );
+		}
+	} else {
+		cm.visibility = (byte *)CM_CacheCopy( &r, header->numVisBytes, 1, 0 );
+		cm.entityString = (char *)CM_CacheCopy( &r, cm.numEntityChars, 1, 1 );
+	}
+	if ( !cm.visibility || !cm.entityString ) {
+		goto bad;
+	}
+
+	// patch collision, the expensive part of a BSP load
+	cm.surfaces = (cPatch_t **)Hunk_Alloc( cm.numSurfaces * sizeof( cm.surfaces[0] ), h_high );
+	for ( i = 0 ; i < header->numPatches ; i++ ) {
+		patchIn = (cmCachePatch_t *)CM_CacheRead( &r, 1, sizeof( *patchIn ) );
+		if ( !patchIn || (unsigned)patchIn->surfaceNum >= (unsigned)cm.numSurfaces ) {
+			goto bad;
+		}
+
+		cm.surfaces[patchIn->surfaceNum] = patch = (cPatch_t *)Hunk_Alloc( sizeof( *patch ), h_high );
+		patch->surfaceFlags = patchIn->surfaceFlags;
+		patch->contents = patchIn->contents;
+
+		patch->pc = pc = (patchCollide_t *)Hunk_Alloc( sizeof( *pc ), h_high );
+		VectorCopy( patchIn->bounds[0], pc->bounds[0] );
+		VectorCopy( patchIn->bounds[1], pc->bounds[1] );
+		pc->numPlanes = patchIn->numPlanes;
+		pc->numFacets = patchIn->numFacets;
+		pc->numBVHNodes = patchIn->numBVHNodes;
+		if ( mapped ) {
+			pc->planes = (patchPlane_t *)CM_CacheRead( &r, pc->numPlanes, sizeof( *pc->planes ) );
+			pc->facets = (facet_t *)CM_CacheRead( &r, pc->numFacets, sizeof( *pc->facets ) );
+			pc->bvh = (patchBVHNode_t *)CM_CacheRead( &r, pc->numBVHNodes, sizeof( *pc->bvh ) );
+		} else {
+			pc->planes = (patchPlane_t *)CM_CacheCopy( &r, pc->numPlanes, sizeof( *pc->planes ), 0 );
+			pc->facets = (facet_t *)CM_CacheCopy( &r, pc->numFacets, sizeof( *pc->facets ), 0 );
+			pc->bvh = (patchBVHNode_t *)CM_CacheCopy( &r, pc->numBVHNodes, sizeof( *pc->bvh ), 0 );
+		}
+		if ( !pc->planes || !pc->facets || !pc->bvh ) {
+			goto bad;
+		}
+		if ( !pc->numBVHNodes ) {
+			pc->bvh = NULL;
+		}
+		for ( j = 0 ; j < pc->numBVHNodes ; j++ ) {
+			const patchBVHNode_t *node = &pc->bvh[j];
+
+			if ( node->skip <= j || node->skip > pc->numBVHNodes || node->numFacets < 0 || node->firstFacet < 0
+				|| node->numFacets > pc->numFacets - node->firstFacet ) {
+				goto bad;
+			}
+		}
+		for ( j = 0 ; j < pc->numFacets ; j++ ) {
+			if ( (unsigned)pc->facets[j].surfacePlane >= (unsigned)pc->numPlanes
+				|| (unsigned)pc->facets[j].numBorders > ARRAY_LEN( pc->facets[j].borderPlanes ) ) {
+				goto bad;
+			}
+			for ( k = 0 ; k < pc->facets[j].numBorders ; k++ ) {
+				if ( (unsigned)pc->facets[j].borderPlanes[k] >= (unsigned)pc->numPlanes ) {
+					goto bad;
+				}
+			}
+		}
+	}
+
+	// the cache replaces the disk image for whatever lives in place
+	CM_UnmapDiskImage( cm );
+	if ( mapped ) {
+		cm.mappedImage = image;
+		cm.mappedLen = len;
+	} else {
+		FS_UnmapFile( image, len, mapped );
+	}
+
+	Com_DPrintf( "CM_LoadCache: %s\n", path );
+	return qtrue;
+
+bad:
+	Com_Printf( S_COLOR_YELLOW "WARNING: %s is damaged, rebuilding it\n", path );
+	FS_UnmapFile( image, len, mapped );
+
+	image = cm.mappedImage;
+	len = cm.mappedLen;
+	Com_Memset( &cm, 0, sizeof( cm ) );
+	cm.mappedImage = image;
+	cm.mappedLen = len;
+	return qfalse;
+}
+
+/*
+==================
+CM_WriteCache
+
+Writes out cm, freshly built from the BSP with this checksum. The file
+is built under a temporary name and renamed over the old one, so other
+servers sharing the homepath keep their mapping of the old file intact.
+==================
+*/
+void CM_WriteCache( const char *name, int checksum, const clipMap_t &cm ) {
+	char				path[MAX_QPATH];
+	char				tmpPath[MAX_QPATH + 16];
+	byte				unique[4];
+	cmCacheHeader_t		header;
+	cmCacheShader_t		shader;
+	cmCacheBrushSide_t	side;
+	cmCacheBrush_t		brush;
+	cmCacheNode_t		node;
+	cmCachePatch_t		patch;
+	fileHandle_t		f;
+	int					i, ofs;
+
+	CM_CachePath( name, path, sizeof( path ) );
+	Com_RandomBytes( unique, sizeof( unique ) );
+	Com_sprintf( tmpPath, sizeof( tmpPath ), "%s.%02x%02x%02x%02x.tmp", path, unique[0], unique[1], unique[2], unique[3] );
+	f = FS_FOpenFileWrite( tmpPath );
+	if ( !f ) {
+		Com_DPrintf( "CM_WriteCache: couldn't write %s\n", tmpPath );
+		return;
+	}
+
+	memset( &header, 0, sizeof( header ) );
+	header.ident = CMCACHE_IDENT;
+	header.version = CMCACHE_VERSION;
+	header.checksum = checksum;
+	CM_CacheStructSizes( header.structSizes );
+	header.numShaders = cm.numShaders;
+	header.numPlanes = cm.numPlanes;
+	header.numBrushSides = cm.numBrushSides;
+	header.numBrushes = cm.numBrushes;
+	header.numNodes = cm.numNodes;
+	header.numLeafs = cm.numLeafs;
+	header.numLeafBrushes = cm.numLeafBrushes;
+	header.numLeafSurfaces = cm.numLeafSurfaces;
+	header.numSubModels = cm.numSubModels;
+	header.numClusters = cm.numClusters;
+	header.clusterBytes = cm.clusterBytes;
+	header.vised = cm.vised;
+	header.numVisBytes = cm.vised ? cm.numClusters * cm.clusterBytes : cm.clusterBytes;
+	header.numEntityChars = cm.numEntityChars;
+	header.numAreas = cm.numAreas;
+	header.numSurfaces = cm.numSurfaces;
+	for ( i = 0 ; i < cm.numSurfaces ; i++ ) {
+		if ( cm.surfaces[i] ) {
+			header.numPatches++;
+		}
+	}
+
+	ofs = 0;
+	CM_CacheWriteSection( f, &ofs, &header, sizeof( header ) );
+
+	CM_CacheWriteSection( f, &ofs, NULL, 0 );
+	for ( i = 0 ; i < cm.numShaders ; i++ ) {
+		memset( &shader, 0, sizeof( shader ) );
+		Q_strncpyz( shader.shader, cm.shaders[i].shader, sizeof( shader.shader ) );
+		shader.surfaceFlags = cm.shaders[i].surfaceFlags;
+		shader.contentFlags = cm.shaders[i].contentFlags;
+		FS_Write( &shader, sizeof( shader ), f );
+		ofs += sizeof( shader );
+	}
+
+	CM_CacheWriteSection( f, &ofs, cm.planes, cm.numPlanes * sizeof( *cm.planes ) );
+
+	CM_CacheWriteSection( f, &ofs, NULL, 0 );
+	for ( i = 0 ; i < cm.numBrushSides ; i++ ) {
+		side.planeNum = cm.brushsides[i].plane - cm.planes;
+		side.shaderNum = cm.brushsides[i].shaderNum;
+		FS_Write( &side, sizeof( side ), f );
+		ofs += sizeof( side );
+	}
+
+	CM_CacheWriteSection( f, &ofs, NULL, 0 );
+	for ( i = 0 ; i < cm.numBrushes ; i++ ) {
+		brush.shaderNum = cm.brushes[i].shaderNum;
+		brush.contents = cm.brushes[i].contents;
+		VectorCopy( cm.brushes[i].bounds[0], brush.bounds[0] );
+		VectorCopy( cm.brushes[i].bounds[1], brush.bounds[1] );
+		brush.firstSide = cm.brushes[i].sides - cm.brushsides;
+		brush.numSides = cm.brushes[i].numsides;
+		FS_Write( &brush, sizeof( brush ), f );
+		ofs += sizeof( brush );
+	}
+
+	CM_CacheWriteSection( f, &ofs, NULL, 0 );
+	for ( i = 0 ; i < cm.numNodes ; i++ ) {
+		node.planeNum = cm.nodes[i].plane - cm.planes;
+		node.children[0] = cm.nodes[i].children[0];
+		node.children[1] = cm.nodes[i].children[1];
+		FS_Write( &node, sizeof( node ), f );
+		ofs += sizeof( node );
+	}
+
+	CM_CacheWriteSection( f, &ofs, cm.leafs, cm.numLeafs * sizeof( *cm.leafs ) );
+	CM_CacheWriteSection( f, &ofs, cm.leafbrushes, cm.numLeafBrushes * sizeof( *cm.leafbrushes ) );
+	CM_CacheWriteSection( f, &ofs, cm.leafsurfaces, cm.numLeafSurfaces * sizeof( *cm.leafsurfaces ) );
+	CM_CacheWriteSection( f, &ofs, cm.cmodels, cm.numSubModels * sizeof( *cm.cmodels ) );
+
+	for ( i = 0 ; i < cm.numSubModels ; i++ ) {
+		const cLeaf_t *leaf = &cm.cmodels[i].leaf;
+
+		if ( cm.cmodels[i].firstNode != -1 ) {
+			continue;
+		}
+		CM_CacheWriteSection( f, &ofs, cm.leafbrushes + leaf->firstLeafBrush, leaf->numLeafBrushes * sizeof( int ) );
+		CM_CacheWriteSection( f, &ofs, cm.leafsurfaces + leaf->firstLeafSurface, leaf->numLeafSurfaces * sizeof( int ) );
+	}
+
+	CM_CacheWriteSection( f, &ofs, cm.visibility, header.numVisBytes );
+	CM_CacheWriteSection( f, &ofs, cm.entityString, cm.numEntityChars );
+
+	for ( i = 0 ; i < cm.numSurfaces ; i++ ) {
+		const patchCollide_t *pc;
+
+		if ( !cm.surfaces[i] ) {
+			continue;
+		}
+		pc = cm.surfaces[i]->pc;
+
+		patch.surfaceNum = i;
+		patch.surfaceFlags = cm.surfaces[i]->surfaceFlags;
+		patch.contents = cm.surfaces[i]->contents;
+		VectorCopy( pc->bounds[0], patch.bounds[0] );
+		VectorCopy( pc->bounds[1], patch.bounds[1] );
+		patch.numPlanes = pc->numPlanes;
+		patch.numFacets = pc->numFacets;
+		patch.numBVHNodes = pc->numBVHNodes;
+		CM_CacheWriteSection( f, &ofs, &patch, sizeof( patch ) );
+		CM_CacheWriteSection( f, &ofs, pc->planes, pc->numPlanes * sizeof( *pc->planes ) );
+		CM_CacheWriteSection( f, &ofs, pc->facets, pc->numFacets * sizeof( *pc->facets ) );
+		CM_CacheWriteSection( f, &ofs, pc->bvh, pc->numBVHNodes * sizeof( *pc->bvh ) );
+	}
+
+	FS_FCloseFile( f );
+	FS_Rename( tmpPath, path );
+	Com_DPrintf( "CM_WriteCache: wrote %s, %i bytes\n", path, ofs );
+}
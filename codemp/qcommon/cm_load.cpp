@@ -20,13 +20,6 @@ void SetPlaneSignbits (cplane_t *out) {
 }
 #endif //BSPC
 
-// to allow boxes to be treated as brush models, we allocate
-// some extra indexes along with those needed by the map
-#define	BOX_BRUSHES		1
-#define	BOX_SIDES		6
-#define	BOX_LEAFS		2
-#define	BOX_PLANES		12
-
 #define	LL(x) x=LittleLong(x)
 
 
@@ -36,12 +29,23 @@ int			c_traces, c_brush_traces, c_patch_traces;
 
 
 byte		*cmod_base;
+static qboolean	cmod_mapped;	// cmod_base stays valid for as long as the clip map, so byte
+								// lumps can be used in place. The leaf brush and surface lists
+								// can't: CMod_LoadSubmodels indexes its own lists relative to
+								// them, which only works within the hunk
 
 #ifndef BSPC
 cvar_t		*cm_noAreas;
 cvar_t		*cm_noCurves;
 cvar_t		*cm_playerCurveClip;
 cvar_t		*cm_extraVerbose;
+cvar_t		*cm_debugSurface;
+cvar_t		*cm_debugSurfaceUpdate;
+cvar_t		*cm_simd;
+cvar_t		*cm_mmap;
+cvar_t		*cm_cache;
+cvar_t		*cm_flatNodes;
+cvar_t		*cm_patchBVH;
 #endif
 
 cmodel_t	box_model;
@@ -199,6 +203,93 @@ void CMod_LoadNodes( lump_t *l, clipMap_t &cm ) {
 
 }
 
+/*
+=================
+CM_BuildFlatNodes
+
+Lays cm.nodes out again as cm.flatNodes. A map whose nodes don't form a
+tree, which the walks never cared about, keeps its own order.
+=================
+*/
+void CM_BuildFlatNodes( clipMap_t &cm ) {
+	cNode_t		*node;
+	cFlatNode_t	*out;
+	int			*remap, *order, *stack;
+	int			i, j, num, child, numOrdered, depth;
+	qboolean	tree;
+
+	cm.flatNodes = NULL;
+	if ( !cm.numNodes ) {
+		return;
+	}
+
+	remap = (int *)Z_Malloc( cm.numNodes * 3 * sizeof( int ), TAG_TEMP_WORKSPACE, qfalse );
+	order = remap + cm.numNodes;
+	stack = order + cm.numNodes;
+	for ( i = 0 ; i < cm.numNodes ; i++ ) {
+		remap[i] = -1;
+	}
+
+	// depth first from the root, which stays node 0. Nodes are marked as they
+	//	are pushed, so nothing goes on the stack twice
+	tree = qtrue;
+	numOrdered = 0;
+	depth = 0;
+	stack[depth++] = 0;
+	remap[0] = 0;
+	while ( depth && tree ) {
+		num = stack[--depth];
+		remap[num] = numOrdered;
+		order[numOrdered++] = num;
+
+		for ( j = 1 ; j >= 0 ; j-- ) {
+			child = cm.nodes[num].children[j];
+			if ( child < 0 ) {
+				continue;
+			}
+			if ( child >= cm.numNodes || remap[child] != -1 ) {
+				tree = qfalse;
+				break;
+			}
+			remap[child] = 0;
+			stack[depth++] = child;
+		}
+	}
+
+	if ( tree ) {
+		// whatever the root doesn't reach goes at the end, untouched
+		for ( i = 0 ; i < cm.numNodes ; i++ ) {
+			if ( remap[i] == -1 ) {
+				remap[i] = numOrdered;
+				order[numOrdered++] = i;
+			}
+		}
+	} else {
+		Com_DPrintf( "CM_BuildFlatNodes: nodes aren't a tree, keeping their order\n" );
+		for ( i = 0 ; i < cm.numNodes ; i++ ) {
+			remap[i] = order[i] = i;
+		}
+	}
+
+	out = (cFlatNode_t *)Hunk_Alloc( cm.numNodes * sizeof( *out ) + 32, h_high );
+	out = (cFlatNode_t *)PADP( out, 32 );
+	cm.flatNodes = out;
+
+	for ( i = 0 ; i < cm.numNodes ; i++, out++ ) {
+		node = &cm.nodes[order[i]];
+		VectorCopy( node->plane->normal, out->normal );
+		out->dist = node->plane->dist;
+		out->type = node->plane->type;
+		out->signbits = node->plane->signbits;
+		for ( j = 0 ; j < 2 ; j++ ) {
+			child = node->children[j];
+			out->children[j] = ( child < 0 || !tree ) ? child : remap[child];
+		}
+	}
+
+	Z_Free( remap );
+}
+
 /*
 =================
 CM_BoundBrush
@@ -217,6 +308,51 @@ void CM_BoundBrush( cbrush_t *b ) {
 }
 
 
+/*
+=================
+CM_BuildBrushPlaneBlocks
+
+Copies every brush's side planes into blocks of four, one array per
+component, so the trace kernels can load four planes at once. The last
+block of a brush is padded with planes that have no normal and a dist of
+one, which every kernel sees as a plane the trace is behind and never
+crosses, so padding never changes a result.
+=================
+*/
+void CM_BuildBrushPlaneBlocks( clipMap_t &cm ) {
+	cbrush_t	*brush;
+	cplane_t	*plane;
+	float		*block;
+	int			i, j, lane, numBlocks;
+
+	numBlocks = 0;
+	for ( i = 0, brush = cm.brushes ; i < cm.numBrushes ; i++, brush++ ) {
+		numBlocks += ( brush->numsides + BRUSH_BLOCK_PLANES - 1 ) / BRUSH_BLOCK_PLANES;
+	}
+
+	// the kernels use aligned loads
+	block = (float *)Hunk_Alloc( numBlocks * BRUSH_BLOCK_FLOATS * sizeof( float ) + 16, h_high );
+	block = (float *)PADP( block, 16 );
+
+	for ( i = 0, brush = cm.brushes ; i < cm.numBrushes ; i++, brush++ ) {
+		brush->planeBlocks = block;
+		for ( j = 0 ; j < brush->numsides ; j += BRUSH_BLOCK_PLANES, block += BRUSH_BLOCK_FLOATS ) {
+			for ( lane = 0 ; lane < BRUSH_BLOCK_PLANES ; lane++ ) {
+				if ( j + lane >= brush->numsides ) {
+					block[lane] = block[4 + lane] = block[8 + lane] = 0.0f;
+					block[12 + lane] = 1.0f;
+					continue;
+				}
+				plane = brush->sides[j + lane].plane;
+				block[lane] = plane->normal[0];
+				block[4 + lane] = plane->normal[1];
+				block[8 + lane] = plane->normal[2];
+				block[12 + lane] = plane->dist;
+			}
+		}
+	}
+}
+
 /*
 =================
 CMod_LoadBrushes
@@ -252,6 +388,7 @@ void CMod_LoadBrushes( lump_t *l, clipMap_t	&cm ) {
 		CM_BoundBrush( out );
 	}
 
+	CM_BuildBrushPlaneBlocks( cm );
 }
 
 /*
@@ -433,6 +570,13 @@ CMod_LoadEntityString
 =================
 */
 void CMod_LoadEntityString( lump_t *l, clipMap_t &cm ) {
+	// q3map writes the terminator, but don't count on it
+	if ( cmod_mapped && l->filelen && !cmod_base[l->fileofs + l->filelen - 1] ) {
+		cm.entityString = (char *)( cmod_base + l->fileofs );
+		cm.numEntityChars = l->filelen;
+		return;
+	}
+
 	cm.entityString = (char *)Hunk_Alloc( l->filelen, h_high );
 	cm.numEntityChars = l->filelen;
 	Com_Memcpy (cm.entityString, cmod_base + l->fileofs, l->filelen);
@@ -458,9 +602,13 @@ void CMod_LoadVisibility( lump_t *l, clipMap_t &cm ) {
 	buf = cmod_base + l->fileofs;
 
 	cm.vised = qtrue;
-	cm.visibility = (unsigned char *)Hunk_Alloc( len, h_high );
 	cm.numClusters = LittleLong( ((int *)buf)[0] );
 	cm.clusterBytes = LittleLong( ((int *)buf)[1] );
+	if ( cmod_mapped ) {
+		cm.visibility = buf + VIS_HEADER;
+		return;
+	}
+	cm.visibility = (unsigned char *)Hunk_Alloc( len, h_high );
 	Com_Memcpy (cm.visibility, buf + VIS_HEADER, len - VIS_HEADER );
 }
 
@@ -591,6 +739,13 @@ static void CM_LoadMap_Actual( const char *name, qboolean clientload, int *check
 	cm_noCurves = Cvar_Get ("cm_noCurves", "0", CVAR_CHEAT);
 	cm_playerCurveClip = Cvar_Get ("cm_playerCurveClip", "1", CVAR_ARCHIVE|CVAR_CHEAT );
 	cm_extraVerbose = Cvar_Get ("cm_extraVerbose", "0", CVAR_TEMP );
+	cm_debugSurface = Cvar_Get ("r_debugSurface", "0", 0 );
+	cm_debugSurfaceUpdate = Cvar_Get ("r_debugSurfaceUpdate", "1", 0 );
+	cm_simd = Cvar_Get ("cm_simd", "1", CVAR_ARCHIVE );
+	cm_mmap = Cvar_Get ("cm_mmap", "1", CVAR_ARCHIVE );
+	cm_cache = Cvar_Get ("cm_cache", "1", CVAR_ARCHIVE );
+	cm_flatNodes = Cvar_Get ("cm_flatNodes", "1", CVAR_ARCHIVE );
+	cm_patchBVH = Cvar_Get ("cm_patchBVH", "1", CVAR_ARCHIVE );
 #endif
 	Com_DPrintf( "CM_LoadMap( %s, %i )\n", name, clientload );
 
@@ -610,6 +765,7 @@ static void CM_LoadMap_Actual( const char *name, qboolean clientload, int *check
 	}
 
 	// free old stuff
+	CM_UnmapDiskImage( cm );
 	Com_Memset( &cm, 0, sizeof( cm ) );
 
 	if ( !name[0] ) {
@@ -640,23 +796,44 @@ static void CM_LoadMap_Actual( const char *name, qboolean clientload, int *check
 	//	then discard it after that...
 	//
 	buf = NULL;
-	fileHandle_t h;
-	const int iBSPLen = FS_FOpenFileRead( name, &h, qfalse );
-	if (h)
+	cmod_mapped = qfalse;
+	int iBSPLen;
+	// the renderer picks up the world's disk image when we keep it, so only map the
+	//	file when the image would be thrown away straight after loading anyway
+	if ( cm_mmap->integer && ( &cm != &cmg || Sys_LowPhysicalMemory() || com_dedicated->integer ) )
 	{
-		newBuff = Z_Malloc( iBSPLen, TAG_BSP_DISKIMAGE );
-		FS_Read( newBuff, iBSPLen, h);
-		FS_FCloseFile( h );
-
-		buf = (int*) newBuff;	// so the rest of the code works as normal
-		if (&cm == &cmg)
-		{
-			gpvCachedMapDiskImage = newBuff;
+		qboolean mapped;
+
+		iBSPLen = FS_MapFile( name, &newBuff, &mapped );
+		buf = (int*) newBuff;
+		if ( mapped )
+		{	// visibility and entities get used in place, so this lives as long as cm
+			cm.mappedImage = newBuff;
+			cm.mappedLen = iBSPLen;
+			cmod_mapped = qtrue;
 			newBuff = 0;
 		}
+	}
+	else
+	{
+		fileHandle_t h;
+		iBSPLen = FS_FOpenFileRead( name, &h, qfalse );
+		if (h)
+		{
+			newBuff = Z_Malloc( iBSPLen, TAG_BSP_DISKIMAGE );
+			FS_Read( newBuff, iBSPLen, h);
+			FS_FCloseFile( h );
 
-		// carry on as before...
-		//
+			buf = (int*) newBuff;	// so the rest of the code works as normal
+			if (&cm == &cmg)
+			{
+				gpvCachedMapDiskImage = newBuff;
+				newBuff = 0;
+			}
+
+			// carry on as before...
+			//
+		}
 	}
 #else
 	const int iBSPLen = LoadQuakeFile((quakefile_t *) name, (void **)&buf);
@@ -678,6 +855,11 @@ static void CM_LoadMap_Actual( const char *name, qboolean clientload, int *check
 	if ( header.version != BSP_VERSION ) {
 		Z_Free(	gpvCachedMapDiskImage);
 				gpvCachedMapDiskImage = NULL;
+#ifndef BSPC
+		if ( newBuff ) {
+			Z_Free( newBuff );
+		}
+#endif
 
 		Com_Error (ERR_DROP, "CM_LoadMap: %s has wrong version number (%i should be %i)"
 		, name, header.version, BSP_VERSION );
@@ -685,19 +867,35 @@ static void CM_LoadMap_Actual( const char *name, qboolean clientload, int *check
 
 	cmod_base = (byte *)buf;
 
-	// load into heap
-	CMod_LoadShaders( &header.lumps[LUMP_SHADERS], cm );
-	CMod_LoadLeafs (&header.lumps[LUMP_LEAFS], cm);
-	CMod_LoadLeafBrushes (&header.lumps[LUMP_LEAFBRUSHES], cm);
-	CMod_LoadLeafSurfaces (&header.lumps[LUMP_LEAFSURFACES], cm);
-	CMod_LoadPlanes (&header.lumps[LUMP_PLANES], cm);
-	CMod_LoadBrushSides (&header.lumps[LUMP_BRUSHSIDES], cm);
-	CMod_LoadBrushes (&header.lumps[LUMP_BRUSHES], cm);
-	CMod_LoadSubmodels (&header.lumps[LUMP_MODELS], cm);
-	CMod_LoadNodes (&header.lumps[LUMP_NODES], cm);
-	CMod_LoadEntityString (&header.lumps[LUMP_ENTITIES], cm);
-	CMod_LoadVisibility( &header.lumps[LUMP_VISIBILITY], cm );
-	CMod_LoadPatches( &header.lumps[LUMP_SURFACES], &header.lumps[LUMP_DRAWVERTS], cm );
+#ifndef BSPC
+	// servers keep the built clip map around between loads; clients on a pure
+	//	server couldn't read it back, so they always build from the BSP
+	if ( clientload || !cm_cache->integer || !CM_LoadCache( name, last_checksum, cm ) )
+#endif
+	{
+		// load into heap
+		CMod_LoadShaders( &header.lumps[LUMP_SHADERS], cm );
+		CMod_LoadLeafs (&header.lumps[LUMP_LEAFS], cm);
+		CMod_LoadLeafBrushes (&header.lumps[LUMP_LEAFBRUSHES], cm);
+		CMod_LoadLeafSurfaces (&header.lumps[LUMP_LEAFSURFACES], cm);
+		CMod_LoadPlanes (&header.lumps[LUMP_PLANES], cm);
+		CMod_LoadBrushSides (&header.lumps[LUMP_BRUSHSIDES], cm);
+		CMod_LoadBrushes (&header.lumps[LUMP_BRUSHES], cm);
+		CMod_LoadSubmodels (&header.lumps[LUMP_MODELS], cm);
+		CMod_LoadNodes (&header.lumps[LUMP_NODES], cm);
+		CMod_LoadEntityString (&header.lumps[LUMP_ENTITIES], cm);
+		CMod_LoadVisibility( &header.lumps[LUMP_VISIBILITY], cm );
+		CMod_LoadPatches( &header.lumps[LUMP_SURFACES], &header.lumps[LUMP_DRAWVERTS], cm );
+
+#ifndef BSPC
+		if ( !clientload && cm_cache->integer )
+		{
+			CM_WriteCache( name, last_checksum, cm );
+		}
+#endif
+	}
+
+	CM_BuildFlatNodes( cm );
 
 	TotalSubModels += cm.numSubModels;
 
@@ -726,6 +924,12 @@ static void CM_LoadMap_Actual( const char *name, qboolean clientload, int *check
 		// ... do nothing, and let the renderer free it after it's finished playing with it...
 		//
 	}
+
+	// sub-BSPs and unmappable files were only needed for the copies above
+	if ( newBuff )
+	{
+		Z_Free( newBuff );
+	}
 #else
 	FS_FreeFile (buf);
 #endif
@@ -752,6 +956,23 @@ void CM_LoadMap( const char *name, qboolean clientload, int *checksum )
 
 
 
+/*
+==================
+CM_UnmapDiskImage
+==================
+*/
+void CM_UnmapDiskImage( clipMap_t &cm )
+{
+#ifndef BSPC
+	if ( cm.mappedImage )
+	{
+		FS_UnmapFile( cm.mappedImage, cm.mappedLen, qtrue );
+		cm.mappedImage = NULL;
+		cm.mappedLen = 0;
+	}
+#endif
+}
+
 /*
 ==================
 CM_ClearMap
@@ -761,13 +982,20 @@ void CM_ClearMap( void )
 {
 	int		i;
 
+	CM_UnmapDiskImage( cmg );
 	Com_Memset( &cmg, 0, sizeof( cmg ) );
 	CM_ClearLevelPatches();
 
 	for(i = 0; i < NumSubBSP; i++)
 	{
+		CM_UnmapDiskImage( SubBSP[i] );
 		memset(&SubBSP[i], 0, sizeof(SubBSP[0]));
 	}
+	// a sub-BSP that failed part way through loading isn't counted yet
+	if ( NumSubBSP < MAX_SUB_BSP )
+	{
+		CM_UnmapDiskImage( SubBSP[NumSubBSP] );
+	}
 	NumSubBSP = 0;
 	TotalSubModels = 0;
 }
@@ -889,6 +1117,7 @@ void CM_InitBoxHull (void)
 	box_brush->numsides = 6;
 	box_brush->sides = cmg.brushsides + cmg.numBrushSides;
 	box_brush->contents = CONTENTS_BODY;
+	box_brush->planeBlocks = NULL;	// CM_TempBoxModel moves its planes around, so it stays scalar
 
 	box_model.firstNode = -1;
 	box_model.leaf.numLeafBrushes = 1;
@@ -929,6 +1158,8 @@ CM_TempBoxModel
 To keep everything totally uniform, bounding boxes are turned into small
 BSP trees instead of being compared directly.
 Capsules are handled differently though.
+There is only the one box, so unlike tracing the world and inline models,
+tracing against a temporary box is not safe from more than one thread.
 ===================
 */
 clipHandle_t CM_TempBoxModel( const vec3_t mins, const vec3_t maxs, int capsule ) {
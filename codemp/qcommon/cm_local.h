@@ -18,6 +18,17 @@ typedef struct cNode_s {
 	int			children[2];		// negative numbers are leafs
 } cNode_t;
 
+// cm.nodes rebuilt at load time for the tree walks: the plane is inline and
+// the nodes are laid out depth first, each one followed by its front child,
+// so a walk mostly moves forward through memory. Two nodes to a cache line.
+typedef struct cFlatNode_s {
+	vec3_t		normal;
+	float		dist;
+	int			children[2];		// indexes into flatNodes, negative numbers are leafs
+	int			type;				// PLANE_X, PLANE_Y or PLANE_Z take the axial paths
+	int			signbits;
+} cFlatNode_t;
+
 typedef struct cLeaf_s {
 	int			cluster;
 	int			area;
@@ -46,9 +57,19 @@ typedef struct cbrush_s {
 	vec3_t				bounds[2];
 	cbrushside_t		*sides;
 	unsigned short		numsides;
-	unsigned short		checkcount;		// to avoid repeated testings
+	float				*planeBlocks;	// sides again in blocks of four planes laid out as
+										// x[4] y[4] z[4] dist[4], for the SIMD kernels
 } cbrush_t;
 
+// the brush plane kernels in cm_trace.cpp need SSE, which every x86 target
+// already builds with; anything else always takes the scalar loops
+#if defined(__SSE2__) || defined(_M_X64) || ( defined(_M_IX86_FP) && _M_IX86_FP >= 2 )
+	#define CM_SIMD
+#endif
+
+#define	BRUSH_BLOCK_PLANES	4
+#define	BRUSH_BLOCK_FLOATS	( BRUSH_BLOCK_PLANES * 4 )
+
 class CCMShader
 {
 public:
@@ -64,7 +85,6 @@ public:
 };
 
 typedef struct cPatch_s {
-	int			checkcount;				// to avoid repeated testings
 	int			surfaceFlags;
 	int			contents;
 	struct patchCollide_s	*pc;
@@ -90,6 +110,7 @@ typedef struct clipMap_s {
 
 	int			numNodes;
 	cNode_t		*nodes;
+	cFlatNode_t	*flatNodes;		// the same tree, only the root keeps its index
 
 	int			numLeafs;
 	cLeaf_t		*leafs;
@@ -122,7 +143,9 @@ typedef struct clipMap_s {
 	cPatch_t	**surfaces;			// non-patches will be NULL
 
 	int			floodvalid;
-	int			checkcount;					// incremented on each trace
+
+	void		*mappedImage;	// the disk image, if some lumps are used in place
+	long		mappedLen;
 } clipMap_t;
 
 
@@ -137,9 +160,81 @@ extern	cvar_t		*cm_noAreas;
 extern	cvar_t		*cm_noCurves;
 extern	cvar_t		*cm_playerCurveClip;
 extern	cvar_t		*cm_extraVerbose;
+extern	cvar_t		*cm_debugSurface;
+extern	cvar_t		*cm_debugSurfaceUpdate;
+extern	cvar_t		*cm_simd;
+extern	cvar_t		*cm_mmap;
+extern	cvar_t		*cm_cache;
+extern	cvar_t		*cm_flatNodes;
+extern	cvar_t		*cm_patchBVH;
+
+/*
+==================
+CM_FlatNodes
+
+The tree the walks should use for local, NULL for local->nodes
+==================
+*/
+static inline const cFlatNode_t *CM_FlatNodes( const clipMap_t *local ) {
+#ifndef BSPC
+	if ( cm_flatNodes->integer ) {
+		return local->flatNodes;
+	}
+#endif
+	return NULL;
+}
+
+// traces can run on any thread, so the statistics above are only ever
+// bumped atomically
+#ifdef _MSC_VER
+	#include <intrin.h>
+	#define CM_STAT_ADD( counter, value )	_InterlockedExchangeAdd( (volatile long *)&(counter), (value) )
+#else
+	#define CM_STAT_ADD( counter, value )	__sync_fetch_and_add( &(counter), (value) )
+#endif
 
 // cm_test.c
 
+// Brushes and patches one trace has already tested, so it doesn't test them
+// again when they span several leafs. This lives with the trace rather than
+// in the clip map, which leaves the clip map read only while tracing. Once
+// it fills up the rest are just tested again, which costs time but gives
+// the same result.
+#define	TRACE_VISITED_BITS		8
+#define	TRACE_VISITED_SIZE		( 1 << TRACE_VISITED_BITS )
+#define	TRACE_VISITED_MAX		( TRACE_VISITED_SIZE * 3 / 4 )
+#define	TRACE_VISITED_PATCH		0x40000000		// patches are keyed by surface number with this added
+
+typedef struct traceVisited_s {
+	int			count;
+	int			keys[TRACE_VISITED_SIZE];		// key + 1, 0 is an empty slot
+} traceVisited_t;
+
+/*
+==================
+CM_FirstVisit
+
+Returns qtrue the first time a key is seen by this trace
+==================
+*/
+static inline qboolean CM_FirstVisit( traceVisited_t *visited, int key ) {
+	unsigned int	slot = ( (unsigned int)key * 2654435761u ) >> ( 32 - TRACE_VISITED_BITS );
+
+	key++;
+	while ( visited->keys[slot] ) {
+		if ( visited->keys[slot] == key ) {
+			return qfalse;
+		}
+		slot = ( slot + 1 ) & ( TRACE_VISITED_SIZE - 1 );
+	}
+
+	if ( visited->count < TRACE_VISITED_MAX ) {
+		visited->keys[slot] = key;
+		visited->count++;
+	}
+	return qtrue;
+}
+
 // Used for oriented capsule collision detection
 typedef struct sphere_s {
 	qboolean	use;
@@ -171,9 +266,12 @@ typedef struct traceWork_s { //rwwRMG - modified
 	float			leaveFrac;		// fraction where the ray leaves the brush
 	cbrushside_t	*leadside;
 	cplane_t		*clipplane;
+	const cFlatNode_t	*flatNodes;	// the tree CM_TraceThroughTree walks, NULL for cm.nodes
 	bool			startout;
 	bool			getout;
 
+	traceVisited_t	visited;		// multi-check avoidance
+	int				patchTraces;	// statistics, added to c_patch_traces once per trace
 } traceWork_t;
 
 typedef struct leafList_s {
@@ -193,6 +291,36 @@ void CM_BoxLeafnums_r( leafList_t *ll, int nodenum );
 
 cmodel_t	*CM_ClipHandleToModel( clipHandle_t handle, clipMap_t **clipMap = 0 );
 
+// cm_load.cpp
+
+// to allow boxes to be treated as brush models, we allocate
+// some extra indexes along with those needed by the map
+#define	BOX_BRUSHES		1
+#define	BOX_SIDES		6
+#define	BOX_LEAFS		2
+#define	BOX_PLANES		12
+
+void CM_BuildBrushPlaneBlocks( clipMap_t &cm );
+void CM_BuildFlatNodes( clipMap_t &cm );
+void CM_UnmapDiskImage( clipMap_t &cm );
+
+// cm_cache.cpp
+
+qboolean CM_LoadCache( const char *name, int checksum, clipMap_t &cm );
+void CM_WriteCache( const char *name, int checksum, const clipMap_t &cm );
+
+// cm_trace.cpp
+
+void CM_Trace( trace_t *trace, const vec3_t start, const vec3_t end, const vec3_t mins, const vec3_t maxs,
+	clipHandle_t model, const vec3_t origin, int brushmask, int capsule, sphere_t *sphere );
+
+// cm_bench.cpp
+
+extern	qboolean	cm_recordingTraces;
+
+void CM_RecordTrace( const vec3_t start, const vec3_t end, const vec3_t mins, const vec3_t maxs,
+	clipHandle_t model, const vec3_t origin, int brushmask, int capsule, const sphere_t *sphere );
+
 // cm_patch.c
 
 struct patchCollide_s	*CM_GeneratePatchCollide( int width, int height, vec3_t *points );
@@ -390,6 +390,7 @@ static	patchPlane_t	planes[MAX_PATCH_PLANES];
 //static	int				numFacets;
 //static	facet_t			facets[MAX_PATCH_PLANES]; //maybe MAX_FACETS ??
 static		facet_t			*facets = NULL;
+static		vec3_t			(*facetBounds)[2] = NULL;	// winding bounds for the facet hierarchy
 
 #define	NORMAL_EPSILON	0.0001
 #define	DIST_EPSILON	0.02
@@ -778,9 +779,12 @@ static inline qboolean CM_ValidateFacet( facet_t *facet ) {
 /*
 ==================
 CM_AddFacetBevels
+
+Also returns the bounds of the facet's winding, which are where its
+axial bevels went
 ==================
 */
-static inline void CM_AddFacetBevels( facet_t *facet ) {
+static inline void CM_AddFacetBevels( facet_t *facet, vec3_t bounds[2] ) {
 
 	int i, j, k, l;
 	int axis, dir, order, flipped;
@@ -803,10 +807,15 @@ static inline void CM_AddFacetBevels( facet_t *facet ) {
 		ChopWindingInPlace( &w, plane, plane[3], 0.1f );
 	}
 	if ( !w ) {
+		// no bevels either, so traces anywhere have to test it
+		VectorSet( bounds[0], -MAX_MAP_BOUNDS, -MAX_MAP_BOUNDS, -MAX_MAP_BOUNDS );
+		VectorSet( bounds[1], MAX_MAP_BOUNDS, MAX_MAP_BOUNDS, MAX_MAP_BOUNDS );
 		return;
 	}
 
 	WindingBounds(w, mins, maxs);
+	VectorCopy( mins, bounds[0] );
+	VectorCopy( maxs, bounds[1] );
 
 	// add the axial planes
 	order = 0;
@@ -951,6 +960,72 @@ typedef enum {
 	EN_LEFT
 } edgeName_t;
 
+/*
+==================
+CM_BuildPatchBVH_r
+
+Returns the number of nodes used so far
+==================
+*/
+static int CM_BuildPatchBVH_r( patchBVHNode_t *nodes, int numNodes, int firstFacet, int numFacets ) {
+	patchBVHNode_t	*node;
+	int				i, half;
+
+	node = &nodes[numNodes++];
+	ClearBounds( node->bounds[0], node->bounds[1] );
+	for ( i = firstFacet ; i < firstFacet + numFacets ; i++ ) {
+		AddPointToBounds( facetBounds[i][0], node->bounds[0], node->bounds[1] );
+		AddPointToBounds( facetBounds[i][1], node->bounds[0], node->bounds[1] );
+	}
+
+	// the facet tests allow for SURFACE_CLIP_EPSILON and the windings were
+	//	chopped with 0.1, so expand by one unit like the patch bounds
+	for ( i = 0 ; i < 3 ; i++ ) {
+		node->bounds[0][i] -= 1;
+		node->bounds[1][i] += 1;
+	}
+
+	node->firstFacet = firstFacet;
+	if ( numFacets <= PATCH_BVH_LEAF_FACETS ) {
+		node->numFacets = numFacets;
+	} else {
+		// facets come out of the grid row by row, so halving the run
+		//	splits the patch into neighbouring strips
+		node->numFacets = 0;
+		half = numFacets / 2;
+		numNodes = CM_BuildPatchBVH_r( nodes, numNodes, firstFacet, half );
+		numNodes = CM_BuildPatchBVH_r( nodes, numNodes, firstFacet + half, numFacets - half );
+	}
+	node->skip = numNodes;
+
+	return numNodes;
+}
+
+/*
+==================
+CM_BuildPatchBVH
+
+Every inner node splits into runs of more than one facet, so there are
+fewer nodes than facets
+==================
+*/
+static void CM_BuildPatchBVH( patchCollide_t *pf ) {
+	patchBVHNode_t	*nodes;
+
+	pf->numBVHNodes = 0;
+	pf->bvh = NULL;
+	if ( !pf->numFacets ) {
+		return;
+	}
+
+	nodes = (patchBVHNode_t *)Z_Malloc( pf->numFacets * sizeof( *nodes ), TAG_TEMP_WORKSPACE, qfalse, 4 );
+	pf->numBVHNodes = CM_BuildPatchBVH_r( nodes, 0, 0, pf->numFacets );
+
+	pf->bvh = (patchBVHNode_t *)Hunk_Alloc( pf->numBVHNodes * sizeof( *pf->bvh ), h_high );
+	Com_Memcpy( pf->bvh, nodes, pf->numBVHNodes * sizeof( *pf->bvh ) );
+	Z_Free( nodes );
+}
+
 /*
 ==================
 CM_PatchCollideFromGrid
@@ -966,6 +1041,7 @@ static inline void CM_PatchCollideFromGrid( cGrid_t *grid, patchCollide_t *pf )
 
 	int numFacets;
 	facets = (facet_t*) Z_Malloc(MAX_FACETS*sizeof(facet_t), TAG_TEMP_WORKSPACE, qfalse, 4);
+	facetBounds = (vec3_t (*)[2]) Z_Malloc(MAX_FACETS*sizeof(facetBounds[0]), TAG_TEMP_WORKSPACE, qfalse, 4);
 
 	numPlanes = 0;
 	numFacets = 0;
@@ -1055,7 +1131,7 @@ static inline void CM_PatchCollideFromGrid( cGrid_t *grid, patchCollide_t *pf )
 				facet->borderNoAdjust[3] = (qboolean)noAdjust[EN_LEFT];
 				CM_SetBorderInward( facet, grid, gridPlanes, i, j, -1 );
 				if ( CM_ValidateFacet( facet ) ) {
-					CM_AddFacetBevels( facet );
+					CM_AddFacetBevels( facet, facetBounds[numFacets] );
 					numFacets++;
 				}
 			} else {
@@ -1075,7 +1151,7 @@ static inline void CM_PatchCollideFromGrid( cGrid_t *grid, patchCollide_t *pf )
 				}
  				CM_SetBorderInward( facet, grid, gridPlanes, i, j, 0 );
 				if ( CM_ValidateFacet( facet ) ) {
-					CM_AddFacetBevels( facet );
+					CM_AddFacetBevels( facet, facetBounds[numFacets] );
 					numFacets++;
 				}
 
@@ -1100,7 +1176,7 @@ static inline void CM_PatchCollideFromGrid( cGrid_t *grid, patchCollide_t *pf )
 				}
 				CM_SetBorderInward( facet, grid, gridPlanes, i, j, 1 );
 				if ( CM_ValidateFacet( facet ) ) {
-					CM_AddFacetBevels( facet );
+					CM_AddFacetBevels( facet, facetBounds[numFacets] );
 					numFacets++;
 				}
 			}
@@ -1122,6 +1198,9 @@ static inline void CM_PatchCollideFromGrid( cGrid_t *grid, patchCollide_t *pf )
 	pf->planes = (patchPlane_t *)Hunk_Alloc( numPlanes * sizeof( *pf->planes ), h_high );
 	Com_Memcpy( pf->planes, planes, numPlanes * sizeof( *pf->planes ) );
 
+	CM_BuildPatchBVH( pf );
+
+	Z_Free(facetBounds);
 	Z_Free(facets);
 }
 
@@ -1212,6 +1291,74 @@ TRACE TESTING
 ================================================================================
 */
 
+/*
+====================
+CM_RecordDebugFacet
+
+Remembers the last facet hit for CM_DrawDebugSurface. Traces can run on
+any thread, so this is only done while that surface is being drawn.
+====================
+*/
+static inline void CM_RecordDebugFacet( const patchCollide_t *pc, const facet_t *facet ) {
+#ifndef BSPC
+	if ( cm_debugSurface->integer == 1 && cm_debugSurfaceUpdate->integer ) {
+		debugPatchCollide = pc;
+		debugFacet = facet;
+	}
+#endif //BSPC
+}
+
+/*
+====================
+CM_NextFacetRun
+
+Steps through the facet hierarchy in facet order, returning the next run
+of facets whose bounds the trace's touch. *nodeNum starts at 0. Without
+the hierarchy the one run is every facet.
+====================
+*/
+static inline qboolean CM_NextFacetRun( const traceWork_t *tw, const patchCollide_t *pc, int *nodeNum, int *first, int *last ) {
+	const patchBVHNode_t	*node;
+
+	if ( *nodeNum < 0 ) {
+		return qfalse;
+	}
+
+#ifndef BSPC
+	if ( !pc->bvh || !cm_patchBVH->integer )
+#else
+	if ( !pc->bvh )
+#endif
+	{
+		*nodeNum = -1;
+		*first = 0;
+		*last = pc->numFacets;
+		return qtrue;
+	}
+
+	while ( *nodeNum < pc->numBVHNodes ) {
+		node = &pc->bvh[*nodeNum];
+		if ( tw->bounds[0][0] > node->bounds[1][0]
+			|| tw->bounds[0][1] > node->bounds[1][1]
+			|| tw->bounds[0][2] > node->bounds[1][2]
+			|| tw->bounds[1][0] < node->bounds[0][0]
+			|| tw->bounds[1][1] < node->bounds[0][1]
+			|| tw->bounds[1][2] < node->bounds[0][2] ) {
+			*nodeNum = node->skip;
+			continue;
+		}
+
+		(*nodeNum)++;
+		if ( node->numFacets ) {
+			*first = node->firstFacet;
+			*last = node->firstFacet + node->numFacets;
+			return qtrue;
+		}
+	}
+
+	return qfalse;
+}
+
 /*
 ====================
 CM_TracePointThroughPatchCollide
@@ -1226,11 +1373,9 @@ static inline void CM_TracePointThroughPatchCollide( traceWork_t *tw, trace_t &t
 	const patchPlane_t	*planes;
 	const facet_t	*facet;
 	int			i, j, k;
+	int			n, first, last;
 	float		offset;
 	float		d1, d2;
-#ifndef BSPC
-	static cvar_t *cv;
-#endif //BSPC
 
 #ifndef BSPC
 	if ( !cm_playerCurveClip->integer || !tw->isPoint ) {
@@ -1261,55 +1406,48 @@ static inline void CM_TracePointThroughPatchCollide( traceWork_t *tw, trace_t &t
 
 
 	// see if any of the surface planes are intersected
-	facet = pc->facets;
-	for ( i = 0 ; i < pc->numFacets ; i++, facet++ ) {
-		if ( !frontFacing[facet->surfacePlane] ) {
-			continue;
-		}
-		intersect = intersection[facet->surfacePlane];
-		if ( intersect < 0 ) {
-			continue;		// surface is behind the starting point
-		}
-		if ( intersect > trace.fraction ) {
-			continue;		// already hit something closer
-		}
-		for ( j = 0 ; j < facet->numBorders ; j++ ) {
-			k = facet->borderPlanes[j];
-			if ( frontFacing[k] ^ facet->borderInward[j] ) {
-				if ( intersection[k] > intersect ) {
-					break;
-				}
-			} else {
-				if ( intersection[k] < intersect ) {
-					break;
-				}
+	for ( n = 0 ; CM_NextFacetRun( tw, pc, &n, &first, &last ) ; ) {
+		for ( i = first, facet = pc->facets + first ; i < last ; i++, facet++ ) {
+			if ( !frontFacing[facet->surfacePlane] ) {
+				continue;
 			}
-		}
-		if ( j == facet->numBorders ) {
-			// we hit this facet
-#ifndef BSPC
-			if (!cv) {
-				cv = Cvar_Get( "r_debugSurfaceUpdate", "1", 0 );
+			intersect = intersection[facet->surfacePlane];
+			if ( intersect < 0 ) {
+				continue;		// surface is behind the starting point
 			}
-			if (cv->integer) {
-				debugPatchCollide = pc;
-				debugFacet = facet;
+			if ( intersect > trace.fraction ) {
+				continue;		// already hit something closer
 			}
-#endif //BSPC
-			planes = &pc->planes[facet->surfacePlane];
-
-			// calculate intersection with a slight pushoff
-			offset = DotProduct( tw->offsets[ planes->signbits ], planes->plane );
-			d1 = DotProduct( tw->start, planes->plane ) - planes->plane[3] + offset;
-			d2 = DotProduct( tw->end, planes->plane ) - planes->plane[3] + offset;
-			trace.fraction = ( d1 - SURFACE_CLIP_EPSILON ) / ( d1 - d2 );
-
-			if ( trace.fraction < 0 ) {
-				trace.fraction = 0;
+			for ( j = 0 ; j < facet->numBorders ; j++ ) {
+				k = facet->borderPlanes[j];
+				if ( frontFacing[k] ^ facet->borderInward[j] ) {
+					if ( intersection[k] > intersect ) {
+						break;
+					}
+				} else {
+					if ( intersection[k] < intersect ) {
+						break;
+					}
+				}
 			}
+			if ( j == facet->numBorders ) {
+				// we hit this facet
+				CM_RecordDebugFacet( pc, facet );
+				planes = &pc->planes[facet->surfacePlane];
+
+				// calculate intersection with a slight pushoff
+				offset = DotProduct( tw->offsets[ planes->signbits ], planes->plane );
+				d1 = DotProduct( tw->start, planes->plane ) - planes->plane[3] + offset;
+				d2 = DotProduct( tw->end, planes->plane ) - planes->plane[3] + offset;
+				trace.fraction = ( d1 - SURFACE_CLIP_EPSILON ) / ( d1 - d2 );
+
+				if ( trace.fraction < 0 ) {
+					trace.fraction = 0;
+				}
 
-			VectorCopy( planes->plane,  trace.plane.normal );
-			trace.plane.dist = planes->plane[3];
+				VectorCopy( planes->plane,  trace.plane.normal );
+				trace.plane.dist = planes->plane[3];
+			}
 		}
 	}
 }
@@ -1368,14 +1506,12 @@ CM_TraceThroughPatchCollide
 void CM_TraceThroughPatchCollide( traceWork_t *tw, trace_t &trace, const struct patchCollide_s *pc )
 {
 	int i, j, hit, hitnum;
+	int n, first, last;
 	float offset, enterFrac, leaveFrac, t;
 	patchPlane_t *planes;
 	facet_t	*facet;
 	float plane[4], bestplane[4];
 	vec3_t startp, endp;
-#ifndef BSPC
-	static cvar_t *cv;
-#endif //BSPC
 
 #ifndef CULL_BBOX
 	// I'm not sure if test is strictly correct.  Are all
@@ -1394,55 +1530,15 @@ void CM_TraceThroughPatchCollide( traceWork_t *tw, trace_t &trace, const struct
 		return;
 	}
 	//
-	facet = pc->facets;
-	for ( i = 0 ; i < pc->numFacets ; i++, facet++ ) {
-		enterFrac = -1.0;
-		leaveFrac = 1.0;
-		hitnum = -1;
-		//
-		planes = &pc->planes[ facet->surfacePlane ];
-		VectorCopy(planes->plane, plane);
-		plane[3] = planes->plane[3];
-		if ( tw->sphere.use ) {
-			// adjust the plane distance appropriately for radius
-			plane[3] += tw->sphere.radius;
-
-			// find the closest point on the capsule to the plane
-			t = DotProduct( plane, tw->sphere.offset );
-			if ( t > 0.0f )
-			{
-				VectorSubtract( tw->start, tw->sphere.offset, startp );
-				VectorSubtract( tw->end, tw->sphere.offset, endp );
-			}
-			else
-			{
-				VectorAdd( tw->start, tw->sphere.offset, startp );
-				VectorAdd( tw->end, tw->sphere.offset, endp );
-			}
-		}
-		else {
-			offset = DotProduct( tw->offsets[ planes->signbits ], plane);
-			plane[3] -= offset;
-			VectorCopy( tw->start, startp );
-			VectorCopy( tw->end, endp );
-		}
-		//
-		if (!CM_CheckFacetPlane(plane, startp, endp, &enterFrac, &leaveFrac, &hit))
-			continue;
-		if (hit) {
-			VectorCopy4(plane, bestplane);
-		}
-		//
-		for ( j = 0 ; j < facet->numBorders ; j++ ) {
-			planes = &pc->planes[ facet->borderPlanes[j] ];
-			if (facet->borderInward[j]) {
-				VectorNegate(planes->plane, plane);
-				plane[3] = -planes->plane[3];
-			}
-			else {
-				VectorCopy(planes->plane, plane);
-				plane[3] = planes->plane[3];
-			}
+	for ( n = 0 ; CM_NextFacetRun( tw, pc, &n, &first, &last ) ; ) {
+		for ( i = first, facet = pc->facets + first ; i < last ; i++, facet++ ) {
+			enterFrac = -1.0;
+			leaveFrac = 1.0;
+			hitnum = -1;
+			//
+			planes = &pc->planes[ facet->surfacePlane ];
+			VectorCopy(planes->plane, plane);
+			plane[3] = planes->plane[3];
 			if ( tw->sphere.use ) {
 				// adjust the plane distance appropriately for radius
 				plane[3] += tw->sphere.radius;
@@ -1461,42 +1557,75 @@ void CM_TraceThroughPatchCollide( traceWork_t *tw, trace_t &trace, const struct
 				}
 			}
 			else {
-				// NOTE: this works even though the plane might be flipped because the bbox is centered
 				offset = DotProduct( tw->offsets[ planes->signbits ], plane);
-				plane[3] += fabs(offset);
+				plane[3] -= offset;
 				VectorCopy( tw->start, startp );
 				VectorCopy( tw->end, endp );
 			}
 			//
 			if (!CM_CheckFacetPlane(plane, startp, endp, &enterFrac, &leaveFrac, &hit))
-				break;
+				continue;
 			if (hit) {
-				hitnum = j;
 				VectorCopy4(plane, bestplane);
 			}
-		}
-		if (j < facet->numBorders) continue;
-		//never clip against the back side
-		if (hitnum == facet->numBorders - 1) continue;
-		//
-		if (enterFrac < leaveFrac && enterFrac >= 0) {
-			if (enterFrac < trace.fraction) {
-				if (enterFrac < 0) {
-					enterFrac = 0;
+			//
+			for ( j = 0 ; j < facet->numBorders ; j++ ) {
+				planes = &pc->planes[ facet->borderPlanes[j] ];
+				if (facet->borderInward[j]) {
+					VectorNegate(planes->plane, plane);
+					plane[3] = -planes->plane[3];
 				}
-#ifndef BSPC
-				if (!cv) {
-					cv = Cvar_Get( "r_debugSurfaceUpdate", "1", 0 );
+				else {
+					VectorCopy(planes->plane, plane);
+					plane[3] = planes->plane[3];
+				}
+				if ( tw->sphere.use ) {
+					// adjust the plane distance appropriately for radius
+					plane[3] += tw->sphere.radius;
+
+					// find the closest point on the capsule to the plane
+					t = DotProduct( plane, tw->sphere.offset );
+					if ( t > 0.0f )
+					{
+						VectorSubtract( tw->start, tw->sphere.offset, startp );
+						VectorSubtract( tw->end, tw->sphere.offset, endp );
+					}
+					else
+					{
+						VectorAdd( tw->start, tw->sphere.offset, startp );
+						VectorAdd( tw->end, tw->sphere.offset, endp );
+					}
 				}
-				if (cv && cv->integer) {
-					debugPatchCollide = pc;
-					debugFacet = facet;
+				else {
+					// NOTE: this works even though the plane might be flipped because the bbox is centered
+					offset = DotProduct( tw->offsets[ planes->signbits ], plane);
+					plane[3] += fabs(offset);
+					VectorCopy( tw->start, startp );
+					VectorCopy( tw->end, endp );
 				}
-#endif // BSPC
+				//
+				if (!CM_CheckFacetPlane(plane, startp, endp, &enterFrac, &leaveFrac, &hit))
+					break;
+				if (hit) {
+					hitnum = j;
+					VectorCopy4(plane, bestplane);
+				}
+			}
+			if (j < facet->numBorders) continue;
+			//never clip against the back side
+			if (hitnum == facet->numBorders - 1) continue;
+			//
+			if (enterFrac < leaveFrac && enterFrac >= 0) {
+				if (enterFrac < trace.fraction) {
+					if (enterFrac < 0) {
+						enterFrac = 0;
+					}
+					CM_RecordDebugFacet( pc, facet );
 
-				trace.fraction = enterFrac;
-				VectorCopy( bestplane, trace.plane.normal );
-				trace.plane.dist = bestplane[3];
+					trace.fraction = enterFrac;
+					VectorCopy( bestplane, trace.plane.normal );
+					trace.plane.dist = bestplane[3];
+				}
 			}
 		}
 	}
@@ -1520,6 +1649,7 @@ Modifies tr->tr if any of the facets effect the trace
 */
 qboolean CM_PositionTestInPatchCollide( traceWork_t *tw, const struct patchCollide_s *pc ) {
 	int i, j;
+	int n, first, last;
 	float offset, t;
 	patchPlane_t *planes;
 	facet_t	*facet;
@@ -1530,51 +1660,18 @@ qboolean CM_PositionTestInPatchCollide( traceWork_t *tw, const struct patchColli
 		return qfalse;
 	}
 	//
-	facet = pc->facets;
-	for ( i = 0 ; i < pc->numFacets ; i++, facet++ ) {
-		planes = &pc->planes[ facet->surfacePlane ];
-		VectorCopy(planes->plane, plane);
-		plane[3] = planes->plane[3];
-		if ( tw->sphere.use ) {
-			// adjust the plane distance appropriately for radius
-			plane[3] += tw->sphere.radius;
-
-			// find the closest point on the capsule to the plane
-			t = DotProduct( plane, tw->sphere.offset );
-			if ( t > 0 ) {
-				VectorSubtract( tw->start, tw->sphere.offset, startp );
-			}
-			else {
-				VectorAdd( tw->start, tw->sphere.offset, startp );
-			}
-		}
-		else {
-			offset = DotProduct( tw->offsets[ planes->signbits ], plane);
-			plane[3] -= offset;
-			VectorCopy( tw->start, startp );
-		}
-
-		if ( DotProduct( plane, startp ) - plane[3] > 0.0f ) {
-			continue;
-		}
-
-		for ( j = 0; j < facet->numBorders; j++ ) {
-			planes = &pc->planes[ facet->borderPlanes[j] ];
-			if (facet->borderInward[j]) {
-				VectorNegate(planes->plane, plane);
-				plane[3] = -planes->plane[3];
-			}
-			else {
-				VectorCopy(planes->plane, plane);
-				plane[3] = planes->plane[3];
-			}
+	for ( n = 0 ; CM_NextFacetRun( tw, pc, &n, &first, &last ) ; ) {
+		for ( i = first, facet = pc->facets + first ; i < last ; i++, facet++ ) {
+			planes = &pc->planes[ facet->surfacePlane ];
+			VectorCopy(planes->plane, plane);
+			plane[3] = planes->plane[3];
 			if ( tw->sphere.use ) {
 				// adjust the plane distance appropriately for radius
 				plane[3] += tw->sphere.radius;
 
 				// find the closest point on the capsule to the plane
 				t = DotProduct( plane, tw->sphere.offset );
-				if ( t > 0.0f ) {
+				if ( t > 0 ) {
 					VectorSubtract( tw->start, tw->sphere.offset, startp );
 				}
 				else {
@@ -1582,22 +1679,56 @@ qboolean CM_PositionTestInPatchCollide( traceWork_t *tw, const struct patchColli
 				}
 			}
 			else {
-				// NOTE: this works even though the plane might be flipped because the bbox is centered
 				offset = DotProduct( tw->offsets[ planes->signbits ], plane);
-				plane[3] += fabs(offset);
+				plane[3] -= offset;
 				VectorCopy( tw->start, startp );
 			}
 
 			if ( DotProduct( plane, startp ) - plane[3] > 0.0f ) {
-				break;
+				continue;
 			}
-		}
-		if (j < facet->numBorders) {
-			continue;
 
+			for ( j = 0; j < facet->numBorders; j++ ) {
+				planes = &pc->planes[ facet->borderPlanes[j] ];
+				if (facet->borderInward[j]) {
+					VectorNegate(planes->plane, plane);
+					plane[3] = -planes->plane[3];
+				}
+				else {
+					VectorCopy(planes->plane, plane);
+					plane[3] = planes->plane[3];
+				}
+				if ( tw->sphere.use ) {
+					// adjust the plane distance appropriately for radius
+					plane[3] += tw->sphere.radius;
+
+					// find the closest point on the capsule to the plane
+					t = DotProduct( plane, tw->sphere.offset );
+					if ( t > 0.0f ) {
+						VectorSubtract( tw->start, tw->sphere.offset, startp );
+					}
+					else {
+						VectorAdd( tw->start, tw->sphere.offset, startp );
+					}
+				}
+				else {
+					// NOTE: this works even though the plane might be flipped because the bbox is centered
+					offset = DotProduct( tw->offsets[ planes->signbits ], plane);
+					plane[3] += fabs(offset);
+					VectorCopy( tw->start, startp );
+				}
+
+				if ( DotProduct( plane, startp ) - plane[3] > 0.0f ) {
+					break;
+				}
+			}
+			if (j < facet->numBorders) {
+				continue;
+
+			}
+			// inside this patch facet
+			return qtrue;
 		}
-		// inside this patch facet
-		return qtrue;
 	}
 
 	return qfalse;
@@ -56,12 +56,27 @@ typedef struct facet_s {
 	qboolean	borderNoAdjust[4+6+16];
 } facet_t;
 
+// A bounding volume hierarchy over runs of consecutive facets, stored
+// depth first. Walking it front to back visits the facets in their own
+// order, so a trace picks the same facet among equally near hits as the
+// plain loop does.
+#define	PATCH_BVH_LEAF_FACETS	4
+
+typedef struct patchBVHNode_s {
+	vec3_t	bounds[2];			// of the facet windings, plus an epsilon
+	int		firstFacet;
+	int		numFacets;			// 0 for inner nodes, whose two children follow them
+	int		skip;				// the node after this one's subtree
+} patchBVHNode_t;
+
 typedef struct patchCollide_s {
 	vec3_t	bounds[2];
 	int		numPlanes;			// surface planes plus edge planes
 	patchPlane_t	*planes;
 	int		numFacets;
 	facet_t	*facets;
+	int		numBVHNodes;
+	patchBVHNode_t	*bvh;
 } patchCollide_t;
 
 #define	MAX_GRID_SIZE	129
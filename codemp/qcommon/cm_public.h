@@ -5,6 +5,10 @@
 
 void		CM_LoadMap( const char *name, qboolean clientload, int *checksum);
 
+// cm_bench.cpp
+void		CM_InitCommands( void );
+void		CM_TraceRecordFrame( void );
+
 void		CM_ClearMap( void );
 clipHandle_t CM_InlineModel( int index );		// 0 = world, 1 + are bmodels
 clipHandle_t CM_TempBoxModel( const vec3_t mins, const vec3_t maxs, int capsule );
@@ -4,12 +4,27 @@
 ==================
 CM_PointLeafnum_r
 
+num has to be the root, 0, as the flat tree numbers the other nodes its own way
 ==================
 */
 int CM_PointLeafnum_r( const vec3_t p, int num, clipMap_t *local ) {
 	float		d;
 	cNode_t		*node;
 	cplane_t	*plane;
+	const cFlatNode_t	*flat, *flatNode;
+
+	flat = CM_FlatNodes( local );
+	if ( flat ) {
+		while ( num >= 0 ) {
+			flatNode = flat + num;
+			if ( flatNode->type < 3 ) {
+				d = p[flatNode->type] - flatNode->dist;
+			} else {
+				d = DotProduct( flatNode->normal, p ) - flatNode->dist;
+			}
+			num = flatNode->children[d < 0];
+		}
+	}
 
 	while (num >= 0)
 	{
@@ -26,7 +41,7 @@ int CM_PointLeafnum_r( const vec3_t p, int num, clipMap_t *local ) {
 			num = node->children[0];
 	}
 
-	c_pointcontents++;		// optimize counter
+	CM_STAT_ADD( c_pointcontents, 1 );		// optimize counter
 
 	return -1 - num;
 }
@@ -66,7 +81,7 @@ void CM_StoreLeafs( leafList_t *ll, int nodenum ) {
 }
 
 void CM_StoreBrushes( leafList_t *ll, int nodenum ) {
-	int			i, k;
+	int			i, j, k;
 	int			leafnum;
 	int			brushnum;
 	cLeaf_t		*leaf;
@@ -79,10 +94,14 @@ void CM_StoreBrushes( leafList_t *ll, int nodenum ) {
 	for ( k = 0 ; k < leaf->numLeafBrushes ; k++ ) {
 		brushnum = cmg.leafbrushes[leaf->firstLeafBrush+k];
 		b = &cmg.brushes[brushnum];
-		if ( b->checkcount == cmg.checkcount ) {
-			continue;	// already checked this brush in another leaf
+		for ( j = 0 ; j < ll->count ; j++ ) {
+			if ( ((cbrush_t **)ll->list)[j] == b ) {
+				break;
+			}
+		}
+		if ( j != ll->count ) {
+			continue;	// already stored from another leaf
 		}
-		b->checkcount = cmg.checkcount;
 		for ( i = 0 ; i < 3 ; i++ ) {
 			if ( b->bounds[0][i] >= ll->bounds[1][i] || b->bounds[1][i] <= ll->bounds[0][i] ) {
 				break;
@@ -110,12 +129,80 @@ void CM_StoreBrushes( leafList_t *ll, int nodenum ) {
 
 /*
 =============
-CM_BoxLeafnums
+CM_BoxOnFlatNodeSide
 
-Fills in a list of all the leafs touched
+BoxOnPlaneSide for a flat node, step for step so the two trees agree
+
+Returns 1, 2, or 1 + 2
 =============
 */
-void CM_BoxLeafnums_r( leafList_t *ll, int nodenum ) {
+static inline int CM_BoxOnFlatNodeSide( const vec3_t emins, const vec3_t emaxs, const cFlatNode_t *node ) {
+	float	dist[2];
+	int		sides, b, i;
+
+	if ( node->type < 3 ) {
+		if ( node->dist <= emins[node->type] ) {
+			return 1;
+		}
+		if ( node->dist >= emaxs[node->type] ) {
+			return 2;
+		}
+		return 3;
+	}
+
+	dist[0] = dist[1] = 0;
+	if ( node->signbits < 8 ) {
+		for ( i = 0 ; i < 3 ; i++ ) {
+			b = ( node->signbits >> i ) & 1;
+			dist[ b] += node->normal[i]*emaxs[i];
+			dist[!b] += node->normal[i]*emins[i];
+		}
+	}
+
+	sides = 0;
+	if ( dist[0] >= node->dist ) {
+		sides = 1;
+	}
+	if ( dist[1] < node->dist ) {
+		sides |= 2;
+	}
+
+	return sides;
+}
+
+/*
+=============
+CM_BoxLeafnumsFlat_r
+=============
+*/
+static void CM_BoxLeafnumsFlat_r( leafList_t *ll, const cFlatNode_t *flat, int nodenum ) {
+	const cFlatNode_t	*node;
+	int					s;
+
+	while ( nodenum >= 0 ) {
+		node = flat + nodenum;
+
+		s = CM_BoxOnFlatNodeSide( ll->bounds[0], ll->bounds[1], node );
+		if ( s == 1 ) {
+			nodenum = node->children[0];
+		} else if ( s == 2 ) {
+			nodenum = node->children[1];
+		} else {
+			// go down both
+			CM_BoxLeafnumsFlat_r( ll, flat, node->children[0] );
+			nodenum = node->children[1];
+		}
+	}
+
+	ll->storeLeafs( ll, nodenum );
+}
+
+/*
+=============
+CM_BoxLeafnumsNodes_r
+=============
+*/
+static void CM_BoxLeafnumsNodes_r( leafList_t *ll, int nodenum ) {
 	cplane_t	*plane;
 	cNode_t		*node;
 	int			s;
@@ -136,13 +223,32 @@ void CM_BoxLeafnums_r( leafList_t *ll, int nodenum ) {
 			nodenum = node->children[1];
 		} else {
 			// go down both
-			CM_BoxLeafnums_r( ll, node->children[0] );
+			CM_BoxLeafnumsNodes_r( ll, node->children[0] );
 			nodenum = node->children[1];
 		}
 
 	}
 }
 
+/*
+=============
+CM_BoxLeafnums
+
+Fills in a list of all the leafs touched. nodenum has to be the root, 0,
+as the flat tree numbers the other nodes its own way
+=============
+*/
+void CM_BoxLeafnums_r( leafList_t *ll, int nodenum ) {
+	const cFlatNode_t	*flat;
+
+	flat = CM_FlatNodes( &cmg );
+	if ( flat ) {
+		CM_BoxLeafnumsFlat_r( ll, flat, nodenum );
+	} else {
+		CM_BoxLeafnumsNodes_r( ll, nodenum );
+	}
+}
+
 /*
 ==================
 CM_BoxLeafnums
@@ -152,8 +258,6 @@ int	CM_BoxLeafnums( const vec3_t mins, const vec3_t maxs, int *boxList, int list
 	//rwwRMG - changed to boxList to not conflict with list type
 	leafList_t	ll;
 
-	cmg.checkcount++;
-
 	VectorCopy( mins, ll.bounds[0] );
 	VectorCopy( maxs, ll.bounds[1] );
 	ll.count = 0;
@@ -1,5 +1,9 @@
 #include "cm_local.h"
 
+#ifdef CM_SIMD
+	#include <xmmintrin.h>
+#endif
+
 // always use bbox vs. bbox collision and never capsule vs. bbox or vice versa
 //#define ALWAYS_BBOX_VS_BBOX
 // always use capsule vs. capsule collision and never capsule vs. bbox or vice versa
@@ -101,6 +105,122 @@ POSITION TESTING
 ===============================================================================
 */
 
+/*
+===============================================================================
+
+SIMD BRUSH PLANES
+
+These go through a brush's planeBlocks four planes at a time. The distances
+are computed with the same operations in the same order as the scalar loops,
+so they come out bit for bit the same, and any plane the trace actually
+crosses is still handed to the scalar code in plane order. The trace_t that
+comes out is identical whichever path ran; cm_traceBench checks that.
+
+===============================================================================
+*/
+
+#ifdef CM_SIMD
+/*
+================
+CM_UseBrushSIMD
+================
+*/
+static inline bool CM_UseBrushSIMD( const cbrush_t *brush ) {
+#ifndef BSPC
+	return brush->planeBlocks && cm_simd->integer;
+#else
+	return false;
+#endif
+}
+
+/*
+================
+CM_BlockOffsetDot
+
+DotProduct( tw->offsets[ plane->signbits ], plane->normal ) for four planes,
+picking the size by the sign of each normal component like signbits does
+================
+*/
+static inline __m128 CM_BlockOffsetDot( const traceWork_t *tw, __m128 nx, __m128 ny, __m128 nz ) {
+	const __m128	zero = _mm_setzero_ps();
+	__m128			neg, ox, oy, oz;
+
+	neg = _mm_cmplt_ps( nx, zero );
+	ox = _mm_or_ps( _mm_and_ps( neg, _mm_set1_ps( tw->size[1][0] ) ), _mm_andnot_ps( neg, _mm_set1_ps( tw->size[0][0] ) ) );
+	neg = _mm_cmplt_ps( ny, zero );
+	oy = _mm_or_ps( _mm_and_ps( neg, _mm_set1_ps( tw->size[1][1] ) ), _mm_andnot_ps( neg, _mm_set1_ps( tw->size[0][1] ) ) );
+	neg = _mm_cmplt_ps( nz, zero );
+	oz = _mm_or_ps( _mm_and_ps( neg, _mm_set1_ps( tw->size[1][2] ) ), _mm_andnot_ps( neg, _mm_set1_ps( tw->size[0][2] ) ) );
+
+	return _mm_add_ps( _mm_add_ps( _mm_mul_ps( ox, nx ), _mm_mul_ps( oy, ny ) ), _mm_mul_ps( oz, nz ) );
+}
+
+/*
+================
+CM_BlockDot
+================
+*/
+static inline __m128 CM_BlockDot( __m128 px, __m128 py, __m128 pz, __m128 nx, __m128 ny, __m128 nz ) {
+	return _mm_add_ps( _mm_add_ps( _mm_mul_ps( px, nx ), _mm_mul_ps( py, ny ) ), _mm_mul_ps( pz, nz ) );
+}
+
+/*
+================
+CM_BoxInBrushSIMD
+
+The plane loop of CM_TestBoxInBrush, returns true if the box is behind
+every plane past the axial six
+================
+*/
+static bool CM_BoxInBrushSIMD( const traceWork_t *tw, const cbrush_t *brush ) {
+	const __m128	zero = _mm_setzero_ps();
+	const __m128	sx = _mm_set1_ps( tw->start[0] );
+	const __m128	sy = _mm_set1_ps( tw->start[1] );
+	const __m128	sz = _mm_set1_ps( tw->start[2] );
+	const float		*block;
+	__m128			nx, ny, nz, dist, d1, t, px, py, pz;
+	int				i, numBlocks, lanes;
+
+	numBlocks = ( brush->numsides + BRUSH_BLOCK_PLANES - 1 ) / BRUSH_BLOCK_PLANES;
+
+	// the first six planes are the axial planes, so start at the second
+	// block and leave out its first two lanes
+	lanes = 0xc;
+	for ( i = 1, block = brush->planeBlocks + BRUSH_BLOCK_FLOATS ; i < numBlocks ; i++, block += BRUSH_BLOCK_FLOATS, lanes = 0xf ) {
+		nx = _mm_load_ps( block );
+		ny = _mm_load_ps( block + 4 );
+		nz = _mm_load_ps( block + 8 );
+
+		if ( tw->sphere.use ) {
+			// adjust the plane distance appropriately for radius
+			dist = _mm_add_ps( _mm_load_ps( block + 12 ), _mm_set1_ps( tw->sphere.radius ) );
+
+			// find the closest point on the capsule to the plane
+			t = _mm_cmpgt_ps( CM_BlockDot( nx, ny, nz, _mm_set1_ps( tw->sphere.offset[0] ),
+				_mm_set1_ps( tw->sphere.offset[1] ), _mm_set1_ps( tw->sphere.offset[2] ) ), zero );
+			px = _mm_or_ps( _mm_and_ps( t, _mm_set1_ps( tw->start[0] - tw->sphere.offset[0] ) ),
+				_mm_andnot_ps( t, _mm_set1_ps( tw->start[0] + tw->sphere.offset[0] ) ) );
+			py = _mm_or_ps( _mm_and_ps( t, _mm_set1_ps( tw->start[1] - tw->sphere.offset[1] ) ),
+				_mm_andnot_ps( t, _mm_set1_ps( tw->start[1] + tw->sphere.offset[1] ) ) );
+			pz = _mm_or_ps( _mm_and_ps( t, _mm_set1_ps( tw->start[2] - tw->sphere.offset[2] ) ),
+				_mm_andnot_ps( t, _mm_set1_ps( tw->start[2] + tw->sphere.offset[2] ) ) );
+			d1 = _mm_sub_ps( CM_BlockDot( px, py, pz, nx, ny, nz ), dist );
+		} else {
+			// adjust the plane distance appropriately for mins/maxs
+			dist = _mm_sub_ps( _mm_load_ps( block + 12 ), CM_BlockOffsetDot( tw, nx, ny, nz ) );
+			d1 = _mm_sub_ps( CM_BlockDot( sx, sy, sz, nx, ny, nz ), dist );
+		}
+
+		// if completely in front of face, no intersection
+		if ( _mm_movemask_ps( _mm_cmpgt_ps( d1, zero ) ) & lanes ) {
+			return false;
+		}
+	}
+
+	return true;
+}
+#endif
+
 /*
 ================
 CM_TestBoxInBrush
@@ -130,6 +250,13 @@ void CM_TestBoxInBrush( traceWork_t *tw, trace_t &trace, cbrush_t *brush ) {
 		return;
 	}
 
+#ifdef CM_SIMD
+	if ( CM_UseBrushSIMD( brush ) ) {
+		if ( !CM_BoxInBrushSIMD( tw, brush ) ) {
+			return;
+		}
+	} else
+#endif
    if ( tw->sphere.use ) {
 		// the first six planes are the axial planes, so we only
 		// need to test the remainder
@@ -189,7 +316,7 @@ CM_TestInLeaf
 void CM_TestInLeaf( traceWork_t *tw, trace_t &trace, cLeaf_t *leaf, clipMap_t *local )
 {
 	int			k;
-	int			brushnum;
+	int			brushnum, surfnum;
 	cbrush_t	*b;
 	cPatch_t	*patch;
 
@@ -197,10 +324,9 @@ void CM_TestInLeaf( traceWork_t *tw, trace_t &trace, cLeaf_t *leaf, clipMap_t *l
 	for (k=0 ; k<leaf->numLeafBrushes ; k++) {
 		brushnum = local->leafbrushes[leaf->firstLeafBrush+k];
 		b = &local->brushes[brushnum];
-		if (b->checkcount == local->checkcount) {
+		if ( !CM_FirstVisit( &tw->visited, brushnum ) ) {
 			continue;	// already checked this brush in another leaf
 		}
-		b->checkcount = local->checkcount;
 
 		if ( !(b->contents & tw->contents)) {
 			continue;
@@ -219,14 +345,14 @@ void CM_TestInLeaf( traceWork_t *tw, trace_t &trace, cLeaf_t *leaf, clipMap_t *l
 	if ( !cm_noCurves->integer ) {
 #endif //BSPC
 		for ( k = 0 ; k < leaf->numLeafSurfaces ; k++ ) {
-			patch = local->surfaces[ local->leafsurfaces[ leaf->firstLeafSurface + k ] ];
+			surfnum = local->leafsurfaces[ leaf->firstLeafSurface + k ];
+			patch = local->surfaces[ surfnum ];
 			if ( !patch ) {
 				continue;
 			}
-			if ( patch->checkcount == local->checkcount ) {
-				continue;	// already checked this brush in another leaf
+			if ( !CM_FirstVisit( &tw->visited, surfnum + TRACE_VISITED_PATCH ) ) {
+				continue;	// already checked this patch in another leaf
 			}
-			patch->checkcount = local->checkcount;
 
 			if ( !(patch->contents & tw->contents)) {
 				continue;
@@ -376,13 +502,8 @@ void CM_PositionTest( traceWork_t *tw, trace_t &trace ) {
 	ll.lastLeaf = 0;
 	ll.overflowed = qfalse;
 
-	cmg.checkcount++;
-
 	CM_BoxLeafnums_r( &ll, 0 );
 
-
-	cmg.checkcount++;
-
 	// test the contents of the leafs
 	for (i=0 ; i < ll.count ; i++) {
 		CM_TestInLeaf( tw, trace, &cmg.leafs[leafs[i]], &cmg );
@@ -410,7 +531,7 @@ CM_TraceThroughPatch
 void CM_TraceThroughPatch( traceWork_t *tw, trace_t &trace, cPatch_t *patch ) {
 	float		oldFrac;
 
-	c_patch_traces++;
+	tw->patchTraces++;
 
 	oldFrac = trace.fraction;
 
@@ -422,6 +543,55 @@ void CM_TraceThroughPatch( traceWork_t *tw, trace_t &trace, cPatch_t *patch ) {
 	}
 }
 
+/*
+================
+CM_PlaneCrossing
+
+Moves the enter or leave fraction for a plane the trace crosses
+================
+*/
+static inline void CM_PlaneCrossing( traceWork_t *tw, cbrushside_t *side, float d1, float d2 )
+{
+	float			f;
+
+	if (d1 > d2)
+	{	// enter
+		f = (d1 - SURFACE_CLIP_EPSILON);
+		if ( f < 0.0f )
+		{
+			f = 0.0f;
+			if (f > tw->enterFrac)
+			{
+				tw->enterFrac = f;
+				tw->clipplane = side->plane;
+				tw->leadside = side;
+			}
+		}
+		else if (f > tw->enterFrac * (d1 - d2) )
+		{
+			tw->enterFrac = f / (d1 - d2);
+			tw->clipplane = side->plane;
+			tw->leadside = side;
+		}
+	}
+	else
+	{	// leave
+		f = (d1 + SURFACE_CLIP_EPSILON);
+		if ( f < (d1 - d2) )
+		{
+			f = 1.0f;
+			if (f < tw->leaveFrac)
+			{
+				tw->leaveFrac = f;
+			}
+		}
+		else if (f > tw->leaveFrac * (d1 - d2) )
+		{
+			tw->leaveFrac = f / (d1 - d2);
+		}
+	}
+}
+
 /*
 ================
 CM_PlaneCollision
@@ -432,7 +602,7 @@ CM_PlaneCollision
 
 bool CM_PlaneCollision(traceWork_t *tw, cbrushside_t *side)
 {
-	float			dist, f;
+	float			dist;
 	float			d1, d2;
 
 	cplane_t		*plane = side->plane;
@@ -466,44 +636,85 @@ bool CM_PlaneCollision(traceWork_t *tw, cbrushside_t *side)
 		return(true);
 	}
 	// crosses face
-	if (d1 > d2)
-	{	// enter
-		f = (d1 - SURFACE_CLIP_EPSILON);
-		if ( f < 0.0f )
+	CM_PlaneCrossing( tw, side, d1, d2 );
+	return(true);
+}
+
+#ifdef CM_SIMD
+/*
+================
+CM_BrushCollisionSIMD
+
+The plane loop of CM_TraceThroughBrush four planes at a time, returns false
+for a quick getout
+================
+*/
+static bool CM_BrushCollisionSIMD( traceWork_t *tw, cbrush_t *brush )
+{
+	const __m128	zero = _mm_setzero_ps();
+	const __m128	epsilon = _mm_set1_ps( SURFACE_CLIP_EPSILON );
+	const __m128	sx = _mm_set1_ps( tw->start[0] );
+	const __m128	sy = _mm_set1_ps( tw->start[1] );
+	const __m128	sz = _mm_set1_ps( tw->start[2] );
+	const __m128	ex = _mm_set1_ps( tw->end[0] );
+	const __m128	ey = _mm_set1_ps( tw->end[1] );
+	const __m128	ez = _mm_set1_ps( tw->end[2] );
+	const float		*block;
+	__m128			nx, ny, nz, dist, v1, v2;
+	float			d1[BRUSH_BLOCK_PLANES], d2[BRUSH_BLOCK_PLANES];
+	int				i, lane, crossing;
+
+	for ( i = 0, block = brush->planeBlocks ; i < brush->numsides ; i += BRUSH_BLOCK_PLANES, block += BRUSH_BLOCK_FLOATS )
+	{
+		nx = _mm_load_ps( block );
+		ny = _mm_load_ps( block + 4 );
+		nz = _mm_load_ps( block + 8 );
+
+		// adjust the plane distance appropriately for mins/maxs
+		dist = _mm_sub_ps( _mm_load_ps( block + 12 ), CM_BlockOffsetDot( tw, nx, ny, nz ) );
+
+		v1 = _mm_sub_ps( CM_BlockDot( sx, sy, sz, nx, ny, nz ), dist );
+		v2 = _mm_sub_ps( CM_BlockDot( ex, ey, ez, nx, ny, nz ), dist );
+
+		// if completely in front of any face, no intersection with the entire brush
+		if ( _mm_movemask_ps( _mm_and_ps( _mm_cmpgt_ps( v1, zero ),
+			_mm_or_ps( _mm_cmpge_ps( v2, epsilon ), _mm_cmpge_ps( v2, v1 ) ) ) ) )
 		{
-			f = 0.0f;
-			if (f > tw->enterFrac)
-			{
-				tw->enterFrac = f;
-				tw->clipplane = plane;
-				tw->leadside = side;
-			}
+			return false;
 		}
-		else if (f > tw->enterFrac * (d1 - d2) )
+
+		if ( _mm_movemask_ps( _mm_cmpgt_ps( v2, zero ) ) )
 		{
-			tw->enterFrac = f / (d1 - d2);
-			tw->clipplane = plane;
-			tw->leadside = side;
+			// endpoint is not in solid
+			tw->getout = true;
 		}
-	}
-	else
-	{	// leave
-		f = (d1 + SURFACE_CLIP_EPSILON);
-		if ( f < (d1 - d2) )
+		if ( _mm_movemask_ps( _mm_cmpgt_ps( v1, zero ) ) )
 		{
-			f = 1.0f;
-			if (f < tw->leaveFrac)
-			{
-				tw->leaveFrac = f;
-			}
+			// startpoint is not in solid
+			tw->startout = true;
 		}
-		else if (f > tw->leaveFrac * (d1 - d2) )
+
+		// planes it doesn't cross aren't relevant, the rest go one by one
+		crossing = ~_mm_movemask_ps( _mm_and_ps( _mm_cmple_ps( v1, zero ), _mm_cmple_ps( v2, zero ) ) ) & 0xf;
+		if ( !crossing )
 		{
-			tw->leaveFrac = f / (d1 - d2);
+			continue;
+		}
+
+		_mm_storeu_ps( d1, v1 );
+		_mm_storeu_ps( d2, v2 );
+		for ( lane = 0 ; lane < BRUSH_BLOCK_PLANES ; lane++ )
+		{
+			if ( crossing & ( 1 << lane ) )
+			{
+				CM_PlaneCrossing( tw, brush->sides + i + lane, d1[lane], d2[lane] );
+			}
 		}
 	}
-	return(true);
+
+	return true;
 }
+#endif
 
 /*
 ================
@@ -546,6 +757,16 @@ void CM_TraceThroughBrush( traceWork_t *tw, trace_t &trace, cbrush_t *brush, boo
 	// find the latest time the trace crosses a plane towards the interior
 	// and the earliest time the trace crosses a plane towards the exterior
 	//
+#ifdef CM_SIMD
+	if ( CM_UseBrushSIMD( brush ) )
+	{
+		if ( !CM_BrushCollisionSIMD( tw, brush ) )
+		{
+			return;
+		}
+	}
+	else
+#endif
 	for (i = 0; i < brush->numsides; i++)
 	{
 		side = brush->sides + i;
@@ -627,7 +848,7 @@ CM_TraceThroughLeaf
 */
 void CM_TraceThroughLeaf( traceWork_t *tw, trace_t &trace, clipMap_t *local, cLeaf_t *leaf ) {
 	int			k;
-	int			brushnum;
+	int			brushnum, surfnum;
 	cbrush_t	*b;
 	cPatch_t	*patch;
 
@@ -636,10 +857,9 @@ void CM_TraceThroughLeaf( traceWork_t *tw, trace_t &trace, clipMap_t *local, cLe
 		brushnum = local->leafbrushes[leaf->firstLeafBrush+k];
 
 		b = &local->brushes[brushnum];
-		if ( b->checkcount == local->checkcount ) {
+		if ( !CM_FirstVisit( &tw->visited, brushnum ) ) {
 			continue;	// already checked this brush in another leaf
 		}
-		b->checkcount = local->checkcount;
 
 		if ( !(b->contents & tw->contents) ) {
 			continue;
@@ -659,14 +879,14 @@ void CM_TraceThroughLeaf( traceWork_t *tw, trace_t &trace, clipMap_t *local, cLe
 	if ( !cm_noCurves->integer ) {
 #endif
 		for ( k = 0 ; k < leaf->numLeafSurfaces ; k++ ) {
-			patch = local->surfaces[ local->leafsurfaces[ leaf->firstLeafSurface + k ] ];
+			surfnum = local->leafsurfaces[ leaf->firstLeafSurface + k ];
+			patch = local->surfaces[ surfnum ];
 			if ( !patch ) {
 				continue;
 			}
-			if ( patch->checkcount == local->checkcount ) {
+			if ( !CM_FirstVisit( &tw->visited, surfnum + TRACE_VISITED_PATCH ) ) {
 				continue;	// already checked this patch in another leaf
 			}
-			patch->checkcount = local->checkcount;
 
 			if ( !(patch->contents & tw->contents) ) {
 				continue;
@@ -983,7 +1203,7 @@ CM_TraceToLeaf
 void CM_TraceToLeaf( traceWork_t *tw, trace_t &trace, cLeaf_t *leaf, clipMap_t *local )
 {
 	int			k;
-	int			brushnum;
+	int			brushnum, surfnum;
 	cbrush_t	*b;
 	cPatch_t	*patch;
 
@@ -993,11 +1213,10 @@ void CM_TraceToLeaf( traceWork_t *tw, trace_t &trace, cLeaf_t *leaf, clipMap_t *
 		brushnum = local->leafbrushes[leaf->firstLeafBrush + k];
 
 		b = &local->brushes[brushnum];
-		if ( b->checkcount == local->checkcount )
+		if ( !CM_FirstVisit( &tw->visited, brushnum ) )
 		{
 			continue;	// already checked this brush in another leaf
 		}
-		b->checkcount = local->checkcount;
 
 		if ( !(b->contents & tw->contents) )
 		{
@@ -1018,14 +1237,14 @@ void CM_TraceToLeaf( traceWork_t *tw, trace_t &trace, cLeaf_t *leaf, clipMap_t *
 	if ( !cm_noCurves->integer ) {
 #endif
 		for ( k = 0 ; k < leaf->numLeafSurfaces ; k++ ) {
-			patch = local->surfaces[ local->leafsurfaces[ leaf->firstLeafSurface + k ] ];
+			surfnum = local->leafsurfaces[ leaf->firstLeafSurface + k ];
+			patch = local->surfaces[ surfnum ];
 			if ( !patch ) {
 				continue;
 			}
-			if ( patch->checkcount == local->checkcount ) {
+			if ( !CM_FirstVisit( &tw->visited, surfnum + TRACE_VISITED_PATCH ) ) {
 				continue;	// already checked this patch in another leaf
 			}
-			patch->checkcount = local->checkcount;
 
 			if ( !(patch->contents & tw->contents) ) {
 				continue;
@@ -1050,8 +1269,10 @@ a smaller intercept fraction.
 ==================
 */
 void CM_TraceThroughTree( traceWork_t *tw, trace_t &trace, clipMap_t *local, int num, float p1f, float p2f, vec3_t p1, vec3_t p2) {
-	cNode_t		*node;
-	cplane_t	*plane;
+	const float	*normal;
+	const int	*children;
+	float		dist;
+	int			type;
 	float		t1, t2, offset;
 	float		frac, frac2;
 	float		idist;
@@ -1073,17 +1294,28 @@ void CM_TraceThroughTree( traceWork_t *tw, trace_t &trace, clipMap_t *local, int
 	// find the point distances to the seperating plane
 	// and the offset for the size of the box
 	//
-	node = local->nodes + num;
-	plane = node->plane;
+	if ( tw->flatNodes ) {
+		const cFlatNode_t *node = tw->flatNodes + num;
+		normal = node->normal;
+		dist = node->dist;
+		type = node->type;
+		children = node->children;
+	} else {
+		const cNode_t *node = local->nodes + num;
+		normal = node->plane->normal;
+		dist = node->plane->dist;
+		type = node->plane->type;
+		children = node->children;
+	}
 
 	// adjust the plane distance appropriately for mins/maxs
-	if ( plane->type < 3 ) {
-		t1 = p1[plane->type] - plane->dist;
-		t2 = p2[plane->type] - plane->dist;
-		offset = tw->extents[plane->type];
+	if ( type < 3 ) {
+		t1 = p1[type] - dist;
+		t2 = p2[type] - dist;
+		offset = tw->extents[type];
 	} else {
-		t1 = DotProduct (plane->normal, p1) - plane->dist;
-		t2 = DotProduct (plane->normal, p2) - plane->dist;
+		t1 = DotProduct (normal, p1) - dist;
+		t2 = DotProduct (normal, p2) - dist;
 		if ( tw->isPoint ) {
 			offset = 0;
 		} else {
@@ -1091,9 +1323,9 @@ void CM_TraceThroughTree( traceWork_t *tw, trace_t &trace, clipMap_t *local, int
 			// an axial brush right behind a slanted bsp plane
 			// will poke through when expanded, so adjust
 			// by sqrt(3)
-			offset = fabs(tw->extents[0]*plane->normal[0]) +
-				fabs(tw->extents[1]*plane->normal[1]) +
-				fabs(tw->extents[2]*plane->normal[2]);
+			offset = fabs(tw->extents[0]*normal[0]) +
+				fabs(tw->extents[1]*normal[1]) +
+				fabs(tw->extents[2]*normal[2]);
 
 			offset *= 2;
 			offset = tw->maxOffset;
@@ -1105,11 +1337,11 @@ void CM_TraceThroughTree( traceWork_t *tw, trace_t &trace, clipMap_t *local, int
 
 	// see which sides we need to consider
 	if ( t1 >= offset + 1 && t2 >= offset + 1 ) {
-		CM_TraceThroughTree( tw, trace, local, node->children[0], p1f, p2f, p1, p2 );
+		CM_TraceThroughTree( tw, trace, local, children[0], p1f, p2f, p1, p2 );
 		return;
 	}
 	if ( t1 < -offset - 1 && t2 < -offset - 1 ) {
-		CM_TraceThroughTree( tw, trace, local, node->children[1], p1f, p2f, p1, p2 );
+		CM_TraceThroughTree( tw, trace, local, children[1], p1f, p2f, p1, p2 );
 		return;
 	}
 
@@ -1144,7 +1376,7 @@ void CM_TraceThroughTree( traceWork_t *tw, trace_t &trace, clipMap_t *local, int
 	mid[1] = p1[1] + frac*(p2[1] - p1[1]);
 	mid[2] = p1[2] + frac*(p2[2] - p1[2]);
 
-	CM_TraceThroughTree( tw, trace, local, node->children[side], p1f, midf, p1, mid );
+	CM_TraceThroughTree( tw, trace, local, children[side], p1f, midf, p1, mid );
 
 
 	// go past the node
@@ -1161,7 +1393,7 @@ void CM_TraceThroughTree( traceWork_t *tw, trace_t &trace, clipMap_t *local, int
 	mid[1] = p1[1] + frac2*(p2[1] - p1[1]);
 	mid[2] = p1[2] + frac2*(p2[2] - p1[2]);
 
-	CM_TraceThroughTree( tw, trace, local, node->children[side^1], midf, p2f, mid, p2 );
+	CM_TraceThroughTree( tw, trace, local, children[side^1], midf, p2f, mid, p2 );
 }
 
 void CM_CalcExtents(const vec3_t start, const vec3_t end, const traceWork_t *tw, vec3pair_t bounds)
@@ -1202,11 +1434,13 @@ void CM_Trace( trace_t *trace, const vec3_t start, const vec3_t end,
 
 	cmod = CM_ClipHandleToModel( model, &local );
 
-	local->checkcount++;		// for multi-check avoidance
+	CM_STAT_ADD( c_traces, 1 );		// for statistics, may be zeroed
 
-	c_traces++;				// for statistics, may be zeroed
+	if ( cm_recordingTraces ) {
+		CM_RecordTrace( start, end, mins, maxs, model, origin, brushmask, capsule, sphere );
+	}
 
-	// fill in a default trace
+	// fill in a default trace, which also empties the visited set
 	Com_Memset( &tw, 0, sizeof(tw) );
 	memset(trace, 0, sizeof(*trace));
 	trace->fraction = 1;	// assume it goes the entire distance until shown otherwise
@@ -1215,6 +1449,7 @@ void CM_Trace( trace_t *trace, const vec3_t start, const vec3_t end,
 	if (!local->numNodes) {
 		return;	// map not loaded, shouldn't happen
 	}
+	tw.flatNodes = CM_FlatNodes( local );
 
 	// allow NULL to be passed in for 0,0,0
 	if ( !mins ) {
@@ -1416,6 +1651,10 @@ void CM_Trace( trace_t *trace, const vec3_t start, const vec3_t end,
 		}
 	}
 
+	if ( tw.patchTraces ) {
+		CM_STAT_ADD( c_patch_traces, tw.patchTraces );
+	}
+
 	// generate endpos from the original, unmodified start/end
 	if ( trace->fraction == 1 ) {
 		VectorCopy (end, trace->endpos);
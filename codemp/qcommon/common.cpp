@@ -712,6 +712,11 @@ sysEvent_t	Com_GetRealEvent( void ) {
 	int			r;
 	sysEvent_t	ev;
 
+	// a server replaying a packet capture takes the place of the system
+	if ( SV_ReplayGetEvent( &ev ) ) {
+		return ev;
+	}
+
 	// either get an event from the system or the journal file
 	if ( com_journal->integer == 2 ) {
 		r = FS_Read( &ev, sizeof(ev), com_journalFile );
@@ -856,6 +861,7 @@ int Com_EventLoop( void ) {
 			// manually send packet events for the loopback channel
 			while ( NET_GetLoopPacket( NS_CLIENT, &evFrom, &buf ) ) {
 				CL_PacketEvent( evFrom, &buf );
+				MSG_Init( &buf, bufData, sizeof( bufData ) );
 			}
 
 			while ( NET_GetLoopPacket( NS_SERVER, &evFrom, &buf ) ) {
@@ -863,6 +869,7 @@ int Com_EventLoop( void ) {
 				if ( com_sv_running->integer ) {
 					Com_RunAndTimeServerPacket( &evFrom, &buf );
 				}
+				MSG_Init( &buf, bufData, sizeof( bufData ) );
 			}
 
 			// check for a Web API request to handle
@@ -931,6 +938,9 @@ int Com_EventLoop( void ) {
 			} else {
 				CL_PacketEvent( evFrom, &buf );
 			}
+
+			// a reassembled message is read from the netchan's own buffer
+			MSG_Init( &buf, bufData, sizeof( bufData ) );
 			break;
 		}
 
@@ -1271,6 +1281,8 @@ void Com_Init( char *commandLine ) {
 		Com_RandomBytes( (byte*)&qport, sizeof(int) );
 		Netchan_Init( qport & 0xffff );	// pick a port value that should be nice and random
 
+		CM_InitCommands();
+
 		VM_Init();
 		SV_Init();
 
@@ -1509,6 +1521,7 @@ void Com_Frame( void ) {
 			msec = com_frameTime - lastTime;
 		} while ( msec < minMsec );
 		Cbuf_Execute ();
+		CM_TraceRecordFrame();
 
 		lastTime = com_frameTime;
 
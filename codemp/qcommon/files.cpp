@@ -21,6 +21,10 @@
 	#include <unistd.h>
 #endif
 
+#ifndef _WIN32
+	#include <sys/mman.h>
+#endif
+
 /*
 =============================================================================
 
@@ -241,6 +245,7 @@ typedef struct fileHandleData_s {
 	int			zipFileLen;
 	qboolean	zipFile;
 	char		name[MAX_ZPATH];
+	char		ospath[MAX_OSPATH];		// of the file, or the pk3 it's in, for FS_FileLocation
 } fileHandleData_t;
 
 static fileHandleData_t	fsh[MAX_FILE_HANDLES];
@@ -871,6 +876,94 @@ int FS_SV_FOpenFileRead( const char *filename, fileHandle_t *fp ) {
 	return 0;
 }
 
+/*
+===========
+FS_SV_MapFile
+
+Maps a file from the same places FS_SV_FOpenFileRead searches into
+read-only memory. Uses mmap where it can, otherwise reads the whole
+file in. Returns the length, or -1 if the file wasn't found
+===========
+*/
+int FS_SV_MapFile( const char *filename, void **buffer, qboolean *mapped ) {
+	fileHandle_t	f;
+	int				len;
+
+	*buffer = NULL;
+	*mapped = qfalse;
+
+	len = FS_SV_FOpenFileRead( filename, &f );
+	if ( !f ) {
+		return -1;
+	}
+
+	if ( len > 0 ) {
+#ifndef _WIN32
+		// the mapping outlives the handle
+		void *map = mmap( NULL, len, PROT_READ, MAP_SHARED, fileno( FS_FileForHandle( f ) ), 0 );
+		if ( map != MAP_FAILED ) {
+			*buffer = map;
+			*mapped = qtrue;
+			FS_FCloseFile( f );
+			return len;
+		}
+#endif
+		*buffer = Z_Malloc( len, TAG_DOWNLOAD, qfalse );
+		if ( FS_Read( *buffer, len, f ) != len ) {
+			Z_Free( *buffer );
+			*buffer = NULL;
+			len = -1;
+		}
+	}
+
+	FS_FCloseFile( f );
+	return len;
+}
+
+/*
+===========
+FS_SV_UnmapFile
+===========
+*/
+void FS_SV_UnmapFile( void *buffer, int len, qboolean mapped ) {
+	if ( !buffer ) {
+		return;
+	}
+#ifndef _WIN32
+	if ( mapped ) {
+		munmap( buffer, len );
+		return;
+	}
+#endif
+	Z_Free( buffer );
+}
+
+#ifndef _WIN32
+/*
+===========
+FS_SV_OpenFileDescriptor
+
+Opens a file from the same places FS_SV_FOpenFileRead searches and
+returns a raw descriptor of its own, for code that hands files straight
+to the OS. Returns -1 if the file wasn't found. The caller closes it
+===========
+*/
+int FS_SV_OpenFileDescriptor( const char *filename, int *len ) {
+	fileHandle_t	f;
+	int				fd;
+
+	*len = FS_SV_FOpenFileRead( filename, &f );
+	if ( !f ) {
+		return -1;
+	}
+
+	fd = dup( fileno( FS_FileForHandle( f ) ) );
+	FS_FCloseFile( f );
+
+	return fd;
+}
+#endif
+
 /*
 ===========
 FS_SV_Rename
@@ -970,6 +1063,24 @@ void FS_FCloseFile( fileHandle_t f ) {
 	Com_Memset( &fsh[f], 0, sizeof( fsh[f] ) );
 }
 
+/*
+===========
+FS_DetachFile
+
+Frees the handle of a file opened for writing and hands its stdio
+stream to the caller, who must fclose it. Lets a writer thread own
+the file without touching the handle table
+===========
+*/
+FILE *FS_DetachFile( fileHandle_t f ) {
+	FILE	*file;
+
+	file = FS_FileForHandle( f );
+	Com_Memset( &fsh[f], 0, sizeof( fsh[f] ) );
+
+	return file;
+}
+
 /*
 ===========
 FS_FOpenFileWrite
@@ -1368,6 +1479,7 @@ long FS_FOpenFileRead( const char *filename, fileHandle_t *file, qboolean unique
 							fsh[*file].handleFiles.file.z = pak->handle;
 						}
 						Q_strncpyz( fsh[*file].name, filename, sizeof( fsh[*file].name ) );
+						Q_strncpyz( fsh[*file].ospath, pak->pakFilename, sizeof( fsh[*file].ospath ) );
 						fsh[*file].zipFile = qtrue;
 
 						// set the file position in the zip file (also sets the current file info)
@@ -1438,6 +1550,7 @@ long FS_FOpenFileRead( const char *filename, fileHandle_t *file, qboolean unique
 				if ( !fsh[*file].handleFiles.file.o ) {
 					continue;
 				}
+				Q_strncpyz( fsh[*file].ospath, netpath, sizeof( fsh[*file].ospath ) );
 
 				if ( !FS_IsExt( filename, ".cfg", l ) &&		// for config files
 					!FS_IsExt( filename, ".fcf", l ) &&		// force configuration files
@@ -2008,6 +2121,134 @@ void FS_FreeFile( void *buffer ) {
 	Z_Free( buffer );
 }
 
+/*
+=============
+FS_MapFile
+
+Like FS_SV_MapFile, but for a qpath found on the game search path. Loose
+files and files stored uncompressed in a pk3 are mapped read-only in
+place; anything else is read into zone memory. Returns the length, or -1
+if the file wasn't found
+=============
+*/
+long FS_MapFile( const char *qpath, void **buffer, qboolean *mapped ) {
+	fileHandle_t	f;
+	long			len;
+
+	*buffer = NULL;
+	*mapped = qfalse;
+
+	len = FS_FOpenFileRead( qpath, &f, qfalse );
+	if ( !f ) {
+		return -1;
+	}
+
+	if ( len > 0 ) {
+#ifndef _WIN32
+		FILE	*fp = NULL;
+		long	offset = 0;
+
+		if ( !fsh[f].zipFile ) {
+			fp = fsh[f].handleFiles.file.o;
+		} else {
+			unz_s						*zfi = (unz_s *)fsh[f].handleFiles.file.z;
+			file_in_zip_read_info_s		*info = zfi->pfile_in_zip_read;
+
+			// only stored entries are laid out in the pk3 the way they are on disk
+			if ( info && info->compression_method == 0 && !zfi->encrypted ) {
+				fp = (FILE *)zfi->filestream;
+				offset = info->pos_in_zipfile + info->byte_before_the_zipfile;
+			}
+		}
+
+		if ( fp ) {
+			// mmap wants a page aligned offset, FS_UnmapFile rounds the pointer back down
+			long pageOffset = offset % sysconf( _SC_PAGESIZE );
+			void *map = mmap( NULL, len + pageOffset, PROT_READ, MAP_SHARED, fileno( fp ), offset - pageOffset );
+			if ( map != MAP_FAILED ) {
+				*buffer = (byte *)map + pageOffset;
+				*mapped = qtrue;
+				FS_FCloseFile( f );
+				if ( fs_debug->integer ) {
+					Com_Printf( "FS_MapFile: %s (%ld bytes mapped)\n", qpath, len );
+				}
+				return len;
+			}
+		}
+#endif
+		*buffer = Z_Malloc( len, TAG_FILESYS, qfalse );
+		if ( FS_Read( *buffer, len, f ) != len ) {
+			Z_Free( *buffer );
+			*buffer = NULL;
+			len = -1;
+		}
+	}
+
+	FS_FCloseFile( f );
+	return len;
+}
+
+/*
+=============
+FS_FileLocation
+
+Where a qpath's bytes sit on disk, for code that reads them without the
+filesystem, like the map preloader's thread: the OS path of the file or
+of the pk3 holding it, and the offset and length of its data there.
+stored is qfalse for pk3 entries that are compressed. Returns the length
+on disk, or -1 if the file wasn't found. Like any open, this marks the
+pk3 as referenced
+=============
+*/
+long FS_FileLocation( const char *qpath, char *ospath, int size, long *offset, qboolean *stored ) {
+	fileHandle_t	f;
+	long			len;
+
+	*offset = 0;
+	*stored = qtrue;
+
+	len = FS_FOpenFileRead( qpath, &f, qfalse );
+	if ( !f ) {
+		return -1;
+	}
+
+	Q_strncpyz( ospath, fsh[f].ospath, size );
+	if ( fsh[f].zipFile ) {
+		unz_s						*zfi = (unz_s *)fsh[f].handleFiles.file.z;
+		file_in_zip_read_info_s		*info = zfi->pfile_in_zip_read;
+
+		if ( !info ) {
+			FS_FCloseFile( f );
+			return -1;
+		}
+		*offset = info->pos_in_zipfile + info->byte_before_the_zipfile;
+		*stored = (qboolean)( info->compression_method == 0 && !zfi->encrypted );
+		len = info->rest_read_compressed;
+	}
+
+	FS_FCloseFile( f );
+	return len;
+}
+
+/*
+=============
+FS_UnmapFile
+=============
+*/
+void FS_UnmapFile( void *buffer, long len, qboolean mapped ) {
+	if ( !buffer ) {
+		return;
+	}
+#ifndef _WIN32
+	if ( mapped ) {
+		long pageOffset = (intptr_t)buffer % sysconf( _SC_PAGESIZE );
+		munmap( (byte *)buffer - pageOffset, len + pageOffset );
+		return;
+	}
+#endif
+	Z_Free( buffer );
+}
+
 /*
 ============
 FS_WriteFile
@@ -72,12 +72,14 @@ void Netchan_Setup( netsrc_t sock, netchan_t *chan, netadr_t adr, int qport ) {
 =================
 Netchan_TransmitNextFragment
 
-Send one fragment of the current message
+Send one fragment of the current message. The header is written on its
+own and the fragment goes out straight from the unsent buffer.
 =================
 */
 void Netchan_TransmitNextFragment( netchan_t *chan ) {
 	msg_t		send;
-	byte		send_buf[MAX_PACKETLEN];
+	byte		send_buf[PACKET_HEADER];
+	netIovec_t	iov[2];
 	int			fragmentLength;
 
 	// write the packet header
@@ -98,15 +100,18 @@ void Netchan_TransmitNextFragment( netchan_t *chan ) {
 
 	MSG_WriteShort( &send, chan->unsentFragmentStart );
 	MSG_WriteShort( &send, fragmentLength );
-	MSG_WriteData( &send, chan->unsentBuffer + chan->unsentFragmentStart, fragmentLength );
 
 	// send the datagram
-	NET_SendPacket( chan->sock, send.cursize, send.data, chan->remoteAddress );
+	iov[0].data = send.data;
+	iov[0].length = send.cursize;
+	iov[1].data = chan->unsentBuffer + chan->unsentFragmentStart;
+	iov[1].length = fragmentLength;
+	NET_SendPacketv( chan->sock, iov, 2, chan->remoteAddress );
 
 	if ( showpackets->integer ) {
 		Com_Printf ("%s send %4i : s=%i fragment=%i,%i\n"
 			, netsrcString[ chan->sock ]
-			, send.cursize
+			, send.cursize + fragmentLength
 			, chan->outgoingSequence - 1
 			, chan->unsentFragmentStart, fragmentLength);
 	}
@@ -130,11 +135,13 @@ Netchan_Transmit
 
 Sends a message to a connection, fragmenting if necessary
 A 0 length will still generate a packet.
+A message built in Netchan_MessageBuffer is fragmented from where it is.
 ================
 */
 void Netchan_Transmit( netchan_t *chan, int length, const byte *data ) {
 	msg_t		send;
-	byte		send_buf[MAX_PACKETLEN];
+	byte		send_buf[PACKET_HEADER];
+	netIovec_t	iov[2];
 
 	if ( length > MAX_MSGLEN ) {
 		Com_Error( ERR_DROP, "Netchan_Transmit: length = %i", length );
@@ -150,7 +157,9 @@ void Netchan_Transmit( netchan_t *chan, int length, const byte *data ) {
 	{
 		chan->unsentFragments = qtrue;
 		chan->unsentLength = length;
-		Com_Memcpy( chan->unsentBuffer, data, length );
+		if ( data != chan->unsentBuffer ) {
+			Com_Memcpy( chan->unsentBuffer, data, length );
+		}
 
 		// only send the first fragment now
 		Netchan_TransmitNextFragment( chan );
@@ -169,20 +178,39 @@ void Netchan_Transmit( netchan_t *chan, int length, const byte *data ) {
 		MSG_WriteShort( &send, qport->integer );
 	}
 
-	MSG_WriteData( &send, data, length );
-
 	// send the datagram
-	NET_SendPacket( chan->sock, send.cursize, send.data, chan->remoteAddress );
+	iov[0].data = send.data;
+	iov[0].length = send.cursize;
+	iov[1].data = data;
+	iov[1].length = length;
+	NET_SendPacketv( chan->sock, iov, 2, chan->remoteAddress );
 
 	if ( showpackets->integer ) {
 		Com_Printf( "%s send %4i : s=%i ack=%i\n"
 			, netsrcString[ chan->sock ]
-			, send.cursize
+			, send.cursize + length
 			, chan->outgoingSequence - 1
 			, chan->incomingSequence );
 	}
 }
 
+/*
+=================
+Netchan_MessageBuffer
+
+Where to build the next message for this channel. While no fragments
+are waiting that is the unsent buffer itself, so if the message turns
+out big enough to fragment, Netchan_Transmit doesn't have to copy it.
+Otherwise it is the caller's scratch buffer of MAX_MSGLEN.
+=================
+*/
+byte *Netchan_MessageBuffer( netchan_t *chan, byte *scratch ) {
+	if ( chan->unsentFragments ) {
+		return scratch;
+	}
+	return chan->unsentBuffer;
+}
+
 /*
 =================
 Netchan_Process
@@ -190,9 +218,11 @@ Netchan_Process
 Returns qfalse if the message should not be processed due to being
 out of order or a fragment.
 
-Msg must be large enough to hold MAX_MSGLEN, because if this is the
-final fragment of a multi-part message, the entire thing will be
-copied out.
+Fragments are gathered behind a copy of the sequence number in the
+channel's fragment buffer. When the final one arrives msg is pointed at
+that buffer instead of copying the message back out, so it stays valid
+until the next fragment for this channel; callers that reuse msg must
+MSG_Init it again before the next packet.
 =================
 */
 qboolean Netchan_Process( netchan_t *chan, msg_t *msg ) {
@@ -304,9 +334,9 @@ qboolean Netchan_Process( netchan_t *chan, msg_t *msg ) {
 			return qfalse;
 		}
 
-		// copy the fragment to the fragment buffer
+		// copy the fragment to the fragment buffer, behind room for the sequence number
 		if ( fragmentLength < 0 || msg->readcount + fragmentLength > msg->cursize ||
-			chan->fragmentLength + fragmentLength > (int)sizeof( chan->fragmentBuffer ) ) {
+			4 + chan->fragmentLength + fragmentLength > (int)sizeof( chan->fragmentBuffer ) ) {
 			if ( showdrop->integer || showpackets->integer ) {
 				Com_Printf ("%s:illegal fragment length\n"
 				, NET_AdrToString (chan->remoteAddress ) );
@@ -314,7 +344,7 @@ qboolean Netchan_Process( netchan_t *chan, msg_t *msg ) {
 			return qfalse;
 		}
 
-		Com_Memcpy( chan->fragmentBuffer + chan->fragmentLength,
+		Com_Memcpy( chan->fragmentBuffer + 4 + chan->fragmentLength,
 			msg->data + msg->readcount, fragmentLength );
 
 		chan->fragmentLength += fragmentLength;
@@ -324,19 +354,13 @@ qboolean Netchan_Process( netchan_t *chan, msg_t *msg ) {
 			return qfalse;
 		}
 
-		if ( chan->fragmentLength+4 > msg->maxsize ) {
-			Com_Printf( "%s:fragmentLength %i > msg->maxsize\n"
-				, NET_AdrToString (chan->remoteAddress ),
-				chan->fragmentLength+4 );
-			return qfalse;
-		}
-
-		// copy the full message over the partial fragment
+		// read the full message from where it was reassembled
 
 		// make sure the sequence number is still there
-		*(int *)msg->data = LittleLong( sequence );
+		*(int *)chan->fragmentBuffer = LittleLong( sequence );
 
-		Com_Memcpy( msg->data + 4, chan->fragmentBuffer, chan->fragmentLength );
+		msg->data = chan->fragmentBuffer;
+		msg->maxsize = sizeof( chan->fragmentBuffer );
 		msg->cursize = chan->fragmentLength + 4;
 		chan->fragmentLength = 0;
 		msg->readcount = 4;	// past the sequence number
@@ -534,6 +558,39 @@ void NET_SendLoopPacket (netsrc_t sock, int length, const void *data, netadr_t t
 //=============================================================================
 
 
+/*
+===============
+NET_SendPacketv
+
+Sends one datagram gathered from several pieces, so the netchan can send a
+header and a payload without first copying them together. Only the paths
+that need the datagram in one piece (loopback, replays) build it here.
+================
+*/
+void NET_SendPacketv( netsrc_t sock, const netIovec_t *iov, int numIov, netadr_t to ) {
+	byte	buf[MAX_PACKETLEN + PACKET_HEADER];
+	int		i, length;
+
+	if ( to.type == NA_BOT || to.type == NA_BAD ) {
+		return;
+	}
+
+	if ( to.type == NA_LOOPBACK || ( sock == NS_SERVER && SV_Replaying() ) ) {
+		length = 0;
+		for ( i = 0 ; i < numIov ; i++ ) {
+			if ( length + iov[i].length > (int)sizeof( buf ) ) {
+				Com_Error( ERR_DROP, "NET_SendPacketv: %i byte datagram", length + iov[i].length );
+			}
+			Com_Memcpy( buf + length, iov[i].data, iov[i].length );
+			length += iov[i].length;
+		}
+		NET_SendPacket( sock, length, buf, to );
+		return;
+	}
+
+	Sys_SendPacketv( iov, numIov, to );
+}
+
 void NET_SendPacket( netsrc_t sock, int length, const void *data, netadr_t to ) {
 
 	// sequenced packets are shown in netchan, so just show oob
@@ -551,6 +608,9 @@ void NET_SendPacket( netsrc_t sock, int length, const void *data, netadr_t to )
 	if ( to.type == NA_BAD ) {
 		return;
 	}
+	if ( sock == NS_SERVER && SV_ReplayOutput( length, data ) ) {
+		return;
+	}
 
 	Sys_SendPacket( length, data, to );
 }
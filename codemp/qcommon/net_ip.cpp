@@ -47,6 +47,15 @@
 #include <sys/filio.h>
 #endif
 
+#ifdef __linux__
+	// recvmmsg/sendmmsg let us move many datagrams per syscall
+	#define NET_BATCHED_IO
+	// epoll + timerfd let NET_Sleep wake on a sub-millisecond deadline
+	#define NET_TIMER_SLEEP
+	#include <sys/epoll.h>
+	#include <sys/timerfd.h>
+#endif
+
 typedef int SOCKET;
 #define INVALID_SOCKET                -1
 #define SOCKET_ERROR                        -1
@@ -71,11 +80,21 @@ static cvar_t	*net_socksPassword;
 static cvar_t	*net_ip;
 static cvar_t	*net_port;
 
+static cvar_t	*net_batchIO;
+
 static struct sockaddr	socksRelayAddr;
 
 static SOCKET	ip_socket = INVALID_SOCKET;
 static SOCKET	socks_socket = INVALID_SOCKET;
 
+#ifdef NET_TIMER_SLEEP
+static int		net_epollFd = -1;
+static int		net_timerFd = -1;
+static SOCKET	net_epollSocket = INVALID_SOCKET;	// socket currently in the epoll set
+static qboolean	net_epollStdin = qfalse;
+static qboolean	net_timerFailed = qfalse;
+#endif
+
 #define	MAX_IPS		16
 static	int		numIP;
 static	byte	localIP[MAX_IPS][4];
@@ -211,17 +230,119 @@ qboolean Sys_StringToAdr( const char *s, netadr_t *a ) {
 
 //=============================================================================
 
+#ifdef _DEBUG
+int	recvfromCount;
+#endif
+
 /*
 ==================
-Sys_GetPacket
+NET_ReceivedPacket
 
-Never called by the game logic, just the system event queing
+Translates a datagram that has been read off the socket into a netadr/msg pair,
+unwrapping the SOCKS relay header if needed
 ==================
 */
+static qboolean NET_ReceivedPacket( struct sockaddr *from, socklen_t fromlen, int ret, netadr_t *net_from, msg_t *net_message ) {
+	memset( ((struct sockaddr_in *)from)->sin_zero, 0, 8 );
+
+	if ( usingSocks && memcmp( from, &socksRelayAddr, fromlen ) == 0 ) {
+		if ( ret < 10 || net_message->data[0] != 0 || net_message->data[1] != 0 || net_message->data[2] != 0 || net_message->data[3] != 1 ) {
+			return qfalse;
+		}
+		net_from->type = NA_IP;
+		net_from->ip[0] = net_message->data[4];
+		net_from->ip[1] = net_message->data[5];
+		net_from->ip[2] = net_message->data[6];
+		net_from->ip[3] = net_message->data[7];
+		net_from->port = *(short *)&net_message->data[8];
+		net_message->readcount = 10;
+	}
+	else {
+		SockadrToNetadr( from, net_from );
+		net_message->readcount = 0;
+	}
+
+	if( ret >= net_message->maxsize ) {
+		Com_Printf( "Oversize packet from %s\n", NET_AdrToString (*net_from) );
+		return qfalse;
+	}
+
+	net_message->cursize = ret;
+	return qtrue;
+}
+
+#ifdef NET_BATCHED_IO
+/*
+==================
+Batched receive ring
+
+Sys_GetPacket drains up to NET_RECV_BATCH datagrams from the socket with a single
+recvmmsg call and then hands them out one at a time until the ring is empty.
+==================
+*/
+#define	NET_RECV_BATCH		32
+
+typedef struct netRecvRing_s {
+	int					head;		// next datagram to hand out
+	int					count;		// datagrams received by the last recvmmsg
+	struct mmsghdr		hdrs[NET_RECV_BATCH];
+	struct iovec		iovecs[NET_RECV_BATCH];
+	struct sockaddr		addrs[NET_RECV_BATCH];
+	byte				data[NET_RECV_BATCH][MAX_MSGLEN];
+} netRecvRing_t;
+
+static netRecvRing_t	recvRing;
+
+/*
+==================
+NET_FillRecvRing
+
+Returns qfalse if nothing could be read
+==================
+*/
+static qboolean NET_FillRecvRing( void ) {
+	int ret, err;
+
+	for ( int i = 0; i < NET_RECV_BATCH; i++ ) {
+		recvRing.iovecs[i].iov_base = recvRing.data[i];
+		recvRing.iovecs[i].iov_len = sizeof( recvRing.data[i] );
+
+		memset( &recvRing.hdrs[i], 0, sizeof( recvRing.hdrs[i] ) );
+		recvRing.hdrs[i].msg_hdr.msg_name = &recvRing.addrs[i];
+		recvRing.hdrs[i].msg_hdr.msg_namelen = sizeof( recvRing.addrs[i] );
+		recvRing.hdrs[i].msg_hdr.msg_iov = &recvRing.iovecs[i];
+		recvRing.hdrs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	recvRing.head = recvRing.count = 0;
+
 #ifdef _DEBUG
-int	recvfromCount;
+	recvfromCount++;		// performance check
+#endif
+	ret = recvmmsg( ip_socket, recvRing.hdrs, NET_RECV_BATCH, MSG_DONTWAIT, NULL );
+
+	if ( ret == SOCKET_ERROR ) {
+		err = socketError;
+
+		if( err == EAGAIN || err == ECONNRESET )
+			return qfalse;
+
+		Com_Printf( "NET_GetPacket: %s\n", NET_ErrorString() );
+		return qfalse;
+	}
+
+	recvRing.count = ret;
+	return (qboolean)(ret > 0);
+}
 #endif
 
+/*
+==================
+Sys_GetPacket
+
+Never called by the game logic, just the system event queing
+==================
+*/
 qboolean Sys_GetPacket( netadr_t *net_from, msg_t *net_message ) {
 	int ret, err;
 	socklen_t fromlen;
@@ -231,6 +352,28 @@ qboolean Sys_GetPacket( netadr_t *net_from, msg_t *net_message ) {
 		return qfalse;
 	}
 
+#ifdef NET_BATCHED_IO
+	if ( recvRing.head < recvRing.count || (net_batchIO && net_batchIO->integer) ) {
+		while ( recvRing.head < recvRing.count || NET_FillRecvRing() ) {
+			struct mmsghdr *hdr = &recvRing.hdrs[recvRing.head];
+			byte *data = recvRing.data[recvRing.head];
+
+			recvRing.head++;
+
+			ret = hdr->msg_len;
+			if ( ret > net_message->maxsize || (hdr->msg_hdr.msg_flags & MSG_TRUNC) ) {
+				ret = net_message->maxsize;	// reported as oversize below
+			}
+			Com_Memcpy( net_message->data, data, ret );
+
+			if ( NET_ReceivedPacket( (struct sockaddr *)hdr->msg_hdr.msg_name, hdr->msg_hdr.msg_namelen, ret, net_from, net_message ) ) {
+				return qtrue;
+			}
+		}
+		return qfalse;
+	}
+#endif
+
 	fromlen = sizeof( from );
 #ifdef _DEBUG
 	recvfromCount++;		// performance check
@@ -247,37 +390,152 @@ qboolean Sys_GetPacket( netadr_t *net_from, msg_t *net_message ) {
 		return qfalse;
 	}
 
-	memset( ((struct sockaddr_in *)&from)->sin_zero, 0, 8 );
+	return NET_ReceivedPacket( &from, fromlen, ret, net_from, net_message );
+}
 
-	if ( usingSocks && memcmp( &from, &socksRelayAddr, fromlen ) == 0 ) {
-		if ( ret < 10 || net_message->data[0] != 0 || net_message->data[1] != 0 || net_message->data[2] != 0 || net_message->data[3] != 1 ) {
-			return qfalse;
+//=============================================================================
+
+static char socksBuf[4096];
+
+/*
+==================
+NET_SendError
+
+Reports a failed send, wouldblock and broadcast failures are silent
+==================
+*/
+static void NET_SendError( netadrtype_t type ) {
+	int err = socketError;
+
+	// wouldblock is silent
+	if( err == EAGAIN ) {
+		return;
+	}
+
+	// some PPP links do not allow broadcasts and return an error
+	if( err == EADDRNOTAVAIL && type == NA_BROADCAST ) {
+		return;
+	}
+
+	Com_Printf( "NET_SendPacket: %s\n", NET_ErrorString() );
+}
+
+#ifdef NET_BATCHED_IO
+/*
+==================
+Batched send queue
+
+While a batch is open, datagrams passed to Sys_SendPacket are copied into the queue
+and pushed out with sendmmsg when the batch is flushed or the queue fills up.
+==================
+*/
+#define	NET_SEND_BATCH			64
+#define	NET_SEND_PACKETLEN		1400	// larger datagrams bypass the queue
+
+typedef struct netSendQueue_s {
+	qboolean			active;
+	int					count;
+	netadrtype_t		types[NET_SEND_BATCH];
+	struct mmsghdr		hdrs[NET_SEND_BATCH];
+	struct iovec		iovecs[NET_SEND_BATCH];
+	struct sockaddr		addrs[NET_SEND_BATCH];
+	byte				data[NET_SEND_BATCH][NET_SEND_PACKETLEN];
+} netSendQueue_t;
+
+static netSendQueue_t	sendQueue;
+
+/*
+==================
+NET_FlushSendQueue
+==================
+*/
+static void NET_FlushSendQueue( void ) {
+	int sent = 0;
+
+	while ( sent < sendQueue.count && ip_socket != INVALID_SOCKET ) {
+		int ret = sendmmsg( ip_socket, &sendQueue.hdrs[sent], sendQueue.count - sent, 0 );
+
+		if ( ret == SOCKET_ERROR ) {
+			// the send buffer is full, drop the rest as a single sendto would
+			if ( socketError == EAGAIN ) {
+				break;
+			}
+
+			// the datagram at the head of the queue failed, skip it and carry on
+			NET_SendError( sendQueue.types[sent] );
+			sent++;
+			continue;
 		}
-		net_from->type = NA_IP;
-		net_from->ip[0] = net_message->data[4];
-		net_from->ip[1] = net_message->data[5];
-		net_from->ip[2] = net_message->data[6];
-		net_from->ip[3] = net_message->data[7];
-		net_from->port = *(short *)&net_message->data[8];
-		net_message->readcount = 10;
+
+		sent += ret;
 	}
-	else {
-		SockadrToNetadr( &from, net_from );
-		net_message->readcount = 0;
+
+	sendQueue.count = 0;
+}
+
+/*
+==================
+NET_QueueSend
+
+Gathers a datagram into the next queue slot
+==================
+*/
+static void NET_QueueSend( const netIovec_t *iov, int numIov, const struct sockaddr *addr, netadrtype_t type ) {
+	int		i, j, length;
+
+	if ( sendQueue.count == NET_SEND_BATCH ) {
+		NET_FlushSendQueue();
 	}
 
-	if( ret >= net_message->maxsize ) {
-		Com_Printf( "Oversize packet from %s\n", NET_AdrToString (*net_from) );
-		return qfalse;
+	i = sendQueue.count++;
+	length = 0;
+	for ( j = 0 ; j < numIov ; j++ ) {
+		Com_Memcpy( sendQueue.data[i] + length, iov[j].data, iov[j].length );
+		length += iov[j].length;
 	}
+	sendQueue.addrs[i] = *addr;
+	sendQueue.types[i] = type;
+	sendQueue.iovecs[i].iov_base = sendQueue.data[i];
+	sendQueue.iovecs[i].iov_len = length;
+
+	memset( &sendQueue.hdrs[i], 0, sizeof( sendQueue.hdrs[i] ) );
+	sendQueue.hdrs[i].msg_hdr.msg_name = &sendQueue.addrs[i];
+	sendQueue.hdrs[i].msg_hdr.msg_namelen = sizeof( sendQueue.addrs[i] );
+	sendQueue.hdrs[i].msg_hdr.msg_iov = &sendQueue.iovecs[i];
+	sendQueue.hdrs[i].msg_hdr.msg_iovlen = 1;
+}
+#endif
 
-	net_message->cursize = ret;
-	return qtrue;
+/*
+==================
+NET_BeginBatch
+
+Start queueing outgoing datagrams until NET_FlushBatch
+==================
+*/
+void NET_BeginBatch( void ) {
+#ifdef NET_BATCHED_IO
+	if ( sendQueue.count ) {
+		NET_FlushSendQueue();
+	}
+
+	sendQueue.active = (qboolean)( net_batchIO && net_batchIO->integer && !usingSocks );
+#endif
 }
 
-//=============================================================================
+/*
+==================
+NET_FlushBatch
 
-static char socksBuf[4096];
+Send everything queued since NET_BeginBatch
+==================
+*/
+void NET_FlushBatch( void ) {
+#ifdef NET_BATCHED_IO
+	NET_FlushSendQueue();
+	sendQueue.active = qfalse;
+#endif
+}
 
 /*
 ==================
@@ -299,6 +557,17 @@ void Sys_SendPacket( int length, const void *data, netadr_t to ) {
 
 	NetadrToSockadr( &to, &addr );
 
+#ifdef NET_BATCHED_IO
+	if ( sendQueue.active && length <= NET_SEND_PACKETLEN ) {
+		netIovec_t	iov;
+
+		iov.data = data;
+		iov.length = length;
+		NET_QueueSend( &iov, 1, &addr, to.type );
+		return;
+	}
+#endif
+
 	if( usingSocks && to.type == NA_IP ) {
 		socksBuf[0] = 0;	// reserved
 		socksBuf[1] = 0;
@@ -313,20 +582,79 @@ void Sys_SendPacket( int length, const void *data, netadr_t to ) {
 		ret = sendto( ip_socket, (const char *)data, length, 0, &addr, sizeof(addr) );
 	}
 	if( ret == SOCKET_ERROR ) {
-		int err = socketError;
+		NET_SendError( to.type );
+	}
+}
+
+/*
+==================
+Sys_SendPacketv
 
-		// wouldblock is silent
-		if( err == EAGAIN ) {
+Sends a datagram gathered from several pieces. It goes to the batch queue
+or straight to sendmsg without being copied together first; SOCKS and
+winsock 1.1 have no gather send, so those get one contiguous buffer.
+==================
+*/
+void Sys_SendPacketv( const netIovec_t *iov, int numIov, netadr_t to ) {
+	static byte		buf[MAX_MSGLEN];
+	int				i, length;
+#ifndef _WIN32
+	struct sockaddr	addr;
+	struct iovec	iovecs[NET_MAX_IOVECS];
+	struct msghdr	hdr;
+#endif
+
+	if ( numIov > NET_MAX_IOVECS ) {
+		Com_Error( ERR_FATAL, "Sys_SendPacketv: %i pieces", numIov );
+	}
+
+	length = 0;
+	for ( i = 0 ; i < numIov ; i++ ) {
+		length += iov[i].length;
+	}
+	if ( length > (int)sizeof( buf ) ) {
+		Com_Error( ERR_DROP, "Sys_SendPacketv: %i byte datagram", length );
+	}
+
+#ifndef _WIN32
+	if ( !usingSocks && ( to.type == NA_IP || to.type == NA_BROADCAST ) ) {
+		if ( ip_socket == INVALID_SOCKET ) {
 			return;
 		}
 
-		// some PPP links do not allow broadcasts and return an error
-		if( err == EADDRNOTAVAIL && to.type == NA_BROADCAST ) {
+		NetadrToSockadr( &to, &addr );
+
+#ifdef NET_BATCHED_IO
+		if ( sendQueue.active && length <= NET_SEND_PACKETLEN ) {
+			NET_QueueSend( iov, numIov, &addr, to.type );
 			return;
 		}
+#endif
+
+		for ( i = 0 ; i < numIov ; i++ ) {
+			iovecs[i].iov_base = (void *)iov[i].data;
+			iovecs[i].iov_len = iov[i].length;
+		}
+
+		memset( &hdr, 0, sizeof( hdr ) );
+		hdr.msg_name = &addr;
+		hdr.msg_namelen = sizeof( addr );
+		hdr.msg_iov = iovecs;
+		hdr.msg_iovlen = numIov;
+
+		if ( sendmsg( ip_socket, &hdr, 0 ) == SOCKET_ERROR ) {
+			NET_SendError( to.type );
+		}
+		return;
+	}
+#endif
 
-		Com_Printf( "NET_SendPacket: %s\n", NET_ErrorString() );
+	length = 0;
+	for ( i = 0 ; i < numIov ; i++ ) {
+		Com_Memcpy( buf + length, iov[i].data, iov[i].length );
+		length += iov[i].length;
 	}
+	Sys_SendPacket( length, buf, to );
 }
 
 //=============================================================================
@@ -924,6 +1252,11 @@ void NET_Config( qboolean enableNetworking ) {
 	}
 
 	if ( stop ) {
+		NET_FlushBatch();
+#ifdef NET_TIMER_SLEEP
+		net_epollSocket = INVALID_SOCKET;	// closing drops it from the epoll set
+#endif
+
 		if ( ip_socket != INVALID_SOCKET ) {
 			closesocket( ip_socket );
 			ip_socket = INVALID_SOCKET;
@@ -960,6 +1293,8 @@ void NET_Init( void ) {
 
 	NET_Config( qtrue );
 
+	net_batchIO = Cvar_Get( "net_batchIO", "1", CVAR_ARCHIVE );
+
 	Cmd_AddCommand ("net_restart", NET_Restart_f );
 }
 
@@ -980,14 +1315,98 @@ void NET_Shutdown( void ) {
 #endif
 }
 
+#ifdef NET_TIMER_SLEEP
+static void NET_TimerSleepClose( void ) {
+	if ( net_timerFd != -1 ) {
+		close( net_timerFd );
+		net_timerFd = -1;
+	}
+	if ( net_epollFd != -1 ) {
+		close( net_epollFd );
+		net_epollFd = -1;
+	}
+	net_epollSocket = INVALID_SOCKET;
+	net_epollStdin = qfalse;
+}
+
+/*
+====================
+NET_TimerSleep
+
+select() only wakes on whole milliseconds plus slack, which is most of a
+tick at high sv_fps. A timerfd in the same epoll set as the socket and
+stdin fires on the exact deadline instead.
+Returns qfalse if epoll or timerfd are unavailable, so the caller can
+fall back to select()
+====================
+*/
+static qboolean NET_TimerSleep( int usec ) {
+	struct epoll_event	ev, events[4];
+	struct itimerspec	its;
+	extern qboolean stdin_active;
+
+	if ( net_timerFailed )
+		return qfalse;
+
+	if ( net_epollFd == -1 ) {
+		net_epollFd = epoll_create( 4 );
+		net_timerFd = timerfd_create( CLOCK_MONOTONIC, TFD_NONBLOCK );
+		memset( &ev, 0, sizeof( ev ) );
+		ev.events = EPOLLIN;
+		ev.data.fd = net_timerFd;
+		if ( net_epollFd == -1 || net_timerFd == -1 || epoll_ctl( net_epollFd, EPOLL_CTL_ADD, net_timerFd, &ev ) == -1 ) {
+			Com_Printf( "WARNING: NET_TimerSleep: %s, falling back to select\n", NET_ErrorString() );
+			NET_TimerSleepClose();
+			net_timerFailed = qtrue;
+			return qfalse;
+		}
+	}
+
+	// the socket gets reopened on net_restart, keep the set in step
+	if ( net_epollSocket != ip_socket ) {
+		if ( net_epollSocket != INVALID_SOCKET )
+			epoll_ctl( net_epollFd, EPOLL_CTL_DEL, net_epollSocket, &ev );
+		memset( &ev, 0, sizeof( ev ) );
+		ev.events = EPOLLIN;
+		ev.data.fd = ip_socket;
+		if ( epoll_ctl( net_epollFd, EPOLL_CTL_ADD, ip_socket, &ev ) == -1 ) {
+			net_epollSocket = INVALID_SOCKET;
+			return qfalse;
+		}
+		net_epollSocket = ip_socket;
+	}
+	if ( net_epollStdin != stdin_active ) {
+		memset( &ev, 0, sizeof( ev ) );
+		ev.events = EPOLLIN;
+		ev.data.fd = 0;
+		epoll_ctl( net_epollFd, stdin_active ? EPOLL_CTL_ADD : EPOLL_CTL_DEL, 0, &ev );
+		net_epollStdin = stdin_active;
+	}
+
+	if ( usec > 0 ) {
+		// re-arming also clears any expiry left over from the last sleep
+		memset( &its, 0, sizeof( its ) );
+		its.it_value.tv_sec = usec / 1000000;
+		its.it_value.tv_nsec = ( usec % 1000000 ) * 1000;
+		if ( timerfd_settime( net_timerFd, 0, &its, NULL ) == -1 )
+			return qfalse;
+	}
+
+	epoll_wait( net_epollFd, events, ARRAY_LEN( events ), usec > 0 ? -1 : 0 );
+
+	return qtrue;
+}
+#endif
+
 /*
 ====================
 NET_Sleep
 
-sleeps msec or until net socket is ready
+Sleeps usec microseconds or until something comes in on the network
+or stdin
 ====================
 */
-void NET_Sleep( int msec ) {
+void NET_Sleep( int usec ) {
 #ifndef _WIN32
 	struct timeval timeout;
 	fd_set	fdset;
@@ -999,12 +1418,20 @@ void NET_Sleep( int msec ) {
 	if ( ip_socket == INVALID_SOCKET )
 		return;
 
+	if ( usec < 0 )
+		usec = 0;
+
+#ifdef NET_TIMER_SLEEP
+	if ( NET_TimerSleep( usec ) )
+		return;
+#endif
+
 	FD_ZERO(&fdset);
 	if (stdin_active)
 		FD_SET(0, &fdset); // stdin is processed too
 	FD_SET(ip_socket, &fdset); // network socket
-	timeout.tv_sec = msec/1000;
-	timeout.tv_usec = (msec%1000)*1000;
+	timeout.tv_sec = usec/1000000;
+	timeout.tv_usec = usec%1000000;
 	select(ip_socket+1, &fdset, NULL, NULL, &timeout);
 #endif
 }
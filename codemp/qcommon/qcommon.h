@@ -126,7 +126,16 @@ void		NET_Shutdown( void );
 void		NET_Restart_f( void );
 void		NET_Config( qboolean enableNetworking );
 
+// one piece of a datagram for NET_SendPacketv
+typedef struct netIovec_s {
+	const void	*data;
+	int			length;
+} netIovec_t;
+
+#define	NET_MAX_IOVECS			4
+
 void		NET_SendPacket (netsrc_t sock, int length, const void *data, netadr_t to);
+void		NET_SendPacketv( netsrc_t sock, const netIovec_t *iov, int numIov, netadr_t to );
 void		QDECL NET_OutOfBandPrint( netsrc_t net_socket, netadr_t adr, const char *format, ...);
 void		QDECL NET_OutOfBandData( netsrc_t sock, netadr_t adr, byte *format, int len );
 
@@ -137,7 +146,9 @@ qboolean	NET_IsLocalAddress (netadr_t adr);
 const char	*NET_AdrToString (netadr_t a);
 qboolean	NET_StringToAdr ( const char *s, netadr_t *a);
 qboolean	NET_GetLoopPacket (netsrc_t sock, netadr_t *net_from, msg_t *net_message);
-void		NET_Sleep(int msec);
+void		NET_Sleep(int usec);
+void		NET_BeginBatch( void );		// queue outgoing datagrams...
+void		NET_FlushBatch( void );		// ...and send them with as few syscalls as possible
 
 
 #define	MAX_MSGLEN				49152		// max length of a message, which may
@@ -165,7 +176,7 @@ typedef struct netchan_s {
 	int			incomingSequence;
 	int			outgoingSequence;
 
-	// incoming fragment assembly buffer
+	// incoming fragment assembly buffer, the sequence number then fragmentLength bytes
 	int			fragmentSequence;
 	int			fragmentLength;
 	byte		fragmentBuffer[MAX_MSGLEN];
@@ -181,6 +192,7 @@ typedef struct netchan_s {
 void Netchan_Init( int qport );
 void Netchan_Setup( netsrc_t sock, netchan_t *chan, netadr_t adr, int qport );
 
+byte *Netchan_MessageBuffer( netchan_t *chan, byte *scratch );
 void Netchan_Transmit( netchan_t *chan, int length, const byte *data );
 void Netchan_TransmitNextFragment( netchan_t *chan );
 
@@ -584,6 +596,12 @@ fileHandle_t	FS_FOpenFileWrite( const char *qpath, qboolean safe=qtrue );
 int		FS_filelength( fileHandle_t f );
 fileHandle_t FS_SV_FOpenFileWrite( const char *filename );
 int		FS_SV_FOpenFileRead( const char *filename, fileHandle_t *fp );
+int		FS_SV_MapFile( const char *filename, void **buffer, qboolean *mapped );
+void	FS_SV_UnmapFile( void *buffer, int len, qboolean mapped );
+// read-only view of a whole file, shared between server downloads
+#ifndef _WIN32
+int		FS_SV_OpenFileDescriptor( const char *filename, int *len );
+#endif
 void	FS_SV_Rename( const char *from, const char *to, qboolean safe );
 long		FS_FOpenFileRead( const char *qpath, fileHandle_t *file, qboolean uniqueFILE );
 // if uniqueFILE is true, then a new FILE will be fopened even if the file
@@ -605,6 +623,9 @@ int		FS_Read( void *buffer, int len, fileHandle_t f );
 void	FS_FCloseFile( fileHandle_t f );
 // note: you can't just fclose from another DLL, due to MS libc issues
 
+FILE	*FS_DetachFile( fileHandle_t f );
+// gives up the handle, the caller fcloses the returned stream
+
 long		FS_ReadFile( const char *qpath, void **buffer );
 // returns the length of the file
 // a null buffer will just return the file length without loading
@@ -619,6 +640,14 @@ void	FS_ForceFlush( fileHandle_t f );
 void	FS_FreeFile( void *buffer );
 // frees the memory returned by FS_ReadFile
 
+long	FS_MapFile( const char *qpath, void **buffer, qboolean *mapped );
+void	FS_UnmapFile( void *buffer, long len, qboolean mapped );
+// read-only view of a file; loose files and files stored uncompressed in
+// a pk3 are mapped rather than read where the platform allows it
+
+long	FS_FileLocation( const char *qpath, char *ospath, int size, long *offset, qboolean *stored );
+// OS path, offset and on-disk length of a file's data, for reading it outside the filesystem
+
 void	FS_WriteFile( const char *qpath, const void *buffer, int size );
 // writes a complete file, creating any subdirectories needed
 
@@ -954,6 +983,9 @@ void SV_Shutdown( char *finalmsg );
 void SV_Frame( int msec );
 void SV_PacketEvent( netadr_t from, msg_t *msg );
 qboolean SV_GameCommand( void );
+qboolean SV_ReplayGetEvent( struct sysEvent_s *ev );
+qboolean SV_ReplayOutput( int length, const void *data );
+qboolean SV_Replaying( void );
 
 
 //
@@ -1028,6 +1060,7 @@ void	Sys_Print( const char *msg );
 // any game related timing information should come from event timestamps
 int		Sys_Milliseconds (bool baseTime = false);
 int		Sys_Milliseconds2(void);
+int64_t	Sys_Microseconds(void);		// same origin as Sys_Milliseconds
 void 	Sys_SetEnv(const char *name, const char *value);
 
 extern "C" void	Sys_SnapVector( float *v );
@@ -1041,6 +1074,7 @@ void	Sys_ShowConsole( int level, qboolean quitOnClose );
 void	Sys_SetErrorText( const char *text );
 
 void	Sys_SendPacket( int length, const void *data, netadr_t to );
+void	Sys_SendPacketv( const netIovec_t *iov, int numIov, netadr_t to );
 
 qboolean	Sys_StringToAdr( const char *s, netadr_t *a );
 //Does NOT parse port numbers, only base addresses.
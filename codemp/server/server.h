@@ -14,8 +14,7 @@
 #define	MAX_ENT_CLUSTERS	16
 
 typedef struct svEntity_s {
-	struct worldSector_s *worldSector;
-	struct svEntity_s *nextEntityInWorldSector;
+	struct areaNode_s *areaNode;	// its leaf in the area tree, NULL when not linked
 
 	entityState_t	baseline;		// for delta compression of initial sighting
 	int			numClusters;		// if -1, use headnode instead
@@ -37,10 +36,15 @@ typedef struct server_s {
 	int				serverId;			// changes each server start
 	int				restartedServerId;	// serverId before a map_restart
 	int				checksumFeed;		//
+	int				randomSeed;			// srand'ed at spawn, kept for packet captures
 	int				snapshotCounter;	// incremented for each snapshot built
 	int				timeResidual;		// <= 1000 / sv_frame->value
+	int				tickFraction;		// sub-millisecond tick remainder carried to the next frame, in usec
 	int				nextFrameTime;		// when time > nextFrameTime, process world
 	char			*configstrings[MAX_CONFIGSTRINGS];
+	qboolean		configstringDirty[MAX_CONFIGSTRINGS];	// changed, not yet sent to clients
+	int				dirtyConfigstrings[MAX_CONFIGSTRINGS];	// the same, in order of first change
+	int				numDirtyConfigstrings;
 	svEntity_t		svEntities[MAX_GENTITIES];
 
 	char			*entityParsePoint;	// used during game VM init
@@ -96,17 +100,47 @@ typedef enum {
 } clientState_t;
 
 
+typedef struct demoStream_s demoStream_t;
+
 // struct to hold demo data for a single demo
 typedef struct {
 	char		demoName[MAX_OSPATH];
 	qboolean	demorecording;
 	qboolean	demowaiting;	// don't record until a non-delta message is sent
 	int			minDeltaFrame;	// the first non-delta frame stored in the demo.  cannot delta against frames older than this
-	fileHandle_t	demofile;
+	demoStream_t	*demofile;	// buffered, written out by sv_demowriter
 	qboolean	isBot;
 	int			botReliableAcknowledge; // for bots, need to maintain a separate reliableAcknowledge to record server messages into the demo file
 } demoInfo_t;
 
+// per client traffic counters, see sv_net_chan.cpp
+#define	NETSTAT_SECONDS		10			// length of the rolling window
+
+typedef enum {
+	NETSTAT_PACKETS_OUT,
+	NETSTAT_BYTES_OUT,					// netchan payload, without UDP/IP headers
+	NETSTAT_FRAGMENTS_OUT,
+	NETSTAT_MESSAGES,					// snapshots and gamestates
+	NETSTAT_MESSAGE_BYTES,
+	NETSTAT_CHOKED,						// messages big enough to push the next one past snapshotMsec
+	NETSTAT_DEFERRED,					// frames held back by sv_maxTotalRate
+	NETSTAT_STALLED,					// messages sent while nothing was acknowledged for PACKET_BACKUP messages
+	NETSTAT_PACKETS_IN,
+	NETSTAT_BYTES_IN,
+	NETSTAT_FRAGMENTS_IN,
+	NETSTAT_DROPPED_IN,					// gaps in the client's sequence numbers
+	NETSTAT_ENTITIES_DEFERRED,			// visible entities left out of a snapshot, see sv_snapshotEntityBudget
+	NETSTAT_MAX
+} netStat_t;
+
+typedef struct {
+	int64_t		total[NETSTAT_MAX];								// since the client connected
+	int			window[NETSTAT_SECONDS + 1][NETSTAT_MAX];		// one slot per second of svs.time
+	int			windowSecond[NETSTAT_SECONDS + 1];
+	int			firstSecond;									// when counting started
+	int			largestMessage;
+} clientNetStats_t;
+
 
 typedef struct client_s {
 	clientState_t	state;
@@ -132,13 +166,13 @@ typedef struct client_s {
 
 	// downloading
 	char			downloadName[MAX_QPATH]; // if not empty string, we are downloading
-	fileHandle_t	download;			// file being downloaded
+	struct downloadCache_s	*download;	// shared copy of the file being downloaded
  	int				downloadSize;		// total bytes (can't use EOF because of paks)
  	int				downloadCount;		// bytes sent
 	int				downloadClientBlock;	// last block we sent to the client, awaiting ack
 	int				downloadCurrentBlock;	// current block number
 	int				downloadXmitBlock;	// last block we xmited
-	unsigned char	*downloadBlocks[MAX_DOWNLOAD_WINDOW];	// the buffers for the download blocks
+	const byte		*downloadBlocks[MAX_DOWNLOAD_WINDOW];	// the download blocks, pointing into cl->download
 	int				downloadBlockSize[MAX_DOWNLOAD_WINDOW];
 	qboolean		downloadEOF;		// We have sent the EOF block
 	int				downloadSendTime;	// time we last got an ack from the client
@@ -149,6 +183,8 @@ typedef struct client_s {
 	int				lastConnectTime;	// svs.time when connection started
 	int				nextSnapshotTime;	// send another snapshot when svs.time >= nextSnapshotTime
 	qboolean		rateDelayed;		// true if nextSnapshotTime was set based on rate instead of snapshotMsec
+	int				lastEgressTime;		// svs.time a message was last sent, oldest goes first under sv_maxTotalRate
+	int				egressDeferred;		// due messages held back by sv_maxTotalRate
 	int				timeoutCount;		// must timeout a few frames in a row so debugging doesn't break
 	clientSnapshot_t	frames[PACKET_BACKUP];	// updates can be delta'd from here
 	int				ping;
@@ -166,6 +202,12 @@ typedef struct client_s {
 	qboolean		csUpdated[MAX_CONFIGSTRINGS];
 
 	demoInfo_t		demo;
+
+	clientNetStats_t	netStats;
+
+	// snapshot entity selection, see SV_PrioritizeSnapshotEntities
+	int				entityLastSent[MAX_GENTITIES];		// svs.time each entity was last put in a snapshot
+	byte			entityEnterCost[MAX_GENTITIES];		// bytes its last delta from the baseline took
 } client_t;
 
 //=============================================================================
@@ -212,9 +254,11 @@ typedef struct serverStatic_s {
 	netadr_t	authorizeAddress;			// for rcon return messages
 
 	qboolean	gameStarted;				// gvm is loaded
+
+	int			egressTokens;				// sv_maxTotalRate bucket in bytes, may go negative
+	int			egressTime;					// svs.time the bucket was last refilled
 } serverStatic_t;
 
-#define SERVER_MAXBANS	1024
 // Structure for managing bans
 typedef struct serverBan_s {
 	netadr_t ip;
@@ -253,6 +297,8 @@ extern	cvar_t	*sv_mapname;
 extern	cvar_t	*sv_mapChecksum;
 extern	cvar_t	*sv_serverid;
 extern	cvar_t	*sv_maxRate;
+extern	cvar_t	*sv_maxTotalRate;
+extern	cvar_t	*sv_snapshotEntityBudget;
 extern	cvar_t	*sv_minPing;
 extern	cvar_t	*sv_maxPing;
 extern	cvar_t	*sv_gametype;
@@ -266,8 +312,9 @@ extern	cvar_t	*sv_autoDemoBots;
 extern	cvar_t	*sv_autoDemoMaxMaps;
 extern	cvar_t	*sv_blockJumpSelect;
 extern	cvar_t	*sv_banFile;
+extern	cvar_t	*sv_pointContentsCache;
 
-extern	serverBan_t serverBans[SERVER_MAXBANS];
+extern	serverBan_t *serverBans;		// Z_Malloc'd, grows as needed
 extern	int serverBansCount;
 
 //===========================================================
@@ -296,6 +343,7 @@ extern leakyBucket_t outboundLeakyBucket;
 qboolean SVC_RateLimit( leakyBucket_t *bucket, int burst, int period );
 qboolean SVC_RateLimitAddress( netadr_t from, int burst, int period );
 void SV_FinalMessage (char *message);
+void SV_InvalidateQueryCache( void );
 void QDECL SV_SendServerCommand( client_t *cl, const char *fmt, ...);
 
 
@@ -315,6 +363,7 @@ void SV_MasterShutdown (void);
 void SV_SetConfigstring( int index, const char *val );
 void SV_GetConfigstring( int index, char *buffer, int bufferSize );
 void SV_UpdateConfigstrings( client_t *client );
+void SV_FlushConfigstrings( void );
 
 void SV_SetUserinfo( int index, const char *val );
 void SV_GetUserinfo( int index, char *buffer, int bufferSize );
@@ -342,6 +391,9 @@ void SV_ExecuteClientCommand( client_t *cl, const char *s, qboolean clientOK );
 void SV_ClientThink (client_t *cl, usercmd_t *cmd);
 
 void SV_WriteDownloadToClient( client_t *cl , msg_t *msg );
+void SV_CloseDownloads( void );
+
+void SV_RebuildBanTrie( void );
 
 //
 // sv_ccmds.c
@@ -352,6 +404,7 @@ void SV_StopRecordDemo( client_t *cl );
 void SV_AutoRecordDemo( client_t *cl );
 void SV_StopAutoRecordDemos();
 void SV_BeginAutoRecordDemos();
+void SV_DemoFilename( char *buf, int bufSize );
 
 //
 // sv_snapshot.c
@@ -375,6 +428,67 @@ void		SV_InitGameProgs ( void );
 void		SV_ShutdownGameProgs ( void );
 qboolean	SV_inPVS (const vec3_t p1, const vec3_t p2);
 
+//
+// sv_demowriter.c
+//
+void		SV_DemoWriterInit( void );
+void		SV_DemoWriterShutdown( void );
+void		SV_DemoWriterStatus_f( void );
+demoStream_t *SV_DemoOpen( fileHandle_t f );
+void		SV_DemoWrite( demoStream_t *stream, const void *data, int len );
+void		SV_DemoClose( demoStream_t *stream );
+
+//
+// sv_mvdemo.c
+//
+void		SV_MVDemoConfigstring( int index, const char *val );
+void		SV_MVDemoServerCommand( client_t *cl, const char *cmd );
+void		SV_MVDemoClientSnapshot( client_t *client );
+void		SV_MVDemoFrame( void );
+void		SV_MVDemoStop( void );
+void		SV_MVRecord_f( void );
+void		SV_MVStopRecord_f( void );
+void		SV_MVExtract_f( void );
+
+//
+// sv_capture.c
+//
+void		SV_CaptureSpawn( const char *mapname );
+void		SV_CapturePacket( netadr_t from, msg_t *msg );
+void		SV_CaptureFrame( void );
+void		SV_CaptureFrameDone( void );
+void		SV_CaptureShutdown( void );
+qboolean	SV_Replaying( void );
+void		SV_Capture_f( void );
+void		SV_StopCapture_f( void );
+void		SV_Replay_f( void );
+
+//
+// sv_preload.c
+//
+void		SV_PreloadInit( void );
+void		SV_PreloadShutdown( void );
+void		SV_PreloadMap( const char *mapname );
+void		SV_PreloadFrame( void );
+void		SV_PreloadSpawn( const char *mapname );
+void		SV_Preload_f( void );
+
+//
+// sv_areabench.c
+//
+extern qboolean	sv_areaBenchRecording;
+
+void		SV_AreaBenchRecord( const vec3_t mins, const vec3_t maxs );
+void		SV_AreaBenchFrame( void );
+void		SV_AreaBench_f( void );
+
+//
+// sv_http.c
+//
+void		SV_HTTP_Init( void );
+void		SV_HTTP_SpawnServer( void );
+void		SV_HTTP_Shutdown( void );
+
 //
 // sv_bot.c
 //
@@ -426,10 +540,17 @@ int SV_AreaEntities( const vec3_t mins, const vec3_t maxs, int *entityList, int
 // returns the number of pointers filled in
 // The world entity is never returned in this list.
 
+int SV_AreaQuery( const vec3_t mins, const vec3_t maxs, int *entityList, int maxcount, int *nodes, int *tests );
+// SV_AreaEntities, also returning how many tree nodes were visited
+// and how many entity boxes were tested
+
 
 int SV_PointContents( const vec3_t p, int passEntityNum );
 // returns the CONTENTS_* value from the world and all entities at the given point.
 
+void SV_ContentsStats_f( void );
+// hit rate of the SV_PointContents cache
+
 
 void SV_Trace( trace_t *results, const vec3_t start, const vec3_t mins, const vec3_t maxs, const vec3_t end, int passEntityNum, int contentmask, int capsule, int traceFlags, int useLod );
 // mins and maxs are relative
@@ -442,6 +563,9 @@ void SV_Trace( trace_t *results, const vec3_t start, const vec3_t mins, const ve
 
 // passEntityNum is explicitly excluded from clipping checks (normally ENTITYNUM_NONE)
 
+void SV_TraceBatch( trace_t *results, const traceRequest_t *requests, int numRequests );
+// the same as an SV_Trace for each request, with the entity gathering shared
+
 
 void SV_ClipToEntity( trace_t *trace, const vec3_t start, const vec3_t mins, const vec3_t maxs, const vec3_t end, int entityNum, int contentmask, int capsule );
 // clip to a specific entity
@@ -450,5 +574,7 @@ void SV_ClipToEntity( trace_t *trace, const vec3_t start, const vec3_t mins, con
 // sv_net_chan.c
 //
 void SV_Netchan_Transmit( client_t *client, msg_t *msg);	//int length, const byte *data );
-void SV_Netchan_TransmitNextFragment( netchan_t *chan );
+void SV_Netchan_TransmitNextFragment( client_t *client );
 qboolean SV_Netchan_Process( client_t *client, msg_t *msg );
+void SV_NetStatsAdd( client_t *client, netStat_t stat, int value );
+void SV_NetStatsRates( const client_t *client, float *rates );
@@ -0,0 +1,319 @@
+// sv_areabench.cpp -- area tree against the old sector grid
+
+#include "server.h"
+#include "qcommon/cm_public.h"
+
+/*
+==============================================================================
+
+AREA BENCHMARK
+
+sv_areabench records the box of every SV_AreaEntities query the next few
+server frames make, game and engine alike. When the frames are done it
+runs all of them against the area tree, and against the uniformly split
+sector grid SV_AreaEntities used to walk, built for the occasion from the
+entities linked at that moment. It prints how many nodes and entity boxes
+each had to look at per query, how long all the queries took, and whether
+both found the same entities.
+
+==============================================================================
+*/
+
+#define	AREABENCH_DEFAULT_FRAMES	100
+#define	AREABENCH_MAX_QUERIES		( 1 << 17 )
+
+// the grid the server used before the area tree
+#define	SECTOR_DEPTH	4
+#define	SECTOR_NODES	64
+
+typedef struct benchSector_s {
+	int						axis;		// -1 = leaf node
+	float					dist;
+	struct benchSector_s	*children[2];
+	int						firstEntity;
+} benchSector_t;
+
+typedef struct {
+	vec3_t		mins, maxs;
+} benchQuery_t;
+
+qboolean		sv_areaBenchRecording;
+
+static struct {
+	int				framesLeft;
+	int				frames;
+	benchQuery_t	*queries;
+	int				numQueries;
+	qboolean		overflowed;
+
+	benchSector_t	sectors[SECTOR_NODES];
+	int				numSectors;
+	int				nextEntity[MAX_GENTITIES];
+} bench;
+
+/*
+===============
+SV_AreaBenchRecord
+===============
+*/
+void SV_AreaBenchRecord( const vec3_t mins, const vec3_t maxs ) {
+	benchQuery_t	*q;
+
+	if ( bench.numQueries == AREABENCH_MAX_QUERIES ) {
+		bench.overflowed = qtrue;
+		return;
+	}
+
+	q = &bench.queries[bench.numQueries++];
+	VectorCopy( mins, q->mins );
+	VectorCopy( maxs, q->maxs );
+}
+
+/*
+===============
+SV_CreateBenchSector
+
+Builds a uniformly subdivided tree for the given world size
+===============
+*/
+static benchSector_t *SV_CreateBenchSector( int depth, vec3_t mins, vec3_t maxs ) {
+	benchSector_t	*anode;
+	vec3_t			size;
+	vec3_t			mins1, maxs1, mins2, maxs2;
+
+	anode = &bench.sectors[bench.numSectors++];
+	anode->firstEntity = -1;
+
+	if ( depth == SECTOR_DEPTH ) {
+		anode->axis = -1;
+		anode->children[0] = anode->children[1] = NULL;
+		return anode;
+	}
+
+	VectorSubtract( maxs, mins, size );
+	anode->axis = ( size[0] > size[1] ) ? 0 : 1;
+
+	anode->dist = 0.5 * ( maxs[anode->axis] + mins[anode->axis] );
+	VectorCopy( mins, mins1 );
+	VectorCopy( mins, mins2 );
+	VectorCopy( maxs, maxs1 );
+	VectorCopy( maxs, maxs2 );
+
+	maxs1[anode->axis] = mins2[anode->axis] = anode->dist;
+
+	anode->children[0] = SV_CreateBenchSector( depth + 1, mins2, maxs2 );
+	anode->children[1] = SV_CreateBenchSector( depth + 1, mins1, maxs1 );
+
+	return anode;
+}
+
+/*
+===============
+SV_BuildBenchSectors
+
+Links every linked entity into the first sector its box crosses
+===============
+*/
+static int SV_BuildBenchSectors( void ) {
+	benchSector_t	*node;
+	sharedEntity_t	*gEnt;
+	vec3_t			mins, maxs;
+	int				i, count;
+
+	bench.numSectors = 0;
+	CM_ModelBounds( CM_InlineModel( 0 ), mins, maxs );
+	SV_CreateBenchSector( 0, mins, maxs );
+
+	count = 0;
+	for ( i = 0 ; i < sv.num_entities ; i++ ) {
+		gEnt = SV_GentityNum( i );
+		if ( !gEnt->r.linked ) {
+			continue;
+		}
+
+		node = bench.sectors;
+		while ( node->axis != -1 ) {
+			if ( gEnt->r.absmin[node->axis] > node->dist ) {
+				node = node->children[0];
+			} else if ( gEnt->r.absmax[node->axis] < node->dist ) {
+				node = node->children[1];
+			} else {
+				break;		// crosses the node
+			}
+		}
+
+		bench.nextEntity[i] = node->firstEntity;
+		node->firstEntity = i;
+		count++;
+	}
+
+	return count;
+}
+
+/*
+===============
+SV_BenchSectorQuery_r
+===============
+*/
+static void SV_BenchSectorQuery_r( const benchSector_t *node, const benchQuery_t *q, int *list, int *count, int *nodes, int *tests ) {
+	sharedEntity_t	*gcheck;
+	int				e;
+
+	(*nodes)++;
+
+	for ( e = node->firstEntity ; e != -1 ; e = bench.nextEntity[e] ) {
+		(*tests)++;
+		gcheck = SV_GentityNum( e );
+
+		if ( gcheck->r.absmin[0] > q->maxs[0]
+		|| gcheck->r.absmin[1] > q->maxs[1]
+		|| gcheck->r.absmin[2] > q->maxs[2]
+		|| gcheck->r.absmax[0] < q->mins[0]
+		|| gcheck->r.absmax[1] < q->mins[1]
+		|| gcheck->r.absmax[2] < q->mins[2]) {
+			continue;
+		}
+
+		list[(*count)++] = e;
+	}
+
+	if ( node->axis == -1 ) {
+		return;		// terminal node
+	}
+
+	// recurse down both sides
+	if ( q->maxs[node->axis] > node->dist ) {
+		SV_BenchSectorQuery_r( node->children[0], q, list, count, nodes, tests );
+	}
+	if ( q->mins[node->axis] < node->dist ) {
+		SV_BenchSectorQuery_r( node->children[1], q, list, count, nodes, tests );
+	}
+}
+
+/*
+===============
+SV_BenchCompareInts
+===============
+*/
+static int SV_BenchCompareInts( const void *a, const void *b ) {
+	return *(const int *)a - *(const int *)b;
+}
+
+/*
+===============
+SV_AreaBenchReport
+===============
+*/
+static void SV_AreaBenchReport( void ) {
+	static int		treeList[MAX_GENTITIES], sectorList[MAX_GENTITIES];
+	const benchQuery_t	*q;
+	int64_t			treeUsec, sectorUsec, start;
+	int64_t			treeNodes, treeTests, sectorNodes, sectorTests, results;
+	int				i, n, t, treeCount, sectorCount, linked, mismatches;
+	float			scale;
+
+	linked = SV_BuildBenchSectors();
+
+	// counts and results, one query at a time
+	treeNodes = treeTests = sectorNodes = sectorTests = results = 0;
+	mismatches = 0;
+	for ( i = 0, q = bench.queries ; i < bench.numQueries ; i++, q++ ) {
+		treeCount = SV_AreaQuery( q->mins, q->maxs, treeList, MAX_GENTITIES, &n, &t );
+		treeNodes += n;
+		treeTests += t;
+
+		sectorCount = n = t = 0;
+		SV_BenchSectorQuery_r( bench.sectors, q, sectorList, &sectorCount, &n, &t );
+		sectorNodes += n;
+		sectorTests += t;
+
+		results += treeCount;
+
+		// the order differs, the entities must not
+		qsort( treeList, treeCount, sizeof( int ), SV_BenchCompareInts );
+		qsort( sectorList, sectorCount, sizeof( int ), SV_BenchCompareInts );
+		if ( treeCount != sectorCount || memcmp( treeList, sectorList, treeCount * sizeof( int ) ) ) {
+			mismatches++;
+		}
+	}
+
+	// then time each over the whole set
+	start = Sys_Microseconds();
+	for ( i = 0, q = bench.queries ; i < bench.numQueries ; i++, q++ ) {
+		SV_AreaQuery( q->mins, q->maxs, treeList, MAX_GENTITIES, NULL, NULL );
+	}
+	treeUsec = Sys_Microseconds() - start;
+
+	start = Sys_Microseconds();
+	for ( i = 0, q = bench.queries ; i < bench.numQueries ; i++, q++ ) {
+		sectorCount = n = t = 0;
+		SV_BenchSectorQuery_r( bench.sectors, q, sectorList, &sectorCount, &n, &t );
+	}
+	sectorUsec = Sys_Microseconds() - start;
+
+	scale = bench.numQueries ? 1.0f / bench.numQueries : 0.0f;
+
+	Com_Printf( "%i area queries over %i frames, %i linked entities%s\n", bench.numQueries, bench.frames, linked,
+		bench.overflowed ? " (stopped recording at the limit)" : "" );
+	Com_Printf( "         nodes/query  tests/query  found/query      usec\n" );
+	Com_Printf( "sectors  %11.1f  %11.1f  %11.1f  %8i\n", sectorNodes * scale, sectorTests * scale, results * scale, (int)sectorUsec );
+	Com_Printf( "tree     %11.1f  %11.1f  %11.1f  %8i\n", treeNodes * scale, treeTests * scale, results * scale, (int)treeUsec );
+
+	if ( mismatches ) {
+		Com_Printf( S_COLOR_RED "%i queries found different entities.\n", mismatches );
+	} else {
+		Com_Printf( "Both found the same entities for every query.\n" );
+	}
+}
+
+/*
+===============
+SV_AreaBenchFrame
+===============
+*/
+void SV_AreaBenchFrame( void ) {
+	if ( !sv_areaBenchRecording || --bench.framesLeft > 0 ) {
+		return;
+	}
+
+	sv_areaBenchRecording = qfalse;
+	SV_AreaBenchReport();
+
+	Z_Free( bench.queries );
+	bench.queries = NULL;
+}
+
+/*
+===============
+SV_AreaBench_f
+
+sv_areabench [frames]
+===============
+*/
+void SV_AreaBench_f( void ) {
+	if ( Cmd_Argc() > 2 ) {
+		Com_Printf( "sv_areabench [frames]\n" );
+		return;
+	}
+
+	if ( !com_sv_running->integer ) {
+		Com_Printf( "Server is not running.\n" );
+		return;
+	}
+	if ( sv_areaBenchRecording ) {
+		Com_Printf( "Already recording, %i frames to go.\n", bench.framesLeft );
+		return;
+	}
+
+	bench.frames = ( Cmd_Argc() == 2 ) ? atoi( Cmd_Argv( 1 ) ) : AREABENCH_DEFAULT_FRAMES;
+	if ( bench.frames < 1 ) {
+		bench.frames = 1;
+	}
+	bench.framesLeft = bench.frames;
+	bench.queries = (benchQuery_t *)Z_Malloc( AREABENCH_MAX_QUERIES * sizeof( benchQuery_t ), TAG_GENERAL, qfalse );
+	bench.numQueries = 0;
+	bench.overflowed = qfalse;
+	sv_areaBenchRecording = qtrue;
+
+	Com_Printf( "Recording area queries for %i frames.\n", bench.frames );
+}
@@ -181,6 +181,7 @@ int SV_BotAllocateClient(void) {
 	cl->gentity = SV_GentityNum( i );
 	cl->gentity->s.number = i;
 	cl->state = CS_ACTIVE;
+	SV_InvalidateQueryCache();
 	cl->lastPacketTime = svs.time;
 	cl->netchan.remoteAddress.type = NA_BOT;
 	cl->rate = 16384;
@@ -203,6 +204,7 @@ void SV_BotFreeClient( int clientNum ) {
 	cl = &svs.clients[clientNum];
 	cl->state = CS_FREE;
 	cl->name[0] = 0;
+	SV_InvalidateQueryCache();
 	if ( cl->gentity ) {
 		cl->gentity->r.svFlags &= ~SVF_BOT;
 	}
@@ -0,0 +1,947 @@
+// sv_capture.cpp -- inbound packet capture and deterministic replay
+
+#include "server.h"
+
+/*
+==============================================================================
+
+PACKET CAPTURE
+
+svcapture records every datagram the server takes in, in the order
+SV_PacketEvent saw it, together with a mark for every SV_Frame. A capture
+starts when the next map spawns, so it also holds the random seed, the
+serverid and svs.time the map started with, plus the connection state of
+every client carried over from the previous map.
+
+svreplay loads the same map with the recorded seed, puts those clients
+back, and then feeds the capture through Com_EventLoop in place of the
+network: packets come back as SE_PACKET events, and each frame mark ends
+the event loop with the recorded com_frameTime, so every SV_Frame gets
+the same msec and sees the same packets before it as it did live. Nothing
+is sent while replaying. The replay runs as fast as the server can go and
+measures each server tick, which gives a frame time profile of exactly
+the load that was captured.
+
+The file is written through the demo writer thread:
+
+"SVCP" [int CAPTURE_VERSION] [int PROTOCOL_VERSION]
+[string mapname] [int seed] [int serverId] [int svs.time] [int sv_fps]
+[int sv_maxclients] [string serverinfo] [string session]
+[int numClients] clients...
+records: [int cap_packet] [int time] [int adrtype] [4 ip] [int port] [int length] data
+         [int cap_frame] [int com_frameTime offset]
+         [int cap_eof]
+
+==============================================================================
+*/
+
+#define	CAPTURE_VERSION		1
+#define	REPLAY_WORST_TICKS	5
+
+enum captureRecord_e {
+	cap_eof,
+	cap_packet,
+	cap_frame
+};
+
+static struct {
+	qboolean		armed;			// start with the next map
+	char			name[MAX_OSPATH];
+	demoStream_t	*stream;
+
+	int				baseTime;		// com_frameTime when the map spawned
+	int				baseRealTime;
+	int				numPackets;
+	int				numFrames;
+	int64_t			bytes;
+} capture;
+
+typedef struct {
+	int				svTime;
+	int				usec;			// events and SV_Frame since the previous tick
+	int				packets;
+	int				bytes;
+} replayTick_t;
+
+static struct {
+	qboolean		pending;		// waiting for svreplay's map to spawn
+	qboolean		running;
+	qboolean		quit;			// quit when done
+	char			name[MAX_OSPATH];
+	fileHandle_t	f;
+
+	// from the header, applied when the map spawns
+	char			mapname[MAX_QPATH];
+	int				seed;
+	int				serverId;
+	int				svsTime;
+
+	// the record to hand out next
+	int				nextType;
+	int				nextTime;
+	netadr_t		nextFrom;
+	int				nextLength;
+	byte			packet[MAX_MSGLEN];
+	int				baseTime;
+
+	// profile
+	replayTick_t	*ticks;
+	int				numTicks;
+	int				maxTicks;
+	int64_t			startUsec;
+	int64_t			lastTickUsec;
+	int				tickPackets;
+	int				tickBytes;
+	int				numPackets;
+	int				outputPackets;
+	unsigned int	outputHash;
+} replay;
+
+/*
+=============================================================================
+
+CAPTURE
+
+=============================================================================
+*/
+
+/*
+==================
+SV_CaptureWriteInt
+==================
+*/
+static void SV_CaptureWriteInt( int value ) {
+	value = LittleLong( value );
+	SV_DemoWrite( capture.stream, &value, 4 );
+}
+
+/*
+==================
+SV_CaptureWriteString
+==================
+*/
+static void SV_CaptureWriteString( const char *s ) {
+	int		len = strlen( s );
+
+	SV_CaptureWriteInt( len );
+	SV_DemoWrite( capture.stream, s, len );
+}
+
+/*
+==================
+SV_CaptureWriteClient
+
+Everything of a carried over client that its next packets depend on
+==================
+*/
+static void SV_CaptureWriteClient( client_t *cl ) {
+	int		i, first;
+
+	SV_CaptureWriteInt( cl - svs.clients );
+	SV_CaptureWriteInt( cl->state );
+	SV_CaptureWriteInt( cl->netchan.remoteAddress.type );
+	SV_DemoWrite( capture.stream, cl->netchan.remoteAddress.ip, 4 );
+	SV_CaptureWriteInt( cl->netchan.remoteAddress.port );
+	SV_CaptureWriteInt( cl->netchan.qport );
+	SV_CaptureWriteInt( cl->netchan.incomingSequence );
+	SV_CaptureWriteInt( cl->netchan.outgoingSequence );
+	SV_CaptureWriteInt( cl->challenge );
+	SV_CaptureWriteInt( cl->reliableSequence );
+	SV_CaptureWriteInt( cl->reliableAcknowledge );
+	SV_CaptureWriteInt( cl->reliableSent );
+	SV_CaptureWriteInt( cl->messageAcknowledge );
+	SV_CaptureWriteInt( cl->gamestateMessageNum );
+	SV_CaptureWriteInt( cl->lastMessageNum );
+	SV_CaptureWriteInt( cl->lastClientCommand );
+	SV_CaptureWriteInt( cl->deltaMessage );
+	SV_CaptureWriteInt( cl->lastPacketTime );
+	SV_CaptureWriteInt( cl->lastConnectTime );
+	SV_CaptureWriteInt( cl->nextSnapshotTime );
+	SV_CaptureWriteInt( cl->oldServerTime );
+	SV_CaptureWriteInt( cl->pureAuthentic );
+	SV_CaptureWriteInt( cl->gotCP );
+	SV_CaptureWriteString( cl->userinfo );
+	SV_CaptureWriteString( cl->lastClientCommandString );
+	SV_CaptureWriteString( Cvar_VariableString( va( "session%i", (int)( cl - svs.clients ) ) ) );
+
+	// the unacknowledged reliable commands, the oldest of them keys the netchan
+	first = cl->reliableAcknowledge;
+	if ( cl->reliableSequence - first >= MAX_RELIABLE_COMMANDS ) {
+		first = cl->reliableSequence - MAX_RELIABLE_COMMANDS + 1;
+	}
+	SV_CaptureWriteInt( first );
+	for ( i = first ; i <= cl->reliableSequence ; i++ ) {
+		SV_CaptureWriteString( cl->reliableCommands[i & ( MAX_RELIABLE_COMMANDS - 1 )] );
+	}
+}
+
+/*
+==================
+SV_CaptureBegin
+==================
+*/
+static void SV_CaptureBegin( const char *mapname ) {
+	fileHandle_t	f;
+	int				i, numClients;
+
+	capture.armed = qfalse;
+
+	f = FS_FOpenFileWrite( capture.name );
+	if ( !f ) {
+		Com_Printf( "ERROR: couldn't open %s.\n", capture.name );
+		return;
+	}
+	capture.stream = SV_DemoOpen( f );
+	if ( !capture.stream ) {
+		return;
+	}
+
+	SV_DemoWrite( capture.stream, "SVCP", 4 );
+	SV_CaptureWriteInt( CAPTURE_VERSION );
+	SV_CaptureWriteInt( PROTOCOL_VERSION );
+	SV_CaptureWriteString( mapname );
+	SV_CaptureWriteInt( sv.randomSeed );
+	SV_CaptureWriteInt( sv.serverId );
+	SV_CaptureWriteInt( svs.time );
+	SV_CaptureWriteInt( sv_fps->integer );
+	SV_CaptureWriteInt( sv_maxclients->integer );
+	SV_CaptureWriteString( Cvar_InfoString( CVAR_SERVERINFO ) );
+	SV_CaptureWriteString( Cvar_VariableString( "session" ) );
+
+	numClients = 0;
+	for ( i = 0 ; i < sv_maxclients->integer ; i++ ) {
+		if ( svs.clients[i].state >= CS_CONNECTED ) {
+			numClients++;
+		}
+	}
+	SV_CaptureWriteInt( numClients );
+	for ( i = 0 ; i < sv_maxclients->integer ; i++ ) {
+		if ( svs.clients[i].state >= CS_CONNECTED ) {
+			SV_CaptureWriteClient( &svs.clients[i] );
+		}
+	}
+
+	capture.baseTime = com_frameTime;
+	capture.baseRealTime = Sys_Milliseconds();
+	capture.numPackets = 0;
+	capture.numFrames = 0;
+	capture.bytes = 0;
+
+	Com_Printf( "capturing to %s.\n", capture.name );
+}
+
+/*
+==================
+SV_CaptureStop
+==================
+*/
+static void SV_CaptureStop( void ) {
+	if ( !capture.stream ) {
+		return;
+	}
+
+	SV_CaptureWriteInt( cap_eof );
+	SV_DemoClose( capture.stream );
+	capture.stream = NULL;
+
+	Com_Printf( "Stopped capture %s: %i packets, %i frames, %i KB.\n", capture.name,
+		capture.numPackets, capture.numFrames, (int)( capture.bytes >> 10 ) );
+}
+
+/*
+==================
+SV_CapturePacket
+
+Called by SV_PacketEvent for everything it is handed, connectionless or not
+==================
+*/
+void SV_CapturePacket( netadr_t from, msg_t *msg ) {
+	int		rec[6];
+
+	if ( !capture.stream || from.type == NA_LOOPBACK || from.type == NA_BOT ) {
+		return;
+	}
+
+	rec[0] = LittleLong( cap_packet );
+	rec[1] = LittleLong( Sys_Milliseconds() - capture.baseRealTime );
+	rec[2] = LittleLong( from.type );
+	Com_Memcpy( &rec[3], from.ip, 4 );
+	rec[4] = LittleLong( from.port );
+	rec[5] = LittleLong( msg->cursize );
+	SV_DemoWrite( capture.stream, rec, sizeof( rec ) );
+	SV_DemoWrite( capture.stream, msg->data, msg->cursize );
+
+	capture.numPackets++;
+	capture.bytes += sizeof( rec ) + msg->cursize;
+}
+
+/*
+=============================================================================
+
+REPLAY
+
+=============================================================================
+*/
+
+/*
+==================
+SV_ReplayReadInt
+==================
+*/
+static qboolean SV_ReplayReadInt( int *value ) {
+	if ( FS_Read( value, 4, replay.f ) != 4 ) {
+		return qfalse;
+	}
+	*value = LittleLong( *value );
+	return qtrue;
+}
+
+/*
+==================
+SV_ReplayReadString
+==================
+*/
+static qboolean SV_ReplayReadString( char *buf, int size ) {
+	int		len;
+
+	if ( !SV_ReplayReadInt( &len ) || len < 0 || len >= size ) {
+		return qfalse;
+	}
+	if ( FS_Read( buf, len, replay.f ) != len ) {
+		return qfalse;
+	}
+	buf[len] = 0;
+	return qtrue;
+}
+
+/*
+==================
+SV_ReplayReadRecord
+
+Loads the next record, a short or broken file simply ends the replay
+==================
+*/
+static void SV_ReplayReadRecord( void ) {
+	int		type, port;
+
+	replay.nextType = cap_eof;
+
+	if ( !SV_ReplayReadInt( &type ) || !SV_ReplayReadInt( &replay.nextTime ) ) {
+		return;
+	}
+
+	if ( type == cap_frame ) {
+		replay.nextType = cap_frame;
+		return;
+	}
+	if ( type != cap_packet ) {
+		return;
+	}
+
+	Com_Memset( &replay.nextFrom, 0, sizeof( replay.nextFrom ) );
+	if ( !SV_ReplayReadInt( (int *)&replay.nextFrom.type )
+		|| FS_Read( replay.nextFrom.ip, 4, replay.f ) != 4
+		|| !SV_ReplayReadInt( &port )
+		|| !SV_ReplayReadInt( &replay.nextLength ) ) {
+		return;
+	}
+	replay.nextFrom.port = port;
+	if ( (unsigned)replay.nextLength > sizeof( replay.packet ) ) {
+		Com_Printf( "WARNING: bad packet record in %s\n", replay.name );
+		return;
+	}
+	if ( FS_Read( replay.packet, replay.nextLength, replay.f ) != replay.nextLength ) {
+		return;
+	}
+
+	replay.nextType = cap_packet;
+}
+
+/*
+==================
+SV_ReplayReadClient
+
+Puts a client back the way it was when the captured map spawned,
+before SV_SpawnServer reconnects everyone that was carried over
+==================
+*/
+static qboolean SV_ReplayReadClient( void ) {
+	client_t	*cl;
+	netadr_t	adr;
+	int			v[21], i, first;
+	char		session[MAX_STRING_CHARS];
+
+	Com_Memset( &adr, 0, sizeof( adr ) );
+	if ( !SV_ReplayReadInt( &v[0] ) || !SV_ReplayReadInt( &v[1] ) || !SV_ReplayReadInt( (int *)&adr.type )
+		|| FS_Read( adr.ip, 4, replay.f ) != 4 ) {
+		return qfalse;
+	}
+	for ( i = 2 ; i < 21 ; i++ ) {
+		if ( !SV_ReplayReadInt( &v[i] ) ) {
+			return qfalse;
+		}
+	}
+	if ( v[0] < 0 || v[0] >= sv_maxclients->integer ) {
+		return qfalse;
+	}
+
+	cl = &svs.clients[v[0]];
+	Com_Memset( cl, 0, sizeof( *cl ) );
+
+	adr.port = v[2];
+	Netchan_Setup( NS_SERVER, &cl->netchan, adr, v[3] );
+	cl->netchan.incomingSequence = v[4];
+	cl->netchan.outgoingSequence = v[5];
+	cl->challenge = v[6];
+	cl->reliableSequence = v[7];
+	cl->reliableAcknowledge = v[8];
+	cl->reliableSent = v[9];
+	cl->messageAcknowledge = v[10];
+	cl->gamestateMessageNum = v[11];
+	cl->lastMessageNum = v[12];
+	cl->lastClientCommand = v[13];
+	cl->deltaMessage = v[14];
+	cl->lastPacketTime = v[15];
+	cl->lastConnectTime = v[16];
+	cl->nextSnapshotTime = v[17];
+	cl->oldServerTime = v[18];
+	cl->pureAuthentic = v[19];
+	cl->gotCP = (qboolean)v[20];
+
+	if ( !SV_ReplayReadString( cl->userinfo, sizeof( cl->userinfo ) )
+		|| !SV_ReplayReadString( cl->lastClientCommandString, sizeof( cl->lastClientCommandString ) )
+		|| !SV_ReplayReadString( session, sizeof( session ) )
+		|| !SV_ReplayReadInt( &first ) ) {
+		return qfalse;
+	}
+	if ( cl->reliableSequence - first >= MAX_RELIABLE_COMMANDS || first > cl->reliableSequence + 1 ) {
+		return qfalse;
+	}
+	for ( i = first ; i <= cl->reliableSequence ; i++ ) {
+		if ( !SV_ReplayReadString( cl->reliableCommands[i & ( MAX_RELIABLE_COMMANDS - 1 )], MAX_STRING_CHARS ) ) {
+			return qfalse;
+		}
+	}
+
+	Cvar_Set( va( "session%i", v[0] ), session );
+	SV_UserinfoChanged( cl );
+	cl->state = (clientState_t)v[1];
+
+	return qtrue;
+}
+
+/*
+==================
+SV_ReplayClose
+==================
+*/
+static void SV_ReplayClose( void ) {
+	if ( replay.f ) {
+		FS_FCloseFile( replay.f );
+	}
+	if ( replay.ticks ) {
+		Z_Free( replay.ticks );
+	}
+	Com_Memset( &replay, 0, sizeof( replay ) );
+}
+
+/*
+==================
+SV_ReplayBegin
+==================
+*/
+static void SV_ReplayBegin( const char *mapname ) {
+	int		i, numClients;
+
+	replay.pending = qfalse;
+
+	if ( Q_stricmp( mapname, replay.mapname ) ) {
+		Com_Printf( "Replay of %s cancelled, %s was loaded instead of %s.\n", replay.name, mapname, replay.mapname );
+		SV_ReplayClose();
+		return;
+	}
+
+	sv.randomSeed = replay.seed;
+	sv.serverId = replay.serverId;
+	svs.time = replay.svsTime;
+
+	if ( !SV_ReplayReadInt( &numClients ) ) {
+		numClients = -1;
+	}
+	for ( i = 0 ; i < numClients ; i++ ) {
+		if ( !SV_ReplayReadClient() ) {
+			break;
+		}
+	}
+	if ( i != numClients ) {
+		Com_Printf( "Replay of %s cancelled, bad client state.\n", replay.name );
+		SV_ReplayClose();
+		return;
+	}
+
+	replay.running = qtrue;
+	replay.baseTime = com_frameTime;
+	replay.startUsec = Sys_Microseconds();
+	SV_ReplayReadRecord();
+
+	Com_Printf( "replaying %s with %i clients.\n", replay.name, numClients );
+}
+
+/*
+==================
+SV_ReplayTickCompare
+==================
+*/
+static int SV_ReplayTickCompare( const void *a, const void *b ) {
+	return *(const int *)a - *(const int *)b;
+}
+
+/*
+==================
+SV_ReplayReport
+==================
+*/
+static void SV_ReplayReport( const char *why ) {
+	static const int	edges[] = { 250, 500, 1000, 2000, 5000, 10000, 25000, 50000 };
+	const int			numEdges = ARRAY_LEN( edges );
+	int					counts[ARRAY_LEN( edges ) + 1];
+	int					*sorted, worst[REPLAY_WORST_TICKS], numWorst;
+	int					i, j, budget, over;
+	int64_t				total;
+	fileHandle_t		f;
+	char				csvName[MAX_OSPATH];
+
+	Com_Printf( "Replay of %s %s after %i ticks, %i packets in %.2f seconds.\n", replay.name, why,
+		replay.numTicks, replay.numPackets, ( Sys_Microseconds() - replay.startUsec ) / 1000000.0 );
+	Com_Printf( "output: %i packets, checksum %08x\n", replay.outputPackets, replay.outputHash );
+
+	if ( !replay.numTicks ) {
+		return;
+	}
+
+	sorted = (int *)Z_Malloc( replay.numTicks * sizeof( int ), TAG_GENERAL, qfalse );
+	total = 0;
+	for ( i = 0 ; i < replay.numTicks ; i++ ) {
+		sorted[i] = replay.ticks[i].usec;
+		total += sorted[i];
+	}
+	qsort( sorted, replay.numTicks, sizeof( int ), SV_ReplayTickCompare );
+
+	Com_Printf( "tick usec: avg %i  p50 %i  p90 %i  p99 %i  p99.9 %i  max %i\n",
+		(int)( total / replay.numTicks ),
+		sorted[replay.numTicks * 50 / 100],
+		sorted[replay.numTicks * 90 / 100],
+		sorted[replay.numTicks * 99 / 100],
+		sorted[replay.numTicks * 999 / 1000],
+		sorted[replay.numTicks - 1] );
+	Z_Free( sorted );
+
+	Com_Memset( counts, 0, sizeof( counts ) );
+	budget = 1000000 / sv_fps->integer;
+	over = 0;
+	for ( i = 0 ; i < replay.numTicks ; i++ ) {
+		for ( j = 0 ; j < numEdges && replay.ticks[i].usec >= edges[j] ; j++ ) {
+		}
+		counts[j]++;
+		if ( replay.ticks[i].usec > budget ) {
+			over++;
+		}
+	}
+	for ( j = 0 ; j <= numEdges ; j++ ) {
+		if ( j < numEdges ) {
+			Com_Printf( "  < %6i usec %7i  %5.1f%%\n", edges[j], counts[j], 100.0f * counts[j] / replay.numTicks );
+		} else {
+			Com_Printf( " >= %6i usec %7i  %5.1f%%\n", edges[j - 1], counts[j], 100.0f * counts[j] / replay.numTicks );
+		}
+	}
+	Com_Printf( "%i ticks over the %i usec budget of sv_fps %i\n", over, budget, sv_fps->integer );
+
+	// the spikes, with what came in just before them
+	numWorst = 0;
+	for ( i = 0 ; i < replay.numTicks ; i++ ) {
+		for ( j = numWorst ; j > 0 && replay.ticks[i].usec > replay.ticks[worst[j - 1]].usec ; j-- ) {
+			if ( j < REPLAY_WORST_TICKS ) {
+				worst[j] = worst[j - 1];
+			}
+		}
+		if ( j < REPLAY_WORST_TICKS ) {
+			worst[j] = i;
+			if ( numWorst < REPLAY_WORST_TICKS ) {
+				numWorst++;
+			}
+		}
+	}
+	for ( j = 0 ; j < numWorst ; j++ ) {
+		Com_Printf( "worst %i: tick %i sv.time %i  %i usec  %i packets  %i bytes\n", j + 1, worst[j],
+			replay.ticks[worst[j]].svTime, replay.ticks[worst[j]].usec,
+			replay.ticks[worst[j]].packets, replay.ticks[worst[j]].bytes );
+	}
+
+	// every tick, for comparing two builds against the same capture
+	COM_StripExtension( replay.name, csvName, sizeof( csvName ) );
+	Q_strcat( csvName, sizeof( csvName ), ".replay.csv" );
+	f = FS_FOpenFileWrite( csvName );
+	if ( !f ) {
+		return;
+	}
+	FS_Printf( f, "tick,svtime,usec,packets,bytes\n" );
+	for ( i = 0 ; i < replay.numTicks ; i++ ) {
+		FS_Printf( f, "%i,%i,%i,%i,%i\n", i, replay.ticks[i].svTime, replay.ticks[i].usec,
+			replay.ticks[i].packets, replay.ticks[i].bytes );
+	}
+	FS_FCloseFile( f );
+	Com_Printf( "profile written to %s\n", csvName );
+}
+
+/*
+==================
+SV_ReplayFinish
+==================
+*/
+static void SV_ReplayFinish( const char *why ) {
+	qboolean	quit = replay.quit;
+
+	if ( !replay.running ) {
+		return;
+	}
+
+	SV_ReplayReport( why );
+	SV_ReplayClose();
+
+	if ( quit ) {
+		Cbuf_AddText( "quit\n" );
+	}
+}
+
+/*
+==================
+SV_Replaying
+==================
+*/
+qboolean SV_Replaying( void ) {
+	return replay.running;
+}
+
+/*
+==================
+SV_ReplayGetEvent
+
+Called by Com_GetRealEvent, takes the place of the system's events while
+a replay runs. A frame record is handed out as SE_NONE at its time until
+SV_Frame takes it, so Com_Milliseconds can look at it as often as it likes.
+==================
+*/
+qboolean SV_ReplayGetEvent( sysEvent_t *ev ) {
+	netadr_t	*buf;
+	int			len;
+
+	if ( !replay.running ) {
+		return qfalse;
+	}
+
+	if ( replay.nextType == cap_eof ) {
+		SV_ReplayFinish( "finished" );
+		return qfalse;
+	}
+
+	Com_Memset( ev, 0, sizeof( *ev ) );
+
+	if ( replay.nextType == cap_frame ) {
+		ev->evType = SE_NONE;
+		ev->evTime = replay.baseTime + replay.nextTime;
+		return qtrue;
+	}
+
+	len = sizeof( netadr_t ) + replay.nextLength;
+	buf = (netadr_t *)Z_Malloc( len, TAG_EVENT, qfalse );
+	*buf = replay.nextFrom;
+	Com_Memcpy( buf + 1, replay.packet, replay.nextLength );
+
+	ev->evType = SE_PACKET;
+	ev->evTime = replay.baseTime + replay.nextTime;
+	ev->evPtrLength = len;
+	ev->evPtr = buf;
+
+	replay.numPackets++;
+	replay.tickPackets++;
+	replay.tickBytes += replay.nextLength;
+
+	SV_ReplayReadRecord();
+	return qtrue;
+}
+
+/*
+==================
+SV_ReplayOutput
+
+Called by NET_SendPacket for the server's packets. The addresses in a
+capture are real players, so nothing goes out while replaying; what would
+have is folded into a checksum instead, which stays the same between runs
+of one build as long as the game module is deterministic.
+==================
+*/
+qboolean SV_ReplayOutput( int length, const void *data ) {
+	const byte	*p = (const byte *)data;
+	int			i;
+
+	if ( !replay.running ) {
+		return qfalse;
+	}
+
+	for ( i = 0 ; i < length ; i++ ) {
+		replay.outputHash = ( replay.outputHash ^ p[i] ) * 16777619;
+	}
+	replay.outputPackets++;
+
+	return qtrue;
+}
+
+/*
+=============================================================================
+
+SERVER HOOKS
+
+=============================================================================
+*/
+
+/*
+==================
+SV_CaptureSpawn
+
+Called by SV_SpawnServer once the old map is gone and the new seed and
+serverid are picked, but before the carried over clients reconnect.
+A capture covers one map.
+==================
+*/
+void SV_CaptureSpawn( const char *mapname ) {
+	SV_CaptureStop();
+	SV_ReplayFinish( "stopped by a map change" );
+
+	if ( replay.pending ) {
+		SV_ReplayBegin( mapname );
+	} else if ( capture.armed ) {
+		SV_CaptureBegin( mapname );
+	}
+}
+
+/*
+==================
+SV_CaptureFrame
+
+Called at the start of SV_Frame
+==================
+*/
+void SV_CaptureFrame( void ) {
+	if ( capture.stream ) {
+		SV_CaptureWriteInt( cap_frame );
+		SV_CaptureWriteInt( com_frameTime - capture.baseTime );
+		capture.bytes += 8;
+		capture.numFrames++;
+	} else if ( replay.running && replay.nextType == cap_frame ) {
+		SV_ReplayReadRecord();
+	}
+}
+
+/*
+==================
+SV_CaptureFrameDone
+
+Called by SV_Frame after a frame that ran the game. A replay tick is
+everything since the last one: the packets before it and the frame itself.
+==================
+*/
+void SV_CaptureFrameDone( void ) {
+	replayTick_t	*tick;
+	int64_t			now;
+
+	if ( !replay.running ) {
+		return;
+	}
+
+	now = Sys_Microseconds();
+
+	// the first tick also carries the rest of the map load
+	if ( !replay.lastTickUsec ) {
+		replay.lastTickUsec = now;
+		replay.tickPackets = 0;
+		replay.tickBytes = 0;
+		return;
+	}
+
+	if ( replay.numTicks == replay.maxTicks ) {
+		replayTick_t	*old = replay.ticks;
+
+		replay.maxTicks = replay.maxTicks ? replay.maxTicks * 2 : 4096;
+		replay.ticks = (replayTick_t *)Z_Malloc( replay.maxTicks * sizeof( replayTick_t ), TAG_GENERAL, qfalse );
+		if ( old ) {
+			Com_Memcpy( replay.ticks, old, replay.numTicks * sizeof( replayTick_t ) );
+			Z_Free( old );
+		}
+	}
+
+	tick = &replay.ticks[replay.numTicks++];
+	tick->svTime = sv.time;
+	tick->usec = (int)( now - replay.lastTickUsec );
+	tick->packets = replay.tickPackets;
+	tick->bytes = replay.tickBytes;
+
+	replay.lastTickUsec = now;
+	replay.tickPackets = 0;
+	replay.tickBytes = 0;
+}
+
+/*
+==================
+SV_CaptureShutdown
+==================
+*/
+void SV_CaptureShutdown( void ) {
+	SV_CaptureStop();
+	SV_ReplayFinish( "stopped by a server shutdown" );
+	if ( replay.pending ) {
+		SV_ReplayClose();
+	}
+}
+
+/*
+=============================================================================
+
+COMMANDS
+
+=============================================================================
+*/
+
+/*
+==================
+SV_Capture_f
+
+svcapture <name>
+==================
+*/
+void SV_Capture_f( void ) {
+	if ( Cmd_Argc() != 2 ) {
+		Com_Printf( "svcapture <name>\n" );
+		return;
+	}
+
+	if ( capture.stream || capture.armed ) {
+		Com_Printf( "Already capturing to %s.\n", capture.name );
+		return;
+	}
+	if ( replay.running || replay.pending ) {
+		Com_Printf( "Can't capture during a replay.\n" );
+		return;
+	}
+
+	Com_sprintf( capture.name, sizeof( capture.name ), "captures/%s.svcap", Cmd_Argv( 1 ) );
+	capture.armed = qtrue;
+
+	Com_Printf( "%s will be captured from the next map load on.\n", capture.name );
+}
+
+/*
+==================
+SV_StopCapture_f
+==================
+*/
+void SV_StopCapture_f( void ) {
+	if ( capture.armed ) {
+		capture.armed = qfalse;
+		Com_Printf( "Capture to %s cancelled.\n", capture.name );
+		return;
+	}
+	if ( !capture.stream ) {
+		Com_Printf( "No capture running.\n" );
+		return;
+	}
+
+	SV_CaptureStop();
+}
+
+/*
+==================
+SV_Replay_f
+
+svreplay <name> [quit]
+==================
+*/
+void SV_Replay_f( void ) {
+	char	info[BIG_INFO_STRING], session[MAX_STRING_CHARS];
+	char	key[BIG_INFO_KEY], value[BIG_INFO_VALUE];
+	char	ident[4];
+	const char	*s;
+	int		version, protocol, fps, maxclients;
+	int		i;
+
+	if ( Cmd_Argc() < 2 || Cmd_Argc() > 3 || ( Cmd_Argc() == 3 && Q_stricmp( Cmd_Argv( 2 ), "quit" ) ) ) {
+		Com_Printf( "svreplay <name> [quit]\n" );
+		return;
+	}
+
+	if ( replay.running || replay.pending ) {
+		Com_Printf( "Already replaying %s.\n", replay.name );
+		return;
+	}
+	if ( capture.stream || capture.armed ) {
+		Com_Printf( "Can't replay during a capture.\n" );
+		return;
+	}
+	if ( com_sv_running->integer ) {
+		for ( i = 0 ; i < sv_maxclients->integer ; i++ ) {
+			if ( svs.clients[i].state >= CS_CONNECTED && svs.clients[i].netchan.remoteAddress.type != NA_BOT ) {
+				Com_Printf( "svreplay needs a server without players.\n" );
+				return;
+			}
+		}
+	}
+
+	Com_sprintf( replay.name, sizeof( replay.name ), "captures/%s.svcap", Cmd_Argv( 1 ) );
+	FS_FOpenFileRead( replay.name, &replay.f, qtrue );
+	if ( !replay.f ) {
+		Com_Printf( "Couldn't open %s.\n", replay.name );
+		SV_ReplayClose();
+		return;
+	}
+
+	if ( FS_Read( ident, 4, replay.f ) != 4 || memcmp( ident, "SVCP", 4 )
+		|| !SV_ReplayReadInt( &version ) || !SV_ReplayReadInt( &protocol ) ) {
+		Com_Printf( "%s is not a capture.\n", replay.name );
+		SV_ReplayClose();
+		return;
+	}
+	if ( version != CAPTURE_VERSION || protocol != PROTOCOL_VERSION ) {
+		Com_Printf( "%s is capture version %i protocol %i, expected %i and %i.\n", replay.name,
+			version, protocol, CAPTURE_VERSION, PROTOCOL_VERSION );
+		SV_ReplayClose();
+		return;
+	}
+	if ( !SV_ReplayReadString( replay.mapname, sizeof( replay.mapname ) )
+		|| !SV_ReplayReadInt( &replay.seed )
+		|| !SV_ReplayReadInt( &replay.serverId )
+		|| !SV_ReplayReadInt( &replay.svsTime )
+		|| !SV_ReplayReadInt( &fps )
+		|| !SV_ReplayReadInt( &maxclients )
+		|| !SV_ReplayReadString( info, sizeof( info ) )
+		|| !SV_ReplayReadString( session, sizeof( session ) ) ) {
+		Com_Printf( "%s has a broken header.\n", replay.name );
+		SV_ReplayClose();
+		return;
+	}
+
+	// the rest of the setup has to come from the same config
+	s = info;
+	while ( Info_NextPair( &s, key, value ) && key[0] ) {
+		if ( Q_stricmp( Cvar_VariableString( key ), value ) && Q_stricmp( key, "sv_maxclients" ) ) {
+			Com_Printf( S_COLOR_YELLOW "WARNING: %s is \"%s\" here but was \"%s\" when captured\n",
+				key, Cvar_VariableString( key ), value );
+		}
+	}
+
+	Cvar_Set( "sv_fps", va( "%i", fps ) );
+	Cvar_Set( "sv_maxclients", va( "%i", maxclients ) );
+	Cvar_Set( "session", session );
+
+	replay.quit = (qboolean)( Cmd_Argc() == 3 );
+	replay.pending = qtrue;
+	Cbuf_AddText( va( "map %s\n", replay.mapname ) );
+}
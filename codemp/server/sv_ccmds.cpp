@@ -261,6 +261,7 @@ static void SV_MapRestart_f( void ) {
 	}
 
 	SV_StopAutoRecordDemos();
+	SV_MVDemoStop();
 
 	// toggle the server bit so clients can detect that a
 	// map_restart has happened
@@ -547,26 +548,50 @@ static void SV_KickNum_f( void ) {
 	cl->lastPacketTime = svs.time;	// in case there is a funny zombie
 }
 
+static int serverBansAlloc = 0;
+
 /*
 ==================
-SV_RehashBans_f
+SV_AllocBanEntry
 
-Load saved bans from file.
+Append a cleared entry to a ban list, growing it as needed.
 ==================
 */
-static void SV_RehashBans_f( void )
+static serverBan_t *SV_AllocBanEntry( serverBan_t **list, int *count, int *alloc )
 {
-	int index, filelen;
-	fileHandle_t readfrom;
-	char *textbuf, *curpos, *maskpos, *newlinepos, *endpos;
-	char filepath[MAX_QPATH];
+	if ( *count == *alloc )
+	{
+		serverBan_t *grown;
 
-	// make sure server is running
-	if ( !com_sv_running->integer ) {
-		return;
+		*alloc = *alloc ? *alloc * 2 : 64;
+		grown = (serverBan_t *)Z_Malloc( *alloc * sizeof( serverBan_t ), TAG_GENERAL, qtrue );
+		if ( *list )
+		{
+			memcpy( grown, *list, *count * sizeof( serverBan_t ) );
+			Z_Free( *list );
+		}
+		*list = grown;
 	}
 
-	serverBansCount = 0;
+	memset( &(*list)[*count], 0, sizeof( serverBan_t ) );
+	return &(*list)[(*count)++];
+}
+
+/*
+==================
+SV_ReadBans
+
+Load saved bans from file into a new list.
+==================
+*/
+static void SV_ReadBans( serverBan_t **list, int *count, int *alloc )
+{
+	int filelen;
+	fileHandle_t readfrom;
+	char *textbuf, *curpos, *maskpos, *newlinepos, *endpos;
+	char filepath[MAX_QPATH];
+	serverBan_t *curban;
+	netadr_t ip;
 
 	if ( !sv_banFile->string || !*sv_banFile->string )
 		return;
@@ -589,7 +614,7 @@ static void SV_RehashBans_f( void )
 
 		endpos = textbuf + filelen;
 
-		for ( index = 0; index < SERVER_MAXBANS && curpos + 2 < endpos; index++ )
+		while ( curpos + 2 < endpos )
 		{
 			// find the end of the address string
 			for ( maskpos = curpos + 2; maskpos < endpos && *maskpos != ' '; maskpos++ );
@@ -608,27 +633,56 @@ static void SV_RehashBans_f( void )
 
 			*newlinepos = '\0';
 
-			if ( NET_StringToAdr( curpos + 2, &serverBans[index].ip ) )
+			if ( NET_StringToAdr( curpos + 2, &ip ) )
 			{
-				serverBans[index].isexception = (qboolean)(curpos[0] != '0');
-				serverBans[index].subnet = atoi( maskpos );
+				curban = SV_AllocBanEntry( list, count, alloc );
+				curban->ip = ip;
+				curban->isexception = (qboolean)(curpos[0] != '0');
+				curban->subnet = atoi( maskpos );
 
-				if ( serverBans[index].ip.type == NA_IP &&
-					(serverBans[index].subnet < 1 || serverBans[index].subnet > 32) )
+				if ( curban->ip.type == NA_IP &&
+					(curban->subnet < 1 || curban->subnet > 32) )
 				{
-					serverBans[index].subnet = 32;
+					curban->subnet = 32;
 				}
 			}
 
 			curpos = newlinepos + 1;
 		}
 
-		serverBansCount = index;
-
 		Z_Free( textbuf );
 	}
 }
 
+/*
+==================
+SV_RehashBans_f
+
+Load saved bans from file, replacing the current list only once the
+new one is complete.
+==================
+*/
+static void SV_RehashBans_f( void )
+{
+	serverBan_t *bans = NULL;
+	int count = 0, alloc = 0;
+
+	// make sure server is running
+	if ( !com_sv_running->integer ) {
+		return;
+	}
+
+	SV_ReadBans( &bans, &count, &alloc );
+
+	if ( serverBans )
+		Z_Free( serverBans );
+	serverBans = bans;
+	serverBansCount = count;
+	serverBansAlloc = alloc;
+
+	SV_RebuildBanTrie();
+}
+
 /*
 ==================
 SV_WriteBans
@@ -675,16 +729,12 @@ Remove a ban or an exception from the list.
 
 static qboolean SV_DelBanEntryFromList( int index )
 {
-	if ( index == serverBansCount - 1 )
-		serverBansCount--;
-	else if ( index < ARRAY_LEN( serverBans ) - 1 )
-	{
-		memmove( serverBans + index, serverBans + index + 1, (serverBansCount - index - 1) * sizeof( *serverBans ) );
-		serverBansCount--;
-	}
-	else
+	if ( index < 0 || index >= serverBansCount )
 		return qtrue;
 
+	memmove( serverBans + index, serverBans + index + 1, (serverBansCount - index - 1) * sizeof( *serverBans ) );
+	serverBansCount--;
+
 	return qfalse;
 }
 
@@ -760,12 +810,6 @@ static void SV_AddBanToList( qboolean isexception )
 		return;
 	}
 
-	if ( serverBansCount >= ARRAY_LEN( serverBans ) )
-	{
-		Com_Printf( "Error: Maximum number of bans/exceptions exceeded.\n" );
-		return;
-	}
-
 	banstring = Cmd_Argv( 1 );
 
 	if ( strchr( banstring, '.' ) /*|| strchr( banstring, ':' )*/ )
@@ -859,12 +903,12 @@ static void SV_AddBanToList( qboolean isexception )
 			index++;
 	}
 
-	serverBans[serverBansCount].ip = ip;
-	serverBans[serverBansCount].subnet = mask;
-	serverBans[serverBansCount].isexception = isexception;
-
-	serverBansCount++;
+	curban = SV_AllocBanEntry( &serverBans, &serverBansCount, &serverBansAlloc );
+	curban->ip = ip;
+	curban->subnet = mask;
+	curban->isexception = isexception;
 
+	SV_RebuildBanTrie();
 	SV_WriteBans();
 
 	Com_Printf( "Added %s: %s/%d\n", isexception ? "ban exception" : "ban",
@@ -959,6 +1003,7 @@ static void SV_DelBanFromList( qboolean isexception )
 		}
 	}
 
+	SV_RebuildBanTrie();
 	SV_WriteBans();
 }
 
@@ -1025,6 +1070,7 @@ static void SV_FlushBans_f( void )
 	}
 
 	serverBansCount = 0;
+	SV_RebuildBanTrie();
 
 	// empty the ban file.
 	SV_WriteBans();
@@ -1315,6 +1361,116 @@ void SV_Heartbeat_f( void ) {
 	svs.nextHeartbeatTime = -9999999;
 }
 
+/*
+===========
+SV_EgressStatus_f
+
+Shows how often sv_maxTotalRate has held back each client
+===========
+*/
+static void SV_EgressStatus_f( void ) {
+	int			i;
+	client_t	*cl;
+
+	// make sure server is running
+	if ( !com_sv_running->integer ) {
+		Com_Printf( "Server is not running.\n" );
+		return;
+	}
+
+	if ( sv_maxTotalRate->integer ) {
+		Com_Printf( "sv_maxTotalRate %i, %i bytes left this frame\n", sv_maxTotalRate->integer, svs.egressTokens );
+	} else {
+		Com_Printf( "sv_maxTotalRate is off\n" );
+	}
+
+	Com_Printf ("cl name            rate  deferred lastsent\n");
+	Com_Printf ("-- --------------- ----- -------- --------\n");
+	for ( i = 0, cl = svs.clients ; i < sv_maxclients->integer ; i++, cl++ ) {
+		if ( !cl->state || cl->netchan.remoteAddress.type == NA_BOT ) {
+			continue;
+		}
+
+		Com_Printf ("%2i %-15.15s ^7%5i %8i %8i\n",
+			i,
+			cl->name,
+			cl->rate,
+			cl->egressDeferred,
+			svs.time - cl->lastEgressTime
+			);
+	}
+	Com_Printf ("\n");
+}
+
+/*
+===========
+SV_NetStatus_f
+
+Traffic per client over the last NETSTAT_SECONDS, and the server's sum of it
+===========
+*/
+static void SV_NetStatus_f( void ) {
+	int			i, j, count;
+	client_t	*cl;
+	float		rates[NETSTAT_MAX], sum[NETSTAT_MAX];
+	int64_t		totalOut;
+
+	// make sure server is running
+	if ( !com_sv_running->integer ) {
+		Com_Printf( "Server is not running.\n" );
+		return;
+	}
+
+	for ( j = 0 ; j < NETSTAT_MAX ; j++ ) {
+		sum[j] = 0;
+	}
+	totalOut = 0;
+	count = 0;
+
+	Com_Printf ("cl name            out KB/s pkt/s frag/s msg/s avgmsg maxmsg choke%% defer/s stall/s ents/s  in KB/s pkt/s loss%% total MB\n");
+	Com_Printf ("-- --------------- -------- ----- ------ ----- ------ ------ ------ ------- ------- ------ -------- ----- ----- --------\n");
+	for ( i = 0, cl = svs.clients ; i < sv_maxclients->integer ; i++, cl++ ) {
+		if ( !cl->state || cl->netchan.remoteAddress.type == NA_BOT ) {
+			continue;
+		}
+
+		SV_NetStatsRates( cl, rates );
+		for ( j = 0 ; j < NETSTAT_MAX ; j++ ) {
+			sum[j] += rates[j];
+		}
+		totalOut += cl->netStats.total[NETSTAT_BYTES_OUT];
+		count++;
+
+		Com_Printf ("%2i %-15.15s ^7%8.1f %5.1f %6.1f %5.1f %6i %6i %6.1f %7.1f %7.1f %6.1f %8.1f %5.1f %5.1f %8.2f\n",
+			i,
+			cl->name,
+			rates[NETSTAT_BYTES_OUT] / 1024,
+			rates[NETSTAT_PACKETS_OUT],
+			rates[NETSTAT_FRAGMENTS_OUT],
+			rates[NETSTAT_MESSAGES],
+			rates[NETSTAT_MESSAGES] ? (int)( rates[NETSTAT_MESSAGE_BYTES] / rates[NETSTAT_MESSAGES] ) : 0,
+			cl->netStats.largestMessage,
+			rates[NETSTAT_MESSAGES] ? 100 * rates[NETSTAT_CHOKED] / rates[NETSTAT_MESSAGES] : 0,
+			rates[NETSTAT_DEFERRED],
+			rates[NETSTAT_STALLED],
+			rates[NETSTAT_ENTITIES_DEFERRED],
+			rates[NETSTAT_BYTES_IN] / 1024,
+			rates[NETSTAT_PACKETS_IN],
+			rates[NETSTAT_PACKETS_IN] ? 100 * rates[NETSTAT_DROPPED_IN] / ( rates[NETSTAT_PACKETS_IN] + rates[NETSTAT_DROPPED_IN] ) : 0,
+			cl->netStats.total[NETSTAT_BYTES_OUT] / ( 1024.0 * 1024.0 )
+			);
+	}
+
+	Com_Printf ("\n%i clients: out %.1f KB/s in %i packets and %.1f fragments/s, in %.1f KB/s, %.1f MB sent since they connected\n",
+		count,
+		sum[NETSTAT_BYTES_OUT] / 1024,
+		(int)sum[NETSTAT_PACKETS_OUT],
+		sum[NETSTAT_FRAGMENTS_OUT],
+		sum[NETSTAT_BYTES_IN] / 1024,
+		totalOut / ( 1024.0 * 1024.0 ) );
+	Com_Printf ("(rates over the last %i seconds, payload bytes without UDP/IP headers, stall/s are messages sent while the client acknowledged nothing for %i messages, ents/s are entities held back by sv_snapshotEntityBudget)\n", NETSTAT_SECONDS, PACKET_BACKUP);
+}
+
 /*
 ===========
 SV_Serverinfo_f
@@ -1397,13 +1553,13 @@ void SV_WriteDemoMessage ( client_t *cl, msg_t *msg, int headerBytes ) {
 	// write the packet sequence
 	len = cl->netchan.outgoingSequence;
 	swlen = LittleLong( len );
-	FS_Write( &swlen, 4, cl->demo.demofile );
+	SV_DemoWrite( cl->demo.demofile, &swlen, 4 );
 
 	// skip the packet sequencing information
 	len = msg->cursize - headerBytes;
 	swlen = LittleLong( len );
-	FS_Write( &swlen, 4, cl->demo.demofile );
-	FS_Write( msg->data + headerBytes, len, cl->demo.demofile );
+	SV_DemoWrite( cl->demo.demofile, &swlen, 4 );
+	SV_DemoWrite( cl->demo.demofile, msg->data + headerBytes, len );
 }
 
 void SV_StopRecordDemo( client_t *cl ) {
@@ -1416,10 +1572,10 @@ void SV_StopRecordDemo( client_t *cl ) {
 
 	// finish up
 	len = -1;
-	FS_Write (&len, 4, cl->demo.demofile);
-	FS_Write (&len, 4, cl->demo.demofile);
-	FS_FCloseFile (cl->demo.demofile);
-	cl->demo.demofile = 0;
+	SV_DemoWrite( cl->demo.demofile, &len, 4 );
+	SV_DemoWrite( cl->demo.demofile, &len, 4 );
+	SV_DemoClose( cl->demo.demofile );
+	cl->demo.demofile = NULL;
 	cl->demo.demorecording = qfalse;
 	Com_Printf ("Stopped demo for client %d.\n", cl - svs.clients);
 }
@@ -1491,6 +1647,7 @@ void SV_RecordDemo( client_t *cl, char *demoName ) {
 	byte		bufData[MAX_MSGLEN];
 	msg_t		msg;
 	int			len;
+	fileHandle_t	f;
 
 	if ( cl->demo.demorecording ) {
 		Com_Printf( "Already recording.\n" );
@@ -1506,11 +1663,15 @@ void SV_RecordDemo( client_t *cl, char *demoName ) {
 	Q_strncpyz( cl->demo.demoName, demoName, sizeof( cl->demo.demoName ) );
 	Com_sprintf( name, sizeof( name ), "demos/%s.dm_%d", cl->demo.demoName, PROTOCOL_VERSION );
 	Com_Printf( "recording to %s.\n", name );
-	cl->demo.demofile = FS_FOpenFileWrite( name );
-	if ( !cl->demo.demofile ) {
+	f = FS_FOpenFileWrite( name );
+	if ( !f ) {
 		Com_Printf ("ERROR: couldn't open.\n");
 		return;
 	}
+	cl->demo.demofile = SV_DemoOpen( f );
+	if ( !cl->demo.demofile ) {
+		return;
+	}
 	cl->demo.demorecording = qtrue;
 
 	// don't start saving messages until a non-delta compressed message is received
@@ -1532,11 +1693,11 @@ void SV_RecordDemo( client_t *cl, char *demoName ) {
 
 	// write it to the demo file
 	len = LittleLong( cl->netchan.outgoingSequence - 1 );
-	FS_Write( &len, 4, cl->demo.demofile );
+	SV_DemoWrite( cl->demo.demofile, &len, 4 );
 
 	len = LittleLong( msg.cursize );
-	FS_Write( &len, 4, cl->demo.demofile );
-	FS_Write( msg.data, msg.cursize, cl->demo.demofile );
+	SV_DemoWrite( cl->demo.demofile, &len, 4 );
+	SV_DemoWrite( cl->demo.demofile, msg.data, msg.cursize );
 
 	// the rest of the demo file will be copied from net messages
 }
@@ -1736,11 +1897,15 @@ void SV_AddOperatorCommands( void ) {
 	Cmd_AddCommand ("kicknum", SV_KickNum_f);
 	Cmd_AddCommand ("clientkick", SV_KickNum_f);
 	Cmd_AddCommand ("status", SV_Status_f);
+	Cmd_AddCommand ("egressstatus", SV_EgressStatus_f);
+	Cmd_AddCommand ("netstatus", SV_NetStatus_f);
 	Cmd_AddCommand ("serverinfo", SV_Serverinfo_f);
 	Cmd_AddCommand ("systeminfo", SV_Systeminfo_f);
 	Cmd_AddCommand ("dumpuser", SV_DumpUser_f);
 	Cmd_AddCommand ("map_restart", SV_MapRestart_f);
 	Cmd_AddCommand ("sectorlist", SV_SectorList_f);
+	Cmd_AddCommand ("sv_areabench", SV_AreaBench_f);
+	Cmd_AddCommand ("contentsstats", SV_ContentsStats_f);
 	Cmd_AddCommand ("map", SV_Map_f);
 	Cmd_SetCommandCompletionFunc( "map", SV_CompleteMapName );
 	Cmd_AddCommand ("devmap", SV_Map_f);
@@ -1756,6 +1921,14 @@ void SV_AddOperatorCommands( void ) {
 	Cmd_AddCommand ("forcetoggle", SV_ForceToggle_f);
 	Cmd_AddCommand ("svrecord", SV_Record_f);
 	Cmd_AddCommand ("svstoprecord", SV_StopRecord_f);
+	Cmd_AddCommand ("svmvrecord", SV_MVRecord_f);
+	Cmd_AddCommand ("svmvstoprecord", SV_MVStopRecord_f);
+	Cmd_AddCommand ("svmvextract", SV_MVExtract_f);
+	Cmd_AddCommand ("demostatus", SV_DemoWriterStatus_f);
+	Cmd_AddCommand ("preload", SV_Preload_f);
+	Cmd_AddCommand ("svcapture", SV_Capture_f);
+	Cmd_AddCommand ("svstopcapture", SV_StopCapture_f);
+	Cmd_AddCommand ("svreplay", SV_Replay_f);
 	Cmd_AddCommand ("sv_rehashbans", SV_RehashBans_f);
 	Cmd_AddCommand ("sv_listbans", SV_ListBans_f);
 	Cmd_AddCommand ("sv_banaddr", SV_BanAddr_f);
@@ -110,38 +110,198 @@ void SV_GetChallenge( netadr_t from ) {
 	NET_OutOfBandPrint( NS_SERVER, challenge->adr, "challengeResponse %i %i", challenge->challenge, clientChallenge );
 }
 
+/*
+==============================================================================
+
+BAN MATCHING
+
+IPv4 bans and exceptions are kept in a path-compressed binary trie built
+from serverBans, so checking an address walks at most 32 bits of it no
+matter how many entries the ban file holds.
+
+==============================================================================
+*/
+
+typedef struct banNode_s {
+	uint32_t	prefix;			// only the top 'bits' bits are significant
+	int			bits;
+	int			child[2];		// next bit 0/1, 0 for none (the root is nobody's child)
+	qboolean	isBan;
+	qboolean	isException;
+} banNode_t;
+
+typedef struct banTrie_s {
+	banNode_t	*nodes;			// nodes[0] is the root, a zero bit prefix
+	int			numNodes;
+	int			maxNodes;
+
+	// NET_CompareBaseAdrMask matches every loopback address to any other
+	qboolean	loopbackBan;
+	qboolean	loopbackException;
+} banTrie_t;
+
+static banTrie_t banTrie;
+
+static uint32_t SV_BanKey( const netadr_t *adr ) {
+	return ((uint32_t)adr->ip[0] << 24) | ((uint32_t)adr->ip[1] << 16) | ((uint32_t)adr->ip[2] << 8) | (uint32_t)adr->ip[3];
+}
+
+static uint32_t SV_BanMask( int bits ) {
+	return bits ? 0xFFFFFFFFu << (32 - bits) : 0;
+}
+
+static int SV_BanTrieAlloc( banTrie_t *trie, uint32_t prefix, int bits ) {
+	banNode_t	*node;
+
+	if ( trie->numNodes == trie->maxNodes ) {
+		banNode_t *nodes;
+
+		trie->maxNodes = trie->maxNodes ? trie->maxNodes * 2 : 64;
+		nodes = (banNode_t *)Z_Malloc( trie->maxNodes * sizeof( banNode_t ), TAG_GENERAL, qtrue );
+		if ( trie->nodes ) {
+			memcpy( nodes, trie->nodes, trie->numNodes * sizeof( banNode_t ) );
+			Z_Free( trie->nodes );
+		}
+		trie->nodes = nodes;
+	}
+
+	node = &trie->nodes[trie->numNodes];
+	memset( node, 0, sizeof( *node ) );
+	node->prefix = prefix & SV_BanMask( bits );
+	node->bits = bits;
+
+	return trie->numNodes++;
+}
+
+static void SV_BanTrieInsert( banTrie_t *trie, uint32_t key, int bits, qboolean isexception ) {
+	int			node, child, split, common, dir;
+	uint32_t	diff;
+
+	key &= SV_BanMask( bits );
+	node = 0;
+
+	// nodes move when the pool grows, so only hold on to indices
+	while ( trie->nodes[node].bits != bits ) {
+		dir = (key >> (31 - trie->nodes[node].bits)) & 1;
+		child = trie->nodes[node].child[dir];
+
+		if ( !child ) {
+			child = SV_BanTrieAlloc( trie, key, bits );
+			trie->nodes[node].child[dir] = child;
+			node = child;
+			break;
+		}
+
+		// how far do the new entry and the child agree
+		diff = key ^ trie->nodes[child].prefix;
+		common = min( bits, trie->nodes[child].bits );
+		for ( split = 0; split < common && !(diff & (0x80000000u >> split)); split++ );
+
+		if ( split == trie->nodes[child].bits ) {
+			node = child;
+			continue;
+		}
+
+		// they part ways above the child, put a node in between
+		split = SV_BanTrieAlloc( trie, key, split );
+		trie->nodes[node].child[dir] = split;
+		common = trie->nodes[split].bits;
+		trie->nodes[split].child[(trie->nodes[child].prefix >> (31 - common)) & 1] = child;
+		if ( common != bits ) {
+			child = SV_BanTrieAlloc( trie, key, bits );
+			trie->nodes[split].child[(key >> (31 - common)) & 1] = child;
+			split = child;
+		}
+		node = split;
+		break;
+	}
+
+	if ( isexception )
+		trie->nodes[node].isException = qtrue;
+	else
+		trie->nodes[node].isBan = qtrue;
+}
+
+/*
+==================
+SV_RebuildBanTrie
+
+Rebuild the matcher after serverBans has changed. The new trie is
+finished before it replaces the old one.
+==================
+*/
+void SV_RebuildBanTrie( void )
+{
+	banTrie_t	trie;
+	serverBan_t	*curban;
+	int			index;
+
+	memset( &trie, 0, sizeof( trie ) );
+	SV_BanTrieAlloc( &trie, 0, 0 );
+
+	for ( index = 0; index < serverBansCount; index++ )
+	{
+		curban = &serverBans[index];
+
+		if ( curban->ip.type == NA_IP )
+		{
+			SV_BanTrieInsert( &trie, SV_BanKey( &curban->ip ), curban->subnet < 0 || curban->subnet > 32 ? 32 : curban->subnet, curban->isexception );
+		}
+		else if ( curban->ip.type == NA_LOOPBACK )
+		{
+			if ( curban->isexception )
+				trie.loopbackException = qtrue;
+			else
+				trie.loopbackBan = qtrue;
+		}
+	}
+
+	if ( banTrie.nodes )
+		Z_Free( banTrie.nodes );
+	banTrie = trie;
+}
+
 /*
 ==================
 SV_IsBanned
 
-Check whether a certain address is banned
+Check whether a certain address is banned, exceptions win over bans
 ==================
 */
 
 static qboolean SV_IsBanned( netadr_t *from, qboolean isexception )
 {
-	int index;
-	serverBan_t *curban;
+	qboolean	banned, excepted;
+	banNode_t	*node;
+	uint32_t	key;
+
+	banned = excepted = qfalse;
 
-	if ( !isexception )
+	if ( from->type == NA_LOOPBACK )
 	{
-		// If this is a query for a ban, first check whether the client is excepted
-		if ( SV_IsBanned( from, qtrue ) )
-			return qfalse;
+		banned = banTrie.loopbackBan;
+		excepted = banTrie.loopbackException;
 	}
-
-	for ( index = 0; index < serverBansCount; index++ )
+	else if ( from->type == NA_IP && banTrie.nodes )
 	{
-		curban = &serverBans[index];
-
-		if ( curban->isexception == isexception )
+		// every node on the way down is a prefix of the address
+		key = SV_BanKey( from );
+		node = &banTrie.nodes[0];
+		while ( !((key ^ node->prefix) & SV_BanMask( node->bits )) )
 		{
-			if ( NET_CompareBaseAdrMask( curban->ip, *from, curban->subnet ) )
-				return qtrue;
+			banned = (qboolean)(banned || node->isBan);
+			excepted = (qboolean)(excepted || node->isException);
+
+			if ( node->bits == 32 || !node->child[(key >> (31 - node->bits)) & 1] )
+				break;
+			node = &banTrie.nodes[node->child[(key >> (31 - node->bits)) & 1]];
 		}
 	}
 
-	return qfalse;
+	if ( isexception )
+		return excepted;
+
+	return (qboolean)(banned && !excepted);
 }
 
 /*
@@ -394,6 +554,7 @@ gotnewcl:
 	Com_DPrintf( "Going from CS_FREE to CS_CONNECTED for %s\n", newcl->name );
 
 	newcl->state = CS_CONNECTED;
+	SV_InvalidateQueryCache();
 	newcl->nextSnapshotTime = svs.time;
 	newcl->lastPacketTime = svs.time;
 	newcl->lastConnectTime = svs.time;
@@ -479,6 +640,7 @@ void SV_DropClient( client_t *drop, const char *reason ) {
 		Com_DPrintf( "Going to CS_ZOMBIE for %s\n", drop->name );
 		drop->state = CS_ZOMBIE;		// become free in a few seconds
 	}
+	SV_InvalidateQueryCache();
 
 	if ( drop->demo.demorecording ) {
 		SV_StopRecordDemo( drop );
@@ -562,8 +724,6 @@ void SV_SendClientGameState( client_t *client ) {
 	msg_t		msg;
 	byte		msgBuffer[MAX_MSGLEN];
 
-	MSG_Init( &msg, msgBuffer, sizeof( msgBuffer ) );
-
 	// MW - my attempt to fix illegible server message errors caused by
 	// packet fragmentation of initial snapshot.
 	while(client->state&&client->netchan.unsentFragments)
@@ -572,9 +732,12 @@ void SV_SendClientGameState( client_t *client ) {
 		// was too large to send at once
 
 		Com_Printf ("[ISM]SV_SendClientGameState() [2] for %s, writing out old fragments\n", client->name);
-		SV_Netchan_TransmitNextFragment(&client->netchan);
+		SV_Netchan_TransmitNextFragment(client);
 	}
 
+	// the gamestate nearly always fragments, so build it where the netchan sends fragments from
+	MSG_Init( &msg, Netchan_MessageBuffer( &client->netchan, msgBuffer ), sizeof( msgBuffer ) );
+
 	Com_DPrintf ("SV_SendClientGameState() for %s\n", client->name);
 	Com_DPrintf( "Going from CS_CONNECTED to CS_PRIMED for %s\n", client->name );
 	if ( client->state == CS_CONNECTED )
@@ -665,6 +828,108 @@ CLIENT COMMAND EXECUTION
 ============================================================
 */
 
+/*
+==============================================================================
+
+DOWNLOAD CACHE
+
+Every client downloading the same file shares one read-only copy of it
+(mmapped where possible) and their download windows point straight into
+it. The copy goes away as soon as the last client using it is done.
+
+==============================================================================
+*/
+
+typedef struct downloadCache_s {
+	char		name[MAX_QPATH];
+	const byte	*data;
+	int			length;
+	qboolean	mapped;
+	int			refCount;
+	struct downloadCache_s	*next;
+} downloadCache_t;
+
+static downloadCache_t *downloadCache;
+
+/*
+==================
+SV_AcquireDownload
+
+Returns the shared copy of a file with a new reference on it,
+or NULL if the file can't be found
+==================
+*/
+static downloadCache_t *SV_AcquireDownload( const char *name ) {
+	downloadCache_t	*entry;
+	void			*data;
+	qboolean		mapped;
+	int				length;
+
+	for ( entry = downloadCache; entry; entry = entry->next ) {
+		if ( !Q_stricmp( entry->name, name ) ) {
+			entry->refCount++;
+			return entry;
+		}
+	}
+
+	length = FS_SV_MapFile( name, &data, &mapped );
+	if ( length < 0 ) {
+		return NULL;
+	}
+
+	entry = (downloadCache_t *)Z_Malloc( sizeof( downloadCache_t ), TAG_DOWNLOAD, qtrue );
+	Q_strncpyz( entry->name, name, sizeof( entry->name ) );
+	entry->data = (const byte *)data;
+	entry->length = length;
+	entry->mapped = mapped;
+	entry->refCount = 1;
+	entry->next = downloadCache;
+	downloadCache = entry;
+
+	return entry;
+}
+
+/*
+==================
+SV_ReleaseDownload
+
+Drops a reference, and the copy itself once nobody is using it
+==================
+*/
+static void SV_ReleaseDownload( downloadCache_t *download ) {
+	downloadCache_t	**link;
+
+	if ( --download->refCount > 0 ) {
+		return;
+	}
+
+	for ( link = &downloadCache; *link; link = &(*link)->next ) {
+		if ( *link == download ) {
+			*link = download->next;
+			break;
+		}
+	}
+
+	FS_SV_UnmapFile( (void *)download->data, download->length, download->mapped );
+	Z_Free( download );
+}
+
+/*
+==================
+SV_CloseDownloads
+
+Ends every client's download before the clients are freed, so no shared
+copy outlives the server session
+==================
+*/
+void SV_CloseDownloads( void ) {
+	int		i;
+
+	for ( i = 0 ; i < sv_maxclients->integer ; i++ ) {
+		SV_CloseDownload( &svs.clients[i] );
+	}
+}
+
 /*
 ==================
 SV_CloseDownload
@@ -677,17 +942,14 @@ static void SV_CloseDownload( client_t *cl ) {
 
 	// EOF
 	if (cl->download) {
-		FS_FCloseFile( cl->download );
+		SV_ReleaseDownload( cl->download );
 	}
-	cl->download = 0;
+	cl->download = NULL;
 	*cl->downloadName = 0;
 
-	// Free the temporary buffer space
+	// The blocks belong to the shared copy
 	for (i = 0; i < MAX_DOWNLOAD_WINDOW; i++) {
-		if (cl->downloadBlocks[i]) {
-			Z_Free( cl->downloadBlocks[i] );
-			cl->downloadBlocks[i] = NULL;
-		}
+		cl->downloadBlocks[i] = NULL;
 	}
 
 }
@@ -839,12 +1101,12 @@ void SV_WriteDownloadToClient(client_t *cl, msg_t *msg)
 			}
 		}
 
-		cl->download = 0;
+		cl->download = NULL;
 
 		// We open the file here
 		if ( !sv_allowDownload->integer ||
 			idPack || unreferenced ||
-			( cl->downloadSize = FS_SV_FOpenFileRead( cl->downloadName, &cl->download ) ) < 0 ) {
+			( cl->download = SV_AcquireDownload( cl->downloadName ) ) == NULL ) {
 			// cannot auto-download file
 			if(unreferenced)
 			{
@@ -888,36 +1150,27 @@ void SV_WriteDownloadToClient(client_t *cl, msg_t *msg)
 
 			*cl->downloadName = 0;
 
-			if(cl->download)
-				FS_FCloseFile(cl->download);
-
 			return;
 		}
 
 		Com_Printf( "clientDownload: %d : beginning \"%s\"\n", (int) (cl - svs.clients), cl->downloadName );
 
+		cl->downloadSize = cl->download->length;
+
 		// Init
 		cl->downloadCurrentBlock = cl->downloadClientBlock = cl->downloadXmitBlock = 0;
 		cl->downloadCount = 0;
 		cl->downloadEOF = qfalse;
 	}
 
-	// Perform any reads that we need to
+	// Fill the window with the next blocks of the shared copy, no reads or copies needed
 	while (cl->downloadCurrentBlock - cl->downloadClientBlock < MAX_DOWNLOAD_WINDOW &&
 		cl->downloadSize != cl->downloadCount) {
 
 		curindex = (cl->downloadCurrentBlock % MAX_DOWNLOAD_WINDOW);
 
-		if (!cl->downloadBlocks[curindex])
-			cl->downloadBlocks[curindex] = (unsigned char *)Z_Malloc( MAX_DOWNLOAD_BLKSIZE, TAG_DOWNLOAD, qtrue );
-
-		cl->downloadBlockSize[curindex] = FS_Read( cl->downloadBlocks[curindex], MAX_DOWNLOAD_BLKSIZE, cl->download );
-
-		if (cl->downloadBlockSize[curindex] < 0) {
-			// EOF right now
-			cl->downloadCount = cl->downloadSize;
-			break;
-		}
+		cl->downloadBlocks[curindex] = cl->download->data + cl->downloadCount;
+		cl->downloadBlockSize[curindex] = min( MAX_DOWNLOAD_BLKSIZE, cl->downloadSize - cl->downloadCount );
 
 		cl->downloadCount += cl->downloadBlockSize[curindex];
 
@@ -1193,6 +1446,7 @@ void SV_UserinfoChanged( client_t *cl ) {
 
 	// name for C code
 	Q_strncpyz( cl->name, Info_ValueForKey (cl->userinfo, "name"), sizeof(cl->name) );
+	SV_InvalidateQueryCache();
 
 	// rate command
 
@@ -1475,6 +1729,16 @@ static void SV_UserMove( client_t *cl, msg_t *msg, qboolean delta ) {
 	// save time for ping calculation
 	cl->frames[ cl->messageAcknowledge & PACKET_MASK ].messageAcked = svs.time;
 
+	// snapshots sent since the previous acknowledge are covered by this one,
+	// the client only acknowledges the newest it has; 0 keeps them out of
+	// both the ping and NETSTAT_STALLED
+	for ( i = cl->messageAcknowledge - 1 ; i > 0 && i > cl->messageAcknowledge - PACKET_BACKUP ; i-- ) {
+		if ( cl->frames[ i & PACKET_MASK ].messageAcked != -1 ) {
+			break;
+		}
+		cl->frames[ i & PACKET_MASK ].messageAcked = 0;
+	}
+
 	// TTimo
 	// catch the no-cp-yet situation before SV_ClientEnterWorld
 	// if CS_ACTIVE, then it's time to trigger a new gamestate emission
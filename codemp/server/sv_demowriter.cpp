@@ -0,0 +1,433 @@
+// sv_demowriter.cpp -- buffered demo output, written to disk from a thread of its own
+
+#include "server.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
+/*
+==============================================================================
+
+Server demos used to be written with three small FS_Write calls per
+snapshot on the game thread, so with every player recording a slow disk
+stalled the frame. Now each demo appends into memory blocks, and a full
+block is queued for a writer thread that puts it on disk in a single
+large sequential write.
+
+sv_demoWriteBuffer caps the memory held by all demos together. When a
+demo needs another block over the cap, the game thread waits for the
+writer to retire one, and the wait is counted as a stall; demostatus
+shows how often that happens, along with the queue depth.
+
+The game thread is the only one that appends or opens and closes streams.
+The writer thread is the only one that touches the FILEs, so it reports
+write errors through the stats instead of printing.
+
+==============================================================================
+*/
+
+#define	DEMO_BLOCK_SIZE		0x10000
+
+typedef struct demoBlock_s {
+	struct demoBlock_s	*next;
+	int					size;
+	byte				data[DEMO_BLOCK_SIZE];
+} demoBlock_t;
+
+struct demoStream_s {
+	demoStream_t	*next;			// in demoWriter.streams
+	FILE			*file;
+
+	demoBlock_t		*current;		// being filled, game thread only
+
+	demoBlock_t		*head, *tail;	// waiting for the writer
+	qboolean		closing;		// no more blocks are coming
+};
+
+static cvar_t	*sv_demoWriteBuffer;	// KB of demo data held in memory before the game thread waits
+
+static struct {
+	qboolean		running;
+	qboolean		quit;
+	demoStream_t	*streams;
+
+	int				blocks;			// allocated, filling or queued
+	int				queued;			// waiting for the writer
+	int				peakBlocks;
+
+	int64_t			bytesWritten;
+	int				writes;
+	int				writeErrors;
+	int				stalls;
+	int				stallMsec;
+
+#ifdef _WIN32
+	CRITICAL_SECTION	lock;
+	HANDLE			thread;
+	HANDLE			workEvent;		// auto-reset, something was queued or quit was set
+	HANDLE			spaceEvent;		// auto-reset, a block was retired
+#else
+	pthread_mutex_t	lock;
+	pthread_t		thread;
+	pthread_cond_t	workCond;
+	pthread_cond_t	spaceCond;
+#endif
+} demoWriter;
+
+#ifdef _WIN32
+static void DW_Lock( void )			{ EnterCriticalSection( &demoWriter.lock ); }
+static void DW_Unlock( void )		{ LeaveCriticalSection( &demoWriter.lock ); }
+static void DW_SignalWork( void )	{ SetEvent( demoWriter.workEvent ); }
+static void DW_SignalSpace( void )	{ SetEvent( demoWriter.spaceEvent ); }
+static void DW_WaitWork( void )		{ DW_Unlock(); WaitForSingleObject( demoWriter.workEvent, INFINITE ); DW_Lock(); }
+static void DW_WaitSpace( void )	{ DW_Unlock(); WaitForSingleObject( demoWriter.spaceEvent, INFINITE ); DW_Lock(); }
+#else
+static void DW_Lock( void )			{ pthread_mutex_lock( &demoWriter.lock ); }
+static void DW_Unlock( void )		{ pthread_mutex_unlock( &demoWriter.lock ); }
+static void DW_SignalWork( void )	{ pthread_cond_signal( &demoWriter.workCond ); }
+static void DW_SignalSpace( void )	{ pthread_cond_signal( &demoWriter.spaceCond ); }
+static void DW_WaitWork( void )		{ pthread_cond_wait( &demoWriter.workCond, &demoWriter.lock ); }
+static void DW_WaitSpace( void )	{ pthread_cond_wait( &demoWriter.spaceCond, &demoWriter.lock ); }
+#endif
+
+/*
+==================
+SV_DemoWriterLoop
+
+Writes queued blocks a stream at a time, round robin, and closes
+streams once they're drained. Returns when told to quit and nothing is left
+==================
+*/
+static void SV_DemoWriterLoop( void ) {
+	demoStream_t	*stream, **prev;
+	demoBlock_t		*block;
+	qboolean		ok, more;
+
+	DW_Lock();
+	for ( ;; ) {
+		for ( prev = &demoWriter.streams; *prev; prev = &(*prev)->next ) {
+			if ( (*prev)->head || (*prev)->closing ) {
+				break;
+			}
+		}
+
+		stream = *prev;
+		if ( !stream ) {
+			if ( demoWriter.quit ) {
+				break;
+			}
+			DW_WaitWork();
+			continue;
+		}
+
+		if ( !stream->head ) {
+			// closing and drained
+			*prev = stream->next;
+			DW_Unlock();
+			fclose( stream->file );
+			free( stream );
+			DW_Lock();
+			continue;
+		}
+
+		block = stream->head;
+		stream->head = block->next;
+		if ( !stream->head ) {
+			stream->tail = NULL;
+		}
+		more = (qboolean)( stream->head != NULL );
+
+		// to the back of the list so one busy demo can't starve the rest
+		*prev = stream->next;
+		stream->next = NULL;
+		for ( prev = &demoWriter.streams; *prev; prev = &(*prev)->next ) {
+		}
+		*prev = stream;
+
+		DW_Unlock();
+		ok = (qboolean)( fwrite( block->data, 1, block->size, stream->file ) == (size_t)block->size );
+		if ( ok && !more ) {
+			// nothing else is coming for a while, don't leave it in the stdio buffer
+			ok = (qboolean)!fflush( stream->file );
+		}
+		DW_Lock();
+
+		demoWriter.queued--;
+		demoWriter.blocks--;
+		demoWriter.writes++;
+		if ( ok ) {
+			demoWriter.bytesWritten += block->size;
+		} else {
+			demoWriter.writeErrors++;
+		}
+		free( block );
+		DW_SignalSpace();
+	}
+	DW_Unlock();
+}
+
+#ifdef _WIN32
+static DWORD WINAPI SV_DemoWriterThread( LPVOID ) {
+	SV_DemoWriterLoop();
+	return 0;
+}
+#else
+static void *SV_DemoWriterThread( void * ) {
+	SV_DemoWriterLoop();
+	return NULL;
+}
+#endif
+
+static qboolean SV_DemoWriterStart( void ) {
+	demoWriter.quit = qfalse;
+
+#ifdef _WIN32
+	InitializeCriticalSection( &demoWriter.lock );
+	demoWriter.workEvent = CreateEvent( NULL, FALSE, FALSE, NULL );
+	demoWriter.spaceEvent = CreateEvent( NULL, FALSE, FALSE, NULL );
+	demoWriter.thread = CreateThread( NULL, 0, SV_DemoWriterThread, NULL, 0, NULL );
+	if ( !demoWriter.thread ) {
+		CloseHandle( demoWriter.workEvent );
+		CloseHandle( demoWriter.spaceEvent );
+		DeleteCriticalSection( &demoWriter.lock );
+		return qfalse;
+	}
+#else
+	pthread_mutex_init( &demoWriter.lock, NULL );
+	pthread_cond_init( &demoWriter.workCond, NULL );
+	pthread_cond_init( &demoWriter.spaceCond, NULL );
+	if ( pthread_create( &demoWriter.thread, NULL, SV_DemoWriterThread, NULL ) ) {
+		pthread_cond_destroy( &demoWriter.workCond );
+		pthread_cond_destroy( &demoWriter.spaceCond );
+		pthread_mutex_destroy( &demoWriter.lock );
+		return qfalse;
+	}
+#endif
+
+	demoWriter.running = qtrue;
+	return qtrue;
+}
+
+/*
+==================
+SV_DemoQueueBlock
+
+Hands the block being filled to the writer thread
+==================
+*/
+static void SV_DemoQueueBlock( demoStream_t *stream ) {
+	demoBlock_t	*block = stream->current;
+
+	if ( !block ) {
+		return;
+	}
+	stream->current = NULL;
+
+	if ( !block->size ) {
+		DW_Lock();
+		demoWriter.blocks--;
+		DW_Unlock();
+		free( block );
+		return;
+	}
+
+	DW_Lock();
+	block->next = NULL;
+	if ( stream->tail ) {
+		stream->tail->next = block;
+	} else {
+		stream->head = block;
+	}
+	stream->tail = block;
+	demoWriter.queued++;
+	DW_SignalWork();
+	DW_Unlock();
+}
+
+/*
+==================
+SV_DemoNewBlock
+
+Waits for the writer while the buffer is over its cap and there is
+something queued that will free room
+==================
+*/
+static demoBlock_t *SV_DemoNewBlock( void ) {
+	demoBlock_t	*block;
+	int			limit, start;
+
+	limit = sv_demoWriteBuffer->integer * 1024 / DEMO_BLOCK_SIZE;
+
+	DW_Lock();
+	if ( demoWriter.blocks >= limit && demoWriter.queued ) {
+		demoWriter.stalls++;
+		start = Sys_Milliseconds();
+		while ( demoWriter.blocks >= limit && demoWriter.queued ) {
+			DW_WaitSpace();
+		}
+		demoWriter.stallMsec += Sys_Milliseconds() - start;
+	}
+	demoWriter.blocks++;
+	if ( demoWriter.blocks > demoWriter.peakBlocks ) {
+		demoWriter.peakBlocks = demoWriter.blocks;
+	}
+	DW_Unlock();
+
+	block = (demoBlock_t *)malloc( sizeof( demoBlock_t ) );
+	if ( !block ) {
+		Com_Error( ERR_FATAL, "SV_DemoNewBlock: out of memory" );
+	}
+	block->next = NULL;
+	block->size = 0;
+
+	return block;
+}
+
+/*
+==================
+SV_DemoOpen
+
+Takes ownership of a file opened with FS_FOpenFileWrite
+==================
+*/
+demoStream_t *SV_DemoOpen( fileHandle_t f ) {
+	demoStream_t	*stream;
+
+	if ( !demoWriter.running && !SV_DemoWriterStart() ) {
+		Com_Printf( "WARNING: couldn't start the demo writer thread\n" );
+		FS_FCloseFile( f );
+		return NULL;
+	}
+
+	stream = (demoStream_t *)calloc( 1, sizeof( *stream ) );
+	stream->file = FS_DetachFile( f );
+
+	DW_Lock();
+	stream->next = demoWriter.streams;
+	demoWriter.streams = stream;
+	DW_Unlock();
+
+	return stream;
+}
+
+/*
+==================
+SV_DemoWrite
+==================
+*/
+void SV_DemoWrite( demoStream_t *stream, const void *data, int len ) {
+	const byte	*in = (const byte *)data;
+	int			n;
+
+	while ( len > 0 ) {
+		if ( !stream->current ) {
+			stream->current = SV_DemoNewBlock();
+		}
+
+		n = DEMO_BLOCK_SIZE - stream->current->size;
+		if ( n > len ) {
+			n = len;
+		}
+		Com_Memcpy( stream->current->data + stream->current->size, in, n );
+		stream->current->size += n;
+		in += n;
+		len -= n;
+
+		if ( stream->current->size == DEMO_BLOCK_SIZE ) {
+			SV_DemoQueueBlock( stream );
+		}
+	}
+}
+
+/*
+==================
+SV_DemoClose
+
+Queues whatever is left; the writer closes the file once it's on disk
+==================
+*/
+void SV_DemoClose( demoStream_t *stream ) {
+	SV_DemoQueueBlock( stream );
+
+	DW_Lock();
+	stream->closing = qtrue;
+	DW_SignalWork();
+	DW_Unlock();
+}
+
+/*
+==================
+SV_DemoWriterStatus_f
+==================
+*/
+void SV_DemoWriterStatus_f( void ) {
+	demoStream_t	*stream;
+	int				streams;
+
+	if ( !demoWriter.running ) {
+		Com_Printf( "Demo writer is idle.\n" );
+		return;
+	}
+
+	DW_Lock();
+	for ( streams = 0, stream = demoWriter.streams; stream; stream = stream->next ) {
+		streams++;
+	}
+	Com_Printf( "streams:  %d open or draining\n", streams );
+	Com_Printf( "buffered: %d KB in use, %d KB queued, %d KB peak, %d KB cap\n",
+		demoWriter.blocks * ( DEMO_BLOCK_SIZE / 1024 ), demoWriter.queued * ( DEMO_BLOCK_SIZE / 1024 ),
+		demoWriter.peakBlocks * ( DEMO_BLOCK_SIZE / 1024 ), sv_demoWriteBuffer->integer );
+	Com_Printf( "written:  %lld KB in %d writes, %d failed\n",
+		(long long)( demoWriter.bytesWritten / 1024 ), demoWriter.writes, demoWriter.writeErrors );
+	Com_Printf( "stalls:   %d, %d msec waiting for the disk\n", demoWriter.stalls, demoWriter.stallMsec );
+	DW_Unlock();
+}
+
+/*
+==================
+SV_DemoWriterInit
+==================
+*/
+void SV_DemoWriterInit( void ) {
+	sv_demoWriteBuffer = Cvar_Get( "sv_demoWriteBuffer", "8192", CVAR_ARCHIVE );
+}
+
+/*
+==================
+SV_DemoWriterShutdown
+
+Waits for everything queued to reach the disk. Demos still open are
+the caller's to close first
+==================
+*/
+void SV_DemoWriterShutdown( void ) {
+	if ( !demoWriter.running ) {
+		return;
+	}
+
+	DW_Lock();
+	demoWriter.quit = qtrue;
+	DW_SignalWork();
+	DW_Unlock();
+
+#ifdef _WIN32
+	WaitForSingleObject( demoWriter.thread, INFINITE );
+	CloseHandle( demoWriter.thread );
+	CloseHandle( demoWriter.workEvent );
+	CloseHandle( demoWriter.spaceEvent );
+	DeleteCriticalSection( &demoWriter.lock );
+#else
+	pthread_join( demoWriter.thread, NULL );
+	pthread_cond_destroy( &demoWriter.workCond );
+	pthread_cond_destroy( &demoWriter.spaceCond );
+	pthread_mutex_destroy( &demoWriter.lock );
+#endif
+
+	if ( demoWriter.writeErrors ) {
+		Com_Printf( "WARNING: %d demo writes failed\n", demoWriter.writeErrors );
+	}
+	Com_Memset( &demoWriter, 0, sizeof( demoWriter ) );
+}
@@ -2833,6 +2833,10 @@ intptr_t SV_GameSystemCalls( intptr_t *args ) {
 		SV_BotCalculatePaths(args[1]);
 		return 0;
 
+	case G_TRACEBATCH:
+		SV_TraceBatch( (trace_t *)VMA(1), (const traceRequest_t *)VMA(2), args[3] );
+		return 0;
+
 	case G_GET_ENTITY_TOKEN:
 		return SV_GetEntityToken((char *)VMA(1), args[2]);
 
@@ -2851,7 +2855,7 @@ void SV_InitGame( qboolean restart ) {
 	for ( i=0, cl=svs.clients; i<sv_maxclients->integer; i++, cl++ )
 		cl->gentity = NULL;
 
-	GVM_InitGame( sv.time, Com_Milliseconds(), restart );
+	GVM_InitGame( sv.time, sv.randomSeed ^ sv.time, restart );
 }
 
 void SV_BindGame( void ) {
@@ -3173,6 +3177,7 @@ void SV_BindGame( void ) {
 		gi.G2API_CleanEntAttachments			= SV_G2API_CleanEntAttachments;
 		gi.G2API_OverrideServer					= SV_G2API_OverrideServer;
 		gi.G2API_GetSurfaceName					= SV_G2API_GetSurfaceName;
+		gi.TraceBatch							= SV_TraceBatch;
 
 		GetGameAPI = (GetGameAPI_t)gvm->GetModuleAPI;
 		ret = GetGameAPI( GAME_API_VERSION, &gi );
@@ -0,0 +1,678 @@
+// sv_http.cpp -- optional HTTP listener for fast pk3 downloads
+
+#include "server.h"
+
+/*
+==============================================================================
+
+Serves the referenced pk3s of the current map over HTTP from a thread of
+its own, so clients can fetch them at line rate instead of through
+SV_WriteDownloadToClient.
+
+The main thread opens every downloadable pk3 when a map is spawned and
+publishes the descriptors in a refcounted list. The listener only ever
+sends files from that list, by exact path, with sendfile(2). A
+connection keeps its list alive until it closes, so a map change never
+pulls a file out from under a transfer. The base URL goes to clients
+in the sv_dlURL systeminfo key while the listener is serving; otherwise
+whatever the operator put there, like an external mirror, is left alone.
+
+Linux only; elsewhere sv_httpDownload just reports that it's unavailable.
+
+==============================================================================
+*/
+
+static cvar_t	*sv_httpDownload;		// TCP port to serve on, 0 = off
+static cvar_t	*sv_httpAddress;		// host to put in sv_dlURL, net_ip if empty
+static cvar_t	*sv_dlURL;
+
+static qboolean	dlURLOwned;							// sv_dlURL points at the listener
+static char		dlURLSaved[MAX_CVAR_VALUE_STRING];	// the operator's value from before that
+
+#ifdef __linux__
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#define	HTTP_MAX_CONNECTIONS	64
+#define	HTTP_REQUEST_SIZE		2048
+#define	HTTP_IDLE_TIMEOUT		15000	// msec without progress before a connection is dropped
+#define	HTTP_SENDFILE_CHUNK		(1 << 20)
+
+typedef struct httpPak_s {
+	char		path[MAX_QPATH];	// as requested, "base/mymap.pk3"
+	int			fd;
+	int			length;
+} httpPak_t;
+
+typedef struct httpPakList_s {
+	int			refCount;			// the published list holds one, each transfer another
+	int			numPaks;
+	httpPak_t	*paks;
+} httpPakList_t;
+
+typedef struct httpConnection_s {
+	int				socket;			// -1 when the slot is free
+	int				lastActive;
+
+	char			request[HTTP_REQUEST_SIZE];
+	int				requestLength;
+
+	qboolean		responding;
+	char			header[512];
+	int				headerLength;
+	int				headerSent;
+
+	httpPakList_t	*list;
+	const httpPak_t	*pak;
+	off_t			offset;
+	int				remaining;
+} httpConnection_t;
+
+static struct {
+	qboolean		running;
+	pthread_t		thread;
+	int				port;
+	int				listenSocket;
+	int				wakePipe[2];		// written to by SV_HTTP_Stop
+
+	pthread_mutex_t	mutex;				// guards paks and every list's refCount
+	httpPakList_t	*paks;
+
+	httpConnection_t	connections[HTTP_MAX_CONNECTIONS];
+} http = { qfalse, 0, 0, -1, { -1, -1 }, PTHREAD_MUTEX_INITIALIZER, NULL };
+
+static int SV_HTTP_Milliseconds( void ) {
+	struct timespec	ts;
+
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	return (int)( ts.tv_sec * 1000 + ts.tv_nsec / 1000000 );
+}
+
+/*
+==================
+SV_HTTP_ReleaseList
+
+Drops a reference, and closes the files once nobody is using them.
+Caller holds http.mutex
+==================
+*/
+static void SV_HTTP_ReleaseList( httpPakList_t *list ) {
+	int		i;
+
+	if ( !list || --list->refCount > 0 ) {
+		return;
+	}
+
+	for ( i = 0; i < list->numPaks; i++ ) {
+		close( list->paks[i].fd );
+	}
+	free( list->paks );
+	free( list );
+}
+
+static void SV_HTTP_CloseConnection( httpConnection_t *conn ) {
+	close( conn->socket );
+	conn->socket = -1;
+
+	if ( conn->list ) {
+		pthread_mutex_lock( &http.mutex );
+		SV_HTTP_ReleaseList( conn->list );
+		pthread_mutex_unlock( &http.mutex );
+		conn->list = NULL;
+	}
+	conn->pak = NULL;
+}
+
+/*
+==================
+SV_HTTP_ParseRange
+
+Understands a single "bytes=first-last", "bytes=first-" or "bytes=-suffix".
+Returns qfalse if the range can't be satisfied, leaves the whole file
+if there is no range or it can't be parsed
+==================
+*/
+static qboolean SV_HTTP_ParseRange( const char *request, int length, int *first, int *last ) {
+	const char	*s;
+	char		*end;
+	long		a, b;
+
+	*first = 0;
+	*last = length - 1;
+
+	s = Q_stristr( request, "\r\nRange:" );
+	if ( !s ) {
+		return qtrue;
+	}
+	s += 8;
+	while ( *s == ' ' || *s == '\t' ) {
+		s++;
+	}
+	if ( Q_stricmpn( s, "bytes=", 6 ) ) {
+		return qtrue;
+	}
+	s += 6;
+
+	if ( *s == '-' ) {
+		// the last n bytes
+		b = strtol( s + 1, &end, 10 );
+		if ( end == s + 1 || b <= 0 ) {
+			return qfalse;
+		}
+		*first = b >= length ? 0 : length - b;
+		return (qboolean)( length > 0 );
+	}
+
+	a = strtol( s, &end, 10 );
+	if ( end == s || *end != '-' || a < 0 ) {
+		return qtrue;
+	}
+	s = end + 1;
+	if ( *s >= '0' && *s <= '9' ) {
+		b = strtol( s, &end, 10 );
+		if ( b < a ) {
+			return qtrue;	// syntactically invalid, ignore it
+		}
+		if ( b < length ) {
+			*last = b;
+		}
+	}
+	if ( a >= length ) {
+		return qfalse;
+	}
+	*first = a;
+
+	return qtrue;
+}
+
+/*
+==================
+SV_HTTP_StartResponse
+
+Called once the request headers are in
+==================
+*/
+static void SV_HTTP_StartResponse( httpConnection_t *conn ) {
+	char		line[MAX_QPATH * 2];
+	char		*path;
+	qboolean	head;
+	int			i, first, last;
+
+	conn->responding = qtrue;
+	conn->headerSent = 0;
+	conn->remaining = 0;
+
+	// "GET /base/mymap.pk3 HTTP/1.1", copied so the headers stay intact for the Range search
+	Q_strncpyz( line, conn->request, min( (int)sizeof( line ), (int)( strcspn( conn->request, "\r\n" ) + 1 ) ) );
+	path = strchr( line, ' ' );
+	if ( !path ) {
+		conn->headerLength = Com_sprintf( conn->header, sizeof( conn->header ),
+			"HTTP/1.0 400 Bad Request\r\nContent-Length: 0\r\nConnection: close\r\n\r\n" );
+		return;
+	}
+	*path++ = '\0';
+	path[strcspn( path, " ?" )] = '\0';
+	while ( *path == '/' ) {
+		path++;
+	}
+
+	head = (qboolean)!strcmp( line, "HEAD" );
+	if ( !head && strcmp( line, "GET" ) ) {
+		conn->headerLength = Com_sprintf( conn->header, sizeof( conn->header ),
+			"HTTP/1.1 405 Method Not Allowed\r\nAllow: GET, HEAD\r\nContent-Length: 0\r\nConnection: close\r\n\r\n" );
+		return;
+	}
+
+	// only what the main thread published, matched exactly
+	pthread_mutex_lock( &http.mutex );
+	if ( http.paks ) {
+		for ( i = 0; i < http.paks->numPaks; i++ ) {
+			if ( !Q_stricmp( http.paks->paks[i].path, path ) ) {
+				conn->list = http.paks;
+				conn->list->refCount++;
+				conn->pak = &http.paks->paks[i];
+				break;
+			}
+		}
+	}
+	pthread_mutex_unlock( &http.mutex );
+
+	if ( !conn->pak ) {
+		conn->headerLength = Com_sprintf( conn->header, sizeof( conn->header ),
+			"HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n" );
+		return;
+	}
+
+	if ( !SV_HTTP_ParseRange( conn->request, conn->pak->length, &first, &last ) ) {
+		conn->headerLength = Com_sprintf( conn->header, sizeof( conn->header ),
+			"HTTP/1.1 416 Range Not Satisfiable\r\nContent-Range: bytes */%d\r\nContent-Length: 0\r\nConnection: close\r\n\r\n",
+			conn->pak->length );
+		return;
+	}
+
+	if ( first != 0 || last != conn->pak->length - 1 ) {
+		conn->headerLength = Com_sprintf( conn->header, sizeof( conn->header ),
+			"HTTP/1.1 206 Partial Content\r\nContent-Type: application/zip\r\nContent-Length: %d\r\n"
+			"Content-Range: bytes %d-%d/%d\r\nAccept-Ranges: bytes\r\nConnection: close\r\n\r\n",
+			last - first + 1, first, last, conn->pak->length );
+	} else {
+		conn->headerLength = Com_sprintf( conn->header, sizeof( conn->header ),
+			"HTTP/1.1 200 OK\r\nContent-Type: application/zip\r\nContent-Length: %d\r\n"
+			"Accept-Ranges: bytes\r\nConnection: close\r\n\r\n",
+			conn->pak->length );
+	}
+
+	conn->offset = first;
+	conn->remaining = head ? 0 : last - first + 1;
+}
+
+/*
+==================
+SV_HTTP_Read
+
+Returns qfalse when the connection should be closed
+==================
+*/
+static qboolean SV_HTTP_Read( httpConnection_t *conn ) {
+	int		n;
+
+	n = recv( conn->socket, conn->request + conn->requestLength, sizeof( conn->request ) - 1 - conn->requestLength, 0 );
+	if ( n == 0 ) {
+		return qfalse;
+	}
+	if ( n < 0 ) {
+		return (qboolean)( errno == EAGAIN || errno == EINTR );
+	}
+
+	conn->requestLength += n;
+	conn->request[conn->requestLength] = '\0';
+
+	if ( strstr( conn->request, "\r\n\r\n" ) ) {
+		SV_HTTP_StartResponse( conn );
+	} else if ( conn->requestLength == sizeof( conn->request ) - 1 ) {
+		return qfalse;		// headers too big for a file request
+	}
+
+	return qtrue;
+}
+
+/*
+==================
+SV_HTTP_Write
+
+Returns qfalse when the connection should be closed
+==================
+*/
+static qboolean SV_HTTP_Write( httpConnection_t *conn ) {
+	ssize_t		n;
+
+	if ( conn->headerSent < conn->headerLength ) {
+		n = send( conn->socket, conn->header + conn->headerSent, conn->headerLength - conn->headerSent, MSG_NOSIGNAL );
+		if ( n < 0 ) {
+			return (qboolean)( errno == EAGAIN || errno == EINTR );
+		}
+		conn->headerSent += n;
+		return qtrue;
+	}
+
+	if ( conn->remaining > 0 ) {
+		// straight from the page cache to the socket, sendfile advances offset itself
+		n = sendfile( conn->socket, conn->pak->fd, &conn->offset, min( conn->remaining, HTTP_SENDFILE_CHUNK ) );
+		if ( n < 0 ) {
+			return (qboolean)( errno == EAGAIN || errno == EINTR );
+		}
+		if ( n == 0 ) {
+			return qfalse;		// file shrank underneath us
+		}
+		conn->remaining -= n;
+		return qtrue;
+	}
+
+	// everything is out, Connection: close
+	return qfalse;
+}
+
+static void SV_HTTP_Accept( void ) {
+	httpConnection_t	*conn;
+	int					sock, i;
+
+	while ( ( sock = accept4( http.listenSocket, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC ) ) != -1 ) {
+		for ( i = 0, conn = http.connections; i < HTTP_MAX_CONNECTIONS; i++, conn++ ) {
+			if ( conn->socket == -1 ) {
+				break;
+			}
+		}
+		if ( i == HTTP_MAX_CONNECTIONS ) {
+			close( sock );		// full, the client will retry
+			continue;
+		}
+
+		memset( conn, 0, sizeof( *conn ) );
+		conn->socket = sock;
+		conn->lastActive = SV_HTTP_Milliseconds();
+	}
+}
+
+static void *SV_HTTP_Thread( void * ) {
+	struct pollfd		fds[HTTP_MAX_CONNECTIONS + 2];
+	httpConnection_t	*owners[HTTP_MAX_CONNECTIONS + 2];
+	httpConnection_t	*conn;
+	sigset_t			set;
+	int					numFds, i, now;
+	qboolean			keep;
+
+	// a client hanging up mid-sendfile must not take the server down
+	sigemptyset( &set );
+	sigaddset( &set, SIGPIPE );
+	pthread_sigmask( SIG_BLOCK, &set, NULL );
+
+	for ( i = 0; i < HTTP_MAX_CONNECTIONS; i++ ) {
+		http.connections[i].socket = -1;
+	}
+
+	for ( ;; ) {
+		fds[0].fd = http.wakePipe[0];
+		fds[0].events = POLLIN;
+		fds[1].fd = http.listenSocket;
+		fds[1].events = POLLIN;
+		numFds = 2;
+
+		for ( i = 0, conn = http.connections; i < HTTP_MAX_CONNECTIONS; i++, conn++ ) {
+			if ( conn->socket == -1 ) {
+				continue;
+			}
+			fds[numFds].fd = conn->socket;
+			fds[numFds].events = conn->responding ? POLLOUT : POLLIN;
+			owners[numFds] = conn;
+			numFds++;
+		}
+
+		if ( poll( fds, numFds, 1000 ) < 0 && errno != EINTR ) {
+			break;
+		}
+
+		if ( fds[0].revents ) {
+			break;		// SV_HTTP_Stop
+		}
+		if ( fds[1].revents & POLLIN ) {
+			SV_HTTP_Accept();
+		}
+
+		now = SV_HTTP_Milliseconds();
+		for ( i = 2; i < numFds; i++ ) {
+			conn = owners[i];
+
+			if ( !fds[i].revents ) {
+				if ( now - conn->lastActive > HTTP_IDLE_TIMEOUT ) {
+					SV_HTTP_CloseConnection( conn );
+				}
+				continue;
+			}
+
+			if ( fds[i].revents & ( POLLERR | POLLNVAL ) ) {
+				keep = qfalse;
+			} else if ( conn->responding ) {
+				keep = SV_HTTP_Write( conn );
+			} else {
+				keep = SV_HTTP_Read( conn );
+			}
+
+			if ( keep ) {
+				conn->lastActive = now;
+			} else {
+				SV_HTTP_CloseConnection( conn );
+			}
+		}
+	}
+
+	for ( i = 0, conn = http.connections; i < HTTP_MAX_CONNECTIONS; i++, conn++ ) {
+		if ( conn->socket != -1 ) {
+			SV_HTTP_CloseConnection( conn );
+		}
+	}
+
+	return NULL;
+}
+
+static void SV_HTTP_Stop( void ) {
+	if ( !http.running ) {
+		return;
+	}
+
+	if ( write( http.wakePipe[1], "", 1 ) != 1 ) {
+		Com_Printf( "WARNING: sv_http: couldn't wake the listener thread\n" );
+	}
+	pthread_join( http.thread, NULL );
+
+	close( http.listenSocket );
+	close( http.wakePipe[0] );
+	close( http.wakePipe[1] );
+	http.listenSocket = http.wakePipe[0] = http.wakePipe[1] = -1;
+	http.running = qfalse;
+	http.port = 0;
+}
+
+static qboolean SV_HTTP_Start( int port ) {
+	struct sockaddr_in	addr;
+	int					one = 1;
+
+	memset( &addr, 0, sizeof( addr ) );
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons( (unsigned short)port );
+	// follow net_ip if it names an interface
+	if ( !inet_aton( Cvar_VariableString( "net_ip" ), &addr.sin_addr ) ) {
+		addr.sin_addr.s_addr = htonl( INADDR_ANY );
+	}
+
+	http.listenSocket = socket( AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0 );
+	if ( http.listenSocket == -1 ) {
+		Com_Printf( "WARNING: sv_http: socket: %s\n", strerror( errno ) );
+		return qfalse;
+	}
+	setsockopt( http.listenSocket, SOL_SOCKET, SO_REUSEADDR, &one, sizeof( one ) );
+
+	if ( bind( http.listenSocket, (struct sockaddr *)&addr, sizeof( addr ) ) == -1 ||
+		listen( http.listenSocket, 64 ) == -1 ) {
+		Com_Printf( "WARNING: sv_http: can't listen on port %d: %s\n", port, strerror( errno ) );
+		close( http.listenSocket );
+		http.listenSocket = -1;
+		return qfalse;
+	}
+
+	if ( pipe2( http.wakePipe, O_CLOEXEC ) == -1 ) {
+		Com_Printf( "WARNING: sv_http: pipe: %s\n", strerror( errno ) );
+		close( http.listenSocket );
+		http.listenSocket = -1;
+		return qfalse;
+	}
+
+	if ( pthread_create( &http.thread, NULL, SV_HTTP_Thread, NULL ) ) {
+		Com_Printf( "WARNING: sv_http: couldn't start the listener thread\n" );
+		close( http.listenSocket );
+		close( http.wakePipe[0] );
+		close( http.wakePipe[1] );
+		http.listenSocket = http.wakePipe[0] = http.wakePipe[1] = -1;
+		return qfalse;
+	}
+
+	http.running = qtrue;
+	http.port = port;
+	Com_Printf( "HTTP downloads on port %d\n", port );
+
+	return qtrue;
+}
+
+/*
+==================
+SV_HTTP_BuildList
+
+Opens every pk3 a client could be asked to download for this map
+==================
+*/
+static httpPakList_t *SV_HTTP_BuildList( void ) {
+	httpPakList_t	*list;
+	char			names[BIG_INFO_STRING];
+	char			*name, *next;
+	int				count, fd, length;
+
+	list = (httpPakList_t *)calloc( 1, sizeof( *list ) );
+	list->refCount = 1;
+
+	if ( !sv_allowDownload->integer ) {
+		return list;
+	}
+
+	// "base/mymap base/other ..."
+	Q_strncpyz( names, FS_ReferencedPakNames(), sizeof( names ) );
+	for ( count = 1, name = names; *name; name++ ) {
+		if ( *name == ' ' ) {
+			count++;
+		}
+	}
+	list->paks = (httpPak_t *)calloc( count, sizeof( httpPak_t ) );
+
+	for ( name = names; name && *name; name = next ) {
+		next = strchr( name, ' ' );
+		if ( next ) {
+			*next++ = '\0';
+		}
+		if ( !*name ) {
+			continue;
+		}
+
+		// same rule as SV_WriteDownloadToClient
+		if ( FS_idPak( name, "base" ) || FS_idPak( name, "missionpack" ) ) {
+			continue;
+		}
+
+		fd = FS_SV_OpenFileDescriptor( va( "%s.pk3", name ), &length );
+		if ( fd == -1 ) {
+			continue;
+		}
+
+		Com_sprintf( list->paks[list->numPaks].path, sizeof( list->paks[0].path ), "%s.pk3", name );
+		list->paks[list->numPaks].fd = fd;
+		list->paks[list->numPaks].length = length;
+		list->numPaks++;
+	}
+
+	return list;
+}
+
+#endif // __linux__
+
+/*
+==================
+SV_HTTP_Init
+==================
+*/
+void SV_HTTP_Init( void ) {
+	sv_httpDownload = Cvar_Get( "sv_httpDownload", "0", CVAR_ARCHIVE );
+	sv_httpAddress = Cvar_Get( "sv_httpAddress", "", CVAR_ARCHIVE );
+	sv_dlURL = Cvar_Get( "sv_dlURL", "", CVAR_SYSTEMINFO );
+}
+
+#ifdef __linux__
+/*
+==================
+SV_HTTP_SetURL
+
+Points sv_dlURL at the listener, remembering what the operator had in it
+==================
+*/
+static void SV_HTTP_SetURL( const char *url ) {
+	if ( !dlURLOwned ) {
+		Q_strncpyz( dlURLSaved, sv_dlURL->string, sizeof( dlURLSaved ) );
+		dlURLOwned = qtrue;
+	}
+	Cvar_Set( "sv_dlURL", url );
+}
+#endif
+
+/*
+==================
+SV_HTTP_RestoreURL
+
+Gives sv_dlURL back to the operator if SV_HTTP_SetURL took it
+==================
+*/
+static void SV_HTTP_RestoreURL( void ) {
+	if ( !dlURLOwned ) {
+		return;
+	}
+	Cvar_Set( "sv_dlURL", dlURLSaved );
+	dlURLOwned = qfalse;
+}
+
+/*
+==================
+SV_HTTP_SpawnServer
+
+Called by SV_SpawnServer before the systeminfo string is built. Starts,
+moves or stops the listener to match sv_httpDownload, swaps in this
+map's pk3s and points sv_dlURL at them
+==================
+*/
+void SV_HTTP_SpawnServer( void ) {
+#ifdef __linux__
+	httpPakList_t	*list;
+	const char		*host;
+
+	if ( sv_httpDownload->integer != http.port ) {
+		SV_HTTP_Stop();
+		if ( sv_httpDownload->integer > 0 && sv_httpDownload->integer < 65536 ) {
+			SV_HTTP_Start( sv_httpDownload->integer );
+		}
+	}
+
+	list = http.running ? SV_HTTP_BuildList() : NULL;
+	pthread_mutex_lock( &http.mutex );
+	SV_HTTP_ReleaseList( http.paks );
+	http.paks = list;
+	pthread_mutex_unlock( &http.mutex );
+
+	if ( !http.running ) {
+		SV_HTTP_RestoreURL();
+		return;
+	}
+
+	host = *sv_httpAddress->string ? sv_httpAddress->string : Cvar_VariableString( "net_ip" );
+	if ( !*host || !Q_stricmp( host, "localhost" ) || !strcmp( host, "0.0.0.0" ) ) {
+		Com_Printf( "WARNING: set sv_httpAddress so clients know where to find HTTP downloads\n" );
+		SV_HTTP_RestoreURL();
+		return;
+	}
+	SV_HTTP_SetURL( va( "http://%s:%d", host, http.port ) );
+#else
+	if ( sv_httpDownload->integer ) {
+		Com_Printf( "WARNING: sv_httpDownload is only available on Linux\n" );
+	}
+#endif
+}
+
+/*
+==================
+SV_HTTP_Shutdown
+==================
+*/
+void SV_HTTP_Shutdown( void ) {
+#ifdef __linux__
+	SV_HTTP_Stop();
+
+	pthread_mutex_lock( &http.mutex );
+	SV_HTTP_ReleaseList( http.paks );
+	http.paks = NULL;
+	pthread_mutex_unlock( &http.mutex );
+#endif
+	SV_HTTP_RestoreURL();
+}
@@ -86,9 +86,6 @@ SV_SetConfigstring
 ===============
 */
 void SV_SetConfigstring (int index, const char *val) {
-	int		i;
-	client_t	*client;
-
 	if ( index < 0 || index >= MAX_CONFIGSTRINGS ) {
 		Com_Error (ERR_DROP, "SV_SetConfigstring: bad index %i\n", index);
 	}
@@ -107,11 +104,50 @@ void SV_SetConfigstring (int index, const char *val) {
 	sv.configstrings[index] = CopyString( val );
 
 	// send it to all the clients if we aren't
-	// spawning a new server
+	// spawning a new server, once the frame's changes are in
 	if ( sv.state == SS_GAME || sv.restarting ) {
+		if ( !sv.configstringDirty[index] ) {
+			sv.configstringDirty[index] = qtrue;
+			sv.dirtyConfigstrings[sv.numDirtyConfigstrings++] = index;
+		}
+	}
+}
+
+/*
+===============
+SV_FlushConfigstrings
+
+Sends every configstring changed since the last flush, once, with its
+latest value. Called before snapshots go out and before any other
+reliable command is queued, so clients still see the changes in order
+with everything else
+===============
+*/
+void SV_FlushConfigstrings( void ) {
+	int			dirty[MAX_CONFIGSTRINGS];
+	int			numDirty;
+	int			i, j, index;
+	client_t	*client;
+
+	if ( !sv.numDirtyConfigstrings ) {
+		return;
+	}
+
+	// take the list first, sending can drop a client and change more
+	numDirty = sv.numDirtyConfigstrings;
+	Com_Memcpy( dirty, sv.dirtyConfigstrings, numDirty * sizeof( dirty[0] ) );
+	sv.numDirtyConfigstrings = 0;
+	for ( i = 0 ; i < numDirty ; i++ ) {
+		sv.configstringDirty[dirty[i]] = qfalse;
+	}
+
+	for ( i = 0 ; i < numDirty ; i++ ) {
+		index = dirty[i];
+
+		SV_MVDemoConfigstring( index, sv.configstrings[index] );
 
 		// send the data to all relevent clients
-		for (i = 0, client = svs.clients; i < sv_maxclients->integer ; i++, client++) {
+		for (j = 0, client = svs.clients; j < sv_maxclients->integer ; j++, client++) {
 			if ( client->state < CS_ACTIVE ) {
 				if ( client->state == CS_PRIMED )
 					client->csUpdated[ index ] = qtrue;
@@ -431,9 +467,12 @@ void SV_SpawnServer( char *server, qboolean killBots, ForceReload_e eForceReload
 	const char	*p;
 
 	SV_StopAutoRecordDemos();
+	SV_MVDemoStop();
 
 	SV_SendMapChange();
 
+	SV_InvalidateQueryCache();
+
 	re->RegisterMedia_LevelLoadBegin(server, eForceReload);
 
 	// shut down the existing game if it is running
@@ -443,6 +482,8 @@ void SV_SpawnServer( char *server, qboolean killBots, ForceReload_e eForceReload
 	Com_Printf ("------ Server Initialization ------\n");
 	Com_Printf ("Server: %s\n",server);
 
+	SV_PreloadSpawn( server );
+
 /*
 Ghoul2 Insert Start
 */
@@ -561,8 +602,12 @@ Ghoul2 Insert End
 	Cvar_Set("cl_paused", "0");
 
 	// get a new checksum feed and restart the file system
-	srand(Com_Milliseconds());
-	sv.checksumFeed = ( ((int) rand() << 16) ^ rand() ) ^ Com_Milliseconds();
+	sv.randomSeed = Com_Milliseconds();
+	sv.serverId = com_frameTime;	// serverid should be different each time
+	// a capture records the seed and serverid, a replay puts the recorded ones back
+	SV_CaptureSpawn( server );
+	srand( sv.randomSeed );
+	sv.checksumFeed = ( ((int) rand() << 16) ^ rand() ) ^ sv.randomSeed;
 	FS_Restart( sv.checksumFeed );
 
 	CM_LoadMap( va("maps/%s.bsp", server), qfalse, &checksum );
@@ -574,8 +619,6 @@ Ghoul2 Insert End
 
 	Cvar_Set( "sv_mapChecksum", va("%i",checksum) );
 
-	// serverid should be different each time
-	sv.serverId = com_frameTime;
 	sv.restartedServerId = sv.serverId; // I suppose the init here is just to be safe
 	Cvar_Set( "sv_serverid", va("%i", sv.serverId ) );
 
@@ -695,6 +738,7 @@ Ghoul2 Insert End
 	Cvar_Set( "sv_referencedPaks", p );
 	p = FS_ReferencedPakNames();
 	Cvar_Set( "sv_referencedPakNames", p );
+	SV_HTTP_SpawnServer();
 
 	// save systeminfo and serverinfo strings
 	Q_strncpyz( systemInfo, Cvar_InfoString_Big( CVAR_SYSTEMINFO ), sizeof( systemInfo ) );
@@ -703,6 +747,7 @@ Ghoul2 Insert End
 
 	SV_SetConfigstring( CS_SERVERINFO, Cvar_InfoString( CVAR_SERVERINFO ) );
 	cvar_modifiedFlags &= ~CVAR_SERVERINFO;
+	SV_InvalidateQueryCache();
 
 	// any media configstring setting now should issue a warning
 	// and any configstring changes should be reliably transmitted
@@ -924,6 +969,9 @@ void SV_Init (void) {
 	sv_hostname = Cvar_Get ("sv_hostname", "*Jedi*", CVAR_SERVERINFO | CVAR_ARCHIVE );
 	sv_maxclients = Cvar_Get ("sv_maxclients", "8", CVAR_SERVERINFO | CVAR_LATCH);
 	sv_maxRate = Cvar_Get ("sv_maxRate", "0", CVAR_ARCHIVE | CVAR_SERVERINFO );
+	sv_maxTotalRate = Cvar_Get ("sv_maxTotalRate", "0", CVAR_ARCHIVE );
+	sv_snapshotEntityBudget = Cvar_Get ("sv_snapshotEntityBudget", "0", CVAR_ARCHIVE );
+	sv_pointContentsCache = Cvar_Get ("sv_pointContentsCache", "1", CVAR_ARCHIVE );
 	sv_minPing = Cvar_Get ("sv_minPing", "0", CVAR_ARCHIVE | CVAR_SERVERINFO );
 	sv_maxPing = Cvar_Get ("sv_maxPing", "0", CVAR_ARCHIVE | CVAR_SERVERINFO );
 	sv_floodProtect = Cvar_Get ("sv_floodProtect", "1", CVAR_ARCHIVE | CVAR_SERVERINFO );
@@ -971,6 +1019,10 @@ void SV_Init (void) {
 
 	sv_banFile = Cvar_Get( "sv_banFile", "serverbans.dat", CVAR_ARCHIVE );
 
+	SV_HTTP_Init();
+	SV_DemoWriterInit();
+	SV_PreloadInit();
+
 	// initialize bot cvars so they are listed and can be set before loading the botlib
 	SV_BotInitCvars();
 
@@ -1041,8 +1093,22 @@ void SV_Shutdown( char *finalmsg )
 		SV_FinalMessage( finalmsg );
 	}
 
+	// finish any demos so the tails still in memory reach the disk
+	if ( svs.clients ) {
+		for ( client_t *client = svs.clients; client - svs.clients < sv_maxclients->integer; client++ ) {
+			if ( client->demo.demorecording ) {
+				SV_StopRecordDemo( client );
+			}
+		}
+	}
+	SV_MVDemoStop();
+	SV_CaptureShutdown();
+	SV_DemoWriterShutdown();
+	SV_PreloadShutdown();
+
 	SV_RemoveOperatorCommands();
 	SV_MasterShutdown();
+	SV_HTTP_Shutdown();
 	SV_ShutdownGameProgs();
 	svs.gameStarted = qfalse;
 /*
@@ -1061,6 +1127,7 @@ Ghoul2 Insert Start
 
 	// free server static data
 	if ( svs.clients ) {
+		SV_CloseDownloads();
 		Z_Free( svs.clients );
 	}
 	Com_Memset( &svs, 0, sizeof( svs ) );
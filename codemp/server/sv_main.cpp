@@ -27,6 +27,8 @@ cvar_t	*sv_mapname;
 cvar_t	*sv_mapChecksum;
 cvar_t	*sv_serverid;
 cvar_t	*sv_maxRate;
+cvar_t	*sv_maxTotalRate;		// bytes/sec shared by all clients, 0 = unlimited
+cvar_t	*sv_snapshotEntityBudget;	// bytes per full snapshot for entities entering view, 0 = unlimited, -1 = from rate
 cvar_t	*sv_minPing;
 cvar_t	*sv_maxPing;
 cvar_t	*sv_gametype;
@@ -40,8 +42,9 @@ cvar_t	*sv_autoDemoBots;
 cvar_t	*sv_autoDemoMaxMaps;
 cvar_t	*sv_blockJumpSelect;
 cvar_t	*sv_banFile;
+cvar_t	*sv_pointContentsCache;	// remember SV_PointContents answers for the rest of the frame
 
-serverBan_t serverBans[SERVER_MAXBANS];
+serverBan_t *serverBans = NULL;
 int serverBansCount = 0;
 
 /*
@@ -89,6 +92,9 @@ not have future snapshot_t executed before it is executed
 void SV_AddServerCommand( client_t *client, const char *cmd ) {
 	int		index, i;
 
+	// configstring changes made before this command have to reach the client first
+	SV_FlushConfigstrings();
+
 	client->reliableSequence++;
 	// if we would be losing an old command that hasn't been acknowledged,
 	// we must drop the connection
@@ -135,6 +141,9 @@ void QDECL SV_SendServerCommand(client_t *cl, const char *fmt, ...) {
 		return;
 	}
 
+	SV_FlushConfigstrings();
+	SV_MVDemoServerCommand( cl, (char *)message );
+
 	if ( cl != NULL ) {
 		SV_AddServerCommand( cl, (char *)message );
 		return;
@@ -430,58 +439,145 @@ qboolean SVC_RateLimitAddress( netadr_t from, int burst, int period ) {
 	return SVC_RateLimit( bucket, burst, period );
 }
 
+/*
+==============================================================================
+
+CACHED QUERY RESPONSES
+
+Master servers and browsers send getstatus/getinfo constantly, so both
+replies are built once and resent as-is until something they show
+changes. Only the requester's challenge differs between replies.
+
+==============================================================================
+*/
+
+// room for "\challenge\" and a maximum length challenge
+#define	CHALLENGE_SPLICE_MAX	(128 + 12)
+
+typedef struct queryCache_s {
+	qboolean	statusValid;
+	int			statusLength;
+	int			statusSplice;		// challenge goes here, ahead of the serverinfo
+	int			statusInfoLength;	// for the MAX_INFO_STRING check on the challenge
+	char		status[MAX_MSGLEN];
+
+	qboolean	infoValid;
+	int			infoLength;
+	int			infoInfoLength;
+	char		info[MAX_MSGLEN];	// challenge goes on the end
+
+	// what the replies were built from, compared once a frame
+	qboolean	connected[MAX_CLIENTS];
+	int			ping[MAX_CLIENTS];
+	int			score[MAX_CLIENTS];
+	char		name[MAX_CLIENTS][MAX_NAME_LENGTH];
+} queryCache_t;
+
+static queryCache_t queryCache;
+
 /*
 ================
-SVC_Status
+SV_InvalidateQueryCache
 
-Responds with all the info that qplug or qspy can see about the server
-and all connected players.  Used for getting detailed information after
-the simple info query.
+Called when something shown by getstatus or getinfo has changed
 ================
 */
-void SVC_Status( netadr_t from ) {
-	char	player[1024];
-	char	status[MAX_MSGLEN];
-	int		i;
-	client_t	*cl;
-	playerState_t	*ps;
-	int		statusLength;
-	int		playerLength;
-	char	infostring[MAX_INFO_STRING];
+void SV_InvalidateQueryCache( void ) {
+	queryCache.statusValid = qfalse;
+	queryCache.infoValid = qfalse;
+}
 
-	// ignore if we are in single player
-	/*
-	if ( Cvar_VariableValue( "g_gametype" ) == GT_SINGLE_PLAYER ) {
-		return;
+/*
+================
+SV_CheckQueryCache
+
+Pings and scores move without any hook to catch them, so look for
+changes once a frame rather than on every query
+================
+*/
+static void SV_CheckQueryCache( void ) {
+	int				i;
+	client_t		*cl;
+	qboolean		connected;
+	int				score;
+
+	for ( i = 0, cl = svs.clients ; i < sv_maxclients->integer ; i++, cl++ ) {
+		connected = (qboolean)( cl->state >= CS_CONNECTED );
+		if ( connected != queryCache.connected[i] ) {
+			queryCache.connected[i] = connected;
+			SV_InvalidateQueryCache();
+		}
+		if ( !connected ) {
+			continue;
+		}
+
+		score = SV_GameClientNum( i )->persistant[PERS_SCORE];
+		if ( cl->ping != queryCache.ping[i] || score != queryCache.score[i] || strcmp( cl->name, queryCache.name[i] ) ) {
+			queryCache.ping[i] = cl->ping;
+			queryCache.score[i] = score;
+			Q_strncpyz( queryCache.name[i], cl->name, sizeof( queryCache.name[i] ) );
+			SV_InvalidateQueryCache();
+		}
 	}
-	*/
+}
 
-	// Prevent using getstatus as an amplifier
-	if ( SVC_RateLimitAddress( from, 10, 1000 ) ) {
-		Com_DPrintf( "SVC_Status: rate limit from %s exceeded, dropping request\n",
-			NET_AdrToString( from ) );
+/*
+================
+SVC_SendCachedResponse
+
+Sends a cached reply with the requester's challenge spliced in, the
+same way Info_SetValueForKey would have added it
+================
+*/
+static void SVC_SendCachedResponse( netadr_t from, const char *response, int length, int splice, int infoLength ) {
+	char		packet[MAX_MSGLEN + CHALLENGE_SPLICE_MAX];
+	const char	*challenge;
+	int			challengeLength;
+
+	// A maximum challenge length of 128 should be more than plenty.
+	challenge = Cmd_Argv(1);
+	if ( strlen( challenge ) > 128 ) {
 		return;
 	}
 
-	// Allow getstatus to be DoSed relatively easily, but prevent
-	// excess outbound bandwidth usage when being flooded inbound
-	if ( SVC_RateLimit( &outboundLeakyBucket, 10, 100 ) ) {
-		Com_DPrintf( "SVC_Status: rate limit exceeded, dropping request\n" );
-		return;
+	challengeLength = 0;
+	if ( *challenge && !strpbrk( challenge, "\\;\"" ) ) {
+		challengeLength = Com_sprintf( packet + splice, CHALLENGE_SPLICE_MAX, "\\challenge\\%s", challenge );
+		if ( infoLength + challengeLength >= MAX_INFO_STRING ) {
+			challengeLength = 0;
+		}
 	}
 
-	// A maximum challenge length of 128 should be more than plenty.
-	if(strlen(Cmd_Argv(1)) > 128)
-		return;
+	memcpy( packet, response, splice );
+	memcpy( packet + splice + challengeLength, response + splice, length - splice );
 
-	strcpy( infostring, Cvar_InfoString( CVAR_SERVERINFO ) );
+	NET_SendPacket( NS_SERVER, length + challengeLength, packet, from );
+}
 
-	// echo back the parameter to status. so master servers can use it as a challenge
-	// to prevent timed spoofed reply packets that add ghost servers
-	Info_SetValueForKey( infostring, "challenge", Cmd_Argv(1) );
+/*
+================
+SVC_BuildStatus
+================
+*/
+static void SVC_BuildStatus( void ) {
+	char	*status = queryCache.status;
+	char	infostring[MAX_INFO_STRING];
+	char	player[1024];
+	int		i;
+	client_t	*cl;
+	playerState_t	*ps;
+	int		statusLength;
+	int		playerLength;
 
-	status[0] = 0;
-	statusLength = 0;
+	Q_strncpyz( infostring, Cvar_InfoString( CVAR_SERVERINFO ), sizeof( infostring ) );
+	Info_RemoveKey( infostring, "challenge" );
+
+	status[0] = status[1] = status[2] = status[3] = -1;
+	statusLength = 4;
+	statusLength += Com_sprintf( status + statusLength, sizeof( queryCache.status ) - statusLength, "statusResponse\n" );
+	queryCache.statusSplice = statusLength;
+	queryCache.statusInfoLength = strlen( infostring );
+	statusLength += Com_sprintf( status + statusLength, sizeof( queryCache.status ) - statusLength, "%s\n", infostring );
 
 	for (i=0 ; i < sv_maxclients->integer ; i++) {
 		cl = &svs.clients[i];
@@ -490,7 +586,7 @@ void SVC_Status( netadr_t from ) {
 			Com_sprintf (player, sizeof(player), "%i %i \"%s\"\n",
 				ps->persistant[PERS_SCORE], cl->ping, cl->name);
 			playerLength = strlen(player);
-			if (statusLength + playerLength >= (int)sizeof(status) ) {
+			if (statusLength + playerLength >= (int)sizeof(queryCache.status) - CHALLENGE_SPLICE_MAX ) {
 				break;		// can't hold any more
 			}
 			strcpy (status + statusLength, player);
@@ -498,56 +594,60 @@ void SVC_Status( netadr_t from ) {
 		}
 	}
 
-	NET_OutOfBandPrint( NS_SERVER, from, "statusResponse\n%s\n%s", infostring, status );
+	queryCache.statusLength = statusLength;
+	queryCache.statusValid = qtrue;
 }
 
 /*
 ================
-SVC_Info
+SVC_Status
 
-Responds with a short info message that should be enough to determine
-if a user is interested in a server to do a full status
+Responds with all the info that qplug or qspy can see about the server
+and all connected players.  Used for getting detailed information after
+the simple info query.
 ================
 */
-void SVC_Info( netadr_t from ) {
-	int		i, count, humans, wDisable;
-	char	*gamedir;
-	char	infostring[MAX_INFO_STRING];
-
+void SVC_Status( netadr_t from ) {
 	// ignore if we are in single player
 	/*
-	if ( Cvar_VariableValue( "g_gametype" ) == GT_SINGLE_PLAYER || Cvar_VariableValue("ui_singlePlayerActive")) {
+	if ( Cvar_VariableValue( "g_gametype" ) == GT_SINGLE_PLAYER ) {
 		return;
 	}
 	*/
 
-	if (Cvar_VariableValue("ui_singlePlayerActive"))
-	{
-		return;
-	}
-
-	// Prevent using getinfo as an amplifier
+	// Prevent using getstatus as an amplifier
 	if ( SVC_RateLimitAddress( from, 10, 1000 ) ) {
-		Com_DPrintf( "SVC_Info: rate limit from %s exceeded, dropping request\n",
+		Com_DPrintf( "SVC_Status: rate limit from %s exceeded, dropping request\n",
 			NET_AdrToString( from ) );
 		return;
 	}
 
-	// Allow getinfo to be DoSed relatively easily, but prevent
+	// Allow getstatus to be DoSed relatively easily, but prevent
 	// excess outbound bandwidth usage when being flooded inbound
 	if ( SVC_RateLimit( &outboundLeakyBucket, 10, 100 ) ) {
-		Com_DPrintf( "SVC_Info: rate limit exceeded, dropping request\n" );
+		Com_DPrintf( "SVC_Status: rate limit exceeded, dropping request\n" );
 		return;
 	}
 
-	/*
-	 * Check whether Cmd_Argv(1) has a sane length. This was not done in the original Quake3 version which led
-	 * to the Infostring bug discovered by Luigi Auriemma. See http://aluigi.altervista.org/ for the advisory.
-	 */
+	// serverinfo changes are only picked up by SV_Frame, don't serve stale ones until then
+	if ( !queryCache.statusValid || (cvar_modifiedFlags & CVAR_SERVERINFO) ) {
+		SVC_BuildStatus();
+	}
 
-	// A maximum challenge length of 128 should be more than plenty.
-	if(strlen(Cmd_Argv(1)) > 128)
-		return;
+	// echo back the parameter to status. so master servers can use it as a challenge
+	// to prevent timed spoofed reply packets that add ghost servers
+	SVC_SendCachedResponse( from, queryCache.status, queryCache.statusLength, queryCache.statusSplice, queryCache.statusInfoLength );
+}
+
+/*
+================
+SVC_BuildInfo
+================
+*/
+static void SVC_BuildInfo( void ) {
+	int		i, count, humans, wDisable;
+	char	*gamedir;
+	char	infostring[MAX_INFO_STRING];
 
 	// don't count privateclients
 	count = humans = 0;
@@ -562,10 +662,6 @@ void SVC_Info( netadr_t from ) {
 
 	infostring[0] = 0;
 
-	// echo back the parameter to status. so servers can use it as a challenge
-	// to prevent timed spoofed reply packets that add ghost servers
-	Info_SetValueForKey( infostring, "challenge", Cmd_Argv(1) );
-
 	Info_SetValueForKey( infostring, "protocol", va("%i", PROTOCOL_VERSION) );
 	Info_SetValueForKey( infostring, "hostname", sv_hostname->string );
 	Info_SetValueForKey( infostring, "mapname", sv_mapname->string );
@@ -600,7 +696,61 @@ void SVC_Info( netadr_t from ) {
 		Info_SetValueForKey( infostring, "game", gamedir );
 	}
 
-	NET_OutOfBandPrint( NS_SERVER, from, "infoResponse\n%s", infostring );
+	queryCache.info[0] = queryCache.info[1] = queryCache.info[2] = queryCache.info[3] = -1;
+	queryCache.infoLength = 4 + Com_sprintf( queryCache.info + 4, sizeof( queryCache.info ) - 4, "infoResponse\n%s", infostring );
+	// the challenge used to be set first, so it always had room
+	queryCache.infoInfoLength = 0;
+	queryCache.infoValid = qtrue;
+}
+
+/*
+================
+SVC_Info
+
+Responds with a short info message that should be enough to determine
+if a user is interested in a server to do a full status
+================
+*/
+void SVC_Info( netadr_t from ) {
+	// ignore if we are in single player
+	/*
+	if ( Cvar_VariableValue( "g_gametype" ) == GT_SINGLE_PLAYER || Cvar_VariableValue("ui_singlePlayerActive")) {
+		return;
+	}
+	*/
+
+	if (Cvar_VariableValue("ui_singlePlayerActive"))
+	{
+		return;
+	}
+
+	// Prevent using getinfo as an amplifier
+	if ( SVC_RateLimitAddress( from, 10, 1000 ) ) {
+		Com_DPrintf( "SVC_Info: rate limit from %s exceeded, dropping request\n",
+			NET_AdrToString( from ) );
+		return;
+	}
+
+	// Allow getinfo to be DoSed relatively easily, but prevent
+	// excess outbound bandwidth usage when being flooded inbound
+	if ( SVC_RateLimit( &outboundLeakyBucket, 10, 100 ) ) {
+		Com_DPrintf( "SVC_Info: rate limit exceeded, dropping request\n" );
+		return;
+	}
+
+	/*
+	 * Check whether Cmd_Argv(1) has a sane length. This was not done in the original Quake3 version which led
+	 * to the Infostring bug discovered by Luigi Auriemma. See http://aluigi.altervista.org/ for the advisory.
+	 * SVC_SendCachedResponse does the check now.
+	 */
+
+	if ( !queryCache.infoValid || (cvar_modifiedFlags & CVAR_SERVERINFO) ) {
+		SVC_BuildInfo();
+	}
+
+	// echo back the parameter to status. so servers can use it as a challenge
+	// to prevent timed spoofed reply packets that add ghost servers
+	SVC_SendCachedResponse( from, queryCache.info, queryCache.infoLength, queryCache.infoLength, queryCache.infoInfoLength );
 }
 
 /*
@@ -749,6 +899,8 @@ void SV_PacketEvent( netadr_t from, msg_t *msg ) {
 	client_t	*cl;
 	int			qport;
 
+	SV_CapturePacket( from, msg );
+
 	// check for connectionless packet (0xffffffff) first
 	if ( msg->cursize >= 4 && *(int *)msg->data == -1) {
 		SV_ConnectionlessPacket( from, msg );
@@ -1003,8 +1155,11 @@ happen before SV_Frame is called
 */
 void SV_Frame( int msec ) {
 	int		frameMsec;
+	int		frameUsec;
 	int		startTime;
 
+	SV_CaptureFrame();
+
 	// the menu kills the server with this cvar
 	if ( sv_killserver->integer ) {
 		SV_Shutdown ("Server was killed.\n");
@@ -1025,13 +1180,17 @@ void SV_Frame( int msec ) {
 	if ( sv_fps->integer < 1 ) {
 		Cvar_Set( "sv_fps", "10" );
 	}
-	frameMsec = 1000 / sv_fps->integer * com_timescale->value;
+	frameUsec = 1000000.0f / sv_fps->integer * com_timescale->value;
 	// don't let it scale below 1ms
-	if(frameMsec < 1)
+	if(frameUsec < 1000)
 	{
 		Cvar_Set("timescale", va("%f", sv_fps->integer / 1000.0f));
-		frameMsec = 1;
+		frameUsec = 1000;
 	}
+	// game time is whole milliseconds, so carry the sub-millisecond part
+	// of each tick into the next one instead of truncating it away
+	// (sv_fps 60 runs 16,17,17,... rather than a steady 16)
+	frameMsec = (frameUsec + sv.tickFraction) / 1000;
 
 	sv.timeResidual += msec;
 
@@ -1039,8 +1198,11 @@ void SV_Frame( int msec ) {
 
 	if ( com_dedicated->integer && sv.timeResidual < frameMsec && (!com_timescale || com_timescale->value >= 1) ) {
 		// NET_Sleep will give the OS time slices until either get a packet
-		// or time enough for a server frame has gone by
-		NET_Sleep(frameMsec - sv.timeResidual);
+		// or the event clock reaches the millisecond the next frame is due,
+		// a replay runs on the capture's clock and doesn't wait
+		if ( !SV_Replaying() ) {
+			NET_Sleep( (int)( (int64_t)(com_frameTime + frameMsec - sv.timeResidual) * 1000 - Sys_Microseconds() ) );
+		}
 		return;
 	}
 
@@ -1070,6 +1232,7 @@ void SV_Frame( int msec ) {
 	if ( cvar_modifiedFlags & CVAR_SERVERINFO ) {
 		SV_SetConfigstring( CS_SERVERINFO, Cvar_InfoString( CVAR_SERVERINFO ) );
 		cvar_modifiedFlags &= ~CVAR_SERVERINFO;
+		SV_InvalidateQueryCache();
 	}
 	if ( cvar_modifiedFlags & CVAR_SYSTEMINFO ) {
 		SV_SetConfigstring( CS_SYSTEMINFO, Cvar_InfoString_Big( CVAR_SYSTEMINFO ) );
@@ -1092,6 +1255,8 @@ void SV_Frame( int msec ) {
 		sv.timeResidual -= frameMsec;
 		svs.time += frameMsec;
 		sv.time += frameMsec;
+		sv.tickFraction = (frameUsec + sv.tickFraction) % 1000;
+		frameMsec = (frameUsec + sv.tickFraction) / 1000;
 
 		// let everything in the world think and move
 		GVM_RunFrame( sv.time );
@@ -1108,6 +1273,9 @@ void SV_Frame( int msec ) {
 	// check timeouts
 	SV_CheckTimeouts();
 
+	// drop the cached getstatus/getinfo replies if anything in them moved
+	SV_CheckQueryCache();
+
 	// send messages back to the clients
 	SV_SendClientMessages();
 
@@ -1115,6 +1283,12 @@ void SV_Frame( int msec ) {
 
 	// send a heartbeat to the master if needed
 	SV_MasterHeartbeat();
+
+	SV_PreloadFrame();
+
+	SV_AreaBenchFrame();
+
+	SV_CaptureFrameDone();
 }
 
 //============================================================================
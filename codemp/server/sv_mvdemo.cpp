@@ -0,0 +1,951 @@
+// sv_mvdemo.cpp -- multi-view server demos, every client's view of a match in one file
+
+#include "server.h"
+
+/*
+==============================================================================
+
+MULTI-VIEW DEMOS
+
+svrecord keeps a demo per client, so recording a whole match writes every
+shared entity once per player. svmvrecord keeps one demo for the server
+instead: each frame, every entity someone saw is delta compressed once
+against the last state written for it, and each client adds only its
+playerstate, areabits and the changes to which entities it could see.
+Configstring changes and broadcast commands are stored once as well.
+
+Nothing extra is built for it, the views are the snapshots the server
+already makes for its clients.
+
+svmvextract replays such a file from one client's point of view and
+writes an ordinary demo of it.
+
+The file is a header followed by records, each an int length and a
+huffman coded message, ended by a length of -1:
+
+"SVDM" [int MVD_VERSION] [int PROTOCOL_VERSION]
+gamestate:	mvd_gamestate, mvd_configstring..., mvd_baseline..., mvd_eof
+frame:		mvd_configstring/mvd_command/mvd_dropped..., mvd_snapshot, mvd_eof
+
+==============================================================================
+*/
+
+#define	MVD_VERSION			1
+#define	MVD_RECORD_SIZE		0x100000	// a frame where every entity and client changed fits easily
+#define	MVD_ALL_CLIENTS		255
+
+enum mvdOps_e {
+	mvd_bad,
+	mvd_gamestate,		// [long checksumFeed]
+	mvd_configstring,	// [short index] [bigstring]
+	mvd_baseline,		// [entity delta from nothing]
+	mvd_command,		// [byte clientNum or MVD_ALL_CLIENTS] [string]
+	mvd_dropped,		// [byte clientNum] its next view starts over
+	mvd_snapshot,		// [long serverTime] [entity deltas] [client views]
+	mvd_eof
+};
+
+// what the file last said about one client, kept alike by writer and reader
+typedef struct {
+	qboolean		valid;
+	int				areabytes;
+	byte			areabits[MAX_MAP_AREA_BYTES];
+	playerState_t	ps;
+	playerState_t	vps;
+	byte			visible[MAX_GENTITIES/8];
+} mvdClient_t;
+
+typedef struct {
+	entityState_t	entities[MAX_GENTITIES];	// last state written for each number
+	mvdClient_t		clients[MAX_CLIENTS];
+} mvdState_t;
+
+typedef struct {
+	client_t			*client;
+	clientSnapshot_t	*frame;
+	int					snapFlags;
+} mvdView_t;
+
+static struct {
+	demoStream_t	*stream;
+	char			name[MAX_OSPATH];
+	mvdState_t		*state;
+	byte			*buffer;
+	msg_t			msg;				// this frame's record
+
+	int				numViews;			// snapshots built this frame
+	mvdView_t		views[MAX_CLIENTS];
+	entityState_t	*seen[MAX_GENTITIES];
+} mvd;
+
+/*
+=============================================================================
+
+RECORDING
+
+=============================================================================
+*/
+
+/*
+==================
+SV_MVDemoWriteRecord
+
+Returns qfalse if the record didn't fit
+==================
+*/
+static qboolean SV_MVDemoWriteRecord( void ) {
+	int		len;
+
+	if ( mvd.msg.overflowed ) {
+		return qfalse;
+	}
+
+	len = LittleLong( mvd.msg.cursize );
+	SV_DemoWrite( mvd.stream, &len, 4 );
+	SV_DemoWrite( mvd.stream, mvd.msg.data, mvd.msg.cursize );
+	MSG_Clear( &mvd.msg );
+
+	return qtrue;
+}
+
+/*
+==================
+SV_MVDemoStop
+==================
+*/
+void SV_MVDemoStop( void ) {
+	int		len;
+
+	if ( !mvd.stream ) {
+		return;
+	}
+
+	// commands and configstrings since the last snapshot
+	if ( mvd.msg.cursize ) {
+		MSG_WriteByte( &mvd.msg, mvd_eof );
+		SV_MVDemoWriteRecord();
+	}
+
+	len = -1;
+	SV_DemoWrite( mvd.stream, &len, 4 );
+	SV_DemoClose( mvd.stream );
+
+	Com_Printf( "Stopped multi-view demo %s.\n", mvd.name );
+
+	Z_Free( mvd.state );
+	Z_Free( mvd.buffer );
+	Com_Memset( &mvd, 0, sizeof( mvd ) );
+}
+
+/*
+==================
+SV_MVDemoRecord
+==================
+*/
+static void SV_MVDemoRecord( const char *demoName ) {
+	fileHandle_t	f;
+	entityState_t	nullstate, *base;
+	int				i, header[3];
+
+	if ( mvd.stream ) {
+		Com_Printf( "Already recording %s.\n", mvd.name );
+		return;
+	}
+
+	Com_sprintf( mvd.name, sizeof( mvd.name ), "demos/%s.svdm_%d", demoName, PROTOCOL_VERSION );
+	Com_Printf( "recording to %s.\n", mvd.name );
+	f = FS_FOpenFileWrite( mvd.name );
+	if ( !f ) {
+		Com_Printf( "ERROR: couldn't open.\n" );
+		return;
+	}
+	mvd.stream = SV_DemoOpen( f );
+	if ( !mvd.stream ) {
+		return;
+	}
+
+	mvd.state = (mvdState_t *)Z_Malloc( sizeof( mvdState_t ), TAG_GENERAL, qtrue );
+	mvd.buffer = (byte *)Z_Malloc( MVD_RECORD_SIZE, TAG_GENERAL, qfalse );
+	MSG_Init( &mvd.msg, mvd.buffer, MVD_RECORD_SIZE );
+	mvd.msg.allowoverflow = qtrue;
+
+	Com_Memcpy( &header[0], "SVDM", 4 );
+	header[1] = LittleLong( MVD_VERSION );
+	header[2] = LittleLong( PROTOCOL_VERSION );
+	SV_DemoWrite( mvd.stream, header, sizeof( header ) );
+
+	// everything a client's gamestate needs, apart from who it is
+	MSG_WriteByte( &mvd.msg, mvd_gamestate );
+	MSG_WriteLong( &mvd.msg, sv.checksumFeed );
+
+	for ( i = 0 ; i < MAX_CONFIGSTRINGS ; i++ ) {
+		if ( sv.configstrings[i][0] ) {
+			MSG_WriteByte( &mvd.msg, mvd_configstring );
+			MSG_WriteShort( &mvd.msg, i );
+			MSG_WriteBigString( &mvd.msg, sv.configstrings[i] );
+		}
+	}
+
+	Com_Memset( &nullstate, 0, sizeof( nullstate ) );
+	for ( i = 0 ; i < MAX_GENTITIES ; i++ ) {
+		base = &sv.svEntities[i].baseline;
+		// like the gamestate, a baseline numbered 0 isn't sent and reads back as nothing
+		if ( !base->number ) {
+			continue;
+		}
+		mvd.state->entities[i] = *base;
+		MSG_WriteByte( &mvd.msg, mvd_baseline );
+		MSG_WriteDeltaEntity( &mvd.msg, &nullstate, base, qtrue );
+	}
+
+	MSG_WriteByte( &mvd.msg, mvd_eof );
+	if ( !SV_MVDemoWriteRecord() ) {
+		Com_Printf( "WARNING: gamestate too big for a multi-view demo\n" );
+		SV_MVDemoStop();
+	}
+}
+
+/*
+==================
+SV_MVDemoConfigstring
+
+Called by SV_FlushConfigstrings for every index it sends
+==================
+*/
+void SV_MVDemoConfigstring( int index, const char *val ) {
+	if ( !mvd.stream ) {
+		return;
+	}
+
+	MSG_WriteByte( &mvd.msg, mvd_configstring );
+	MSG_WriteShort( &mvd.msg, index );
+	MSG_WriteBigString( &mvd.msg, val );
+}
+
+/*
+==================
+SV_MVDemoServerCommand
+
+Called by SV_SendServerCommand, once for a broadcast
+==================
+*/
+void SV_MVDemoServerCommand( client_t *cl, const char *cmd ) {
+	if ( !mvd.stream ) {
+		return;
+	}
+
+	// configstring updates are rebuilt from mvd_configstring on extraction
+	if ( !Q_strncmp( cmd, "cs ", 3 ) || !Q_strncmp( cmd, "bcs", 3 ) ) {
+		return;
+	}
+
+	MSG_WriteByte( &mvd.msg, mvd_command );
+	MSG_WriteByte( &mvd.msg, cl ? cl - svs.clients : MVD_ALL_CLIENTS );
+	MSG_WriteString( &mvd.msg, cmd );
+}
+
+/*
+==================
+SV_MVDemoClientSnapshot
+
+Called by SV_SendClientSnapshot once the snapshot is built
+==================
+*/
+void SV_MVDemoClientSnapshot( client_t *client ) {
+	mvdView_t	*view;
+	int			i;
+
+	if ( !mvd.stream || client->state != CS_ACTIVE || !client->gentity ) {
+		return;
+	}
+
+	for ( i = 0 ; i < mvd.numViews ; i++ ) {
+		if ( mvd.views[i].client == client ) {
+			return;
+		}
+	}
+
+	// the frame and rateDelayed are what SV_WriteSnapshotToClient is about to use
+	view = &mvd.views[mvd.numViews++];
+	view->client = client;
+	view->frame = &client->frames[ client->netchan.outgoingSequence & PACKET_MASK ];
+	view->snapFlags = svs.snapFlagServerBit;
+	if ( client->rateDelayed ) {
+		view->snapFlags |= SNAPFLAG_RATE_DELAYED;
+	}
+}
+
+/*
+==================
+SV_MVDemoWriteView
+==================
+*/
+static void SV_MVDemoWriteView( msg_t *msg, mvdView_t *view ) {
+	clientSnapshot_t	*frame = view->frame;
+	mvdClient_t			*last = &mvd.state->clients[view->client - svs.clients];
+	entityState_t		*state;
+	byte				visible[MAX_GENTITIES/8];
+	qboolean			delta;
+	int					i, n, changed;
+
+	MSG_WriteByte( msg, view->client - svs.clients );
+	MSG_WriteByte( msg, view->snapFlags );
+
+	if ( !last->valid || frame->areabytes != last->areabytes
+		|| memcmp( frame->areabits, last->areabits, frame->areabytes ) ) {
+		MSG_WriteBits( msg, 1, 1 );
+		MSG_WriteByte( msg, frame->areabytes );
+		MSG_WriteData( msg, frame->areabits, frame->areabytes );
+		last->areabytes = frame->areabytes;
+		Com_Memcpy( last->areabits, frame->areabits, sizeof( last->areabits ) );
+	} else {
+		MSG_WriteBits( msg, 0, 1 );
+	}
+
+	MSG_WriteBits( msg, last->valid, 1 );
+#ifdef _ONEBIT_COMBO
+	MSG_WriteDeltaPlayerstate( msg, last->valid ? &last->ps : NULL, &frame->ps, NULL, NULL );
+#else
+	MSG_WriteDeltaPlayerstate( msg, last->valid ? &last->ps : NULL, &frame->ps );
+#endif
+	if ( frame->ps.m_iVehicleNum ) {
+		// same rule as SV_WriteSnapshotToClient, an old vps only counts if there was a vehicle
+		delta = (qboolean)( last->valid && last->ps.m_iVehicleNum );
+		MSG_WriteBits( msg, delta, 1 );
+#ifdef _ONEBIT_COMBO
+		MSG_WriteDeltaPlayerstate( msg, delta ? &last->vps : NULL, &frame->vps, NULL, NULL, qtrue );
+#else
+		MSG_WriteDeltaPlayerstate( msg, delta ? &last->vps : NULL, &frame->vps, qtrue );
+#endif
+		last->vps = frame->vps;
+	}
+	last->ps = frame->ps;
+
+	// which entities it could see, as the ones that came or went
+	Com_Memset( visible, 0, sizeof( visible ) );
+	for ( i = 0 ; i < frame->num_entities ; i++ ) {
+		state = &svs.snapshotEntities[ ( frame->first_entity + i ) % svs.numSnapshotEntities ];
+		visible[state->number >> 3] |= 1 << ( state->number & 7 );
+	}
+	if ( !last->valid ) {
+		Com_Memset( last->visible, 0, sizeof( last->visible ) );
+	}
+	for ( i = 0 ; i < (int)sizeof( visible ) ; i++ ) {
+		changed = visible[i] ^ last->visible[i];
+		for ( n = 0 ; changed ; n++, changed >>= 1 ) {
+			if ( changed & 1 ) {
+				MSG_WriteBits( msg, i * 8 + n, GENTITYNUM_BITS );
+			}
+		}
+	}
+	MSG_WriteBits( msg, MAX_GENTITIES-1, GENTITYNUM_BITS );
+	Com_Memcpy( last->visible, visible, sizeof( visible ) );
+
+	last->valid = qtrue;
+}
+
+/*
+==================
+SV_MVDemoFrame
+
+Called at the end of SV_SendClientMessages to write out the frame
+==================
+*/
+void SV_MVDemoFrame( void ) {
+	clientSnapshot_t	*frame;
+	entityState_t		*state;
+	int					i, j;
+
+	if ( !mvd.stream ) {
+		return;
+	}
+
+	// anyone who left since their last view
+	for ( i = 0 ; i < sv_maxclients->integer ; i++ ) {
+		if ( mvd.state->clients[i].valid && svs.clients[i].state != CS_ACTIVE ) {
+			MSG_WriteByte( &mvd.msg, mvd_dropped );
+			MSG_WriteByte( &mvd.msg, i );
+			mvd.state->clients[i].valid = qfalse;
+		}
+	}
+
+	if ( mvd.numViews ) {
+		MSG_WriteByte( &mvd.msg, mvd_snapshot );
+		MSG_WriteLong( &mvd.msg, sv.time );
+
+		// every entity anyone saw, once
+		for ( i = 0 ; i < mvd.numViews ; i++ ) {
+			frame = mvd.views[i].frame;
+			for ( j = 0 ; j < frame->num_entities ; j++ ) {
+				state = &svs.snapshotEntities[ ( frame->first_entity + j ) % svs.numSnapshotEntities ];
+				mvd.seen[state->number] = state;
+			}
+		}
+		for ( i = 0 ; i < MAX_GENTITIES ; i++ ) {
+			if ( !mvd.seen[i] ) {
+				continue;
+			}
+			MSG_WriteDeltaEntity( &mvd.msg, &mvd.state->entities[i], mvd.seen[i], qfalse );
+			mvd.state->entities[i] = *mvd.seen[i];
+			mvd.seen[i] = NULL;
+		}
+		MSG_WriteBits( &mvd.msg, MAX_GENTITIES-1, GENTITYNUM_BITS );
+
+		for ( i = 0 ; i < mvd.numViews ; i++ ) {
+			SV_MVDemoWriteView( &mvd.msg, &mvd.views[i] );
+		}
+		MSG_WriteByte( &mvd.msg, MVD_ALL_CLIENTS );
+
+		mvd.numViews = 0;
+	} else if ( !mvd.msg.cursize ) {
+		return;
+	}
+
+	MSG_WriteByte( &mvd.msg, mvd_eof );
+	if ( !SV_MVDemoWriteRecord() ) {
+		Com_Printf( "WARNING: multi-view demo frame overflowed\n" );
+		SV_MVDemoStop();
+	}
+}
+
+/*
+====================
+SV_MVRecord_f
+
+svmvrecord [demoname]
+====================
+*/
+void SV_MVRecord_f( void ) {
+	char	demoName[MAX_OSPATH];
+
+	if ( sv.state != SS_GAME ) {
+		Com_Printf( "Server is not running.\n" );
+		return;
+	}
+
+	if ( Cmd_Argc() > 2 ) {
+		Com_Printf( "svmvrecord <demoname>\n" );
+		return;
+	}
+
+	if ( Cmd_Argc() == 2 ) {
+		Q_strncpyz( demoName, Cmd_Argv( 1 ), sizeof( demoName ) );
+	} else {
+		SV_DemoFilename( demoName, sizeof( demoName ) );
+	}
+
+	SV_MVDemoRecord( demoName );
+}
+
+/*
+====================
+SV_MVStopRecord_f
+====================
+*/
+void SV_MVStopRecord_f( void ) {
+	if ( !mvd.stream ) {
+		Com_Printf( "No multi-view demo being recorded.\n" );
+		return;
+	}
+
+	SV_MVDemoStop();
+}
+
+/*
+=============================================================================
+
+EXTRACTION
+
+=============================================================================
+*/
+
+typedef struct {
+	fileHandle_t	out;
+	int				clientNum;
+	qboolean		started;		// the gamestate is written
+	qboolean		finished;		// the client left
+
+	int				messageNum;		// sequence of the next demo message
+	int				commandNum;		// last reliable command handed out
+	int				numPending;		// commands for the next snapshot
+	char			pending[MAX_RELIABLE_COMMANDS][MAX_STRING_CHARS];
+
+	int				checksumFeed;
+	char			*configstrings[MAX_CONFIGSTRINGS];
+	entityState_t	baselines[MAX_GENTITIES];
+	mvdState_t		state;
+
+	// the last snapshot written, to delta the next one against
+	playerState_t	ps;
+	playerState_t	vps;
+	int				numEntities;
+	entityState_t	entities[MAX_SNAPSHOT_ENTITIES];
+	entityState_t	newEntities[MAX_SNAPSHOT_ENTITIES];
+} mvdExtract_t;
+
+static void SV_MVDemoQueueCommand( mvdExtract_t *ex, const char *cmd ) {
+	if ( ex->numPending == MAX_RELIABLE_COMMANDS ) {
+		Com_Printf( "WARNING: more than %d commands between snapshots, dropping \"%s\"\n", MAX_RELIABLE_COMMANDS, cmd );
+		return;
+	}
+	Q_strncpyz( ex->pending[ex->numPending++], cmd, MAX_STRING_CHARS );
+}
+
+/*
+==================
+SV_MVDemoQueueConfigstring
+
+The same commands SV_SendConfigstring would have sent
+==================
+*/
+static void SV_MVDemoQueueConfigstring( mvdExtract_t *ex, int index ) {
+	int			maxChunkSize = MAX_STRING_CHARS - 24;
+	const char	*s = ex->configstrings[index] ? ex->configstrings[index] : "";
+	int			len, sent, remaining;
+	const char	*cmd;
+	char		buf[MAX_STRING_CHARS];
+
+	len = strlen( s );
+	if ( len < maxChunkSize ) {
+		SV_MVDemoQueueCommand( ex, va( "cs %i \"%s\"\n", index, s ) );
+		return;
+	}
+
+	for ( sent = 0, remaining = len ; remaining > 0 ; sent += maxChunkSize - 1, remaining -= maxChunkSize - 1 ) {
+		if ( sent == 0 ) {
+			cmd = "bcs0";
+		} else if ( remaining < maxChunkSize ) {
+			cmd = "bcs2";
+		} else {
+			cmd = "bcs1";
+		}
+		Q_strncpyz( buf, &s[sent], maxChunkSize );
+		SV_MVDemoQueueCommand( ex, va( "%s %i \"%s\"\n", cmd, index, buf ) );
+	}
+}
+
+static void SV_MVDemoWriteMessage( mvdExtract_t *ex, msg_t *msg ) {
+	int		len;
+
+	len = LittleLong( ex->messageNum++ );
+	FS_Write( &len, 4, ex->out );
+	len = LittleLong( msg->cursize );
+	FS_Write( &len, 4, ex->out );
+	FS_Write( msg->data, msg->cursize, ex->out );
+}
+
+/*
+==================
+SV_MVDemoWriteGamestate
+
+Like SV_CreateClientGameStateMessage, from what the file has said so far
+==================
+*/
+static void SV_MVDemoWriteGamestate( mvdExtract_t *ex ) {
+	byte			buf[MAX_MSGLEN];
+	msg_t			msg;
+	entityState_t	nullstate;
+	int				i;
+
+	MSG_Init( &msg, buf, sizeof( buf ) );
+
+	MSG_WriteLong( &msg, 0 );
+
+	MSG_WriteByte( &msg, svc_gamestate );
+	MSG_WriteLong( &msg, ex->commandNum );
+
+	for ( i = 0 ; i < MAX_CONFIGSTRINGS ; i++ ) {
+		if ( ex->configstrings[i] && ex->configstrings[i][0] ) {
+			MSG_WriteByte( &msg, svc_configstring );
+			MSG_WriteShort( &msg, i );
+			MSG_WriteBigString( &msg, ex->configstrings[i] );
+		}
+	}
+
+	Com_Memset( &nullstate, 0, sizeof( nullstate ) );
+	for ( i = 0 ; i < MAX_GENTITIES ; i++ ) {
+		if ( !ex->baselines[i].number ) {
+			continue;
+		}
+		MSG_WriteByte( &msg, svc_baseline );
+		MSG_WriteDeltaEntity( &msg, &nullstate, &ex->baselines[i], qtrue );
+	}
+
+	MSG_WriteByte( &msg, svc_EOF );
+	MSG_WriteLong( &msg, ex->clientNum );
+	MSG_WriteLong( &msg, ex->checksumFeed );
+	MSG_WriteShort( &msg, 0 );
+	MSG_WriteByte( &msg, svc_EOF );
+
+	SV_MVDemoWriteMessage( ex, &msg );
+}
+
+/*
+==================
+SV_MVDemoEmitEntities
+
+SV_EmitPacketEntities over plain arrays
+==================
+*/
+static void SV_MVDemoEmitEntities( mvdExtract_t *ex, msg_t *msg, entityState_t *from, int numFrom, entityState_t *to, int numTo ) {
+	int		oldindex, newindex;
+	int		oldnum, newnum;
+
+	oldindex = newindex = 0;
+	while ( newindex < numTo || oldindex < numFrom ) {
+		newnum = newindex < numTo ? to[newindex].number : 9999;
+		oldnum = oldindex < numFrom ? from[oldindex].number : 9999;
+
+		if ( newnum == oldnum ) {
+			MSG_WriteDeltaEntity( msg, &from[oldindex], &to[newindex], qfalse );
+			oldindex++;
+			newindex++;
+		} else if ( newnum < oldnum ) {
+			MSG_WriteDeltaEntity( msg, &ex->baselines[newnum], &to[newindex], qtrue );
+			newindex++;
+		} else {
+			MSG_WriteDeltaEntity( msg, &from[oldindex], NULL, qtrue );
+			oldindex++;
+		}
+	}
+
+	MSG_WriteBits( msg, MAX_GENTITIES-1, GENTITYNUM_BITS );
+}
+
+/*
+==================
+SV_MVDemoWriteSnapshot
+
+Turns the extracted client's view into a demo message
+==================
+*/
+static void SV_MVDemoWriteSnapshot( mvdExtract_t *ex, int serverTime, int snapFlags ) {
+	byte			buf[MAX_MSGLEN];
+	msg_t			msg;
+	mvdClient_t		*view = &ex->state.clients[ex->clientNum];
+	qboolean		delta;
+	int				i, numEntities;
+
+	delta = ex->started;
+	if ( !ex->started ) {
+		SV_MVDemoWriteGamestate( ex );
+		ex->started = qtrue;
+	}
+
+	MSG_Init( &msg, buf, sizeof( buf ) );
+	msg.allowoverflow = qtrue;
+
+	// nothing to acknowledge in a demo
+	MSG_WriteLong( &msg, 0 );
+
+	for ( i = 0 ; i < ex->numPending ; i++ ) {
+		MSG_WriteByte( &msg, svc_serverCommand );
+		MSG_WriteLong( &msg, ++ex->commandNum );
+		MSG_WriteString( &msg, ex->pending[i] );
+	}
+	ex->numPending = 0;
+
+	MSG_WriteByte( &msg, svc_snapshot );
+	MSG_WriteLong( &msg, serverTime );
+	MSG_WriteByte( &msg, delta ? 1 : 0 );
+	MSG_WriteByte( &msg, snapFlags );
+	MSG_WriteByte( &msg, view->areabytes );
+	MSG_WriteData( &msg, view->areabits, view->areabytes );
+
+#ifdef _ONEBIT_COMBO
+	MSG_WriteDeltaPlayerstate( &msg, delta ? &ex->ps : NULL, &view->ps, NULL, NULL );
+#else
+	MSG_WriteDeltaPlayerstate( &msg, delta ? &ex->ps : NULL, &view->ps );
+#endif
+	if ( view->ps.m_iVehicleNum ) {
+		qboolean vehDelta = (qboolean)( delta && ex->ps.m_iVehicleNum );
+#ifdef _ONEBIT_COMBO
+		MSG_WriteDeltaPlayerstate( &msg, vehDelta ? &ex->vps : NULL, &view->vps, NULL, NULL, qtrue );
+#else
+		MSG_WriteDeltaPlayerstate( &msg, vehDelta ? &ex->vps : NULL, &view->vps, qtrue );
+#endif
+	}
+
+	numEntities = 0;
+	for ( i = 0 ; i < MAX_GENTITIES && numEntities < MAX_SNAPSHOT_ENTITIES ; i++ ) {
+		if ( view->visible[i >> 3] & ( 1 << ( i & 7 ) ) ) {
+			ex->newEntities[numEntities++] = ex->state.entities[i];
+		}
+	}
+	SV_MVDemoEmitEntities( ex, &msg, ex->entities, delta ? ex->numEntities : 0, ex->newEntities, numEntities );
+
+	MSG_WriteByte( &msg, svc_EOF );
+
+	if ( msg.overflowed ) {
+		Com_Printf( "WARNING: snapshot at %d overflowed, skipped\n", serverTime );
+		return;
+	}
+
+	SV_MVDemoWriteMessage( ex, &msg );
+
+	ex->ps = view->ps;
+	ex->vps = view->vps;
+	ex->numEntities = numEntities;
+	Com_Memcpy( ex->entities, ex->newEntities, numEntities * sizeof( entityState_t ) );
+}
+
+/*
+==================
+SV_MVDemoReadSnapshot
+==================
+*/
+static qboolean SV_MVDemoReadSnapshot( mvdExtract_t *ex, msg_t *msg ) {
+	mvdClient_t		*view;
+	entityState_t	state;
+	int				serverTime, snapFlags;
+	int				num, clientNum;
+
+	serverTime = MSG_ReadLong( msg );
+
+	for ( ;; ) {
+		num = MSG_ReadBits( msg, GENTITYNUM_BITS );
+		if ( num == MAX_GENTITIES-1 ) {
+			break;
+		}
+		if ( msg->readcount > msg->cursize ) {
+			return qfalse;
+		}
+		MSG_ReadDeltaEntity( msg, &ex->state.entities[num], &state, num );
+		ex->state.entities[num] = state;
+	}
+
+	for ( ;; ) {
+		clientNum = MSG_ReadByte( msg );
+		if ( clientNum == MVD_ALL_CLIENTS ) {
+			break;
+		}
+		if ( clientNum < 0 || clientNum >= MAX_CLIENTS ) {
+			return qfalse;
+		}
+		view = &ex->state.clients[clientNum];
+
+		snapFlags = MSG_ReadByte( msg );
+		if ( MSG_ReadBits( msg, 1 ) ) {
+			view->areabytes = MSG_ReadByte( msg );
+			if ( view->areabytes < 0 || view->areabytes > MAX_MAP_AREA_BYTES ) {
+				return qfalse;
+			}
+			MSG_ReadData( msg, view->areabits, view->areabytes );
+		}
+
+		view->valid = (qboolean)MSG_ReadBits( msg, 1 );
+		MSG_ReadDeltaPlayerstate( msg, view->valid ? &view->ps : NULL, &view->ps );
+		if ( view->ps.m_iVehicleNum ) {
+			MSG_ReadDeltaPlayerstate( msg, MSG_ReadBits( msg, 1 ) ? &view->vps : NULL, &view->vps, qtrue );
+		}
+
+		if ( !view->valid ) {
+			Com_Memset( view->visible, 0, sizeof( view->visible ) );
+		}
+		for ( ;; ) {
+			num = MSG_ReadBits( msg, GENTITYNUM_BITS );
+			if ( num == MAX_GENTITIES-1 ) {
+				break;
+			}
+			if ( msg->readcount > msg->cursize ) {
+				return qfalse;
+			}
+			view->visible[num >> 3] ^= 1 << ( num & 7 );
+		}
+		view->valid = qtrue;
+
+		if ( clientNum == ex->clientNum && !ex->finished ) {
+			SV_MVDemoWriteSnapshot( ex, serverTime, snapFlags );
+		}
+	}
+
+	return qtrue;
+}
+
+/*
+==================
+SV_MVDemoReadRecord
+==================
+*/
+static qboolean SV_MVDemoReadRecord( mvdExtract_t *ex, msg_t *msg ) {
+	entityState_t	nullstate;
+	const char		*s;
+	int				op, index, target;
+
+	Com_Memset( &nullstate, 0, sizeof( nullstate ) );
+
+	for ( ;; ) {
+		if ( msg->readcount > msg->cursize ) {
+			return qfalse;
+		}
+
+		op = MSG_ReadByte( msg );
+		switch ( op ) {
+		case mvd_eof:
+			return qtrue;
+
+		case mvd_gamestate:
+			ex->checksumFeed = MSG_ReadLong( msg );
+			break;
+
+		case mvd_configstring:
+			index = MSG_ReadShort( msg );
+			s = MSG_ReadBigString( msg );
+			if ( index < 0 || index >= MAX_CONFIGSTRINGS ) {
+				return qfalse;
+			}
+			if ( ex->configstrings[index] ) {
+				Z_Free( ex->configstrings[index] );
+			}
+			ex->configstrings[index] = CopyString( s );
+			if ( ex->started ) {
+				SV_MVDemoQueueConfigstring( ex, index );
+			}
+			break;
+
+		case mvd_baseline:
+			index = MSG_ReadBits( msg, GENTITYNUM_BITS );
+			MSG_ReadDeltaEntity( msg, &nullstate, &ex->baselines[index], index );
+			ex->state.entities[index] = ex->baselines[index];
+			break;
+
+		case mvd_command:
+			target = MSG_ReadByte( msg );
+			s = MSG_ReadString( msg );
+			if ( ex->started && ( target == MVD_ALL_CLIENTS || target == ex->clientNum ) ) {
+				SV_MVDemoQueueCommand( ex, s );
+			}
+			break;
+
+		case mvd_dropped:
+			target = MSG_ReadByte( msg );
+			if ( target < 0 || target >= MAX_CLIENTS ) {
+				return qfalse;
+			}
+			ex->state.clients[target].valid = qfalse;
+			if ( target == ex->clientNum && ex->started ) {
+				ex->finished = qtrue;
+			}
+			break;
+
+		case mvd_snapshot:
+			if ( !SV_MVDemoReadSnapshot( ex, msg ) ) {
+				return qfalse;
+			}
+			break;
+
+		default:
+			return qfalse;
+		}
+	}
+}
+
+/*
+====================
+SV_MVExtract_f
+
+svmvextract <demoname> <clientnum> [outname]
+====================
+*/
+void SV_MVExtract_f( void ) {
+	mvdExtract_t	*ex;
+	fileHandle_t	in;
+	char			name[MAX_OSPATH];
+	byte			*buffer;
+	msg_t			msg;
+	int				header[3], len, i, snapshots;
+	qboolean		ok;
+
+	if ( Cmd_Argc() < 3 || Cmd_Argc() > 4 ) {
+		Com_Printf( "svmvextract <demoname> <clientnum> [outname]\n" );
+		return;
+	}
+
+	Com_sprintf( name, sizeof( name ), "demos/%s.svdm_%d", Cmd_Argv( 1 ), PROTOCOL_VERSION );
+	FS_FOpenFileRead( name, &in, qtrue );
+	if ( !in ) {
+		Com_Printf( "Couldn't open %s.\n", name );
+		return;
+	}
+
+	if ( FS_Read( header, sizeof( header ), in ) != sizeof( header ) || memcmp( &header[0], "SVDM", 4 )
+		|| LittleLong( header[1] ) != MVD_VERSION || LittleLong( header[2] ) != PROTOCOL_VERSION ) {
+		Com_Printf( "%s is not a multi-view demo this server can read.\n", name );
+		FS_FCloseFile( in );
+		return;
+	}
+
+	ex = (mvdExtract_t *)Z_Malloc( sizeof( mvdExtract_t ), TAG_GENERAL, qtrue );
+	buffer = (byte *)Z_Malloc( MVD_RECORD_SIZE, TAG_GENERAL, qfalse );
+
+	ex->clientNum = atoi( Cmd_Argv( 2 ) );
+	ex->messageNum = 1;
+	if ( ex->clientNum < 0 || ex->clientNum >= MAX_CLIENTS ) {
+		Com_Printf( "Bad client number %s.\n", Cmd_Argv( 2 ) );
+		ok = qfalse;
+		goto done;
+	}
+
+	if ( Cmd_Argc() == 4 ) {
+		Com_sprintf( name, sizeof( name ), "demos/%s.dm_%d", Cmd_Argv( 3 ), PROTOCOL_VERSION );
+	} else {
+		Com_sprintf( name, sizeof( name ), "demos/%s_%d.dm_%d", Cmd_Argv( 1 ), ex->clientNum, PROTOCOL_VERSION );
+	}
+	ex->out = FS_FOpenFileWrite( name );
+	if ( !ex->out ) {
+		Com_Printf( "ERROR: couldn't open %s.\n", name );
+		ok = qfalse;
+		goto done;
+	}
+
+	ok = qtrue;
+	while ( !ex->finished ) {
+		if ( FS_Read( &len, 4, in ) != 4 ) {
+			ok = qfalse;
+			break;
+		}
+		len = LittleLong( len );
+		if ( len == -1 ) {
+			break;
+		}
+		if ( len <= 0 || len > MVD_RECORD_SIZE || FS_Read( buffer, len, in ) != len ) {
+			ok = qfalse;
+			break;
+		}
+
+		MSG_Init( &msg, buffer, MVD_RECORD_SIZE );
+		msg.cursize = len;
+		MSG_BeginReading( &msg );
+		if ( !SV_MVDemoReadRecord( ex, &msg ) ) {
+			ok = qfalse;
+			break;
+		}
+	}
+
+	if ( !ok ) {
+		Com_Printf( "WARNING: %s is damaged, the demo stops where it does\n", Cmd_Argv( 1 ) );
+	}
+
+	// finish up like SV_StopRecordDemo
+	len = -1;
+	FS_Write( &len, 4, ex->out );
+	FS_Write( &len, 4, ex->out );
+	FS_FCloseFile( ex->out );
+
+	snapshots = ex->started ? ex->messageNum - 2 : 0;
+	if ( snapshots ) {
+		Com_Printf( "Wrote %d snapshots of client %d to %s.\n", snapshots, ex->clientNum, name );
+	} else {
+		Com_Printf( "Client %d is never seen in %s.\n", ex->clientNum, Cmd_Argv( 1 ) );
+	}
+
+done:
+	FS_FCloseFile( in );
+	for ( i = 0 ; i < MAX_CONFIGSTRINGS ; i++ ) {
+		if ( ex->configstrings[i] ) {
+			Z_Free( ex->configstrings[i] );
+		}
+	}
+	Z_Free( buffer );
+	Z_Free( ex );
+}
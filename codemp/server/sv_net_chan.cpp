@@ -111,13 +111,79 @@ static void SV_Netchan_Decode( client_t *client, msg_t *msg ) {
 }
 #endif
 
+/*
+=================
+SV_NetStatsAdd
+
+Counts into the client's total and into the slot of its rolling window
+for the current second of svs.time, which is cleared when it comes around
+=================
+*/
+void SV_NetStatsAdd( client_t *client, netStat_t stat, int value ) {
+	clientNetStats_t	*ns = &client->netStats;
+	int					second = svs.time / 1000;
+	int					slot = second % ( NETSTAT_SECONDS + 1 );
+
+	if ( ns->windowSecond[slot] != second ) {
+		ns->windowSecond[slot] = second;
+		Com_Memset( ns->window[slot], 0, sizeof( ns->window[slot] ) );
+	}
+
+	ns->window[slot][stat] += value;
+	ns->total[stat] += value;
+}
+
+/*
+=================
+SV_NetStatsRates
+
+Per second averages over the last NETSTAT_SECONDS whole seconds,
+or over as many as the client has been connected
+=================
+*/
+void SV_NetStatsRates( const client_t *client, float *rates ) {
+	const clientNetStats_t	*ns = &client->netStats;
+	int						now = svs.time / 1000;
+	int						seconds, second, slot, i;
+
+	seconds = now - client->lastConnectTime / 1000;
+	if ( seconds > NETSTAT_SECONDS ) {
+		seconds = NETSTAT_SECONDS;
+	} else if ( seconds < 1 ) {
+		seconds = 1;
+	}
+
+	for ( i = 0 ; i < NETSTAT_MAX ; i++ ) {
+		rates[i] = 0;
+	}
+	for ( second = now - seconds ; second < now ; second++ ) {
+		slot = second % ( NETSTAT_SECONDS + 1 );
+		if ( second < 0 || ns->windowSecond[slot] != second ) {
+			continue;
+		}
+		for ( i = 0 ; i < NETSTAT_MAX ; i++ ) {
+			rates[i] += ns->window[slot][i];
+		}
+	}
+	for ( i = 0 ; i < NETSTAT_MAX ; i++ ) {
+		rates[i] /= seconds;
+	}
+}
+
 /*
 =================
 SV_Netchan_TransmitNextFragment
 =================
 */
-void SV_Netchan_TransmitNextFragment( netchan_t *chan ) {
-	Netchan_TransmitNextFragment( chan );
+void SV_Netchan_TransmitNextFragment( client_t *client ) {
+	int		start = client->netchan.unsentFragmentStart;
+
+	Netchan_TransmitNextFragment( &client->netchan );
+
+	// sequence, fragment start and fragment length ahead of the data
+	SV_NetStatsAdd( client, NETSTAT_PACKETS_OUT, 1 );
+	SV_NetStatsAdd( client, NETSTAT_FRAGMENTS_OUT, 1 );
+	SV_NetStatsAdd( client, NETSTAT_BYTES_OUT, client->netchan.unsentFragmentStart - start + 8 );
 }
 
 
@@ -136,6 +202,15 @@ void SV_Netchan_Transmit( client_t *client, msg_t *msg) {	//int length, const by
 //	Huff_Compress( msg, SV_ENCODE_START );
 	SV_Netchan_Encode( client, msg );
 	Netchan_Transmit( &client->netchan, msg->cursize, msg->data );
+
+	SV_NetStatsAdd( client, NETSTAT_PACKETS_OUT, 1 );
+	if ( client->netchan.unsentFragments ) {
+		// only the first fragment went out now
+		SV_NetStatsAdd( client, NETSTAT_FRAGMENTS_OUT, 1 );
+		SV_NetStatsAdd( client, NETSTAT_BYTES_OUT, client->netchan.unsentFragmentStart + 8 );
+	} else {
+		SV_NetStatsAdd( client, NETSTAT_BYTES_OUT, msg->cursize + 4 );
+	}
 }
 
 /*
@@ -146,9 +221,18 @@ Netchan_SV_Process
 qboolean SV_Netchan_Process( client_t *client, msg_t *msg ) {
 	int ret;
 //	int i;
+	SV_NetStatsAdd( client, NETSTAT_PACKETS_IN, 1 );
+	SV_NetStatsAdd( client, NETSTAT_BYTES_IN, msg->cursize );
+	if ( msg->cursize >= 4 && ( LittleLong( *(int *)msg->data ) & ( 1 << 31 ) ) ) {
+		SV_NetStatsAdd( client, NETSTAT_FRAGMENTS_IN, 1 );	// FRAGMENT_BIT
+	}
+
 	ret = Netchan_Process( &client->netchan, msg );
 	if (!ret)
 		return qfalse;
+	if ( client->netchan.dropped > 0 ) {
+		SV_NetStatsAdd( client, NETSTAT_DROPPED_IN, client->netchan.dropped );
+	}
 	SV_Netchan_Decode( client, msg );
 //	Huff_Decompress( msg, SV_DECODE_START );
 //	for(i=SV_DECODE_START+msg->readcount;i<msg->cursize;i++) {
@@ -0,0 +1,634 @@
+// sv_preload.cpp -- stages the next map's files from a thread of its own
+
+#include "server.h"
+#include "zlib/zlib.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
+/*
+==============================================================================
+
+Once the next map is known, either from the nextmap cvar or from the
+preload command, the files SV_SpawnServer is going to need are read from a
+background thread while the current match goes on, so the map change finds
+them in the OS cache instead of waiting for the disk. That covers the BSP,
+its collision cache, the bot AAS, nav and route files, and the Ghoul2
+models named in the entity string along with their animation files.
+
+Everything that loads those files allocates from the zone and goes through
+the filesystem's handle table, neither of which can be used off the game
+thread, so the thread only reads bytes. The game thread looks every file up
+with FS_FileLocation and queues its OS path and byte range; the thread reads
+them, pulls model names out of the BSP's entity lump when the BSP isn't
+compressed and animation file names out of model headers, and hands them
+back for the game thread to look up in turn.
+
+==============================================================================
+*/
+
+#define	MAX_PRELOAD_FILES		256
+#define	MAX_PRELOAD_MODELS		64
+#define	PRELOAD_CHUNK			0x40000
+#define	PRELOAD_CHECK_MSEC		1000
+
+typedef enum {
+	PRELOAD_PLAIN,
+	PRELOAD_BSP,				// look for models in the entity lump
+	PRELOAD_GLM					// look for the animation file in the header
+} preloadKind_t;
+
+typedef struct {
+	char			ospath[MAX_OSPATH];
+	long			offset;
+	long			length;
+	qboolean		stored;		// not deflated in a pk3
+	preloadKind_t	kind;
+} preloadFile_t;
+
+static cvar_t	*sv_preload;
+
+static struct {
+	qboolean		running;
+	qboolean		quit;
+	int				generation;		// bumped to drop whatever is queued
+
+	char			mapname[MAX_QPATH];		// game thread only
+	qboolean		fromCommand;			// staged by the preload command, don't follow nextmap
+	int				nextCheck;
+	int				startMsec;
+
+	preloadFile_t	files[MAX_PRELOAD_FILES];
+	int				numFiles;
+	int				nextFile;		// the thread's position in files
+	int64_t			bytes;
+	int				readErrors;
+	int				doneMsec;		// when the thread caught up with the queue
+
+	char			models[MAX_PRELOAD_MODELS][MAX_QPATH];	// models and animation files found by the thread
+	int				numModels;
+	int				resolvedModels;	// looked up by the game thread
+
+#ifdef _WIN32
+	CRITICAL_SECTION	lock;
+	HANDLE			thread;
+	HANDLE			workEvent;		// auto-reset, something was queued or quit was set
+#else
+	pthread_mutex_t	lock;
+	pthread_t		thread;
+	pthread_cond_t	workCond;
+#endif
+} preload;
+
+#ifdef _WIN32
+static void PL_Lock( void )			{ EnterCriticalSection( &preload.lock ); }
+static void PL_Unlock( void )		{ LeaveCriticalSection( &preload.lock ); }
+static void PL_SignalWork( void )	{ SetEvent( preload.workEvent ); }
+static void PL_WaitWork( void )		{ PL_Unlock(); WaitForSingleObject( preload.workEvent, INFINITE ); PL_Lock(); }
+#else
+static void PL_Lock( void )			{ pthread_mutex_lock( &preload.lock ); }
+static void PL_Unlock( void )		{ pthread_mutex_unlock( &preload.lock ); }
+static void PL_SignalWork( void )	{ pthread_cond_signal( &preload.workCond ); }
+static void PL_WaitWork( void )		{ pthread_cond_wait( &preload.workCond, &preload.lock ); }
+#endif
+
+/*
+==================
+SV_PreloadEntityModels
+
+Collects the Ghoul2 models the entity string names. Runs on the preload
+thread, so it can't use COM_Parse and its shared token buffer
+==================
+*/
+static int SV_PreloadEntityModels( const char *s, const char *end, char models[][MAX_QPATH], int maxModels ) {
+	char		token[2][MAX_QPATH];
+	const char	*start;
+	int			i, len, numModels, numTokens;
+
+	numModels = 0;
+	numTokens = 0;
+	while ( s < end ) {
+		if ( *s == '{' || *s == '}' ) {
+			numTokens = 0;
+			s++;
+			continue;
+		}
+		if ( *s != '"' ) {
+			s++;
+			continue;
+		}
+
+		start = ++s;
+		while ( s < end && *s != '"' ) {
+			s++;
+		}
+		len = s - start;
+		s++;
+
+		// keys and values alternate inside an entity
+		Q_strncpyz( token[numTokens & 1], start, minimum( len + 1, MAX_QPATH ) );
+		if ( !( numTokens++ & 1 ) ) {
+			continue;
+		}
+
+		if ( Q_stricmp( token[0], "model" ) && Q_stricmp( token[0], "model2" ) ) {
+			continue;
+		}
+		len = strlen( token[1] );
+		if ( len < 4 || Q_stricmp( token[1] + len - 4, ".glm" ) ) {
+			continue;
+		}
+
+		for ( i = 0 ; i < numModels ; i++ ) {
+			if ( !Q_stricmp( models[i], token[1] ) ) {
+				break;
+			}
+		}
+		if ( i == numModels && numModels < maxModels ) {
+			Q_strncpyz( models[numModels++], token[1], MAX_QPATH );
+		}
+	}
+
+	return numModels;
+}
+
+/*
+==================
+SV_PreloadAnimFile
+
+Names the animation file of the Ghoul2 model whose first bytes are in buf,
+inflating them first if the model is deflated in a pk3
+==================
+*/
+static qboolean SV_PreloadAnimFile( const preloadFile_t *file, byte *buf, size_t len, char *name ) {
+	mdxmHeader_t	header;
+	z_stream		zs;
+	qboolean		ok;
+
+	if ( file->stored ) {
+		if ( len < sizeof( header ) ) {
+			return qfalse;
+		}
+		Com_Memcpy( &header, buf, sizeof( header ) );
+	} else {
+		// raw deflate, the zip entry has no zlib header
+		Com_Memset( &zs, 0, sizeof( zs ) );
+		if ( inflateInit2( &zs, -MAX_WBITS ) != Z_OK ) {
+			return qfalse;
+		}
+		zs.next_in = buf;
+		zs.avail_in = len;
+		zs.next_out = (Bytef *)&header;
+		zs.avail_out = sizeof( header );
+		inflate( &zs, Z_SYNC_FLUSH );
+		ok = (qboolean)!zs.avail_out;
+		inflateEnd( &zs );
+		if ( !ok ) {
+			return qfalse;
+		}
+	}
+
+	if ( LittleLong( header.ident ) != MDXM_IDENT || !header.animName[0] ) {
+		return qfalse;
+	}
+	header.animName[sizeof( header.animName ) - 1] = 0;
+	Com_sprintf( name, MAX_QPATH, "%s.gla", header.animName );
+	return qtrue;
+}
+
+/*
+==================
+SV_PreloadCancelled
+
+True once the thread is told to quit or the queue it is working from is dropped
+==================
+*/
+static qboolean SV_PreloadCancelled( int generation ) {
+	qboolean	cancelled;
+
+	PL_Lock();
+	cancelled = (qboolean)( preload.quit || preload.generation != generation );
+	PL_Unlock();
+
+	return cancelled;
+}
+
+/*
+==================
+SV_PreloadReadFile
+
+Reads a queued byte range through, so it's in the OS cache when the
+map change opens it, giving up between chunks if the queue was dropped.
+Returns the bytes read, or -1 if the file couldn't be opened
+==================
+*/
+static long SV_PreloadReadFile( const preloadFile_t *file, int generation, char models[][MAX_QPATH], int *numModels ) {
+	static byte	buf[PRELOAD_CHUNK];
+	dheader_t	*header;
+	FILE		*f;
+	char		*entities;
+	long		total, len, ofs;
+	size_t		got;
+
+	f = fopen( file->ospath, "rb" );
+	if ( !f ) {
+		return -1;
+	}
+
+	total = 0;
+	if ( !fseek( f, file->offset, SEEK_SET ) ) {
+		while ( total < file->length ) {
+			if ( total && SV_PreloadCancelled( generation ) ) {
+				break;
+			}
+
+			got = fread( buf, 1, minimum( (long)sizeof( buf ), file->length - total ), f );
+			if ( !got ) {
+				break;
+			}
+
+			if ( file->kind == PRELOAD_GLM && !total && *numModels < MAX_PRELOAD_MODELS ) {
+				if ( SV_PreloadAnimFile( file, buf, got, models[*numModels] ) ) {
+					(*numModels)++;
+				}
+			}
+
+			// the entity lump is small and usually near the front, read it once the header is in
+			if ( file->kind == PRELOAD_BSP && !total && got >= sizeof( dheader_t ) ) {
+				header = (dheader_t *)buf;
+				ofs = LittleLong( header->lumps[LUMP_ENTITIES].fileofs );
+				len = LittleLong( header->lumps[LUMP_ENTITIES].filelen );
+				if ( LittleLong( header->version ) == BSP_VERSION && ofs >= 0 && len > 0
+					&& len <= file->length - ofs && ( entities = (char *)malloc( len ) ) != NULL ) {
+					if ( !fseek( f, file->offset + ofs, SEEK_SET ) && fread( entities, 1, len, f ) == (size_t)len ) {
+						*numModels = SV_PreloadEntityModels( entities, entities + len, models, MAX_PRELOAD_MODELS );
+					}
+					free( entities );
+					fseek( f, file->offset + got, SEEK_SET );
+				}
+			}
+
+			total += got;
+		}
+	}
+
+	fclose( f );
+	return total;
+}
+
+/*
+==================
+SV_PreloadLoop
+==================
+*/
+static void SV_PreloadLoop( void ) {
+	static char		models[MAX_PRELOAD_MODELS][MAX_QPATH];
+	preloadFile_t	file;
+	int				generation, numModels, i;
+	long			bytes;
+
+	PL_Lock();
+	for ( ;; ) {
+		while ( !preload.quit && preload.nextFile == preload.numFiles ) {
+			PL_WaitWork();
+		}
+		if ( preload.quit ) {
+			break;
+		}
+
+		file = preload.files[preload.nextFile];
+		generation = preload.generation;
+		PL_Unlock();
+
+		numModels = 0;
+		bytes = SV_PreloadReadFile( &file, generation, models, &numModels );
+
+		PL_Lock();
+		if ( generation != preload.generation ) {
+			continue;	// a different map was asked for meanwhile
+		}
+
+		preload.nextFile++;
+		if ( bytes < 0 ) {
+			preload.readErrors++;
+		} else {
+			preload.bytes += bytes;
+		}
+		for ( i = 0 ; i < numModels && preload.numModels < MAX_PRELOAD_MODELS ; i++ ) {
+			Q_strncpyz( preload.models[preload.numModels++], models[i], MAX_QPATH );
+		}
+		if ( preload.nextFile == preload.numFiles ) {
+			preload.doneMsec = Sys_Milliseconds();
+		}
+	}
+	PL_Unlock();
+}
+
+#ifdef _WIN32
+static DWORD WINAPI SV_PreloadThread( LPVOID ) {
+	SV_PreloadLoop();
+	return 0;
+}
+#else
+static void *SV_PreloadThread( void * ) {
+	SV_PreloadLoop();
+	return NULL;
+}
+#endif
+
+static qboolean SV_PreloadStart( void ) {
+	preload.quit = qfalse;
+
+#ifdef _WIN32
+	InitializeCriticalSection( &preload.lock );
+	preload.workEvent = CreateEvent( NULL, FALSE, FALSE, NULL );
+	preload.thread = CreateThread( NULL, 0, SV_PreloadThread, NULL, 0, NULL );
+	if ( !preload.thread ) {
+		CloseHandle( preload.workEvent );
+		DeleteCriticalSection( &preload.lock );
+		return qfalse;
+	}
+#else
+	pthread_mutex_init( &preload.lock, NULL );
+	pthread_cond_init( &preload.workCond, NULL );
+	if ( pthread_create( &preload.thread, NULL, SV_PreloadThread, NULL ) ) {
+		pthread_cond_destroy( &preload.workCond );
+		pthread_mutex_destroy( &preload.lock );
+		return qfalse;
+	}
+#endif
+
+	preload.running = qtrue;
+	return qtrue;
+}
+
+/*
+==================
+SV_PreloadQueue
+
+Looks qpath up on the game thread and queues its bytes for the thread.
+Called with the lock held
+==================
+*/
+static void SV_PreloadQueue( const char *qpath, preloadKind_t kind ) {
+	preloadFile_t	*file;
+	int				i;
+
+	if ( preload.numFiles == MAX_PRELOAD_FILES ) {
+		return;
+	}
+
+	file = &preload.files[preload.numFiles];
+	file->length = FS_FileLocation( qpath, file->ospath, sizeof( file->ospath ), &file->offset, &file->stored );
+	if ( file->length <= 0 ) {
+		return;
+	}
+	// the entity lump is found by its offset, which a deflated BSP doesn't keep
+	file->kind = ( kind == PRELOAD_BSP && !file->stored ) ? PRELOAD_PLAIN : kind;
+
+	// models share animation files, and skins their pk3s, so only queue a range once
+	for ( i = 0 ; i < preload.numFiles ; i++ ) {
+		if ( preload.files[i].offset == file->offset && !Q_stricmp( preload.files[i].ospath, file->ospath ) ) {
+			return;
+		}
+	}
+
+	preload.numFiles++;
+	PL_SignalWork();
+}
+
+/*
+==================
+SV_PreloadMap
+
+Drops whatever was queued for another map and queues this one's files
+==================
+*/
+void SV_PreloadMap( const char *mapname ) {
+	if ( !mapname[0] || !Q_stricmp( mapname, preload.mapname ) ) {
+		return;
+	}
+
+	if ( !preload.running && !SV_PreloadStart() ) {
+		Com_Printf( "WARNING: couldn't start the map preload thread\n" );
+		return;
+	}
+
+	Q_strncpyz( preload.mapname, mapname, sizeof( preload.mapname ) );
+	preload.startMsec = Sys_Milliseconds();
+
+	PL_Lock();
+	preload.generation++;
+	preload.numFiles = preload.nextFile = 0;
+	preload.numModels = preload.resolvedModels = 0;
+	preload.bytes = 0;
+	preload.readErrors = 0;
+	preload.doneMsec = 0;
+
+	SV_PreloadQueue( va( "maps/%s.bsp", mapname ), PRELOAD_BSP );
+	SV_PreloadQueue( va( "cmcache/maps/%s.cmc", mapname ), PRELOAD_PLAIN );
+	SV_PreloadQueue( va( "maps/%s.aas", mapname ), PRELOAD_PLAIN );
+	SV_PreloadQueue( va( "maps/%s.nav", mapname ), PRELOAD_PLAIN );
+	SV_PreloadQueue( va( "maps/%s.siege", mapname ), PRELOAD_PLAIN );
+	SV_PreloadQueue( va( "botroutes/%s.wnt", mapname ), PRELOAD_PLAIN );
+	PL_Unlock();
+
+	Com_DPrintf( "Preloading %s: %d files queued\n", mapname, preload.numFiles );
+}
+
+/*
+==================
+SV_PreloadNextMap
+
+Digs the map name out of the nextmap cvar, following vstr chains the
+way map rotations are usually written. Returns "" if the next map
+isn't a map command
+==================
+*/
+static const char *SV_PreloadNextMap( void ) {
+	static char	mapname[MAX_QPATH];
+	char		cmd[MAX_CVAR_VALUE_STRING], word[2][MAX_QPATH];
+	const char	*s, *start;
+	int			depth, numWords;
+
+	Q_strncpyz( cmd, Cvar_VariableString( "nextmap" ), sizeof( cmd ) );
+	for ( depth = 0 ; depth < 8 ; depth++ ) {
+		s = cmd;
+		numWords = 0;
+		while ( *s && numWords < 2 ) {
+			while ( *s == ' ' || *s == '\t' || *s == '"' ) {
+				s++;
+			}
+			if ( !*s || *s == ';' ) {
+				break;
+			}
+			start = s;
+			while ( *s && *s != ' ' && *s != '\t' && *s != '"' && *s != ';' ) {
+				s++;
+			}
+			Q_strncpyz( word[numWords++], start, minimum( (int)( s - start ) + 1, MAX_QPATH ) );
+		}
+		if ( numWords < 2 ) {
+			break;
+		}
+
+		if ( !Q_stricmp( word[0], "map" ) || !Q_stricmp( word[0], "devmap" ) ) {
+			Q_strncpyz( mapname, word[1], sizeof( mapname ) );
+			return mapname;
+		}
+		if ( Q_stricmp( word[0], "vstr" ) ) {
+			break;
+		}
+		Q_strncpyz( cmd, Cvar_VariableString( word[1] ), sizeof( cmd ) );
+	}
+
+	return "";
+}
+
+/*
+==================
+SV_PreloadFrame
+
+Picks up nextmap changes, unless the preload command chose the map, and
+looks up the files the thread found
+==================
+*/
+void SV_PreloadFrame( void ) {
+	const char	*model;
+	int			len;
+
+	if ( !sv_preload->integer || sv.state != SS_GAME ) {
+		return;
+	}
+
+	if ( !preload.fromCommand && ( svs.time - preload.nextCheck >= 0 || preload.nextCheck - svs.time > PRELOAD_CHECK_MSEC ) ) {
+		preload.nextCheck = svs.time + PRELOAD_CHECK_MSEC;
+		const char *next = SV_PreloadNextMap();
+		if ( Q_stricmp( next, sv_mapname->string ) ) {
+			SV_PreloadMap( next );
+		}
+	}
+
+	if ( !preload.running ) {
+		return;
+	}
+
+	PL_Lock();
+	while ( preload.resolvedModels < preload.numModels ) {
+		model = preload.models[preload.resolvedModels++];
+		len = strlen( model );
+		SV_PreloadQueue( model, ( len > 4 && !Q_stricmp( model + len - 4, ".glm" ) ) ? PRELOAD_GLM : PRELOAD_PLAIN );
+	}
+	PL_Unlock();
+}
+
+/*
+==================
+SV_PreloadSpawn
+
+Called as a map starts loading. Reports how far the thread got if it was
+this map, and lets the next one be picked up afresh either way
+==================
+*/
+void SV_PreloadSpawn( const char *mapname ) {
+	preload.fromCommand = qfalse;
+
+	if ( !preload.running || !preload.mapname[0] ) {
+		return;
+	}
+
+	PL_Lock();
+	if ( !Q_stricmp( mapname, preload.mapname ) ) {
+		Com_Printf( "Preloaded %s: %d of %d files, %lld KB\n", mapname,
+			preload.nextFile, preload.numFiles, (long long)( preload.bytes / 1024 ) );
+	} else {
+		// not what we staged, don't compete with the real load for the disk
+		preload.generation++;
+		preload.numFiles = preload.nextFile = 0;
+	}
+	preload.numModels = preload.resolvedModels = 0;
+	PL_Unlock();
+
+	preload.mapname[0] = 0;
+}
+
+/*
+==================
+SV_Preload_f
+==================
+*/
+void SV_Preload_f( void ) {
+	if ( Cmd_Argc() > 2 ) {
+		Com_Printf( "Usage: preload [mapname]\n" );
+		return;
+	}
+
+	if ( Cmd_Argc() == 2 ) {
+		if ( !com_sv_running->integer ) {
+			Com_Printf( "Server is not running.\n" );
+			return;
+		}
+		preload.mapname[0] = 0;
+		SV_PreloadMap( Cmd_Argv( 1 ) );
+		preload.fromCommand = (qboolean)!!preload.mapname[0];
+		return;
+	}
+
+	if ( !preload.running || !preload.mapname[0] ) {
+		Com_Printf( "Nothing is being preloaded.\n" );
+		return;
+	}
+
+	PL_Lock();
+	Com_Printf( "map:    %s\n", preload.mapname );
+	Com_Printf( "files:  %d of %d read, %d failed, %d models found\n",
+		preload.nextFile, preload.numFiles, preload.readErrors, preload.numModels );
+	Com_Printf( "read:   %lld KB", (long long)( preload.bytes / 1024 ) );
+	if ( preload.doneMsec ) {
+		Com_Printf( " in %d msec\n", preload.doneMsec - preload.startMsec );
+	} else {
+		Com_Printf( ", still reading\n" );
+	}
+	PL_Unlock();
+}
+
+/*
+==================
+SV_PreloadInit
+==================
+*/
+void SV_PreloadInit( void ) {
+	sv_preload = Cvar_Get( "sv_preload", "1", CVAR_ARCHIVE );
+}
+
+/*
+==================
+SV_PreloadShutdown
+==================
+*/
+void SV_PreloadShutdown( void ) {
+	if ( !preload.running ) {
+		return;
+	}
+
+	PL_Lock();
+	preload.quit = qtrue;
+	PL_SignalWork();
+	PL_Unlock();
+
+#ifdef _WIN32
+	WaitForSingleObject( preload.thread, INFINITE );
+	CloseHandle( preload.thread );
+	CloseHandle( preload.workEvent );
+	DeleteCriticalSection( &preload.lock );
+#else
+	pthread_join( preload.thread, NULL );
+	pthread_cond_destroy( &preload.workCond );
+	pthread_mutex_destroy( &preload.lock );
+#endif
+
+	Com_Memset( &preload, 0, sizeof( preload ) );
+}
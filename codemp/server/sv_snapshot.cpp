@@ -28,13 +28,16 @@ A normal server packet will look like:
 SV_EmitPacketEntities
 
 Writes a delta update of an entityState_t list to the message.
+If enterCost is given, the size of every entity sent from its baseline
+is recorded there for SV_PrioritizeSnapshotEntities.
 =============
 */
-static void SV_EmitPacketEntities( clientSnapshot_t *from, clientSnapshot_t *to, msg_t *msg ) {
+static void SV_EmitPacketEntities( clientSnapshot_t *from, clientSnapshot_t *to, msg_t *msg, byte *enterCost ) {
 	entityState_t	*oldent, *newent;
 	int		oldindex, newindex;
 	int		oldnum, newnum;
 	int		from_num_entities;
+	int		startBit, bytes;
 
 	// generate the delta update
 	if ( !from ) {
@@ -74,7 +77,12 @@ static void SV_EmitPacketEntities( clientSnapshot_t *from, clientSnapshot_t *to,
 
 		if ( newnum < oldnum ) {
 			// this is a new entity, send it from the baseline
+			startBit = msg->bit;
 			MSG_WriteDeltaEntity (msg, &sv.svEntities[newnum].baseline, newent, qtrue );
+			if ( enterCost ) {
+				bytes = ( msg->bit - startBit + 7 ) >> 3;
+				enterCost[newnum] = (byte)Com_Clampi( 1, 255, bytes );
+			}
 			newindex++;
 			continue;
 		}
@@ -238,7 +246,7 @@ static void SV_WriteSnapshotToClient( client_t *client, msg_t *msg ) {
 	}
 
 	// delta encode the entities
-	SV_EmitPacketEntities (oldframe, frame, msg);
+	SV_EmitPacketEntities (oldframe, frame, msg, client->entityEnterCost);
 
 	// padding for rate debugging
 	if ( sv_padPackets->integer ) {
@@ -283,9 +291,12 @@ Build a client snapshot structure
 =============================================================================
 */
 
+// every candidate is collected, SV_PrioritizeSnapshotEntities then
+// cuts the list down to what fits in a snapshot
 typedef struct snapshotEntityNumbers_s {
 	int		numSnapshotEntities;
-	int		snapshotEntities[MAX_SNAPSHOT_ENTITIES];
+	int		snapshotEntities[MAX_GENTITIES];
+	byte	always[MAX_GENTITIES];		// broadcast, own and portal entities skip the ranking
 } snapshotEntityNumbers_t;
 
 /*
@@ -316,19 +327,19 @@ static int QDECL SV_QsortEntityNumbers( const void *a, const void *b ) {
 SV_AddEntToSnapshot
 ===============
 */
-static void SV_AddEntToSnapshot( svEntity_t *svEnt, sharedEntity_t *gEnt, snapshotEntityNumbers_t *eNums ) {
+static void SV_AddEntToSnapshot( svEntity_t *svEnt, sharedEntity_t *gEnt, snapshotEntityNumbers_t *eNums, qboolean always ) {
 	// if we have already added this entity to this snapshot, don't add again
 	if ( svEnt->snapshotCounter == sv.snapshotCounter ) {
 		return;
 	}
 	svEnt->snapshotCounter = sv.snapshotCounter;
 
-	// if we are full, silently discard entities
-	if ( eNums->numSnapshotEntities == MAX_SNAPSHOT_ENTITIES ) {
+	if ( eNums->numSnapshotEntities == MAX_GENTITIES ) {
 		return;
 	}
 
 	eNums->snapshotEntities[ eNums->numSnapshotEntities ] = gEnt->s.number;
+	eNums->always[ eNums->numSnapshotEntities ] = (byte)always;
 	eNums->numSnapshotEntities++;
 }
 
@@ -420,13 +431,13 @@ static void SV_AddEntitiesVisibleFromPoint( vec3_t origin, clientSnapshot_t *fra
 		if ( (ent->r.svFlags & SVF_BROADCAST) || e == frame->ps.clientNum
 			|| (ent->r.broadcastClients[frame->ps.clientNum/32] & (1 << (frame->ps.clientNum % 32))) )
 		{
-			SV_AddEntToSnapshot( svEnt, ent, eNums );
+			SV_AddEntToSnapshot( svEnt, ent, eNums, qtrue );
 			continue;
 		}
 
 		if (ent->s.isPortalEnt)
 		{ //rww - portal entities are always sent as well
-			SV_AddEntToSnapshot( svEnt, ent, eNums );
+			SV_AddEntToSnapshot( svEnt, ent, eNums, qtrue );
 			continue;
 		}
 
@@ -487,8 +498,8 @@ static void SV_AddEntitiesVisibleFromPoint( vec3_t origin, clientSnapshot_t *fra
 			}
 		}
 
-		// add it
-		SV_AddEntToSnapshot( svEnt, ent, eNums );
+		// add it, portal surfaces are needed to merge their view
+		SV_AddEntToSnapshot( svEnt, ent, eNums, (qboolean)( ( ent->r.svFlags & SVF_PORTAL ) != 0 ) );
 
 		// if its a portal entity, add everything visible from its camera position
 		if ( ent->r.svFlags & SVF_PORTAL ) {
@@ -504,6 +515,212 @@ static void SV_AddEntitiesVisibleFromPoint( vec3_t origin, clientSnapshot_t *fra
 	}
 }
 
+/*
+=============================================================================
+
+Snapshot entity priority
+
+When more entities are visible than a snapshot holds, the rest wait for
+a later one, and sv_snapshotEntityBudget can further limit how many of
+them may come into view at once.  Brush models and movers are always
+sent, since the client predicts against them.  Clients, missiles and
+events go next, then whatever is closest, and anything left waiting
+climbs the list until it gets through.  Entities in the snapshot the
+client last acknowledged are never charged against the budget, since
+their deltas are usually small, so nothing in view flickers when the
+budget is tight.
+
+=============================================================================
+*/
+
+#define	SNAPSHOT_PRIORITY_DIST		512.0f		// distance at which the priority halves
+#define	SNAPSHOT_PRIORITY_AGE		500.0f		// msec of waiting that doubles the priority
+#define	SNAPSHOT_PRIORITY_MAX_AGE	2000
+#define	SNAPSHOT_ENTER_COST			32			// guess for entities never sent to this client
+
+typedef struct {
+	int		number;
+	float	priority;
+} snapshotCandidate_t;
+
+/*
+=======================
+SV_QsortSnapshotCandidates
+
+Highest priority first, ties by entity number so the order is stable
+=======================
+*/
+static int QDECL SV_QsortSnapshotCandidates( const void *a, const void *b ) {
+	const snapshotCandidate_t	*ca = (const snapshotCandidate_t *)a;
+	const snapshotCandidate_t	*cb = (const snapshotCandidate_t *)b;
+
+	if ( ca->priority > cb->priority ) {
+		return -1;
+	}
+	if ( ca->priority < cb->priority ) {
+		return 1;
+	}
+	return ca->number - cb->number;
+}
+
+/*
+=======================
+SV_SnapshotEntityBudget
+
+Bytes per snapshot that entities coming into view may take, 0 for no limit
+=======================
+*/
+static int SV_SnapshotEntityBudget( client_t *client ) {
+	int		rate;
+
+	if ( !sv_snapshotEntityBudget->integer || client->netchan.remoteAddress.type == NA_BOT ) {
+		return 0;
+	}
+	if ( sv_snapshotEntityBudget->integer > 0 ) {
+		return sv_snapshotEntityBudget->integer;
+	}
+
+	// half of what the client's rate allows per snapshot
+	rate = client->rate;
+	if ( sv_maxRate->integer && sv_maxRate->integer < rate ) {
+		rate = sv_maxRate->integer;
+	}
+	return Com_Clampi( SNAPSHOT_ENTER_COST, MAX_MSGLEN, rate * client->snapshotMsec / 2000 );
+}
+
+/*
+=======================
+SV_SnapshotAckedEntities
+
+Flags the entities in the snapshot the next one will be delta compressed
+against, which are the ones the client is known to have
+=======================
+*/
+static void SV_SnapshotAckedEntities( client_t *client, byte *acked ) {
+	clientSnapshot_t	*frame;
+	int					i;
+
+	Com_Memset( acked, 0, MAX_GENTITIES );
+
+	// same tests as SV_WriteSnapshotToClient
+	if ( client->deltaMessage <= 0 || client->state != CS_ACTIVE ) {
+		return;
+	}
+	if ( client->netchan.outgoingSequence - client->deltaMessage >= (PACKET_BACKUP - 3) ) {
+		return;
+	}
+	frame = &client->frames[ client->deltaMessage & PACKET_MASK ];
+	if ( frame->first_entity <= svs.nextSnapshotEntities - svs.numSnapshotEntities ) {
+		return;
+	}
+
+	for ( i = 0 ; i < frame->num_entities ; i++ ) {
+		acked[ svs.snapshotEntities[ (frame->first_entity + i) % svs.numSnapshotEntities ].number ] = 1;
+	}
+}
+
+/*
+=======================
+SV_SnapshotEntityPriority
+=======================
+*/
+static float SV_SnapshotEntityPriority( client_t *client, const vec3_t org, int number, const byte *acked ) {
+	sharedEntity_t	*ent;
+	vec3_t			center;
+	float			priority;
+	int				age;
+
+	ent = SV_GentityNum( number );
+
+	if ( number < MAX_CLIENTS || ent->s.eType == ET_PLAYER || ent->s.eType == ET_NPC ) {
+		priority = 4.0f;
+	} else if ( ent->s.eType == ET_MISSILE || ent->s.eType >= ET_EVENTS || ent->s.event ) {
+		priority = 3.0f;
+	} else {
+		priority = 1.0f;
+	}
+
+	VectorAdd( ent->r.absmin, ent->r.absmax, center );
+	VectorScale( center, 0.5f, center );
+	priority *= SNAPSHOT_PRIORITY_DIST / ( SNAPSHOT_PRIORITY_DIST + Distance( org, center ) );
+
+	if ( acked[number] ) {
+		// a little hysteresis so two entities of equal rank don't take turns
+		priority *= 1.5f;
+	} else {
+		age = client->entityLastSent[number] ? svs.time - client->entityLastSent[number] : SNAPSHOT_PRIORITY_MAX_AGE;
+		if ( age > SNAPSHOT_PRIORITY_MAX_AGE || age < 0 ) {
+			age = SNAPSHOT_PRIORITY_MAX_AGE;
+		}
+		priority *= 1.0f + age / SNAPSHOT_PRIORITY_AGE;
+	}
+
+	return priority;
+}
+
+/*
+=======================
+SV_PrioritizeSnapshotEntities
+
+Cuts the candidate list down to MAX_SNAPSHOT_ENTITIES, and to the byte
+budget while doing so
+=======================
+*/
+static void SV_PrioritizeSnapshotEntities( client_t *client, const vec3_t org, snapshotEntityNumbers_t *eNums ) {
+	snapshotCandidate_t	candidates[MAX_GENTITIES];
+	byte				acked[MAX_GENTITIES];
+	sharedEntity_t		*ent;
+	int					numCandidates, kept;
+	int					budget, spent, cost;
+	int					i, number;
+
+	if ( eNums->numSnapshotEntities <= MAX_SNAPSHOT_ENTITIES ) {
+		return;
+	}
+
+	budget = SV_SnapshotEntityBudget( client );
+	SV_SnapshotAckedEntities( client, acked );
+
+	// entities that must go are kept in place, the rest are ranked
+	kept = 0;
+	numCandidates = 0;
+	for ( i = 0 ; i < eNums->numSnapshotEntities ; i++ ) {
+		number = eNums->snapshotEntities[i];
+		ent = SV_GentityNum( number );
+		if ( eNums->always[i] || ent->s.solid == SOLID_BMODEL || ent->s.eType == ET_MOVER ) {
+			if ( kept < MAX_SNAPSHOT_ENTITIES ) {
+				eNums->snapshotEntities[kept++] = number;
+			}
+			continue;
+		}
+
+		candidates[numCandidates].number = number;
+		candidates[numCandidates].priority = SV_SnapshotEntityPriority( client, org, number, acked );
+		numCandidates++;
+	}
+
+	qsort( candidates, numCandidates, sizeof( candidates[0] ), SV_QsortSnapshotCandidates );
+
+	spent = 0;
+	for ( i = 0 ; i < numCandidates && kept < MAX_SNAPSHOT_ENTITIES ; i++ ) {
+		number = candidates[i].number;
+		if ( budget && !acked[number] ) {
+			cost = client->entityEnterCost[number] ? client->entityEnterCost[number] : SNAPSHOT_ENTER_COST;
+			// always let one through so a crowded view still fills in
+			if ( spent && spent + cost > budget ) {
+				continue;
+			}
+			spent += cost;
+		}
+		eNums->snapshotEntities[kept++] = number;
+	}
+
+	if ( kept < eNums->numSnapshotEntities ) {
+		SV_NetStatsAdd( client, NETSTAT_ENTITIES_DEFERRED, eNums->numSnapshotEntities - kept );
+	}
+	eNums->numSnapshotEntities = kept;
+}
+
 /*
 =============
 SV_BuildClientSnapshot
@@ -588,6 +805,9 @@ static void SV_BuildClientSnapshot( client_t *client ) {
 	// may include portal entities that merge other viewpoints
 	SV_AddEntitiesVisibleFromPoint( org, frame, &entityNumbers, qfalse );
 
+	// pick the ones that fit
+	SV_PrioritizeSnapshotEntities( client, org, &entityNumbers );
+
 	// if there were portals visible, there may be out of order entities
 	// in the list which will need to be resorted for the delta compression
 	// to work correctly.  This also catches the error condition
@@ -608,6 +828,7 @@ static void SV_BuildClientSnapshot( client_t *client ) {
 		ent = SV_GentityNum(entityNumbers.snapshotEntities[i]);
 		state = &svs.snapshotEntities[svs.nextSnapshotEntities % svs.numSnapshotEntities];
 		*state = ent->s;
+		client->entityLastSent[state->number] = svs.time;
 		svs.nextSnapshotEntities++;
 		// this should never hit, map should always be restarted first in SV_Frame
 		if ( svs.nextSnapshotEntities >= 0x7FFFFFFE ) {
@@ -649,6 +870,97 @@ static int SV_RateMsec( client_t *client, int messageSize ) {
 	return rateMsec;
 }
 
+/*
+====================
+SV_EgressExempt
+
+Loopback and bot clients never touch the wire, so sv_maxTotalRate
+neither charges nor holds them back
+====================
+*/
+static qboolean SV_EgressExempt( client_t *client ) {
+	return (qboolean)( client->netchan.remoteAddress.type == NA_LOOPBACK || client->netchan.remoteAddress.type == NA_BOT );
+}
+
+/*
+====================
+SV_ChargeEgress
+
+Takes a message out of the server-wide bucket, counted the same way
+SV_RateMsec counts it against the client's own rate
+====================
+*/
+static void SV_ChargeEgress( client_t *client, int messageSize ) {
+	if ( !sv_maxTotalRate->integer || SV_EgressExempt( client ) ) {
+		return;
+	}
+
+	// individual messages will never be larger than fragment size
+	if ( messageSize > 1500 ) {
+		messageSize = 1500;
+	}
+	svs.egressTokens -= messageSize + HEADER_RATE_BYTES;
+}
+
+/*
+====================
+SV_RefillEgress
+
+Tops the sv_maxTotalRate bucket up for the time since the last frame.
+The bucket never holds more than one frame's share, so an idle moment
+can't be spent as a burst and the uplink is used evenly frame to frame
+====================
+*/
+static void SV_RefillEgress( void ) {
+	int		rate;
+	int		burst;
+	int		elapsed;
+
+	elapsed = svs.time - svs.egressTime;
+	svs.egressTime = svs.time;
+
+	rate = sv_maxTotalRate->integer;
+	if ( !rate ) {
+		svs.egressTokens = 0;
+		return;
+	}
+	if ( rate < 1000 ) {
+		Cvar_Set( "sv_maxTotalRate", "1000" );
+		rate = 1000;
+	}
+
+	if ( elapsed > 0 ) {
+		svs.egressTokens += (int)( (double)elapsed * rate / (1000.0 * com_timescale->value) );
+	}
+
+	// always let at least one full-sized message through per frame
+	burst = rate / sv_fps->integer;
+	if ( burst < 1500 + HEADER_RATE_BYTES ) {
+		burst = 1500 + HEADER_RATE_BYTES;
+	}
+	if ( svs.egressTokens > burst ) {
+		svs.egressTokens = burst;
+	}
+}
+
+/*
+====================
+SV_CompareEgressAge
+
+qsort callback, the client that has waited longest for a message goes first
+====================
+*/
+static int SV_CompareEgressAge( const void *a, const void *b ) {
+	const client_t *ca = *(const client_t **)a;
+	const client_t *cb = *(const client_t **)b;
+
+	if ( ca->lastEgressTime != cb->lastEgressTime ) {
+		return ca->lastEgressTime < cb->lastEgressTime ? -1 : 1;
+	}
+	// keep client order for ties so nobody is starved by qsort
+	return ca < cb ? -1 : ( ca > cb ? 1 : 0 );
+}
+
 extern void SV_WriteDemoMessage ( client_t *cl, msg_t *msg, int headerBytes );
 /*
 =======================
@@ -659,6 +971,7 @@ Called by SV_SendClientSnapshot and SV_SendClientGameState
 */
 void SV_SendMessageToClient( msg_t *msg, client_t *client ) {
 	int			rateMsec;
+	clientSnapshot_t	*frame;
 
 	// MW - my attempt to fix illegible server message errors caused by
 	// packet fragmentation of initial snapshot.
@@ -667,13 +980,21 @@ void SV_SendMessageToClient( msg_t *msg, client_t *client ) {
 		// send additional message fragments if the last message
 		// was too large to send at once
 		Com_Printf ("[ISM]SV_SendClientGameState() [1] for %s, writing out old fragments\n", client->name);
-		SV_Netchan_TransmitNextFragment(&client->netchan);
+		SV_Netchan_TransmitNextFragment(client);
+	}
+
+	// a frame sent PACKET_BACKUP messages ago that neither it nor anything
+	// later was acknowledged for means the client stalled; plain loss can't
+	// be seen here, the client only acknowledges the newest snapshot it has
+	frame = &client->frames[client->netchan.outgoingSequence & PACKET_MASK];
+	if ( frame->messageAcked == -1 && client->netchan.remoteAddress.type != NA_BOT ) {
+		SV_NetStatsAdd( client, NETSTAT_STALLED, 1 );
 	}
 
 	// record information about the message
-	client->frames[client->netchan.outgoingSequence & PACKET_MASK].messageSize = msg->cursize;
-	client->frames[client->netchan.outgoingSequence & PACKET_MASK].messageSent = svs.time;
-	client->frames[client->netchan.outgoingSequence & PACKET_MASK].messageAcked = -1;
+	frame->messageSize = msg->cursize;
+	frame->messageSent = svs.time;
+	frame->messageAcked = -1;
 
 	// save the message to demo.  this must happen before sending over network as that encodes the backing databuf
 	if ( client->demo.demorecording && !client->demo.demowaiting ) {
@@ -692,6 +1013,14 @@ void SV_SendMessageToClient( msg_t *msg, client_t *client ) {
 
 	// send the datagram
 	SV_Netchan_Transmit( client, msg );	//msg->cursize, msg->data );
+	SV_ChargeEgress( client, msg->cursize );
+	client->lastEgressTime = svs.time;
+
+	SV_NetStatsAdd( client, NETSTAT_MESSAGES, 1 );
+	SV_NetStatsAdd( client, NETSTAT_MESSAGE_BYTES, msg->cursize );
+	if ( msg->cursize > client->netStats.largestMessage ) {
+		client->netStats.largestMessage = msg->cursize;
+	}
 
 	// set nextSnapshotTime based on rate and requested number of updates
 
@@ -712,6 +1041,7 @@ void SV_SendMessageToClient( msg_t *msg, client_t *client ) {
 		client->rateDelayed = qfalse;
 	} else {
 		client->rateDelayed = qtrue;
+		SV_NetStatsAdd( client, NETSTAT_CHOKED, 1 );
 	}
 
 	client->nextSnapshotTime = svs.time + ((int) (rateMsec * com_timescale->value));
@@ -769,7 +1099,7 @@ void SV_SendClientSnapshot( client_t *client ) {
 			// send additional message fragments if the last message
 			// was too large to send at once
 			Com_Printf ("[ISM]SV_SendClientGameState() [1] for %s, writing out old fragments\n", client->name);
-			SV_Netchan_TransmitNextFragment(&client->netchan);
+			SV_Netchan_TransmitNextFragment(client);
 		}
 
 		// record information about the message
@@ -785,6 +1115,7 @@ void SV_SendClientSnapshot( client_t *client ) {
 
 	// build the snapshot
 	SV_BuildClientSnapshot( client );
+	SV_MVDemoClientSnapshot( client );
 
 	if ( sv_autoDemo->integer && !client->demo.demorecording ) {
 		if ( client->netchan.remoteAddress.type != NA_BOT || sv_autoDemoBots->integer ) {
@@ -798,7 +1129,8 @@ void SV_SendClientSnapshot( client_t *client ) {
 		return;
 	}
 
-	MSG_Init (&msg, msg_buf, sizeof(msg_buf));
+	// a big snapshot is then fragmented from where it was written
+	MSG_Init (&msg, Netchan_MessageBuffer( &client->netchan, msg_buf ), sizeof(msg_buf));
 	msg.allowoverflow = qtrue;
 
 	// NOTE, MRE: all server->client messages now acknowledge
@@ -833,8 +1165,16 @@ SV_SendClientMessages
 void SV_SendClientMessages( void ) {
 	int			i;
 	client_t	*c;
+	client_t	*due[MAX_CLIENTS];
+	int			numDue;
 
-	// send a message to each connected client
+	// the frame's configstring changes go out with these snapshots
+	SV_FlushConfigstrings();
+
+	SV_RefillEgress();
+
+	// find everyone who is owed a message this frame
+	numDue = 0;
 	for (i=0, c = svs.clients ; i < sv_maxclients->integer ; i++, c++) {
 		if (!c->state) {
 			continue;		// not connected
@@ -844,17 +1184,47 @@ void SV_SendClientMessages( void ) {
 			continue;		// not time yet
 		}
 
+		due[numDue++] = c;
+	}
+
+	// with a shared uplink budget, whoever has gone longest without
+	// a message gets first claim on it
+	if ( sv_maxTotalRate->integer && numDue > 1 ) {
+		qsort( due, numDue, sizeof( due[0] ), SV_CompareEgressAge );
+	}
+
+	// queue the datagrams up and push them out together at the end of the frame
+	NET_BeginBatch();
+
+	// send a message to each connected client
+	for ( i = 0 ; i < numDue ; i++ ) {
+		c = due[i];
+
+		// over the server-wide budget, try again next frame
+		// (nextSnapshotTime is left alone so they stay due and move up the queue)
+		if ( sv_maxTotalRate->integer && svs.egressTokens <= 0 && !SV_EgressExempt( c ) ) {
+			c->egressDeferred++;
+			SV_NetStatsAdd( c, NETSTAT_DEFERRED, 1 );
+			continue;
+		}
+
 		// send additional message fragments if the last message
 		// was too large to send at once
 		if ( c->netchan.unsentFragments ) {
 			c->nextSnapshotTime = svs.time +
 				SV_RateMsec( c, c->netchan.unsentLength - c->netchan.unsentFragmentStart );
-			SV_Netchan_TransmitNextFragment( &c->netchan );
+			SV_ChargeEgress( c, c->netchan.unsentLength - c->netchan.unsentFragmentStart );
+			c->lastEgressTime = svs.time;
+			SV_Netchan_TransmitNextFragment( c );
 			continue;
 		}
 
 		// generate and send a new message
 		SV_SendClientSnapshot( c );
 	}
+
+	NET_FlushBatch();
+
+	SV_MVDemoFrame();
 }
 
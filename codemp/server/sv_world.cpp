@@ -35,88 +35,299 @@ clipHandle_t SV_ClipHandleForEntity( const sharedEntity_t *ent ) {
 ENTITY CHECKING
 
 To avoid linearly searching through lists of entities during environment testing,
-the world is carved up with an evenly spaced, axially aligned bsp tree.  Entities
-are kept in chains either at the final leafs, or at the first node that splits
-them, which prevents having to deal with multiple fragments of a single entity.
+linked entities are kept in a dynamic bounding volume tree. Every entity is a leaf
+holding a fat box, its absmin / absmax grown by AREA_FAT_MARGIN, and every other
+node bounds its two children. SV_LinkEntity only moves a leaf once the entity gets
+out of its fat box, so entities that stand still or shuffle about leave the tree
+alone. A new leaf goes next to the node that grows the tree's surface area least,
+and the path back up is kept balanced with rotations, so however the entities are
+spread over the map a query only walks the part of the tree near its box.
 
 ===============================================================================
 */
 
-typedef struct worldSector_s {
-	int		axis;		// -1 = leaf node
-	float	dist;
-	struct worldSector_s	*children[2];
-	svEntity_t	*entities;
-} worldSector_t;
+typedef struct areaNode_s {
+	vec3_t				mins, maxs;		// fat entity bounds in leafs, bounds of both children otherwise
+	struct areaNode_s	*parent;		// next free node while on the free list
+	struct areaNode_s	*children[2];	// NULL in leafs
+	int					height;			// 0 in leafs
+	int					entityNum;		// leafs only
+} areaNode_t;
 
-#define	AREA_DEPTH	4
-#define	AREA_NODES	64
+#define	AREA_NODES			( MAX_GENTITIES * 2 )
+#define	AREA_FAT_MARGIN		16		// room to move before a leaf has to be moved
 
-worldSector_t	sv_worldSectors[AREA_NODES];
-int			sv_numworldSectors;
+static areaNode_t	sv_areaNodes[AREA_NODES];
+static areaNode_t	*sv_areaRoot;
+static areaNode_t	*sv_areaFree;
+static int			sv_numAreaNodes;
+
+static void SV_FlushContentsCache( void );
 
 
+/*
+===============
+SV_CountAreaLeafs_r
+===============
+*/
+static int SV_CountAreaLeafs_r( const areaNode_t *node ) {
+	if ( !node->children[0] ) {
+		return 1;
+	}
+	return SV_CountAreaLeafs_r( node->children[0] ) + SV_CountAreaLeafs_r( node->children[1] );
+}
+
 /*
 ===============
 SV_SectorList_f
 ===============
 */
 void SV_SectorList_f( void ) {
-	int				i, c;
-	worldSector_t	*sec;
-	svEntity_t		*ent;
+	if ( !sv_areaRoot ) {
+		Com_Printf( "area tree is empty\n" );
+		return;
+	}
 
-	for ( i = 0 ; i < AREA_NODES ; i++ ) {
-		sec = &sv_worldSectors[i];
+	Com_Printf( "area tree: %i nodes, %i entities, height %i\n", sv_numAreaNodes,
+		SV_CountAreaLeafs_r( sv_areaRoot ), sv_areaRoot->height );
+	Com_Printf( "root bounds: (%.0f %.0f %.0f) to (%.0f %.0f %.0f)\n",
+		sv_areaRoot->mins[0], sv_areaRoot->mins[1], sv_areaRoot->mins[2],
+		sv_areaRoot->maxs[0], sv_areaRoot->maxs[1], sv_areaRoot->maxs[2] );
+}
 
-		c = 0;
-		for ( ent = sec->entities ; ent ; ent = ent->nextEntityInWorldSector ) {
-			c++;
-		}
-		Com_Printf( "sector %i: %i entities\n", i, c );
+/*
+===============
+SV_AllocAreaNode
+===============
+*/
+static areaNode_t *SV_AllocAreaNode( void ) {
+	areaNode_t	*node;
+
+	node = sv_areaFree;
+	if ( !node ) {
+		Com_Error( ERR_DROP, "SV_AllocAreaNode: no free nodes" );
+	}
+	sv_areaFree = node->parent;
+	sv_numAreaNodes++;
+
+	Com_Memset( node, 0, sizeof( *node ) );
+	return node;
+}
+
+/*
+===============
+SV_FreeAreaNode
+===============
+*/
+static void SV_FreeAreaNode( areaNode_t *node ) {
+	node->parent = sv_areaFree;
+	node->children[0] = node->children[1] = NULL;
+	sv_areaFree = node;
+	sv_numAreaNodes--;
+}
+
+/*
+===============
+SV_AreaCost
+
+Half the surface area of a box, which is what a node costs in how
+often queries have to look into it
+===============
+*/
+static float SV_AreaCost( const vec3_t mins, const vec3_t maxs ) {
+	vec3_t	size;
+
+	VectorSubtract( maxs, mins, size );
+	return size[0] * size[1] + size[1] * size[2] + size[2] * size[0];
+}
+
+/*
+===============
+SV_AreaUnionCost
+===============
+*/
+static float SV_AreaUnionCost( const areaNode_t *a, const areaNode_t *b ) {
+	vec3_t	mins, maxs;
+	int		i;
+
+	for ( i = 0 ; i < 3 ; i++ ) {
+		mins[i] = minimum( a->mins[i], b->mins[i] );
+		maxs[i] = maximum( a->maxs[i], b->maxs[i] );
+	}
+	return SV_AreaCost( mins, maxs );
+}
+
+/*
+===============
+SV_RefitAreaNode
+
+Bounds and height of an inner node from its children
+===============
+*/
+static void SV_RefitAreaNode( areaNode_t *node ) {
+	const areaNode_t	*a = node->children[0];
+	const areaNode_t	*b = node->children[1];
+	int					i;
+
+	for ( i = 0 ; i < 3 ; i++ ) {
+		node->mins[i] = minimum( a->mins[i], b->mins[i] );
+		node->maxs[i] = maximum( a->maxs[i], b->maxs[i] );
+	}
+	node->height = 1 + maximum( a->height, b->height );
+}
+
+/*
+===============
+SV_ReplaceAreaChild
+===============
+*/
+static void SV_ReplaceAreaChild( areaNode_t *parent, areaNode_t *oldChild, areaNode_t *newChild ) {
+	newChild->parent = parent;
+	if ( !parent ) {
+		sv_areaRoot = newChild;
+	} else if ( parent->children[0] == oldChild ) {
+		parent->children[0] = newChild;
+	} else {
+		parent->children[1] = newChild;
 	}
 }
 
 /*
 ===============
-SV_CreateworldSector
+SV_BalanceAreaNode
 
-Builds a uniformly subdivided tree for the given world size
+If one child of node is more than one level taller than the other, the
+taller one is rotated up into node's place. Returns the node that now
+roots this part of the tree.
 ===============
 */
-worldSector_t *SV_CreateworldSector( int depth, vec3_t mins, vec3_t maxs ) {
-	worldSector_t	*anode;
-	vec3_t		size;
-	vec3_t		mins1, maxs1, mins2, maxs2;
+static areaNode_t *SV_BalanceAreaNode( areaNode_t *a ) {
+	areaNode_t	*up, *f, *g;
+	int			tall, balance;
 
-	anode = &sv_worldSectors[sv_numworldSectors];
-	sv_numworldSectors++;
+	if ( !a->children[0] || a->height < 2 ) {
+		return a;
+	}
 
-	if (depth == AREA_DEPTH) {
-		anode->axis = -1;
-		anode->children[0] = anode->children[1] = NULL;
-		return anode;
+	balance = a->children[1]->height - a->children[0]->height;
+	if ( balance >= -1 && balance <= 1 ) {
+		return a;
 	}
 
-	VectorSubtract (maxs, mins, size);
-	if (size[0] > size[1]) {
-		anode->axis = 0;
+	// the taller child takes a's place, a keeps the other child and
+	// the shorter of the taller child's children
+	tall = ( balance > 1 ) ? 1 : 0;
+	up = a->children[tall];
+	f = up->children[0];
+	g = up->children[1];
+
+	SV_ReplaceAreaChild( a->parent, a, up );
+	up->children[0] = a;
+	a->parent = up;
+
+	if ( f->height > g->height ) {
+		up->children[1] = f;
+		a->children[tall] = g;
+		g->parent = a;
 	} else {
-		anode->axis = 1;
+		up->children[1] = g;
+		a->children[tall] = f;
+		f->parent = a;
 	}
 
-	anode->dist = 0.5 * (maxs[anode->axis] + mins[anode->axis]);
-	VectorCopy (mins, mins1);
-	VectorCopy (mins, mins2);
-	VectorCopy (maxs, maxs1);
-	VectorCopy (maxs, maxs2);
+	SV_RefitAreaNode( a );
+	SV_RefitAreaNode( up );
 
-	maxs1[anode->axis] = mins2[anode->axis] = anode->dist;
+	return up;
+}
 
-	anode->children[0] = SV_CreateworldSector (depth+1, mins2, maxs2);
-	anode->children[1] = SV_CreateworldSector (depth+1, mins1, maxs1);
+/*
+===============
+SV_RefitAreaPath
 
-	return anode;
+Walks from node up to the root, balancing and refitting on the way
+===============
+*/
+static void SV_RefitAreaPath( areaNode_t *node ) {
+	while ( node ) {
+		node = SV_BalanceAreaNode( node );
+		SV_RefitAreaNode( node );
+		node = node->parent;
+	}
+}
+
+/*
+===============
+SV_InsertAreaLeaf
+===============
+*/
+static void SV_InsertAreaLeaf( areaNode_t *leaf ) {
+	areaNode_t	*sibling, *parent;
+	float		cost, inheritance, childCost[2];
+	int			i;
+
+	if ( !sv_areaRoot ) {
+		sv_areaRoot = leaf;
+		leaf->parent = NULL;
+		return;
+	}
+
+	// find the best sibling: stop where pairing with the node itself is
+	// cheaper than pushing the leaf further down into either child
+	sibling = sv_areaRoot;
+	while ( sibling->children[0] ) {
+		cost = 2 * SV_AreaUnionCost( sibling, leaf );
+
+		// everything below here grows by as much as sibling would
+		inheritance = cost - 2 * SV_AreaCost( sibling->mins, sibling->maxs );
+
+		for ( i = 0 ; i < 2 ; i++ ) {
+			childCost[i] = SV_AreaUnionCost( sibling->children[i], leaf ) + inheritance;
+			if ( sibling->children[i]->children[0] ) {
+				childCost[i] -= SV_AreaCost( sibling->children[i]->mins, sibling->children[i]->maxs );
+			}
+		}
+
+		if ( cost < childCost[0] && cost < childCost[1] ) {
+			break;
+		}
+		sibling = sibling->children[childCost[1] < childCost[0]];
+	}
+
+	// pair them under a new parent
+	parent = SV_AllocAreaNode();
+	SV_ReplaceAreaChild( sibling->parent, sibling, parent );
+	parent->children[0] = sibling;
+	parent->children[1] = leaf;
+	sibling->parent = parent;
+	leaf->parent = parent;
+
+	SV_RefitAreaPath( parent );
+}
+
+/*
+===============
+SV_RemoveAreaLeaf
+
+Takes the leaf out of the tree, its sibling moves up into their parent's place
+===============
+*/
+static void SV_RemoveAreaLeaf( areaNode_t *leaf ) {
+	areaNode_t	*parent, *sibling;
+
+	if ( leaf == sv_areaRoot ) {
+		sv_areaRoot = NULL;
+		return;
+	}
+
+	parent = leaf->parent;
+	sibling = ( parent->children[0] == leaf ) ? parent->children[1] : parent->children[0];
+
+	SV_ReplaceAreaChild( parent->parent, parent, sibling );
+	SV_FreeAreaNode( parent );
+	leaf->parent = NULL;
+
+	SV_RefitAreaPath( sibling->parent );
 }
 
 /*
@@ -126,16 +337,21 @@ SV_ClearWorld
 ===============
 */
 void SV_ClearWorld( void ) {
-	clipHandle_t	h;
-	vec3_t			mins, maxs;
+	int		i;
 
-	Com_Memset( sv_worldSectors, 0, sizeof(sv_worldSectors) );
-	sv_numworldSectors = 0;
+	for ( i = 0 ; i < AREA_NODES - 1 ; i++ ) {
+		sv_areaNodes[i].parent = &sv_areaNodes[i + 1];
+	}
+	sv_areaNodes[AREA_NODES - 1].parent = NULL;
+	sv_areaFree = sv_areaNodes;
+	sv_areaRoot = NULL;
+	sv_numAreaNodes = 0;
+
+	SV_FlushContentsCache();
 
-	// get world map bounds
-	h = CM_InlineModel( 0 );
-	CM_ModelBounds( h, mins, maxs );
-	SV_CreateworldSector( 0, mins, maxs );
+	for ( i = 0 ; i < MAX_GENTITIES ; i++ ) {
+		sv.svEntities[i].areaNode = NULL;
+	}
 }
 
 
@@ -147,32 +363,58 @@ SV_UnlinkEntity
 */
 void SV_UnlinkEntity( sharedEntity_t *gEnt ) {
 	svEntity_t		*ent;
-	svEntity_t		*scan;
-	worldSector_t	*ws;
 
 	ent = SV_SvEntityForGentity( gEnt );
 
 	gEnt->r.linked = qfalse;
+	SV_FlushContentsCache();
 
-	ws = ent->worldSector;
-	if ( !ws ) {
+	if ( !ent->areaNode ) {
 		return;		// not linked in anywhere
 	}
-	ent->worldSector = NULL;
 
-	if ( ws->entities == ent ) {
-		ws->entities = ent->nextEntityInWorldSector;
-		return;
-	}
+	SV_RemoveAreaLeaf( ent->areaNode );
+	SV_FreeAreaNode( ent->areaNode );
+	ent->areaNode = NULL;
+}
+
+/*
+===============
+SV_LinkAreaLeaf
+
+Leaves the entity's leaf alone while its box is still inside the fat
+box and the fat box hasn't become much too large for it, otherwise
+puts the leaf back in with a new fat box
+===============
+*/
+static void SV_LinkAreaLeaf( svEntity_t *ent, const sharedEntity_t *gEnt ) {
+	areaNode_t	*leaf;
+	int			i;
 
-	for ( scan = ws->entities ; scan ; scan = scan->nextEntityInWorldSector ) {
-		if ( scan->nextEntityInWorldSector == ent ) {
-			scan->nextEntityInWorldSector = ent->nextEntityInWorldSector;
+	leaf = ent->areaNode;
+	if ( leaf ) {
+		for ( i = 0 ; i < 3 ; i++ ) {
+			if ( gEnt->r.absmin[i] < leaf->mins[i] || gEnt->r.absmax[i] > leaf->maxs[i]
+				|| gEnt->r.absmin[i] - leaf->mins[i] > 4 * AREA_FAT_MARGIN
+				|| leaf->maxs[i] - gEnt->r.absmax[i] > 4 * AREA_FAT_MARGIN ) {
+				break;
+			}
+		}
+		if ( i == 3 ) {
 			return;
 		}
+		SV_RemoveAreaLeaf( leaf );
+	} else {
+		leaf = SV_AllocAreaNode();
+		leaf->entityNum = ent - sv.svEntities;
+		ent->areaNode = leaf;
 	}
 
-	Com_Printf( "WARNING: SV_UnlinkEntity: not found in worldSector\n" );
+	for ( i = 0 ; i < 3 ; i++ ) {
+		leaf->mins[i] = gEnt->r.absmin[i] - AREA_FAT_MARGIN;
+		leaf->maxs[i] = gEnt->r.absmax[i] + AREA_FAT_MARGIN;
+	}
+	SV_InsertAreaLeaf( leaf );
 }
 
 
@@ -184,7 +426,6 @@ SV_LinkEntity
 */
 #define MAX_TOTAL_ENT_LEAFS		128
 void SV_LinkEntity( sharedEntity_t *gEnt ) {
-	worldSector_t	*node;
 	int			leafs[MAX_TOTAL_ENT_LEAFS];
 	int			cluster;
 	int			num_leafs;
@@ -196,10 +437,6 @@ void SV_LinkEntity( sharedEntity_t *gEnt ) {
 
 	ent = SV_SvEntityForGentity( gEnt );
 
-	if ( ent->worldSector ) {
-		SV_UnlinkEntity( gEnt );	// unlink from old position
-	}
-
 	// encode the size into the entityState_t for client prediction
 	if ( gEnt->r.bmodel ) {
 		gEnt->s.solid = SOLID_BMODEL;		// a solid_box will never create this value
@@ -279,6 +516,7 @@ void SV_LinkEntity( sharedEntity_t *gEnt ) {
 	// if none of the leafs were inside the map, the
 	// entity is outside the world and can be considered unlinked
 	if ( !num_leafs ) {
+		SV_UnlinkEntity( gEnt );
 		return;
 	}
 
@@ -320,24 +558,9 @@ void SV_LinkEntity( sharedEntity_t *gEnt ) {
 
 	gEnt->r.linkcount++;
 
-	// find the first world sector node that the ent's box crosses
-	node = sv_worldSectors;
-	while (1)
-	{
-		if (node->axis == -1)
-			break;
-		if ( gEnt->r.absmin[node->axis] > node->dist)
-			node = node->children[0];
-		else if ( gEnt->r.absmax[node->axis] < node->dist)
-			node = node->children[1];
-		else
-			break;		// crosses the node
-	}
-
-	// link it in
-	ent->worldSector = node;
-	ent->nextEntityInWorldSector = node->entities;
-	node->entities = ent;
+	// link it in, or move it if it got too far
+	SV_LinkAreaLeaf( ent, gEnt );
+	SV_FlushContentsCache();
 
 	gEnt->r.linked = qtrue;
 }
@@ -357,6 +580,7 @@ typedef struct areaParms_s {
 	const float	*maxs;
 	int			*list;
 	int			count, maxcount;
+	int			nodes, tests;	// for sv_areabench
 } areaParms_t;
 
 
@@ -366,52 +590,57 @@ SV_AreaEntities_r
 
 ====================
 */
-void SV_AreaEntities_r( worldSector_t *node, areaParms_t *ap ) {
-	svEntity_t	*check, *next;
+static void SV_AreaEntities_r( const areaNode_t *node, areaParms_t *ap ) {
 	sharedEntity_t *gcheck;
 
-	for ( check = node->entities  ; check ; check = next ) {
-		next = check->nextEntityInWorldSector;
+	ap->nodes++;
 
-		gcheck = SV_GEntityForSvEntity( check );
+	if ( node->mins[0] > ap->maxs[0]
+	|| node->mins[1] > ap->maxs[1]
+	|| node->mins[2] > ap->maxs[2]
+	|| node->maxs[0] < ap->mins[0]
+	|| node->maxs[1] < ap->mins[1]
+	|| node->maxs[2] < ap->mins[2]) {
+		return;
+	}
 
-		if ( gcheck->r.absmin[0] > ap->maxs[0]
-		|| gcheck->r.absmin[1] > ap->maxs[1]
-		|| gcheck->r.absmin[2] > ap->maxs[2]
-		|| gcheck->r.absmax[0] < ap->mins[0]
-		|| gcheck->r.absmax[1] < ap->mins[1]
-		|| gcheck->r.absmax[2] < ap->mins[2]) {
-			continue;
-		}
+	if ( node->children[0] ) {
+		SV_AreaEntities_r( node->children[0], ap );
+		SV_AreaEntities_r( node->children[1], ap );
+		return;
+	}
 
-		if ( ap->count == ap->maxcount ) {
-			Com_DPrintf ("SV_AreaEntities: MAXCOUNT\n");
-			return;
-		}
+	// the fat box touches, now the entity itself
+	ap->tests++;
+	gcheck = SV_GentityNum( node->entityNum );
 
-		ap->list[ap->count] = check - sv.svEntities;
-		ap->count++;
+	if ( gcheck->r.absmin[0] > ap->maxs[0]
+	|| gcheck->r.absmin[1] > ap->maxs[1]
+	|| gcheck->r.absmin[2] > ap->maxs[2]
+	|| gcheck->r.absmax[0] < ap->mins[0]
+	|| gcheck->r.absmax[1] < ap->mins[1]
+	|| gcheck->r.absmax[2] < ap->mins[2]) {
+		return;
 	}
 
-	if (node->axis == -1) {
-		return;		// terminal node
+	if ( ap->count == ap->maxcount ) {
+		Com_DPrintf ("SV_AreaEntities: MAXCOUNT\n");
+		return;
 	}
 
-	// recurse down both sides
-	if ( ap->maxs[node->axis] > node->dist ) {
-		SV_AreaEntities_r ( node->children[0], ap );
-	}
-	if ( ap->mins[node->axis] < node->dist ) {
-		SV_AreaEntities_r ( node->children[1], ap );
-	}
+	ap->list[ap->count] = node->entityNum;
+	ap->count++;
 }
 
 /*
 ================
-SV_AreaEntities
+SV_AreaQuery
+
+SV_AreaEntities, also counting the tree nodes it looked at and the
+entity boxes it tested
 ================
 */
-int SV_AreaEntities( const vec3_t mins, const vec3_t maxs, int *entityList, int maxcount ) {
+int SV_AreaQuery( const vec3_t mins, const vec3_t maxs, int *entityList, int maxcount, int *nodes, int *tests ) {
 	areaParms_t		ap;
 
 	ap.mins = mins;
@@ -419,12 +648,34 @@ int SV_AreaEntities( const vec3_t mins, const vec3_t maxs, int *entityList, int
 	ap.list = entityList;
 	ap.count = 0;
 	ap.maxcount = maxcount;
+	ap.nodes = ap.tests = 0;
 
-	SV_AreaEntities_r( sv_worldSectors, &ap );
+	if ( sv_areaRoot ) {
+		SV_AreaEntities_r( sv_areaRoot, &ap );
+	}
 
+	if ( nodes ) {
+		*nodes = ap.nodes;
+	}
+	if ( tests ) {
+		*tests = ap.tests;
+	}
 	return ap.count;
 }
 
+/*
+================
+SV_AreaEntities
+================
+*/
+int SV_AreaEntities( const vec3_t mins, const vec3_t maxs, int *entityList, int maxcount ) {
+	if ( sv_areaBenchRecording ) {
+		SV_AreaBenchRecord( mins, maxs );
+	}
+
+	return SV_AreaQuery( mins, maxs, entityList, maxcount, NULL, NULL );
+}
+
 
 
 //===========================================================================
@@ -498,8 +749,9 @@ void SV_ClipToEntity( trace_t *trace, const vec3_t start, const vec3_t mins, con
 
 /*
 ====================
-SV_ClipMoveToEntities
+SV_ClipMoveToEntityList
 
+Clips the move against the entities in touchlist, in that order
 ====================
 */
 #ifndef FINAL_BUILD
@@ -514,9 +766,8 @@ static float VectorDistance(vec3_t p1, vec3_t p2)
 #ifdef _MSC_VER
 #pragma warning(disable : 4701) //local variable used without having been init
 #endif
-static void SV_ClipMoveToEntities( moveclip_t *clip ) {
-	static int	touchlist[MAX_GENTITIES];
-	int			i, num;
+static void SV_ClipMoveToEntityList( moveclip_t *clip, const int *touchlist, int num ) {
+	int			i;
 	sharedEntity_t *touch;
 	int			passOwnerNum;
 	trace_t		trace, oldTrace= {0};
@@ -524,8 +775,6 @@ static void SV_ClipMoveToEntities( moveclip_t *clip ) {
 	float		*origin, *angles;
 	int			thisOwnerShared = 1;
 
-	num = SV_AreaEntities( clip->boxmins, clip->boxmaxs, touchlist, MAX_GENTITIES);
-
 	if ( clip->passEntityNum != ENTITYNUM_NONE ) {
 		passOwnerNum = ( SV_GentityNum( clip->passEntityNum ) )->r.ownerNum;
 		if ( passOwnerNum == ENTITYNUM_NONE ) {
@@ -786,22 +1035,30 @@ Ghoul2 Insert End
 #pragma warning(default : 4701) //local variable used without having been init
 #endif
 
+/*
+====================
+SV_ClipMoveToEntities
+====================
+*/
+static void SV_ClipMoveToEntities( moveclip_t *clip ) {
+	static int	touchlist[MAX_GENTITIES];
+	int			num;
+
+	num = SV_AreaEntities( clip->boxmins, clip->boxmaxs, touchlist, MAX_GENTITIES);
+
+	SV_ClipMoveToEntityList( clip, touchlist, num );
+}
+
 /*
 ==================
-SV_Trace
+SV_ClipMoveToWorld
 
-Moves the given mins/maxs volume through the world from start to end.
-passEntityNum and entities owned by passEntityNum are explicitly not checked.
+Clips the move to the world and sets up clip for the entities. Returns
+qfalse when the world already blocks it at the start, and clip->trace is
+the final result.
 ==================
 */
-/*
-Ghoul2 Insert Start
-*/
-void SV_Trace( trace_t *results, const vec3_t start, const vec3_t mins, const vec3_t maxs, const vec3_t end, int passEntityNum, int contentmask, int capsule, int traceFlags, int useLod ) {
-/*
-Ghoul2 Insert End
-*/
-	moveclip_t	clip;
+static qboolean SV_ClipMoveToWorld( moveclip_t *clip, const vec3_t start, const vec3_t mins, const vec3_t maxs, const vec3_t end, int passEntityNum, int contentmask, int capsule, int traceFlags, int useLod ) {
 	int			i;
 
 	if ( !mins ) {
@@ -811,32 +1068,31 @@ Ghoul2 Insert End
 		maxs = vec3_origin;
 	}
 
-	Com_Memset ( &clip, 0, sizeof ( moveclip_t ) );
+	Com_Memset ( clip, 0, sizeof ( moveclip_t ) );
 
 	// clip to world
-	CM_BoxTrace( &clip.trace, start, end, mins, maxs, 0, contentmask, capsule );
-	clip.trace.entityNum = clip.trace.fraction != 1.0 ? ENTITYNUM_WORLD : ENTITYNUM_NONE;
-	if ( clip.trace.fraction == 0 ) {
-		*results = clip.trace;
-		return;		// blocked immediately by the world
+	CM_BoxTrace( &clip->trace, start, end, mins, maxs, 0, contentmask, capsule );
+	clip->trace.entityNum = clip->trace.fraction != 1.0 ? ENTITYNUM_WORLD : ENTITYNUM_NONE;
+	if ( clip->trace.fraction == 0 ) {
+		return qfalse;		// blocked immediately by the world
 	}
 
-	clip.contentmask = contentmask;
+	clip->contentmask = contentmask;
 /*
 Ghoul2 Insert Start
 */
-	VectorCopy( start, clip.start );
-	clip.traceFlags = traceFlags;
-	clip.useLod = useLod;
+	VectorCopy( start, clip->start );
+	clip->traceFlags = traceFlags;
+	clip->useLod = useLod;
 /*
 Ghoul2 Insert End
 */
-//	VectorCopy( clip.trace.endpos, clip.end );
-	VectorCopy( end, clip.end );
-	clip.mins = mins;
-	clip.maxs = maxs;
-	clip.passEntityNum = passEntityNum;
-	clip.capsule = capsule;
+//	VectorCopy( clip->trace.endpos, clip->end );
+	VectorCopy( end, clip->end );
+	clip->mins = mins;
+	clip->maxs = maxs;
+	clip->passEntityNum = passEntityNum;
+	clip->capsule = capsule;
 
 	// create the bounding box of the entire move
 	// we can limit it to the part of the move not
@@ -844,22 +1100,220 @@ Ghoul2 Insert End
 	// a significant savings for line of sight and shot traces
 	for ( i=0 ; i<3 ; i++ ) {
 		if ( end[i] > start[i] ) {
-			clip.boxmins[i] = clip.start[i] + clip.mins[i] - 1;
-			clip.boxmaxs[i] = clip.end[i] + clip.maxs[i] + 1;
+			clip->boxmins[i] = clip->start[i] + clip->mins[i] - 1;
+			clip->boxmaxs[i] = clip->end[i] + clip->maxs[i] + 1;
 		} else {
-			clip.boxmins[i] = clip.end[i] + clip.mins[i] - 1;
-			clip.boxmaxs[i] = clip.start[i] + clip.maxs[i] + 1;
+			clip->boxmins[i] = clip->end[i] + clip->mins[i] - 1;
+			clip->boxmaxs[i] = clip->start[i] + clip->maxs[i] + 1;
 		}
 	}
 
-	// clip to other solid entities
-	SV_ClipMoveToEntities ( &clip );
+	return qtrue;
+}
+
+/*
+==================
+SV_Trace
+
+Moves the given mins/maxs volume through the world from start to end.
+passEntityNum and entities owned by passEntityNum are explicitly not checked.
+==================
+*/
+/*
+Ghoul2 Insert Start
+*/
+void SV_Trace( trace_t *results, const vec3_t start, const vec3_t mins, const vec3_t maxs, const vec3_t end, int passEntityNum, int contentmask, int capsule, int traceFlags, int useLod ) {
+/*
+Ghoul2 Insert End
+*/
+	moveclip_t	clip;
+
+	if ( SV_ClipMoveToWorld( &clip, start, mins, maxs, end, passEntityNum, contentmask, capsule, traceFlags, useLod ) ) {
+		// clip to other solid entities
+		SV_ClipMoveToEntities ( &clip );
+	}
 
 	*results = clip.trace;
 }
 
+/*
+==================
+SV_TraceBatch
+
+Gives the same results as an SV_Trace for each request. The requests go
+in chunks; the world is clipped first for a whole chunk, then a single
+area query gathers the entities near any of its moves, and each move is
+only clipped against those its own box touches. A smaller box walks a
+subset of the same tree nodes in the same order, so the entities come in
+the same order SV_AreaEntities would give them for that move alone.
+This pays off when the traces of a batch stay close together, like the
+sight checks of one NPC.
+==================
+*/
+#define	TRACE_BATCH_CHUNK	64
+
+void SV_TraceBatch( trace_t *results, const traceRequest_t *requests, int numRequests ) {
+	static int				nearby[MAX_GENTITIES];
+	static int				touchlist[MAX_GENTITIES];
+	moveclip_t				clips[TRACE_BATCH_CHUNK];
+	qboolean				moving[TRACE_BATCH_CHUNK];
+	const traceRequest_t	*req;
+	moveclip_t				*clip;
+	sharedEntity_t			*check;
+	vec3_t					mins, maxs;
+	int						first, count, i, j;
+	int						numMoving, numNearby, num;
+
+	for ( first = 0 ; first < numRequests ; first += count ) {
+		count = numRequests - first;
+		if ( count > TRACE_BATCH_CHUNK ) {
+			count = TRACE_BATCH_CHUNK;
+		}
+
+		// clip the whole chunk to the world, and bound what is left of the moves
+		numMoving = 0;
+		for ( i = 0, req = requests + first ; i < count ; i++, req++ ) {
+			moving[i] = SV_ClipMoveToWorld( &clips[i], req->start, req->mins, req->maxs, req->end,
+				req->passEntityNum, req->contentmask, req->capsule, req->traceFlags, req->useLod );
+			if ( !moving[i] ) {
+				continue;
+			}
+
+			if ( !numMoving ) {
+				VectorCopy( clips[i].boxmins, mins );
+				VectorCopy( clips[i].boxmaxs, maxs );
+			} else {
+				AddPointToBounds( clips[i].boxmins, mins, maxs );
+				AddPointToBounds( clips[i].boxmaxs, mins, maxs );
+			}
+			numMoving++;
+		}
+
+		numNearby = numMoving ? SV_AreaEntities( mins, maxs, nearby, MAX_GENTITIES ) : 0;
+
+		for ( i = 0, clip = clips ; i < count ; i++, clip++ ) {
+			if ( moving[i] ) {
+				// the same test SV_AreaEntities_r makes
+				num = 0;
+				for ( j = 0 ; j < numNearby ; j++ ) {
+					check = SV_GentityNum( nearby[j] );
+					if ( check->r.absmin[0] > clip->boxmaxs[0]
+					|| check->r.absmin[1] > clip->boxmaxs[1]
+					|| check->r.absmin[2] > clip->boxmaxs[2]
+					|| check->r.absmax[0] < clip->boxmins[0]
+					|| check->r.absmax[1] < clip->boxmins[1]
+					|| check->r.absmax[2] < clip->boxmins[2]) {
+						continue;
+					}
+					touchlist[num++] = nearby[j];
+				}
+
+				SV_ClipMoveToEntityList( clip, touchlist, num );
+			}
+
+			results[first + i] = clip->trace;
+		}
+	}
+}
+
 
 
+/*
+===============================================================================
+
+POINT CONTENTS CACHE
+
+Pmove water checks, NPC senses, item drops and missiles all ask for the
+contents of the same points several times a frame. With
+sv_pointContentsCache set, SV_PointContents remembers its answers until the
+frame ends or an entity is linked or unlinked, which covers every movement
+the area tree knows about. Answers are keyed by the exact point: rounding
+it would hand back the contents of a different point.
+
+===============================================================================
+*/
+
+#define	CONTENTS_CACHE_SIZE		1024	// must be a power of two
+
+typedef struct {
+	vec3_t		point;
+	int			passEntityNum;
+	int			contents;
+	unsigned	generation;		// valid while it matches contentsCache.generation
+} contentsCacheEntry_t;
+
+static struct {
+	contentsCacheEntry_t	entries[CONTENTS_CACHE_SIZE];
+	unsigned				generation;
+	int						time;		// svs.time the entries were made at
+
+	// statistics, since the last contentsstats reset
+	int64_t					frames;
+	int64_t					lookups;
+	int64_t					hits;
+	int64_t					flushes;
+} contentsCache;
+
+/*
+=============
+SV_FlushContentsCache
+=============
+*/
+static void SV_FlushContentsCache( void ) {
+	if ( !++contentsCache.generation ) {
+		// wrapped, so old entries could look current again
+		memset( contentsCache.entries, 0, sizeof( contentsCache.entries ) );
+		contentsCache.generation = 1;
+	}
+	contentsCache.flushes++;
+}
+
+/*
+=============
+SV_ContentsCacheEntry
+=============
+*/
+static contentsCacheEntry_t *SV_ContentsCacheEntry( const vec3_t p, int passEntityNum ) {
+	byteAlias_t	x, y, z;
+	unsigned	hash;
+
+	x.f = p[0];
+	y.f = p[1];
+	z.f = p[2];
+	hash = ( x.ui * 73856093u ) ^ ( y.ui * 19349663u ) ^ ( z.ui * 83492791u ) ^ ( (unsigned)passEntityNum * 2654435761u );
+	hash ^= hash >> 16;
+
+	return &contentsCache.entries[hash & ( CONTENTS_CACHE_SIZE - 1 )];
+}
+
+/*
+=============
+SV_ContentsStats_f
+
+contentsstats [reset]
+=============
+*/
+void SV_ContentsStats_f( void ) {
+	if ( Cmd_Argc() == 2 && !Q_stricmp( Cmd_Argv( 1 ), "reset" ) ) {
+		contentsCache.frames = contentsCache.lookups = contentsCache.hits = contentsCache.flushes = 0;
+		return;
+	}
+
+	if ( !sv_pointContentsCache->integer ) {
+		Com_Printf( "sv_pointContentsCache is off.\n" );
+	}
+	if ( !contentsCache.lookups ) {
+		Com_Printf( "No cached point contents lookups yet.\n" );
+		return;
+	}
+
+	Com_Printf( "%lld lookups over %lld frames, %.1f per frame\n", (long long)contentsCache.lookups, (long long)contentsCache.frames,
+		(double)contentsCache.lookups / maximum( contentsCache.frames, 1 ) );
+	Com_Printf( "%lld hits, %.1f%%\n", (long long)contentsCache.hits, contentsCache.hits * 100.0 / contentsCache.lookups );
+	Com_Printf( "%lld flushes, %.1f per frame\n", (long long)contentsCache.flushes,
+		(double)contentsCache.flushes / maximum( contentsCache.frames, 1 ) );
+}
+
 /*
 =============
 SV_PointContents
@@ -871,6 +1325,24 @@ int SV_PointContents( const vec3_t p, int passEntityNum ) {
 	int			i, num;
 	int			contents, c2;
 	clipHandle_t	clipHandle;
+	contentsCacheEntry_t	*entry;
+
+	entry = NULL;
+	if ( sv_pointContentsCache->integer ) {
+		if ( contentsCache.time != svs.time ) {
+			contentsCache.time = svs.time;
+			contentsCache.frames++;
+			SV_FlushContentsCache();
+		}
+
+		contentsCache.lookups++;
+		entry = SV_ContentsCacheEntry( p, passEntityNum );
+		if ( entry->generation == contentsCache.generation && entry->passEntityNum == passEntityNum
+			&& VectorCompare( entry->point, p ) ) {
+			contentsCache.hits++;
+			return entry->contents;
+		}
+	}
 
 	// get base contents from world
 	contents = CM_PointContents( p, 0 );
@@ -891,6 +1363,13 @@ int SV_PointContents( const vec3_t p, int passEntityNum ) {
 		contents |= c2;
 	}
 
+	if ( entry ) {
+		VectorCopy( p, entry->point );
+		entry->passEntityNum = passEntityNum;
+		entry->contents = contents;
+		entry->generation = contentsCache.generation;
+	}
+
 	return contents;
 }
 
@@ -43,6 +43,9 @@ unsigned long sys_timeBase = 0;
    although timeval:tv_usec is an int, I'm not sure wether it is actually used as an unsigned int
      (which would affect the wrap period) */
 int curtime;
+/* first non-origin reading, Sys_Milliseconds( false ) counts from here */
+static int sys_curtimeBase = 0;
+static qboolean sys_curtimeBaseSet = qfalse;
 int Sys_Milliseconds (bool baseTime)
 {
 	struct timeval tp;
@@ -57,10 +60,14 @@ int Sys_Milliseconds (bool baseTime)
 
 	curtime = (tp.tv_sec - sys_timeBase)*1000 + tp.tv_usec/1000;
 
-    static int sys_timeBase = curtime;
+	if (!sys_curtimeBaseSet)
+	{
+		sys_curtimeBase = curtime;
+		sys_curtimeBaseSet = qtrue;
+	}
 	if (!baseTime)
 	{
-		curtime -= sys_timeBase;
+		curtime -= sys_curtimeBase;
 	}
 
 	return curtime;
@@ -71,6 +78,28 @@ int Sys_Milliseconds2( void )
     return Sys_Milliseconds(false);
 }
 
+/*
+================
+Sys_Microseconds
+
+Same origin as Sys_Milliseconds( false ), so Sys_Microseconds() / 1000
+always equals the millisecond clock that stamps events
+================
+*/
+int64_t Sys_Microseconds( void )
+{
+	struct timeval tp;
+
+	if (!sys_curtimeBaseSet)
+	{
+		return (int64_t)Sys_Milliseconds() * 1000;
+	}
+
+	gettimeofday(&tp, NULL);
+
+	return (int64_t)(tp.tv_sec - sys_timeBase)*1000000 + tp.tv_usec - (int64_t)sys_curtimeBase*1000;
+}
+
 void Sys_SetEnv(const char *name, const char *value)
 {
 	if(value && *value)
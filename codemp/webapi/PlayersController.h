@@ -242,9 +242,52 @@ private:
 		out["isBot"] = (cl->netchan.remoteAddress.type == NA_BOT);
 		out["isLocal"] = (cl->netchan.remoteAddress.type == NA_LOOPBACK);
 		out["score"] = ps->persistant[PERS_SCORE];
+		if (cl->netchan.remoteAddress.type != NA_BOT) {
+			out["network"] = CreateNetworkValue(cl);
+		}
 
 		return true;
 	}
+
+	// Rates are per second over the last NETSTAT_SECONDS, totals since the player connected
+	static Json::Value CreateNetworkValue(const client_t *cl)
+	{
+		float rates[NETSTAT_MAX];
+		SV_NetStatsRates(cl, rates);
+
+		Json::Value out = Json::Value(Json::objectValue);
+		out["rate"] = cl->rate;
+		out["snapshotMsec"] = cl->snapshotMsec;
+		out["bytesOutPerSecond"] = rates[NETSTAT_BYTES_OUT];
+		out["packetsOutPerSecond"] = rates[NETSTAT_PACKETS_OUT];
+		out["fragmentsOutPerSecond"] = rates[NETSTAT_FRAGMENTS_OUT];
+		out["messagesPerSecond"] = rates[NETSTAT_MESSAGES];
+		out["averageMessageSize"] = rates[NETSTAT_MESSAGES] ? rates[NETSTAT_MESSAGE_BYTES] / rates[NETSTAT_MESSAGES] : 0.0f;
+		out["largestMessageSize"] = cl->netStats.largestMessage;
+		out["chokedPerSecond"] = rates[NETSTAT_CHOKED];
+		out["deferredPerSecond"] = rates[NETSTAT_DEFERRED];
+		out["stalledPerSecond"] = rates[NETSTAT_STALLED];
+		out["entitiesDeferredPerSecond"] = rates[NETSTAT_ENTITIES_DEFERRED];
+		out["bytesInPerSecond"] = rates[NETSTAT_BYTES_IN];
+		out["packetsInPerSecond"] = rates[NETSTAT_PACKETS_IN];
+		out["droppedInPerSecond"] = rates[NETSTAT_DROPPED_IN];
+
+		Json::Value totals = Json::Value(Json::objectValue);
+		totals["bytesOut"] = (Json::Int64)cl->netStats.total[NETSTAT_BYTES_OUT];
+		totals["packetsOut"] = (Json::Int64)cl->netStats.total[NETSTAT_PACKETS_OUT];
+		totals["fragmentsOut"] = (Json::Int64)cl->netStats.total[NETSTAT_FRAGMENTS_OUT];
+		totals["messages"] = (Json::Int64)cl->netStats.total[NETSTAT_MESSAGES];
+		totals["choked"] = (Json::Int64)cl->netStats.total[NETSTAT_CHOKED];
+		totals["deferred"] = (Json::Int64)cl->netStats.total[NETSTAT_DEFERRED];
+		totals["stalled"] = (Json::Int64)cl->netStats.total[NETSTAT_STALLED];
+		totals["entitiesDeferred"] = (Json::Int64)cl->netStats.total[NETSTAT_ENTITIES_DEFERRED];
+		totals["bytesIn"] = (Json::Int64)cl->netStats.total[NETSTAT_BYTES_IN];
+		totals["packetsIn"] = (Json::Int64)cl->netStats.total[NETSTAT_PACKETS_IN];
+		totals["droppedIn"] = (Json::Int64)cl->netStats.total[NETSTAT_DROPPED_IN];
+		out["totals"] = totals;
+
+		return out;
+	}
 };
 
 #endif //_WEBAPI_PLAYERSCONTROLLER_H
\ No newline at end of file
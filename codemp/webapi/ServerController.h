@@ -171,11 +171,42 @@ private:
 		// Fields that only exist when the server is actually running
 		if (com_sv_running->integer) {
 			server["mapName"] = sv_mapname->string;
+			server["network"] = CreateNetworkValue();
 		}
 
 		mRequest.OK(server);
 	}
 
+	// Sum of every player's traffic, per second over the last NETSTAT_SECONDS
+	static Json::Value CreateNetworkValue()
+	{
+		float rates[NETSTAT_MAX], sum[NETSTAT_MAX] = {};
+		for (int i = 0; i < sv_maxclients->integer; i++) {
+			const client_t *cl = &svs.clients[i];
+			if (!cl->state || cl->netchan.remoteAddress.type == NA_BOT) {
+				continue;
+			}
+			SV_NetStatsRates(cl, rates);
+			for (int j = 0; j < NETSTAT_MAX; j++) {
+				sum[j] += rates[j];
+			}
+		}
+
+		Json::Value out = Json::Value(Json::objectValue);
+		out["bytesOutPerSecond"] = sum[NETSTAT_BYTES_OUT];
+		out["packetsOutPerSecond"] = sum[NETSTAT_PACKETS_OUT];
+		out["fragmentsOutPerSecond"] = sum[NETSTAT_FRAGMENTS_OUT];
+		out["messagesPerSecond"] = sum[NETSTAT_MESSAGES];
+		out["chokedPerSecond"] = sum[NETSTAT_CHOKED];
+		out["deferredPerSecond"] = sum[NETSTAT_DEFERRED];
+		out["stalledPerSecond"] = sum[NETSTAT_STALLED];
+		out["entitiesDeferredPerSecond"] = sum[NETSTAT_ENTITIES_DEFERRED];
+		out["bytesInPerSecond"] = sum[NETSTAT_BYTES_IN];
+		out["packetsInPerSecond"] = sum[NETSTAT_PACKETS_IN];
+		out["droppedInPerSecond"] = sum[NETSTAT_DROPPED_IN];
+		return out;
+	}
+
 	// POST /server/restart
 	void PostRestart()
 	{
@@ -152,6 +152,19 @@ int Sys_Milliseconds2( void )
 	return sys_curtime;
 }
 
+/*
+================
+Sys_Microseconds
+
+Kept on the Sys_Milliseconds clock so the two never disagree;
+NET_Sleep doesn't block on win32, so nothing needs finer grain here
+================
+*/
+int64_t Sys_Microseconds( void )
+{
+	return (int64_t)Sys_Milliseconds() * 1000;
+}
+
 /*
 ================
 Sys_RandomBytes